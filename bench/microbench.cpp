@@ -0,0 +1,282 @@
+/**
+ * Microbenchmarks for the inner loops, using Google Benchmark.
+ *
+ * Kernels which sample the input are run on a small input which fits in the
+ * cache ("resident") and on a large input which does not ("cold"), since
+ * the large-image case is usually limited by memory access rather than by
+ * arithmetic. Run with --benchmark_filter to select kernels. The scalar
+ * functions are run in the variant for the best ISA level the CPU supports.
+ */
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "InputImage.h"
+#include "Isa.h"
+#include "OutputPyramid.h"
+#include "OutputTiler.h"
+#include "atanApprox.h"
+#include "extractFace.h"
+
+using namespace PanoProjector;
+namespace fs = std::filesystem;
+
+namespace {
+
+/** The size of each input buffer for the scalar kernels */
+const int NUM_SAMPLES = 4096;
+
+/** Small enough to stay in the L2 cache */
+const int RESIDENT_WIDTH = 512;
+
+/** Much larger than the last level cache */
+const int COLD_WIDTH = 8192;
+
+/**
+ * An input image filled with pseudo-random data
+ */
+class SyntheticInput : public InputImage {
+public:
+	SyntheticInput(int width, int height) {
+		m_width = width;
+		m_height = height;
+		m_crop = IntegerCropRect(CropRect{0, 1, 0, 1}, width, height);
+		m_data = new uint8_t[(size_t)width * height * COMPONENTS];
+		std::minstd_rand rng(1);
+		for (size_t i = 0; i < (size_t)width * height * COMPONENTS; i++) {
+			m_data[i] = (uint8_t)rng();
+		}
+	}
+
+	~SyntheticInput() override {
+		delete[] m_data;
+	}
+};
+
+/**
+ * Get a shared input image of the given width, so that each size is only
+ * generated once
+ */
+SyntheticInput & getInput(int width) {
+	static SyntheticInput resident(RESIDENT_WIDTH, RESIDENT_WIDTH / 2);
+	static SyntheticInput cold(COLD_WIDTH, COLD_WIDTH / 2);
+	return width == RESIDENT_WIDTH ? resident : cold;
+}
+
+/**
+ * An output which discards the data
+ */
+class NullOutput : public OutputBase {
+public:
+	NullOutput(int width, int height)
+		: m_width(width), m_height(height)
+	{}
+
+	void writeRow(uint8_t * data) override {
+		benchmark::DoNotOptimize(data[0]);
+	}
+
+	void finish() override {}
+	int getWidth() const override { return m_width; }
+	int getHeight() const override { return m_height; }
+
+private:
+	int m_width, m_height;
+};
+
+std::vector<float> getRandomFloats(float min, float max, int seed) {
+	std::minstd_rand rng(seed);
+	std::uniform_real_distribution<float> dist(min, max);
+	std::vector<float> values(NUM_SAMPLES);
+	for (auto & value : values) {
+		value = dist(rng);
+	}
+	return values;
+}
+
+/**
+ * Call a scalar function on each sample, with an argument from each array.
+ * This is inlined into a variant for each ISA level, so that the function
+ * is compiled as in the kernels which use it.
+ */
+template <auto fn, class... Args>
+PANO_KERNEL_INLINE void sampleLoop(const Args *... args) {
+	for (int i = 0; i < NUM_SAMPLES; i++) {
+		benchmark::DoNotOptimize(fn(args[i]...));
+	}
+}
+
+template <auto fn, class... Args>
+void sampleLoopBaseline(const Args *... args) {
+	sampleLoop<fn>(args...);
+}
+
+#ifdef PANO_MULTI_ISA
+template <auto fn, class... Args>
+PANO_TARGET_AVX2 void sampleLoopAvx2(const Args *... args) {
+	sampleLoop<fn>(args...);
+}
+
+template <auto fn, class... Args>
+PANO_TARGET_AVX512 void sampleLoopAvx512(const Args *... args) {
+	sampleLoop<fn>(args...);
+}
+#endif
+
+/**
+ * Benchmark a scalar function with the variant of sampleLoop() for the
+ * selected ISA level, which is shown in the label
+ */
+template <auto fn, class... Args>
+void runSampleLoop(benchmark::State & state, const std::vector<Args> &... args) {
+	state.SetLabel(getIsaName(getIsa()));
+	for (auto _ : state) {
+		switch (getIsa()) {
+#ifdef PANO_MULTI_ISA
+			case Isa::Avx512:
+				sampleLoopAvx512<fn>(args.data()...);
+				break;
+			case Isa::Avx2:
+				sampleLoopAvx2<fn>(args.data()...);
+				break;
+#endif
+			default:
+				sampleLoopBaseline<fn>(args.data()...);
+				break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * NUM_SAMPLES);
+}
+
+void BM_atan_approx(benchmark::State & state) {
+	runSampleLoop<atan_approx>(state, getRandomFloats(-1, 1, 1));
+}
+BENCHMARK(BM_atan_approx);
+
+void BM_atan_approx_fast(benchmark::State & state) {
+	runSampleLoop<atan_approx_fast>(state, getRandomFloats(-1, 1, 1));
+}
+BENCHMARK(BM_atan_approx_fast);
+
+void BM_atanf(benchmark::State & state) {
+	runSampleLoop<atanf>(state, getRandomFloats(-1, 1, 1));
+}
+BENCHMARK(BM_atanf);
+
+void BM_atan2f_approx(benchmark::State & state) {
+	runSampleLoop<atan2f_approx<>>(state, getRandomFloats(-1, 1, 1),
+		getRandomFloats(-1, 1, 2));
+}
+BENCHMARK(BM_atan2f_approx);
+
+void BM_atan2f_approx_fast(benchmark::State & state) {
+	runSampleLoop<atan2f_approx<atan_approx_fast>>(state, getRandomFloats(-1, 1, 1),
+		getRandomFloats(-1, 1, 2));
+}
+BENCHMARK(BM_atan2f_approx_fast);
+
+void BM_atan2f(benchmark::State & state) {
+	runSampleLoop<atan2f>(state, getRandomFloats(-1, 1, 1), getRandomFloats(-1, 1, 2));
+}
+BENCHMARK(BM_atan2f);
+
+/**
+ * Benchmark an InputImage::interpolate() variant at random coordinates.
+ * The argument is the input width.
+ */
+template <void (InputImage::*interpolate)(uint8_t *, float, float)>
+void BM_interpolate(benchmark::State & state) {
+	auto & input = getInput(state.range(0));
+	auto x = getRandomFloats(0, input.getWidth() - 1.001f, 1);
+	auto y = getRandomFloats(0, input.getHeight() - 1.001f, 2);
+	uint8_t dest[COMPONENTS];
+	for (auto _ : state) {
+		for (int i = 0; i < NUM_SAMPLES; i++) {
+			(input.*interpolate)(dest, x[i], y[i]);
+			benchmark::DoNotOptimize(dest);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * NUM_SAMPLES);
+}
+BENCHMARK(BM_interpolate<&InputImage::interpolate>)
+	->Name("BM_interpolate/fixed")->Arg(RESIDENT_WIDTH)->Arg(COLD_WIDTH);
+BENCHMARK(BM_interpolate<&InputImage::interpolateFloat>)
+	->Name("BM_interpolate/float")->Arg(RESIDENT_WIDTH)->Arg(COLD_WIDTH);
+BENCHMARK(BM_interpolate<&InputImage::interpolateVector>)
+	->Name("BM_interpolate/vector")->Arg(RESIDENT_WIDTH)->Arg(COLD_WIDTH);
+
+/**
+ * Benchmark extracting a 512x512 face. The arguments are the face and the
+ * input width.
+ */
+void BM_extractFace(benchmark::State & state) {
+	int face = state.range(0);
+	auto & input = getInput(state.range(1));
+	const int size = 512;
+	for (auto _ : state) {
+		NullOutput output(size, size);
+		extractFace(face, input, output);
+	}
+	state.SetItemsProcessed(state.iterations() * size * size);
+}
+BENCHMARK(BM_extractFace)
+	->ArgsProduct({{0, 1, 2, 3, 4, 5}, {RESIDENT_WIDTH, COLD_WIDTH}})
+	->Unit(benchmark::kMicrosecond);
+
+/**
+ * Benchmark OutputPyramid::writeRow(), which mixes each pair of rows into
+ * the next level, with outputs which discard the data. The argument is the
+ * width.
+ */
+void BM_OutputPyramid_writeRow(benchmark::State & state) {
+	const int width = state.range(0);
+	const int height = 64;
+	const int levels = 4;
+	auto & input = getInput(RESIDENT_WIDTH);
+	std::vector<uint8_t> row((size_t)width * COMPONENTS);
+	for (size_t i = 0; i < row.size(); i++) {
+		row[i] = input.row(0)[i % (RESIDENT_WIDTH * COMPONENTS)];
+	}
+	for (auto _ : state) {
+		OutputPyramid pyramid(levels, width, height);
+		for (int level = 0; level < levels; level++) {
+			pyramid.addLevelOutput(new NullOutput(width >> level, height >> level));
+		}
+		for (int j = 0; j < height; j++) {
+			pyramid.writeRow(row.data());
+		}
+		pyramid.finish();
+	}
+	state.SetItemsProcessed(state.iterations() * width * height);
+}
+BENCHMARK(BM_OutputPyramid_writeRow)->Arg(RESIDENT_WIDTH)->Arg(COLD_WIDTH)
+	->Unit(benchmark::kMicrosecond);
+
+/**
+ * Benchmark OutputTiler::writeRow(), including the JPEG encoding, writing a
+ * 1024x1024 image in 512x512 tiles to a temporary directory
+ */
+void BM_OutputTiler_writeRow(benchmark::State & state) {
+	const int size = 1024;
+	const int tileSize = 512;
+	fs::path dir = fs::temp_directory_path() / "pano-projector-microbench";
+	fs::create_directories(dir);
+	auto & input = getInput(COLD_WIDTH);
+	for (auto _ : state) {
+		OutputTiler tiler((dir / "t").string(), ".jpg", size, size, tileSize, tileSize,
+			Metadata(), EncoderOptions());
+		for (int j = 0; j < size; j++) {
+			tiler.writeRow(input.row(j));
+		}
+		tiler.finish();
+	}
+	state.SetItemsProcessed(state.iterations() * size * size);
+	fs::remove_all(dir);
+}
+BENCHMARK(BM_OutputTiler_writeRow)->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,359 @@
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "BatchCommand.h"
+#include "BenchCommand.h"
+#include "CubeMapping.h"
+#include "FaceInfo.h"
+#include "HugePageArena.h"
+#include "InputMosaic.h"
+#include "OutputPyramid.h"
+#include "Planner.h"
+#include "PyramidCommand.h"
+
+namespace PanoProjector {
+
+namespace fs = std::filesystem;
+
+struct BatchCommand::Panorama {
+	/** The line number in the manifest */
+	int line = 0;
+	std::string inputPath;
+	fs::path outDir;
+	po::variables_map options;
+
+	// Set by the panorama job for the face jobs
+	std::unique_ptr<Planner> planner;
+	ExecutionPlan plan;
+	std::vector<TileMask> masks;
+	Metadata metadata;
+	EncoderOptions encoderOptions;
+	int cubeSize = 0;
+	int tileSize = 0;
+	int levels = 0;
+};
+
+std::string BatchCommand::getName() {
+	return "batch";
+}
+
+std::string BatchCommand::getDescription() {
+	return "Make tiled pyramids for the panoramas listed in a manifest file, "
+		"which has an input image, an output directory and pyramid options "
+		"on each line. The faces of all of the panoramas are extracted "
+		"concurrently by a pool of threads, and the timing of each job is "
+		"written as a line of JSON.";
+}
+
+std::string BatchCommand::getSynopsis() {
+	return "batch [options] <manifest>";
+}
+
+void BatchCommand::initOptions() {
+	m_visible.add_options()
+		("help",
+			"Show help message and exit")
+		("threads", po::value<int>()->default_value(0),
+			"The number of worker threads (default: one per CPU)")
+		("report", po::value<std::string>()->default_value("-"),
+			"The file to write the job timings to, or - for stdout")
+		("mem-limit", po::value<unsigned long>(),
+			"The approximate maximum memory usage in MiB")
+		;
+
+	addEngineOptions(m_visible);
+
+	m_invisible.add_options()
+		("manifest", po::value<std::string>())
+		;
+
+	m_pos
+		.add("manifest", 1)
+		;
+}
+
+void BatchCommand::addLineOptions(po::options_description & options) {
+	options.add_options()
+		("input-format", po::value<std::string>()->default_value(""))
+		("cube-size", po::value<int>())
+		("tile-size", po::value<int>()->default_value(512))
+		("levels", po::value<int>())
+		("quality", po::value<int>()->default_value(80))
+		("face", po::value<std::string>())
+		("precision", po::value<std::string>()->default_value("standard"))
+		("mapping", po::value<std::string>()->default_value("standard"))
+		("yaw", po::value<double>()->default_value(0))
+		("pitch", po::value<double>()->default_value(0))
+		("roll", po::value<double>()->default_value(0))
+		("hfov", po::value<double>())
+		("vfov", po::value<double>())
+		("hoffset", po::value<double>())
+		("voffset", po::value<double>())
+		("fill", po::value<std::string>()->default_value("000000"))
+		("input", po::value<std::string>())
+		("outDir", po::value<std::string>())
+		;
+}
+
+std::vector<std::shared_ptr<BatchCommand::Panorama>> BatchCommand::readManifest(
+	const std::string & path
+) {
+	std::ifstream file(path);
+	if (!file) {
+		throw std::runtime_error("Unable to open manifest file \"" + path + "\"");
+	}
+	po::options_description lineOptions;
+	addLineOptions(lineOptions);
+	po::positional_options_description pos;
+	pos.add("input", 1).add("outDir", 1);
+
+	std::vector<std::shared_ptr<Panorama>> panoramas;
+	std::string line;
+	for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+		auto args = po::split_unix(line);
+		if (args.empty() || args[0][0] == '#') {
+			continue;
+		}
+		auto panorama = std::make_shared<Panorama>();
+		panorama->line = lineNumber;
+		try {
+			po::store(po::command_line_parser(args)
+				.options(lineOptions)
+				.positional(pos)
+				.run(), panorama->options);
+			po::notify(panorama->options);
+		} catch (po::error & e) {
+			throw std::runtime_error("Line " + std::to_string(lineNumber)
+				+ " of the manifest: " + e.what());
+		}
+		if (!panorama->options.count("outDir")) {
+			throw std::runtime_error("Line " + std::to_string(lineNumber)
+				+ " of the manifest: an input filename and an output directory "
+				"must be specified");
+		}
+		panorama->inputPath = panorama->options["input"].as<std::string>();
+		panorama->outDir = panorama->options["outDir"].as<std::string>();
+		panoramas.push_back(panorama);
+	}
+	return panoramas;
+}
+
+int BatchCommand::doRun() {
+	if (!m_options.count("manifest")) {
+		std::cerr << "Error: a manifest filename must be specified.\n";
+		return 1;
+	}
+
+	setMemoryLimit();
+
+	int threads = m_options["threads"].as<int>();
+	if (threads <= 0) {
+		threads = std::max((int)std::thread::hardware_concurrency(), 1);
+	}
+
+	auto panoramas = readManifest(m_options["manifest"].as<std::string>());
+
+	std::ofstream file;
+	auto & reportPath = m_options["report"].as<std::string>();
+	if (reportPath != "-") {
+		file.open(reportPath);
+		if (!file) {
+			throw std::runtime_error("Unable to open report file \"" + reportPath + "\"");
+		}
+	}
+	m_reportStream = reportPath == "-" ? &std::cout : &file;
+
+	// Keep the input buffers freed by finished panoramas for the next ones,
+	// which are typically the same size. There is at most one panorama in
+	// progress per worker.
+	g_hugePageArena.setCacheSize(threads);
+
+	// Each worker may be decoding a mosaic at the same time, so share the
+	// cores between their decoding threads rather than starting a thread
+	// per core for each of them
+	InputMosaic::setMaxThreads(
+		std::max((int)std::thread::hardware_concurrency() / threads, 1));
+
+	// Each worker may be decoding a panorama at the same time, so each plan
+	// must fit in a worker's share of the memory
+	m_workerLimit = getPlanningLimit() / threads;
+
+	m_pool = std::make_unique<WorkStealingPool>(threads);
+	m_startTime = std::chrono::steady_clock::now();
+	for (auto & panorama : panoramas) {
+		m_pool->submit([this, panorama] {
+			runPanorama(panorama);
+		});
+	}
+	// The jobs own the panoramas, so that each input is freed when its last
+	// face is done
+	int numPanoramas = (int)panoramas.size();
+	panoramas.clear();
+	m_pool->run();
+	g_hugePageArena.setCacheSize(0);
+	InputMosaic::setMaxThreads(0);
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_startTime;
+	std::cerr << "Completed " << numPanoramas << " panoramas, "
+		<< m_numJobs << " jobs with " << threads << " threads in "
+		<< std::setprecision(3) << elapsed.count() << " s";
+	if (m_numFailed) {
+		std::cerr << ", " << m_numFailed << " jobs failed";
+	}
+	std::cerr << "\n";
+	return m_numFailed ? 1 : 0;
+}
+
+void BatchCommand::runPanorama(const std::shared_ptr<Panorama> & panorama) {
+	auto start = std::chrono::steady_clock::now();
+	std::string error;
+	try {
+		auto & options = panorama->options;
+		auto & inputFormat = options["input-format"].as<std::string>();
+		InputInfo info = InputImageFactory::getInfo(panorama->inputPath, inputFormat);
+		Coverage coverage = getCoverage(options, info);
+		CubeMapping mapping = getMappingFromName(options["mapping"].as<std::string>());
+		Precision precision = getPrecisionFromName(options["precision"].as<std::string>());
+		Rotation rotation = getRotation(options);
+
+		int cubeSize = options.count("cube-size")
+			? options["cube-size"].as<int>()
+			: getDefaultCubeSize(mapping, coverage.getFullWidth(info.width));
+		int tileSize = options["tile-size"].as<int>();
+		int levels = options.count("levels")
+			? options["levels"].as<int>()
+			: OutputPyramid::getDefaultLevels(cubeSize, tileSize);
+
+		std::vector<int> faces;
+		if (options.count("face")) {
+			auto & faceName = options["face"].as<std::string>();
+			int face = FaceInfo::getFaceFromName(faceName);
+			if (face == -1) {
+				throw std::runtime_error("Invalid face name \"" + faceName + "\"");
+			}
+			faces.push_back(face);
+		} else {
+			for (int face = 0; face < 6; face++) {
+				faces.push_back(face);
+			}
+		}
+
+		// Skip the tiles which lie entirely outside a partial panorama
+		for (int face = 0; face < 6; face++) {
+			panorama->masks.emplace_back(levels, cubeSize, tileSize);
+			panorama->masks[face].markAll();
+			coverage.unmarkUncoveredTiles(panorama->masks[face], face, cubeSize, tileSize,
+				getMaxAngleError(precision), rotation, mapping);
+		}
+		std::erase_if(faces, [&](int face) {
+			return panorama->masks[face].isEmpty();
+		});
+
+		panorama->planner = std::make_unique<Planner>(info, faces, cubeSize,
+			OutputPyramid::estimateMemory(cubeSize, levels));
+		panorama->planner->setPrecision(precision);
+		panorama->planner->setRotation(rotation);
+		panorama->planner->setCoverage(coverage);
+		panorama->planner->setMapping(mapping);
+		panorama->metadata.icc = info.metadata.icc;
+		setMappingXmp(mapping, panorama->metadata);
+		panorama->encoderOptions.quality = options["quality"].as<int>();
+		panorama->cubeSize = cubeSize;
+		panorama->tileSize = tileSize;
+		panorama->levels = levels;
+
+		panorama->plan = panorama->planner->getPlanByName("auto", m_workerLimit);
+
+		fs::create_directories(panorama->outDir);
+		// If the plan decodes the input once, the faces share it, and it is
+		// freed by the last one to finish. Otherwise each face job decodes
+		// the parts of the input it needs.
+		std::shared_ptr<InputImage> input;
+		if (!faces.empty() && panorama->plan.strategy == DecodeStrategy::Single) {
+			input.reset(panorama->planner->createSharedInput(
+				InputSource(panorama->inputPath, inputFormat)));
+		}
+		for (int face : faces) {
+			m_pool->submit([this, panorama, input, face] {
+				if (input) {
+					runFace(*panorama, *input, face);
+				} else {
+					runFace(*panorama, face);
+				}
+			});
+		}
+	} catch (std::exception & e) {
+		error = e.what();
+	}
+	report(*panorama, "decode", -1, start, error,
+		panorama->planner ? Planner::getStrategyName(panorama->plan) : "");
+}
+
+void BatchCommand::runFace(const Panorama & panorama, InputImage & input, int face) {
+	auto start = std::chrono::steady_clock::now();
+	std::string error;
+	try {
+		auto output = PyramidCommand::makeFaceOutput(face, panorama.metadata,
+			panorama.outDir, panorama.levels, panorama.cubeSize, panorama.tileSize,
+			panorama.encoderOptions, panorama.masks[face], nullptr);
+		panorama.planner->executeFace(face, input, *output);
+	} catch (std::exception & e) {
+		error = e.what();
+	}
+	report(panorama, "face", face, start, error);
+}
+
+void BatchCommand::runFace(const Panorama & panorama, int face) {
+	auto start = std::chrono::steady_clock::now();
+	std::string error;
+	try {
+		auto output = PyramidCommand::makeFaceOutput(face, panorama.metadata,
+			panorama.outDir, panorama.levels, panorama.cubeSize, panorama.tileSize,
+			panorama.encoderOptions, panorama.masks[face], nullptr);
+		panorama.planner->executeFace(panorama.plan, face,
+			InputSource(panorama.inputPath, panorama.options["input-format"].as<std::string>()),
+			*output);
+	} catch (std::exception & e) {
+		error = e.what();
+	}
+	report(panorama, "face", face, start, error);
+}
+
+void BatchCommand::report(const Panorama & panorama, const char * job, int face,
+	std::chrono::steady_clock::time_point start, const std::string & error,
+	const std::string & strategy
+) {
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> startSeconds = start - m_startTime;
+	std::chrono::duration<double> seconds = end - start;
+
+	std::lock_guard<std::mutex> lock(m_reportMutex);
+	std::ostream & out = *m_reportStream;
+	out << std::setprecision(6)
+		<< "{\"line\": " << panorama.line
+		<< ", \"input\": ";
+	BenchCommand::writeJsonString(out, panorama.inputPath);
+	out << ", \"job\": \"" << job << "\"";
+	if (face >= 0) {
+		out << ", \"face\": \"" << FaceInfo::getLetter(face) << "\"";
+	}
+	out << ", \"thread\": " << WorkStealingPool::getWorkerIndex()
+		<< ", \"start\": " << startSeconds.count()
+		<< ", \"seconds\": " << seconds.count();
+	if (!strategy.empty()) {
+		out << ", \"strategy\": \"" << strategy << "\"";
+	}
+	if (!error.empty()) {
+		out << ", \"error\": ";
+		BenchCommand::writeJsonString(out, error);
+		m_numFailed++;
+	}
+	out << "}\n";
+	out.flush();
+	m_numJobs++;
+}
+
+} // namespace
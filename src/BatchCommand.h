@@ -0,0 +1,82 @@
+#ifndef PANO_BATCH_COMMAND_H
+#define PANO_BATCH_COMMAND_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "Command.h"
+#include "WorkStealingPool.h"
+
+namespace PanoProjector {
+
+/**
+ * Make tiled pyramids for many panoramas listed in a manifest, in a single
+ * process, running the jobs for the faces of all of the panoramas on a pool
+ * of worker threads
+ */
+class BatchCommand : public Command {
+public:
+	std::string getName() override;
+	std::string getDescription() override;
+
+protected:
+	void initOptions() override;
+	std::string getSynopsis() override;
+	int doRun() override;
+
+private:
+	/** A panorama from a line of the manifest */
+	struct Panorama;
+
+	/**
+	 * Add the options which can be given on each line of the manifest. These
+	 * are the options of the pyramid command which apply to a single job.
+	 */
+	static void addLineOptions(po::options_description & options);
+
+	/**
+	 * Parse the manifest, which has the input, the output directory and the
+	 * options for a panorama on each line. Blank lines and lines starting
+	 * with # are ignored. Throw if a line is invalid.
+	 */
+	std::vector<std::shared_ptr<Panorama>> readManifest(const std::string & path);
+
+	/**
+	 * The job for a panorama: choose a plan within the memory of a worker,
+	 * and submit a job for each of its faces. If the whole input fits, it is
+	 * decoded once and shared by the face jobs, otherwise each face job
+	 * decodes the parts it needs.
+	 */
+	void runPanorama(const std::shared_ptr<Panorama> & panorama);
+
+	/** The job for one face of a panorama, using its decoded input */
+	void runFace(const Panorama & panorama, InputImage & input, int face);
+
+	/** The job for one face of a panorama, decoding according to its plan */
+	void runFace(const Panorama & panorama, int face);
+
+	/** The memory limit for the work of each worker */
+	unsigned long m_workerLimit = 0;
+
+	/**
+	 * Write the timing of a job as a line of JSON, with the decode strategy
+	 * if given, and an error message if it failed
+	 */
+	void report(const Panorama & panorama, const char * job, int face,
+		std::chrono::steady_clock::time_point start, const std::string & error,
+		const std::string & strategy = "");
+
+	std::unique_ptr<WorkStealingPool> m_pool;
+	std::chrono::steady_clock::time_point m_startTime;
+
+	/** Protects the report output and the counts */
+	std::mutex m_reportMutex;
+	std::ostream * m_reportStream = nullptr;
+	int m_numJobs = 0;
+	int m_numFailed = 0;
+};
+
+} // namespace
+#endif
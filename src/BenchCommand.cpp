@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "BenchCommand.h"
+#include "FaceInfo.h"
+#include "InputImageFactory.h"
+#include "Isa.h"
+#include "OutputImage.h"
+#include "OutputPyramid.h"
+#include "PyramidCommand.h"
+#include "TileMask.h"
+#include "extractFace.h"
+
+namespace PanoProjector {
+
+namespace fs = std::filesystem;
+
+std::string BenchCommand::getName() {
+	return "bench";
+}
+
+std::string BenchCommand::getDescription() {
+	return "Generate a synthetic equirectangular image, run the face and pyramid "
+		"workloads on it, and report the throughput as JSON.";
+}
+
+std::string BenchCommand::getSynopsis() {
+	return "bench [options]";
+}
+
+void BenchCommand::initOptions() {
+	m_visible.add_options()
+		("help",
+		 	"Show help message and exit")
+		("width", po::value<int>()->default_value(8000),
+			"The width of the synthetic image. The height is half the width.")
+		("input", po::value<std::string>(),
+			"Use an existing equirectangular image instead of generating one")
+		("quality", po::value<int>()->default_value(80),
+			"The encoder quality, as a percentage")
+		("tile-size", po::value<int>()->default_value(512),
+			"The pyramid tile size in pixels")
+		("precision", po::value<std::string>()->default_value("standard"),
+			"The accuracy of the sampling kernels: fast, standard, exact, or "
+			"mesh to compute the coordinates on a sparse grid and interpolate them")
+		("repeat", po::value<int>()->default_value(1),
+			"Run each workload this many times and report the fastest run")
+		("work-dir", po::value<std::string>(),
+			"The directory for the generated image and outputs (default: a new "
+			"directory in the system temporary directory, removed on exit)")
+		("output", po::value<std::string>()->default_value("-"),
+			"The file to write the JSON report to, or - for stdout")
+		;
+
+	addEngineOptions(m_visible);
+}
+
+int BenchCommand::doRun() {
+	int width = m_options["width"].as<int>();
+	int repeat = m_options["repeat"].as<int>();
+	int tileSize = m_options["tile-size"].as<int>();
+	if (width < 16 || width % 2) {
+		std::cerr << "Error: the width must be an even number, at least 16\n";
+		return 1;
+	}
+	if (repeat < 1 || tileSize < 1) {
+		std::cerr << "Error: invalid repeat count or tile size\n";
+		return 1;
+	}
+
+	EncoderOptions encoderOptions;
+	encoderOptions.quality = m_options["quality"].as<int>();
+	Precision precision = getPrecisionFromName(m_options["precision"].as<std::string>());
+
+	fs::path workDir;
+	bool removeWorkDir = false;
+	if (m_options.count("work-dir")) {
+		workDir = m_options["work-dir"].as<std::string>();
+		fs::create_directories(workDir);
+	} else {
+		workDir = fs::temp_directory_path()
+			/ ("pano-projector-bench-" + std::to_string(getpid()));
+		fs::create_directory(workDir);
+		removeWorkDir = true;
+	}
+
+	struct Cleanup {
+		fs::path dir;
+		~Cleanup() {
+			if (!dir.empty()) {
+				std::error_code ec;
+				fs::remove_all(dir, ec);
+			}
+		}
+	} cleanup{removeWorkDir ? workDir : fs::path()};
+
+	// Generate the input
+	std::string inputPath;
+	bool generated = !m_options.count("input");
+	Result generateResult;
+	if (generated) {
+		inputPath = workDir / "input.jpg";
+		std::cerr << "Generating " << width << "x" << width / 2 << " input\n";
+		resetPeakRss();
+		StageTimer timer;
+		generateImage(inputPath, width, encoderOptions);
+		timer.finish(generateResult, "generate");
+		generateResult.name = "generate";
+		generateResult.outputPixels = (double)width * (width / 2);
+		generateResult.peakRss = getPeakRss();
+	} else {
+		inputPath = m_options["input"].as<std::string>();
+	}
+	InputInfo info = InputImageFactory::getInfo(inputPath, "");
+
+#ifdef PANO_TRACING
+	// Record the per-row stages, unless --trace already did
+	if (!g_tracer.isEnabled()) {
+		g_tracer.start();
+	}
+#endif
+
+	// Run the workloads, keeping the fastest of each
+	std::vector<Result> results;
+	for (int workload = 0; workload < 2; workload++) {
+		Result best;
+		for (int run = 0; run < repeat; run++) {
+			fs::path outDir = workDir / ("out-" + std::to_string(workload));
+			fs::remove_all(outDir);
+			fs::create_directory(outDir);
+
+			resetPeakRss();
+			Result result = workload == 0
+				? runFace(inputPath, outDir, encoderOptions, precision)
+				: runPyramid(inputPath, outDir, tileSize, encoderOptions, precision);
+			result.peakRss = getPeakRss();
+			std::cerr << result.name << " run " << (run + 1) << ": "
+				<< result.getWallSeconds() << " s\n";
+			if (run == 0 || result.getWallSeconds() < best.getWallSeconds()) {
+				best = result;
+			}
+			fs::remove_all(outDir);
+		}
+		results.push_back(best);
+	}
+
+	// Write the report
+	std::ofstream file;
+	auto & outputPath = m_options["output"].as<std::string>();
+	if (outputPath != "-") {
+		file.open(outputPath);
+		if (!file) {
+			throw std::runtime_error("Unable to open output file \"" + outputPath + "\"");
+		}
+	}
+	std::ostream & out = outputPath == "-" ? std::cout : file;
+	out << std::setprecision(6)
+		<< "{\n"
+		<< "  \"host\": {\"cpu\": ";
+	writeJsonString(out, getCpuName());
+	out << ", \"threads\": " << std::thread::hardware_concurrency() << "},\n"
+		<< "  \"config\": {\"width\": " << info.width
+		<< ", \"height\": " << info.height
+		<< ", \"generated\": " << (generated ? "true" : "false")
+		<< ", \"quality\": " << encoderOptions.quality
+		<< ", \"tile_size\": " << tileSize
+		<< ", \"precision\": \"" << getPrecisionName(precision) << "\""
+		<< ", \"isa\": \"" << getIsaName(getIsa()) << "\""
+		<< ", \"repeat\": " << repeat << "},\n";
+	if (generated) {
+		out << "  \"generate\": ";
+		writeResult(out, generateResult);
+		out << ",\n";
+	}
+	out << "  \"workloads\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		out << "    ";
+		writeResult(out, results[i]);
+		out << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n"
+		<< "}\n";
+	return 0;
+}
+
+void BenchCommand::generateImage(const std::string & path, int width,
+	const EncoderOptions & options
+) {
+	int height = width / 2;
+	OutputImage output(path, width, height, Metadata(), options);
+
+	// Low-frequency structure from per-column and per-row waves, with
+	// edges and noise, so that the entropy is similar to a photo
+	std::vector<int> colWave(width * COMPONENTS);
+	for (int i = 0; i < width; i++) {
+		double u = 2 * M_PI * i / width;
+		colWave[i * COMPONENTS] = (int)(40 * sin(3 * u) + 20 * sin(17 * u));
+		colWave[i * COMPONENTS + 1] = (int)(35 * sin(5 * u + 1) + 15 * sin(41 * u));
+		colWave[i * COMPONENTS + 2] = (int)(30 * cos(4 * u) + 10 * sin(97 * u));
+	}
+	std::unique_ptr<uint8_t[]> row(new uint8_t[width * COMPONENTS]);
+	uint32_t seed = 1;
+	for (int j = 0; j < height; j++) {
+		double v = M_PI * j / height;
+		int rowBase[COMPONENTS] = {
+			(int)(100 + 60 * cos(v)),
+			(int)(120 + 40 * sin(2 * v)),
+			(int)(140 - 80 * cos(v))
+		};
+		for (int i = 0; i < width; i++) {
+			seed = seed * 1103515245 + 12345;
+			int edge = ((i >> 6) ^ (j >> 6)) & 1 ? 24 : 0;
+			for (int c = 0; c < COMPONENTS; c++) {
+				int value = rowBase[c] + colWave[i * COMPONENTS + c] + edge
+					+ (int)((seed >> (16 + 4 * c)) & 15);
+				row[i * COMPONENTS + c] = (uint8_t)std::clamp(value, 0, 255);
+			}
+		}
+		output.writeRow(row.get());
+	}
+	output.finish();
+}
+
+BenchCommand::Result BenchCommand::runFace(const std::string & inputPath,
+	const std::string & outDir, const EncoderOptions & options, Precision precision
+) {
+	Result result;
+	result.name = "face";
+	StageTimer timer;
+	int face = FaceInfo::getFaceFromName("front");
+	std::unique_ptr<InputImage> input(InputImageFactory::create(
+		inputPath, "", FaceInfo::getCropRect(face, getMaxAngleError(precision))));
+	timer.finish(result, "decode");
+
+	int size = getDefaultCubeSize(CubeMapping::Standard, input->getWidth());
+	OutputImage output(outDir + "/f.jpg", size, size, input->getMetadata(), options);
+	extractFace(face, *input, output, precision);
+	timer.finishExtract(result);
+
+	result.inputPixels = (double)input->getWidth() * input->getHeight();
+	result.outputPixels = (double)size * size;
+	return result;
+}
+
+BenchCommand::Result BenchCommand::runPyramid(const std::string & inputPath,
+	const std::string & outDir, int tileSize, const EncoderOptions & options,
+	Precision precision
+) {
+	Result result;
+	result.name = "pyramid";
+	StageTimer timer;
+	std::unique_ptr<InputImage> input(InputImageFactory::create(
+		inputPath, "", CropRect{0, 1, 0, 1}));
+	timer.finish(result, "decode");
+
+	int cubeSize = getDefaultCubeSize(CubeMapping::Standard, input->getWidth());
+	int levels = OutputPyramid::getDefaultLevels(cubeSize, tileSize);
+	TileMask mask(levels, cubeSize, tileSize);
+	mask.markAll();
+	for (int face = 0; face < 6; face++) {
+		auto output = PyramidCommand::makeFaceOutput(face, input->getMetadata(), outDir,
+			levels, cubeSize, tileSize, options, mask, nullptr);
+		extractFace(face, *input, *output, precision);
+	}
+	timer.finishExtract(result);
+
+	result.inputPixels = (double)input->getWidth() * input->getHeight();
+	result.outputPixels = 6.0 * cubeSize * cubeSize;
+	return result;
+}
+
+double BenchCommand::Result::getWallSeconds() const {
+	double seconds = 0;
+	for (auto & stage : stages) {
+		seconds += stage.wallSeconds;
+	}
+	return seconds;
+}
+
+double BenchCommand::Result::getCpuSeconds() const {
+	double seconds = 0;
+	for (auto & stage : stages) {
+		seconds += stage.cpuSeconds;
+	}
+	return seconds;
+}
+
+BenchCommand::StageTimer::StageTimer() {
+	restart();
+}
+
+void BenchCommand::StageTimer::restart() {
+	m_wallStart = getWallSeconds();
+	m_cpuStart = getCpuSeconds();
+#ifdef PANO_TRACING
+	for (int stage = 0; stage < Tracer::NUM_STAGES; stage++) {
+		m_traceStart[stage] = g_tracer.getStageTotals((TraceStage)stage);
+	}
+#endif
+}
+
+void BenchCommand::StageTimer::finish(Result & result, const std::string & name) {
+	result.stages.push_back({name,
+		getWallSeconds() - m_wallStart, getCpuSeconds() - m_cpuStart});
+	restart();
+}
+
+void BenchCommand::StageTimer::finishExtract(Result & result) {
+#ifdef PANO_TRACING
+	double wall = getWallSeconds() - m_wallStart;
+	double cpu = getCpuSeconds() - m_cpuStart;
+	for (int stage = 0; stage < Tracer::NUM_STAGES; stage++) {
+		auto totals = g_tracer.getStageTotals((TraceStage)stage);
+		double stageWall = (totals.nanoseconds - m_traceStart[stage].nanoseconds) * 1e-9;
+		double stageCpu = (totals.cpuNanoseconds - m_traceStart[stage].cpuNanoseconds) * 1e-9;
+		result.stages.push_back({Tracer::getStageName((TraceStage)stage),
+			stageWall, stageCpu});
+		wall -= stageWall;
+		cpu -= stageCpu;
+	}
+	// Stages on other threads can overlap, and the clocks differ slightly
+	result.stages.push_back({"other", std::max(wall, 0.0), std::max(cpu, 0.0)});
+	restart();
+#else
+	finish(result, "extract");
+#endif
+}
+
+double BenchCommand::getCpuSeconds() {
+	struct rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+		+ usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+double BenchCommand::getWallSeconds() {
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void BenchCommand::resetPeakRss() {
+	// Supported since Linux 4.0
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5\n";
+}
+
+unsigned long BenchCommand::getPeakRss() {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.starts_with("VmHWM:")) {
+			return std::stoul(line.substr(6)) * 1024;
+		}
+	}
+	struct rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss * 1024UL;
+}
+
+std::string BenchCommand::getCpuName() {
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line)) {
+		if (line.starts_with("model name")) {
+			auto pos = line.find(':');
+			if (pos != std::string::npos && pos + 2 <= line.size()) {
+				return line.substr(pos + 2);
+			}
+		}
+	}
+	return "";
+}
+
+void BenchCommand::writeJsonString(std::ostream & out, const std::string & s) {
+	out << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if ((unsigned char)c < 0x20) {
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+				<< std::dec << std::setfill(' ');
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+void BenchCommand::writeResult(std::ostream & out, const Result & result) {
+	double wall = result.getWallSeconds();
+	double pixels = result.inputPixels ? result.inputPixels : result.outputPixels;
+	out << "{\"name\": ";
+	writeJsonString(out, result.name);
+	out << ", \"input_mpix\": " << result.inputPixels / 1e6
+		<< ", \"output_mpix\": " << result.outputPixels / 1e6
+		<< ", \"wall_s\": " << wall
+		<< ", \"cpu_s\": " << result.getCpuSeconds()
+		<< ", \"mpix_per_s\": " << (wall > 0 ? pixels / 1e6 / wall : 0)
+		<< ", \"peak_rss_mib\": " << result.peakRss / 1048576.0
+		<< ", \"stages\": [";
+	for (size_t i = 0; i < result.stages.size(); i++) {
+		auto & stage = result.stages[i];
+		out << (i ? ", " : "") << "{\"name\": ";
+		writeJsonString(out, stage.name);
+		out << ", \"wall_s\": " << stage.wallSeconds
+			<< ", \"cpu_s\": " << stage.cpuSeconds << "}";
+	}
+	out << "]}";
+}
+
+} // namespace
@@ -0,0 +1,118 @@
+#ifndef PANO_BENCH_COMMAND_H
+#define PANO_BENCH_COMMAND_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Command.h"
+#include "EncoderOptions.h"
+#include "Precision.h"
+#include "Tracer.h"
+
+namespace PanoProjector {
+
+/**
+ * Generate a synthetic equirectangular image, run the face and pyramid
+ * workloads on it, and report the throughput as JSON.
+ */
+class BenchCommand : public Command {
+public:
+	std::string getName() override;
+	std::string getDescription() override;
+
+	/** Write a string as a JSON string literal */
+	static void writeJsonString(std::ostream & out, const std::string & s);
+
+protected:
+	void initOptions() override;
+	std::string getSynopsis() override;
+	int doRun() override;
+
+private:
+	/** The wall and CPU time of a stage of a workload */
+	struct Stage {
+		std::string name;
+		double wallSeconds = 0;
+		double cpuSeconds = 0;
+	};
+
+	/** The result of running a workload */
+	struct Result {
+		std::string name;
+		double inputPixels = 0;
+		double outputPixels = 0;
+		std::vector<Stage> stages;
+		unsigned long peakRss = 0;
+
+		double getWallSeconds() const;
+		double getCpuSeconds() const;
+	};
+
+	/**
+	 * Measures the wall and CPU time since construction or the last call to
+	 * finish()
+	 */
+	class StageTimer {
+	public:
+		StageTimer();
+
+		/** Add a stage to the result, and restart the timer */
+		void finish(Result & result, const std::string & name);
+
+		/**
+		 * Add the stages of extracting faces to the result, and restart the
+		 * timer. Sampling, downsampling and encoding are taken from the
+		 * tracer totals, and the rest of the time is added as "other". If
+		 * tracing is not available, a single "extract" stage is added.
+		 */
+		void finishExtract(Result & result);
+
+	private:
+		/** Restart the timer */
+		void restart();
+
+		double m_wallStart;
+		double m_cpuStart;
+#ifdef PANO_TRACING
+		Tracer::StageTotals m_traceStart[Tracer::NUM_STAGES];
+#endif
+	};
+
+	/**
+	 * Write a synthetic equirectangular image to a file. The image is
+	 * generated one row at a time, so memory usage does not depend on the
+	 * height.
+	 */
+	static void generateImage(const std::string & path, int width,
+		const EncoderOptions & options);
+
+	/** Extract the front face */
+	static Result runFace(const std::string & inputPath, const std::string & outDir,
+		const EncoderOptions & options, Precision precision);
+
+	/** Make a tiled pyramid of all faces */
+	static Result runPyramid(const std::string & inputPath, const std::string & outDir,
+		int tileSize, const EncoderOptions & options, Precision precision);
+
+	/** Get the process CPU time in seconds */
+	static double getCpuSeconds();
+
+	/** Get the monotonic wall time in seconds */
+	static double getWallSeconds();
+
+	/** Reset the peak RSS of the process to the current RSS, if supported */
+	static void resetPeakRss();
+
+	/** Get the peak RSS of the process in bytes */
+	static unsigned long getPeakRss();
+
+	/** Get the CPU model name, or an empty string if it is unknown */
+	static std::string getCpuName();
+
+	/** Write a workload result as a JSON object */
+	static void writeResult(std::ostream & out, const Result & result);
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <jpeglib.h>
+
+#include "ChangedBlocks.h"
+#include "FaceInfo.h"
+#include "InputJpeg.h"
+#include "Metadata.h"
+
+namespace PanoProjector {
+
+namespace {
+
+/**
+ * A JPEG decompressor reading scanlines from a file, with the same output
+ * settings as InputJpeg.
+ */
+struct ScanlineDecoder {
+	explicit ScanlineDecoder(const std::string & path)
+		: cinfo(), jerr()
+	{
+		file = fopen(path.c_str(), "rb");
+		if (!file) {
+			throw std::runtime_error(
+				"Unable to open input image \"" + path + "\": " +
+					std::string(strerror(errno)));
+		}
+		InputJpeg::initErrorHandler(cinfo, jerr);
+		jpeg_create_decompress(&cinfo);
+		try {
+			jpeg_stdio_src(&cinfo, file);
+			(void)jpeg_read_header(&cinfo, TRUE);
+			cinfo.out_color_space = JCS_RGB;
+			if (cinfo.num_components != COMPONENTS) {
+				throw std::runtime_error("Invalid input image: wrong number of components");
+			}
+			(void)jpeg_start_decompress(&cinfo);
+		} catch (...) {
+			jpeg_destroy_decompress(&cinfo);
+			fclose(file);
+			throw;
+		}
+	}
+
+	~ScanlineDecoder() {
+		jpeg_destroy_decompress(&cinfo);
+		fclose(file);
+	}
+
+	FILE * file;
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+};
+
+} // namespace
+
+ChangedBlocks::ChangedBlocks(const std::string & oldPath, const std::string & newPath)
+	: m_numChanged(0)
+{
+	ScanlineDecoder oldImage(oldPath);
+	ScanlineDecoder newImage(newPath);
+
+	m_width = newImage.cinfo.output_width;
+	m_height = newImage.cinfo.output_height;
+	if ((int)oldImage.cinfo.output_width != m_width
+		|| (int)oldImage.cinfo.output_height != m_height
+	) {
+		throw std::runtime_error("The previous input image has a different size");
+	}
+
+	m_blockWidth = newImage.cinfo.max_h_samp_factor * DCTSIZE;
+	m_blockHeight = newImage.cinfo.max_v_samp_factor * DCTSIZE;
+	m_numBlocksWide = (m_width + m_blockWidth - 1) / m_blockWidth;
+	m_numBlocksHigh = (m_height + m_blockHeight - 1) / m_blockHeight;
+	m_changed.resize(m_numBlocksWide * m_numBlocksHigh);
+
+	size_t rowSize = (size_t)m_width * COMPONENTS;
+	std::vector<uint8_t> oldRow(rowSize), newRow(rowSize);
+	uint8_t * oldPtr = oldRow.data();
+	uint8_t * newPtr = newRow.data();
+	size_t blockSize = (size_t)m_blockWidth * COMPONENTS;
+
+	while ((int)newImage.cinfo.output_scanline < m_height) {
+		int by = newImage.cinfo.output_scanline / m_blockHeight;
+		(void)jpeg_read_scanlines(&oldImage.cinfo, &oldPtr, 1);
+		(void)jpeg_read_scanlines(&newImage.cinfo, &newPtr, 1);
+		for (int bx = 0; bx < m_numBlocksWide; bx++) {
+			if (m_changed[by * m_numBlocksWide + bx]) {
+				continue;
+			}
+			size_t offset = bx * blockSize;
+			size_t length = std::min(blockSize, rowSize - offset);
+			if (memcmp(oldPtr + offset, newPtr + offset, length) != 0) {
+				m_changed[by * m_numBlocksWide + bx] = true;
+				m_numChanged++;
+			}
+		}
+	}
+	(void)jpeg_finish_decompress(&oldImage.cinfo);
+	(void)jpeg_finish_decompress(&newImage.cinfo);
+}
+
+void ChangedBlocks::markTiles(std::vector<TileMask> & masks, int cubeSize,
+	const Rotation & rotation, const Coverage & coverage, CubeMapping mapping
+) const {
+	for (int by = 0; by < m_numBlocksHigh; by++) {
+		for (int bx = 0; bx < m_numBlocksWide; bx++) {
+			if (!isChanged(bx, by)) {
+				continue;
+			}
+			// Expand the block by one pixel on each side since bilinear
+			// interpolation reads the neighbouring pixels. The column is
+			// allowed to go outside the image since only the angle is used.
+			int left = bx * m_blockWidth - 1;
+			int right = std::min((bx + 1) * m_blockWidth, m_width) + 1;
+			int top = std::max(by * m_blockHeight - 1, 0);
+			int bottom = std::min((by + 1) * m_blockHeight + 1, m_height);
+			for (int face = 0; face < 6; face++) {
+				markRect(masks[face], face, cubeSize, left, top, right, bottom,
+					rotation, coverage, mapping);
+			}
+		}
+	}
+}
+
+void ChangedBlocks::markRect(TileMask & mask, int face, int cubeSize,
+	int left, int top, int right, int bottom, const Rotation & rotation,
+	const Coverage & coverage, CubeMapping mapping
+) const {
+	// A margin in face pixels, to allow for the coarse sampling of the block
+	// edges, and for extractFace() reflecting the right half of each row
+	// about a slightly different centre line.
+	const int margin = 2;
+
+	// The projection of the block onto the face plane lies within the
+	// projection of its perimeter, as long as the whole block is in front of
+	// the plane. So it is sufficient to find the bounding box of the
+	// projected perimeter.
+	float minA = INFINITY, maxA = -INFINITY, minB = INFINITY, maxB = -INFINITY;
+	int numInFront = 0, numPoints = 0;
+	auto addPoint = [&] (int u, int v) {
+		float a, b;
+		float theta = getTheta(u, coverage), phi = getPhi(v, coverage);
+		rotation.unrotateAngles(theta, phi);
+		numPoints++;
+		if (FaceInfo::sphereToFacePlane(face, theta, phi, a, b)) {
+			numInFront++;
+			minA = std::min(minA, a);
+			maxA = std::max(maxA, a);
+			minB = std::min(minB, b);
+			maxB = std::max(maxB, b);
+		}
+	};
+	for (int u = left; u < right; u++) {
+		addPoint(u, top);
+		addPoint(u, bottom - 1);
+	}
+	for (int v = top + 1; v < bottom - 1; v++) {
+		addPoint(left, v);
+		addPoint(right - 1, v);
+	}
+
+	// The face plane coordinates are mapped to pixels, and may be outside
+	// the face
+	auto toPixel = [cubeSize, mapping] (float a) {
+		float mapped = (float)mappingFromPlane(mapping, std::clamp(a, -2.0f, 2.0f));
+		return (int)floorf((mapped + 1.0f) * cubeSize / 2);
+	};
+
+	if (numInFront == numPoints) {
+		if (minA <= 1.0f && maxA >= -1.0f && minB <= 1.0f && maxB >= -1.0f) {
+			mask.markRect(
+				toPixel(minA) - margin, toPixel(minB) - margin,
+				toPixel(maxA) + margin + 1, toPixel(maxB) + margin + 1);
+		}
+	} else if (numInFront > 0) {
+		// The block straddles the plane through the cube centre parallel to
+		// the face. That is far from the face unless the source image is tiny,
+		// but check every pixel to be sure.
+		for (int v = top; v < bottom; v++) {
+			for (int u = left; u < right; u++) {
+				float a, b;
+				float theta = getTheta(u, coverage), phi = getPhi(v, coverage);
+				rotation.unrotateAngles(theta, phi);
+				if (FaceInfo::sphereToFacePlane(face, theta, phi, a, b)) {
+					int i = toPixel(a), j = toPixel(b);
+					mask.markRect(i - margin, j - margin, i + margin + 1, j + margin + 1);
+				}
+			}
+		}
+	}
+}
+
+} // namespace
@@ -0,0 +1,104 @@
+#ifndef PANO_CHANGEDBLOCKS_H
+#define PANO_CHANGEDBLOCKS_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include "Coverage.h"
+#include "CubeMapping.h"
+#include "Rotation.h"
+#include "TileMask.h"
+
+namespace PanoProjector {
+
+/**
+ * A map of the blocks of an equirectangular source image which differ between
+ * two versions of the image.
+ *
+ * The block size is the MCU size of the new image, typically 16x16 for 4:2:0
+ * JPEG. Both images are decoded in lockstep one scanline at a time, with the
+ * same decoder settings as InputJpeg, so memory usage is proportional to the
+ * image width, and a block is marked as changed if and only if a pixel seen
+ * by extractFace() would change.
+ */
+class ChangedBlocks {
+public:
+	/**
+	 * Decode and compare the two images. The images must have the same size.
+	 */
+	ChangedBlocks(const std::string & oldPath, const std::string & newPath);
+
+	/** Get the source image width */
+	int getWidth() const {
+		return m_width;
+	}
+
+	/** Get the source image height */
+	int getHeight() const {
+		return m_height;
+	}
+
+	/** Get the total number of changed blocks */
+	int getNumChanged() const {
+		return m_numChanged;
+	}
+
+	/** Get the total number of blocks */
+	int getNumBlocks() const {
+		return m_numBlocksWide * m_numBlocksHigh;
+	}
+
+	/** Determine whether a block was changed */
+	bool isChanged(int bx, int by) const {
+		return m_changed[by * m_numBlocksWide + bx];
+	}
+
+	/**
+	 * Map the changed blocks through the cube projection and mark the
+	 * affected tiles in the masks. There must be one mask per cube face,
+	 * indexed by face, with the given face size in level 0 pixels, and the
+	 * orientation of the cube relative to the source image, the part of the
+	 * sphere covered by the source image, and the mapping of the faces.
+	 */
+	void markTiles(std::vector<TileMask> & masks, int cubeSize,
+		const Rotation & rotation = Rotation(),
+		const Coverage & coverage = Coverage(),
+		CubeMapping mapping = CubeMapping::Standard) const;
+
+private:
+	/**
+	 * Mark the tiles affected by a rectangle of source pixels in the mask of
+	 * a single face. The right and bottom coordinates are past-the-end.
+	 */
+	void markRect(TileMask & mask, int face, int cubeSize,
+		int left, int top, int right, int bottom, const Rotation & rotation,
+		const Coverage & coverage, CubeMapping mapping) const;
+
+	/** Get the longitude of a source pixel column, as in extractFace() */
+	float getTheta(int u, const Coverage & coverage) const {
+		if (coverage.isFullWidth()) {
+			return u * (float)M_PI * 2 / (m_width - 1) - (float)M_PI;
+		}
+		double fullU = coverage.left + u * (coverage.right - coverage.left) / (m_width - 1);
+		return (float)(fullU * M_PI * 2 - M_PI);
+	}
+
+	/** Get the latitude of a source pixel row, as in extractFace() */
+	float getPhi(int v, const Coverage & coverage) const {
+		if (coverage.isFullHeight()) {
+			return (float)M_PI_2 - v * (float)M_PI / (m_height - 1);
+		}
+		double fullV = coverage.top + v * (coverage.bottom - coverage.top) / (m_height - 1);
+		return (float)(M_PI_2 - fullV * M_PI);
+	}
+
+	int m_width, m_height;
+	int m_blockWidth, m_blockHeight;
+	int m_numBlocksWide, m_numBlocksHigh;
+	int m_numChanged;
+	std::vector<bool> m_changed;
+};
+
+} // namespace
+
+#endif
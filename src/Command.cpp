@@ -1,6 +1,11 @@
 #include <iostream>
 #include "Command.h"
 #include "MemoryBudget.h"
+#include "HugePageArena.h"
+#include "Isa.h"
+#include "Planner.h"
+#include "Precision.h"
+#include "Tracer.h"
 
 namespace PanoProjector {
 
@@ -44,11 +49,63 @@ int Command::run(int argc, char **argv) {
 		return 1;
 	}
 
+	if (m_options.count("no-huge-pages") && m_options["no-huge-pages"].as<bool>()) {
+		g_hugePageArena.setEnabled(false);
+	}
+	bool memReport = m_options.count("mem-report") && m_options["mem-report"].as<bool>();
+	g_hugePageArena.setMeasured(memReport || m_options.count("trace"));
+
+	int result;
+	std::string name = getName();
 	try {
-		return doRun();
+		if (m_options.count("isa") && m_options["isa"].as<std::string>() != "auto") {
+			setIsa(getIsaFromName(m_options["isa"].as<std::string>()));
+		}
+		if (m_options.count("mesh-tolerance")) {
+			setMeshTolerance(m_options["mesh-tolerance"].as<double>());
+		}
+		if (m_options.count("trace")) {
+#ifdef PANO_TRACING
+			g_tracer.start(m_options["trace"].as<std::string>());
+#else
+			throw std::runtime_error("Tracing is not available in this build");
+#endif
+		}
+		PANO_TRACE_SPAN(name.c_str());
+		result = doRun();
 	} catch (std::exception & e) {
 		std::cerr << "Error: " << e.what() << "\n";
-		return 1;
+		result = 1;
+	}
+#ifdef PANO_TRACING
+	g_tracer.finish();
+#endif
+
+	if (memReport) {
+		g_memBudget.report(std::cerr);
+		g_hugePageArena.report(std::cerr);
+	}
+	return result;
+}
+
+void Command::addEngineOptions(po::options_description & options, bool sampling) {
+	options.add_options()
+		("mem-report", po::bool_switch(),
+			"Show accounted memory usage by category and the peak RSS on exit")
+		("no-huge-pages", po::bool_switch(),
+			"Use normal pages instead of huge pages for the decoded input images")
+		("trace", po::value<std::string>(),
+			"Write a Chrome trace of the time and hardware counters of each stage to this file")
+		;
+	if (sampling) {
+		options.add_options()
+			("isa", po::value<std::string>()->default_value("auto"),
+				"The instruction set for the kernels: baseline, avx2, avx512, or "
+				"auto to use the best one the CPU supports")
+			("mesh-tolerance", po::value<double>()->default_value(0.05, "0.05"),
+				"The largest error in input pixels of the coordinates interpolated "
+				"with the mesh precision")
+			;
 	}
 }
 
@@ -61,4 +118,59 @@ void Command::setMemoryLimit() {
 	}
 }
 
+unsigned long Command::getPlanningLimit() {
+	if (m_options.count("mem-limit")) {
+		auto limit = m_options["mem-limit"].as<unsigned long>();
+		if (limit < ULONG_MAX / 1048576) {
+			return limit * 1048576;
+		}
+	}
+	return Planner::getDefaultLimit();
+}
+
+Rotation Command::getRotation() {
+	return getRotation(m_options);
+}
+
+Rotation Command::getRotation(const po::variables_map & options) {
+	return Rotation(
+		options["yaw"].as<double>(),
+		options["pitch"].as<double>(),
+		options["roll"].as<double>());
+}
+
+Coverage Command::getCoverage(const InputInfo & info) {
+	return getCoverage(m_options, info);
+}
+
+Coverage Command::getCoverage(const po::variables_map & options, const InputInfo & info) {
+	Coverage coverage;
+	bool hasAngles = false;
+	for (const char * name : {"hfov", "vfov", "hoffset", "voffset"}) {
+		hasAngles = hasAngles || options.count(name);
+	}
+	if (hasAngles || !Coverage::fromXmp(info.metadata.xmp, info.width, info.height, coverage)) {
+		// A missing field of view is derived from the other with square pixels
+		double aspect = (double)info.width / info.height;
+		double hfov = 360, vfov = 360 / aspect;
+		if (options.count("hfov")) {
+			hfov = options["hfov"].as<double>();
+			vfov = options.count("vfov") ? options["vfov"].as<double>() : hfov / aspect;
+		} else if (options.count("vfov")) {
+			vfov = options["vfov"].as<double>();
+			hfov = vfov * aspect;
+		} else if (vfov > 180) {
+			throw std::runtime_error("The input image is narrower than 2:1, use "
+				"--hfov and --vfov to specify its field of view");
+		}
+		double hoffset = options.count("hoffset")
+			? options["hoffset"].as<double>() : (360 - hfov) / 2;
+		double voffset = options.count("voffset")
+			? options["voffset"].as<double>() : (180 - vfov) / 2;
+		coverage = Coverage::fromAngles(hfov, vfov, hoffset, voffset);
+	}
+	Coverage::parseColour(options["fill"].as<std::string>(), coverage.fill);
+	return coverage;
+}
+
 } // namespace
@@ -2,7 +2,9 @@
 #define PANO_COMMAND_H
 
 #include <boost/program_options.hpp>
+#include "Coverage.h"
 #include "InputImageFactory.h"
+#include "Rotation.h"
 
 namespace PanoProjector {
 
@@ -51,11 +53,45 @@ protected:
 	 */
 	virtual int doRun() = 0;
 
+	/**
+	 * Add the options which are applied by run() for every command:
+	 * mem-report, no-huge-pages, trace, and if the command samples faces,
+	 * isa and mesh-tolerance
+	 */
+	static void addEngineOptions(po::options_description & options, bool sampling = true);
+
 	/**
 	 * Set the memory limit from the mem-limit command line option
 	 */
 	void setMemoryLimit();
 
+	/**
+	 * Get the memory limit for choosing an execution plan: the mem-limit
+	 * option in bytes, or if it was not given, the default from the cgroup
+	 * limit or available RAM.
+	 */
+	unsigned long getPlanningLimit();
+
+	/**
+	 * Get the cube orientation from the yaw, pitch and roll command line
+	 * options
+	 */
+	Rotation getRotation();
+
+	/** Get the cube orientation from the yaw, pitch and roll options in a map */
+	static Rotation getRotation(const po::variables_map & options);
+
+	/**
+	 * Get the part of the sphere covered by the input from the hfov, vfov,
+	 * hoffset, voffset and fill command line options, or if they were not
+	 * given, from the GPano XMP metadata. Otherwise, the input is taken to be
+	 * 360° wide with square pixels, centred vertically.
+	 */
+	Coverage getCoverage(const InputInfo & info);
+
+	/** Get the coverage from the options in a map, as for getCoverage() */
+	static Coverage getCoverage(const po::variables_map & options, const InputInfo & info);
+
 	po::options_description m_visible;
 	po::options_description m_invisible;
 	po::positional_options_description m_pos;
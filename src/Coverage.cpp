@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include "Coverage.h"
+#include "FaceInfo.h"
+#include "Rotation.h"
+#include "TileMask.h"
+
+namespace PanoProjector {
+
+bool Coverage::getImageCropRect(const CropRect & rect, CropRect & imageRect) const {
+	if (isFullWidth()) {
+		imageRect.left = rect.left;
+		imageRect.right = rect.right;
+	} else {
+		// Split a rectangle which wraps around the seam, clip the parts to
+		// the input and take the union, since the input doesn't wrap
+		double parts[2][2] = {{rect.left, rect.right}, {0, -1}};
+		if (rect.left > rect.right) {
+			parts[0][1] = 1;
+			parts[1][0] = 0;
+			parts[1][1] = rect.right;
+		}
+		double start = 1, end = 0;
+		for (auto & part : parts) {
+			double partStart = std::max(part[0], left);
+			double partEnd = std::min(part[1], right);
+			if (partStart <= partEnd) {
+				start = std::min(start, partStart);
+				end = std::max(end, partEnd);
+			}
+		}
+		if (start > end) {
+			return false;
+		}
+		imageRect.left = (start - left) / (right - left);
+		imageRect.right = (end - left) / (right - left);
+	}
+
+	double start = std::max(rect.top, top);
+	double end = std::min(rect.bottom, bottom);
+	if (start > end) {
+		return false;
+	}
+	imageRect.top = (start - top) / (bottom - top);
+	imageRect.bottom = (end - top) / (bottom - top);
+	return true;
+}
+
+void Coverage::unmarkUncoveredTiles(TileMask & mask, int face, int cubeSize, int tileSize,
+	double angleError, const Rotation & rotation, CubeMapping mapping
+) const {
+	if (isFull()) {
+		return;
+	}
+	TileMask covered(mask.getNumLevels(), cubeSize, tileSize);
+	double scale = 2.0 / cubeSize;
+	auto toPlane = [&] (int pixel) {
+		return mappingToPlane(mapping, pixel * scale - 1);
+	};
+	for (int top = 0; top < cubeSize; top += tileSize) {
+		int bottom = std::min(top + tileSize, cubeSize);
+		for (int left = 0; left < cubeSize; left += tileSize) {
+			int right = std::min(left + tileSize, cubeSize);
+			CropRect imageRect;
+			CropRect rect = FaceInfo::getRegionCropRect(face,
+				toPlane(left), toPlane(right), toPlane(top), toPlane(bottom),
+				256, angleError, rotation);
+			if (getImageCropRect(rect, imageRect)) {
+				covered.markRect(left, top, right, bottom);
+			}
+		}
+	}
+	mask.intersect(covered);
+}
+
+Coverage Coverage::fromAngles(double hfov, double vfov, double leftAngle, double topAngle) {
+	// Allow for rounding in angles computed by the user
+	const double epsilon = 1e-9;
+	if (!(hfov > 0 && hfov <= 360 && vfov > 0 && vfov <= 180)) {
+		throw std::runtime_error("The field of view must be at most 360° by 180°");
+	}
+	if (leftAngle < 0 || leftAngle + hfov > 360 + epsilon
+		|| topAngle < 0 || topAngle + vfov > 180 + epsilon
+	) {
+		throw std::runtime_error("The input must fit within 360° by 180° without "
+			"wrapping around; use --yaw to move the seam");
+	}
+	Coverage coverage;
+	coverage.left = leftAngle / 360;
+	coverage.right = std::min((leftAngle + hfov) / 360, 1.0);
+	coverage.top = topAngle / 180;
+	coverage.bottom = std::min((topAngle + vfov) / 180, 1.0);
+	return coverage;
+}
+
+/**
+ * Find a numeric XMP property in the GPano namespace, which may be written
+ * either as an attribute, GPano:Name="1", or as an element,
+ * <GPano:Name>1</GPano:Name>
+ */
+static bool getGPanoNumber(const std::string & xmp, const std::string & name, double & value) {
+	const std::string key = "GPano:" + name;
+	size_t pos = 0;
+	while ((pos = xmp.find(key, pos)) != std::string::npos) {
+		pos += key.size();
+		size_t p = pos;
+		if (p < xmp.size() && xmp[p] == '=') {
+			p++;
+			if (p < xmp.size() && (xmp[p] == '"' || xmp[p] == '\'')) {
+				p++;
+			}
+		} else if (p < xmp.size() && xmp[p] == '>') {
+			p++;
+		} else {
+			// A longer name with the same prefix
+			continue;
+		}
+		const char * start = xmp.c_str() + p;
+		char * end;
+		double v = strtod(start, &end);
+		if (end != start) {
+			value = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Coverage::fromXmp(const std::string & xmp, int width, int height, Coverage & coverage) {
+	double fullWidth, fullHeight;
+	if (!getGPanoNumber(xmp, "FullPanoWidthPixels", fullWidth)
+		|| !getGPanoNumber(xmp, "FullPanoHeightPixels", fullHeight)
+	) {
+		return false;
+	}
+	double left = 0, top = 0, croppedWidth = width, croppedHeight = height;
+	getGPanoNumber(xmp, "CroppedAreaLeftPixels", left);
+	getGPanoNumber(xmp, "CroppedAreaTopPixels", top);
+	getGPanoNumber(xmp, "CroppedAreaImageWidthPixels", croppedWidth);
+	getGPanoNumber(xmp, "CroppedAreaImageHeightPixels", croppedHeight);
+	if (fullWidth < 2 || fullHeight < 2 || croppedWidth < 1 || croppedHeight < 1
+		|| left < 0 || top < 0
+		|| left + croppedWidth > fullWidth || top + croppedHeight > fullHeight
+	) {
+		throw std::runtime_error("Invalid GPano cropped area in the input XMP metadata");
+	}
+	// The cropped area is in pixels of the full panorama, which may have a
+	// different scale from the input
+	coverage.left = left / (fullWidth - 1);
+	coverage.right = (left + croppedWidth - 1) / (fullWidth - 1);
+	coverage.top = top / (fullHeight - 1);
+	coverage.bottom = (top + croppedHeight - 1) / (fullHeight - 1);
+	return true;
+}
+
+void Coverage::parseColour(const std::string & hex, uint8_t (&colour)[3]) {
+	std::string digits = hex.starts_with("#") ? hex.substr(1) : hex;
+	if (digits.size() != 6
+		|| digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos
+	) {
+		throw std::runtime_error("Invalid colour \"" + hex + "\", must be six hex digits");
+	}
+	for (int c = 0; c < 3; c++) {
+		colour[c] = (uint8_t)std::stoi(digits.substr(c * 2, 2), nullptr, 16);
+	}
+}
+
+} // namespace
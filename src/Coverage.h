@@ -0,0 +1,100 @@
+#ifndef PANO_COVERAGE_H
+#define PANO_COVERAGE_H
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include "CropRect.h"
+#include "CubeMapping.h"
+
+namespace PanoProjector {
+
+class Rotation;
+class TileMask;
+
+/**
+ * The part of the sphere covered by the input image, for partial panoramas
+ * which are not 360°x180°.
+ *
+ * The position is given in units of the full equirectangular panorama
+ * scaled to 0≤u≤1 and 0≤v≤1, as used by the crop rectangles. As in
+ * extractFace(), the first and last pixel centres of the full panorama are
+ * at u=0 and u=1, so left is the u of the centre of the first column of the
+ * input, and right is the u of the centre of the last column. The input may
+ * not wrap around the seam.
+ *
+ * Samples outside the covered area are filled with a constant colour.
+ */
+struct Coverage {
+	double left = 0;
+	double right = 1;
+	double top = 0;
+	double bottom = 1;
+
+	/** The colour of the area which is not covered */
+	uint8_t fill[3] = {0, 0, 0};
+
+	/** Whether the input covers all longitudes */
+	bool isFullWidth() const {
+		return left == 0 && right == 1;
+	}
+
+	/** Whether the input covers all latitudes */
+	bool isFullHeight() const {
+		return top == 0 && bottom == 1;
+	}
+
+	/** Whether the input covers the whole sphere */
+	bool isFull() const {
+		return isFullWidth() && isFullHeight();
+	}
+
+	/**
+	 * Get the width of the full panorama at the scale of an input of the
+	 * given width
+	 */
+	int getFullWidth(int width) const {
+		return isFullWidth() ? width : (int)lround((width - 1) / (right - left)) + 1;
+	}
+
+	/**
+	 * Convert a crop rectangle in full panorama coordinates to the
+	 * coordinates of the input, clipped to the input. Return false if the
+	 * rectangle doesn't intersect the covered area, in which case nothing
+	 * needs to be decoded.
+	 */
+	bool getImageCropRect(const CropRect & rect, CropRect & imageRect) const;
+
+	/**
+	 * Deselect the tiles of a face which lie entirely outside the covered
+	 * area, so that they are not written. The face is rotated, mapped and
+	 * sampled with the given angle error as in Planner.
+	 */
+	void unmarkUncoveredTiles(TileMask & mask, int face, int cubeSize, int tileSize,
+		double angleError, const Rotation & rotation,
+		CubeMapping mapping = CubeMapping::Standard) const;
+
+	/**
+	 * Get the coverage from the horizontal and vertical field of view and the
+	 * angles from the left and top edges of the full panorama to those of the
+	 * input, in degrees. Throw if it doesn't fit in the full panorama.
+	 */
+	static Coverage fromAngles(double hfov, double vfov, double leftAngle, double topAngle);
+
+	/**
+	 * Get the coverage from the GPano properties of Photo Sphere XMP metadata
+	 * for an input of the given size. Return false if the XMP doesn't have
+	 * them.
+	 */
+	static bool fromXmp(const std::string & xmp, int width, int height, Coverage & coverage);
+
+	/**
+	 * Parse a colour given as six hex digits, for the fill colour. Throw if it
+	 * is invalid.
+	 */
+	static void parseColour(const std::string & hex, uint8_t (&colour)[3]);
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,53 @@
+#include <stdexcept>
+#include "CubeMapping.h"
+
+namespace PanoProjector {
+
+CubeMapping getMappingFromName(const std::string & name) {
+	if (name == "standard") {
+		return CubeMapping::Standard;
+	} else if (name == "eac" || name == "equi-angular") {
+		return CubeMapping::EquiAngular;
+	}
+	throw std::runtime_error("Invalid cube mapping \"" + name + "\"");
+}
+
+const char * getMappingName(CubeMapping mapping) {
+	switch (mapping) {
+		case CubeMapping::Standard: return "standard";
+		case CubeMapping::EquiAngular: return "eac";
+	}
+	return "unknown";
+}
+
+double mappingToPlane(CubeMapping mapping, double a) {
+	return mapping == CubeMapping::EquiAngular ? tan(M_PI_4 * a) : a;
+}
+
+double mappingFromPlane(CubeMapping mapping, double p) {
+	return mapping == CubeMapping::EquiAngular ? atan(p) * 4 / M_PI : p;
+}
+
+int getDefaultCubeSize(CubeMapping mapping, double fullWidth) {
+	// At the centre of a face of size N, a pixel subtends 2/N radians with
+	// the standard mapping and π/2N with the equi-angular mapping, and a
+	// pixel of the input subtends 2π/width.
+	double size = mapping == CubeMapping::EquiAngular ? fullWidth / 4 : fullWidth / M_PI;
+	return 8 * (int)(size / 8);
+}
+
+void setMappingXmp(CubeMapping mapping, Metadata & metadata) {
+	if (mapping == CubeMapping::Standard) {
+		return;
+	}
+	metadata.xmp =
+		"<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">"
+		"<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">"
+		"<rdf:Description rdf:about=\"\""
+		" xmlns:PanoProjector=\"http://ns.pano-projector/1.0/\""
+		" PanoProjector:CubeMapping=\"" + std::string(getMappingName(mapping)) + "\"/>"
+		"</rdf:RDF>"
+		"</x:xmpmeta>";
+}
+
+} // namespace
@@ -0,0 +1,96 @@
+#ifndef PANO_CUBE_MAPPING_H
+#define PANO_CUBE_MAPPING_H
+
+#include <cmath>
+#include <string>
+#include "Metadata.h"
+
+namespace PanoProjector {
+
+/**
+ * How the pixels of a cube face are distributed over the face, selected
+ * with --mapping
+ */
+enum class CubeMapping {
+	/**
+	 * Uniformly on the face plane. The pixels at the edges of a face subtend
+	 * half the angle of the pixels at the centre.
+	 */
+	Standard,
+	/**
+	 * Uniformly in angle from the face centre, as in an equi-angular cubemap
+	 * (EAC), so that fewer pixels give the same resolution at the centre
+	 */
+	EquiAngular,
+};
+
+/**
+ * Mapping policies for extractFaceTpl(). Each provides toPlane(), which
+ * converts a cube face image coordinate scaled to |a|≤1 to the coordinate on
+ * the face plane passed to FaceInfo::setMajor() and FaceInfo::setMinor(),
+ * and fromPlane(), its inverse. Both preserve ±1 and are odd, so the faces
+ * cover the same part of the sphere, and the right half of each row is still
+ * the reflection of the left half.
+ */
+struct StandardMapping {
+	static constexpr CubeMapping MAPPING = CubeMapping::Standard;
+
+	static inline float toPlane(float a) {
+		return a;
+	}
+
+	static inline float fromPlane(float p) {
+		return p;
+	}
+};
+
+struct EquiAngularMapping {
+	static constexpr CubeMapping MAPPING = CubeMapping::EquiAngular;
+
+	static inline float toPlane(float a) {
+		return tanf((float)M_PI_4 * a);
+	}
+
+	static inline float fromPlane(float p) {
+		return atanf(p) * (float)(4 / M_PI);
+	}
+};
+
+/**
+ * Get the mapping for a name accepted by --mapping. Throw if it is invalid.
+ */
+CubeMapping getMappingFromName(const std::string & name);
+
+/**
+ * Get the name of a mapping
+ */
+const char * getMappingName(CubeMapping mapping);
+
+/**
+ * Convert a cube face image coordinate to a face plane coordinate in double
+ * precision, as in the toPlane() function of the policy for a mapping
+ */
+double mappingToPlane(CubeMapping mapping, double a);
+
+/**
+ * The inverse of mappingToPlane()
+ */
+double mappingFromPlane(CubeMapping mapping, double p);
+
+/**
+ * Get the default face size for an input with the given full panorama
+ * width, at which the face centre has the angular resolution of the input,
+ * rounded down to a multiple of 8
+ */
+int getDefaultCubeSize(CubeMapping mapping, double fullWidth);
+
+/**
+ * Add an XMP packet to the metadata of a face image identifying the mapping,
+ * so that viewers can tell an equi-angular face from a standard one. The
+ * standard mapping is the default, and has no metadata.
+ */
+void setMappingXmp(CubeMapping mapping, Metadata & metadata);
+
+} // namespace
+
+#endif
@@ -5,6 +5,12 @@ namespace PanoProjector {
 
 struct EncoderOptions {
 	int quality = 90;
+
+	/**
+	 * Whether the image is given as YCbCr planes with 4:2:0 subsampling by
+	 * OutputImage::writeRawRows(), rather than as RGB rows
+	 */
+	bool rawYcc = false;
 };
 
 } // namespace
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <memory>
+
+#include "EquirectAssembler.h"
+#include "FaceInfo.h"
+#include "MemoryBudget.h"
+#include "Tracer.h"
+
+namespace PanoProjector {
+
+/**
+ * The number of output pixels between samples when estimating the bounding
+ * boxes
+ */
+static const int ESTIMATE_STEP = 4;
+
+/**
+ * The band counts to try when choosing one. With fewer bands, the output
+ * band buffers dominate the memory usage.
+ */
+static const int g_bandCounts[] = {8, 16, 32, 64, 128, 256};
+
+/** The bytes per output pixel of a band: the cell, coordinates and colour */
+static const unsigned long BAND_BYTES_PER_PIXEL = 1 + 2 * sizeof(float) + COMPONENTS;
+
+void EquirectAssembler::Box::add(int x, int y) {
+	if (isEmpty()) {
+		left = x;
+		right = x + 1;
+		top = y;
+		bottom = y + 1;
+	} else {
+		left = std::min(left, x);
+		right = std::max(right, x + 1);
+		top = std::min(top, y);
+		bottom = std::max(bottom, y + 1);
+	}
+}
+
+EquirectAssembler::EquirectAssembler(int cubeSize, int width, CubeMapping mapping)
+	: m_cubeSize(cubeSize), m_width(width), m_height(width / 2), m_mapping(mapping),
+	m_maxCoord(nextafterf((float)(cubeSize - 1), 0.0f)),
+	m_cosTheta(width), m_sinTheta(width)
+{
+	for (int i = 0; i < width; i++) {
+		double theta = i * M_PI * 2 / (width - 1) - M_PI;
+		m_cosTheta[i] = (float)cos(theta);
+		m_sinTheta[i] = (float)sin(theta);
+	}
+}
+
+int EquirectAssembler::getDefaultWidth(int cubeSize, CubeMapping mapping) {
+	if (mapping == CubeMapping::EquiAngular) {
+		return 4 * cubeSize;
+	}
+	return 2 * (int)lround(cubeSize * M_PI / 2);
+}
+
+float EquirectAssembler::toPixelX(float a) const {
+	// The left half pixel i is sampled at t=i, and the right half pixel i at
+	// t=i+1, so there is a gap between the middle two pixels
+	float t = (a + 1.0f) * m_cubeSize / 2;
+	float lastLeft = (m_cubeSize + 1) / 2 - 1;
+	float x;
+	if (t <= lastLeft) {
+		x = t;
+	} else if (t >= lastLeft + 2) {
+		x = t - 1;
+	} else {
+		x = lastLeft + (t - lastLeft) / 2;
+	}
+	return std::clamp(x, 0.0f, m_maxCoord);
+}
+
+float EquirectAssembler::toPixelY(float b) const {
+	return std::clamp((b + 1.0f) * m_cubeSize / 2, 0.0f, m_maxCoord);
+}
+
+int EquirectAssembler::mapPixel(int i, float cosPhi, float sinPhi, float & x, float & y) const {
+	float dx = cosPhi * m_cosTheta[i];
+	float dy = cosPhi * m_sinTheta[i];
+	float a, b;
+	int face = FaceInfo::directionToFace(dx, dy, sinPhi, a, b);
+	if (m_mapping == CubeMapping::EquiAngular) {
+		a = EquiAngularMapping::fromPlane(a);
+		b = EquiAngularMapping::fromPlane(b);
+	}
+	x = toPixelX(a);
+	y = toPixelY(b);
+	if (face < 4) {
+		return face;
+	}
+	// Split the top and bottom faces by the nearest side face
+	int side;
+	if (fabsf(dx) >= fabsf(dy)) {
+		side = dx < 0 ? 0 : 2;
+	} else {
+		side = dy < 0 ? 1 : 3;
+	}
+	return 4 + (face - 4) * 4 + side;
+}
+
+std::vector<EquirectAssembler::Box> EquirectAssembler::estimateBoxes(int numBands) const {
+	// Allow for the unsampled pixels. Near the face edges, a face pixel
+	// subtends as little as 1/cubeSize radians, and an output pixel subtends
+	// 2π/width radians.
+	const int margin = (int)ceil(ESTIMATE_STEP * 2 * M_PI * m_cubeSize / m_width) + 2;
+	std::vector<Box> boxes(numBands * NUM_CELLS);
+	for (int band = 0; band < numBands; band++) {
+		int startRow = getBandStart(numBands, band);
+		int endRow = getBandStart(numBands, band + 1);
+		for (int j = startRow; j < endRow; j += ESTIMATE_STEP) {
+			int row = std::min(j, endRow - 1);
+			float phi = getPhi(row);
+			float cosPhi = cosf(phi), sinPhi = sinf(phi);
+			for (int i = 0; i < m_width; i += ESTIMATE_STEP) {
+				float x, y;
+				int cell = mapPixel(i, cosPhi, sinPhi, x, y);
+				Box & box = boxes[band * NUM_CELLS + cell];
+				box.add(std::max((int)x - margin, 0), std::max((int)y - margin, 0));
+				box.add(std::min((int)x + margin, m_cubeSize - 1),
+					std::min((int)y + margin, m_cubeSize - 1));
+			}
+		}
+	}
+	return boxes;
+}
+
+unsigned long EquirectAssembler::getMemory(int numBands) const {
+	auto boxes = estimateBoxes(numBands);
+	unsigned long maxArea = 0;
+	for (auto & box : boxes) {
+		maxArea = std::max(maxArea, box.getArea());
+	}
+	unsigned long bandHeight = getBandStart(numBands, 1) + 1;
+	return maxArea * COMPONENTS + bandHeight * m_width * BAND_BYTES_PER_PIXEL;
+}
+
+int EquirectAssembler::chooseNumBands(unsigned long limit) const {
+	int chosen = 0;
+	unsigned long chosenMemory = ULONG_MAX;
+	for (int numBands : g_bandCounts) {
+		if (numBands > m_height) {
+			break;
+		}
+		unsigned long memory = getMemory(numBands);
+		if (memory <= limit) {
+			return numBands;
+		}
+		if (memory < chosenMemory) {
+			chosen = numBands;
+			chosenMemory = memory;
+		}
+	}
+	return chosen ? chosen : 1;
+}
+
+void EquirectAssembler::execute(int numBands, const InputFactory & makeInput,
+	OutputBase & output
+) const {
+	const size_t rowSize = (size_t)m_width * COMPONENTS;
+	const size_t maxBandHeight = getBandStart(numBands, 1) + 1;
+	MemoryReservation reservedRows(MemoryCategory::TileBuffers, maxBandHeight, rowSize);
+	MemoryReservation reservedMap(
+		MemoryCategory::RemapTables, maxBandHeight, m_width, 1 + 2 * sizeof(float));
+	std::unique_ptr<uint8_t[]> rows(new uint8_t[maxBandHeight * rowSize]);
+	std::unique_ptr<uint8_t[]> cells(new uint8_t[maxBandHeight * m_width]);
+	std::unique_ptr<float[]> coords(new float[maxBandHeight * m_width * 2]);
+	const double scale = 1.0 / m_cubeSize;
+
+	for (int band = 0; band < numBands; band++) {
+		PANO_TRACE_SPAN("band");
+		int startRow = getBandStart(numBands, band);
+		int endRow = getBandStart(numBands, band + 1);
+		size_t numPixels = (size_t)(endRow - startRow) * m_width;
+
+		// Map the pixels of the band, and find the bounding box of the face
+		// pixels needed by each cell, including the interpolation neighbours
+		Box boxes[NUM_CELLS];
+		{
+			PANO_TRACE_STAGE(Sample);
+			size_t k = 0;
+			for (int j = startRow; j < endRow; j++) {
+				float phi = getPhi(j);
+				float cosPhi = cosf(phi), sinPhi = sinf(phi);
+				for (int i = 0; i < m_width; i++, k++) {
+					float x, y;
+					int cell = mapPixel(i, cosPhi, sinPhi, x, y);
+					cells[k] = (uint8_t)cell;
+					coords[2 * k] = x;
+					coords[2 * k + 1] = y;
+					boxes[cell].add((int)x, (int)y);
+					boxes[cell].add((int)x + 1, (int)y + 1);
+				}
+			}
+		}
+
+		// Decode each cell and interpolate its pixels
+		for (int cell = 0; cell < NUM_CELLS; cell++) {
+			const Box & box = boxes[cell];
+			if (box.isEmpty()) {
+				continue;
+			}
+			std::unique_ptr<InputImage> input(makeInput(getCellFace(cell), CropRect{
+				box.left * scale, box.right * scale, box.top * scale, box.bottom * scale}));
+			PANO_TRACE_STAGE(Sample);
+			for (size_t k = 0; k < numPixels; k++) {
+				if (cells[k] == cell) {
+					input->interpolate(&rows[k * COMPONENTS], coords[2 * k], coords[2 * k + 1]);
+				}
+			}
+		}
+
+		output.writeRows(&rows[0], endRow - startRow, rowSize);
+	}
+	output.finish();
+}
+
+} // namespace
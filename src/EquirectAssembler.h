@@ -0,0 +1,138 @@
+#ifndef PANO_EQUIRECTASSEMBLER_H
+#define PANO_EQUIRECTASSEMBLER_H
+
+#include <functional>
+#include <vector>
+
+#include "CubeMapping.h"
+#include "InputImage.h"
+#include "OutputBase.h"
+
+namespace PanoProjector {
+
+/**
+ * Rebuild an equirectangular image from six square cube faces, as written by
+ * extractFace(), streaming the output in row order.
+ *
+ * The output is processed in bands of rows. For each band, every output
+ * pixel is mapped to a face with FaceInfo::directionToFace(), and the
+ * bounding box of the face pixels needed by the band is decoded, one face at
+ * a time. The top and bottom faces are split into four triangles, one for
+ * each adjacent side face, since a band of latitudes is a ring around the
+ * pole. So the memory used is a band of output rows and one decoded face
+ * band, rather than six whole faces.
+ */
+class EquirectAssembler {
+public:
+	/**
+	 * A function which decodes a face cropped to the given rectangle, in
+	 * coordinates of the face image scaled to 0≤u≤1 and 0≤v≤1 as in CropRect
+	 */
+	typedef std::function<InputImage*(int face, const CropRect & cropRect)> InputFactory;
+
+	/**
+	 * Constructor
+	 *
+	 * @param cubeSize The width and height of the faces
+	 * @param width The output width. The output height is half of it.
+	 * @param mapping How the pixels are distributed over the faces
+	 */
+	EquirectAssembler(int cubeSize, int width,
+		CubeMapping mapping = CubeMapping::Standard);
+
+	/**
+	 * Estimate the peak memory usage in bytes for the given number of bands,
+	 * excluding the output
+	 */
+	unsigned long getMemory(int numBands) const;
+
+	/**
+	 * Get the smallest number of bands which fits within the memory limit,
+	 * or the number with the least memory if none fit
+	 */
+	int chooseNumBands(unsigned long limit) const;
+
+	/**
+	 * Write the output image, decoding the faces with the given function
+	 */
+	void execute(int numBands, const InputFactory & makeInput, OutputBase & output) const;
+
+	/**
+	 * Get the default output width for a cube size, which is the inverse of
+	 * the default cube size for an input width
+	 */
+	static int getDefaultWidth(int cubeSize, CubeMapping mapping = CubeMapping::Standard);
+
+private:
+	/**
+	 * The parts of the faces which are decoded separately: the four side
+	 * faces, and four triangles of each of the top and bottom faces
+	 */
+	enum { NUM_CELLS = 12 };
+
+	/** A bounding box of face pixels, with past-the-end right and bottom */
+	struct Box {
+		int left = 0, right = 0, top = 0, bottom = 0;
+
+		bool isEmpty() const {
+			return left >= right || top >= bottom;
+		}
+
+		unsigned long getArea() const {
+			return isEmpty() ? 0 : (unsigned long)(right - left) * (bottom - top);
+		}
+
+		/** Extend the box to include a pixel */
+		void add(int x, int y);
+	};
+
+	/** Get the face of a cell */
+	static int getCellFace(int cell) {
+		return cell < 4 ? cell : 4 + (cell - 4) / 4;
+	}
+
+	/**
+	 * Map an output pixel in column i of a row with the given latitude to a
+	 * cell, and the face pixel coordinates to interpolate at
+	 */
+	int mapPixel(int i, float cosPhi, float sinPhi, float & x, float & y) const;
+
+	/** Get the latitude of an output row, as in extractFace() */
+	float getPhi(int j) const {
+		return (float)(M_PI_2 - j * M_PI / (m_height - 1));
+	}
+
+	/**
+	 * Convert a face image coordinate scaled to -1≤a≤1 to a pixel coordinate.
+	 * This inverts the sample positions of extractFace(), in which the right
+	 * half of each row mirrors the left half.
+	 */
+	float toPixelX(float a) const;
+
+	/** Convert a vertical face image coordinate to a pixel coordinate */
+	float toPixelY(float b) const;
+
+	/** Get the first output row of a band */
+	int getBandStart(int numBands, int band) const {
+		return (int)((long)m_height * band / numBands);
+	}
+
+	/**
+	 * Find the bounding box of each cell for each of a number of bands of
+	 * equal height, sampling every few output pixels, for estimating memory
+	 */
+	std::vector<Box> estimateBoxes(int numBands) const;
+
+	int m_cubeSize, m_width, m_height;
+	CubeMapping m_mapping;
+
+	/** The largest interpolated pixel coordinate, just inside the last pixel */
+	float m_maxCoord;
+
+	/** The cosine and sine of the longitude of each output column */
+	std::vector<float> m_cosTheta, m_sinTheta;
+};
+
+} // namespace
+
+#endif
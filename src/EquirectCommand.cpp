@@ -0,0 +1,132 @@
+#include <filesystem>
+#include <iostream>
+
+#include "EquirectCommand.h"
+#include "EquirectAssembler.h"
+#include "FaceInfo.h"
+#include "OutputImage.h"
+
+namespace PanoProjector {
+
+namespace fs = std::filesystem;
+
+void EquirectCommand::initOptions() {
+	m_visible.add_options()
+		("help",
+			"Show help message and exit")
+		("input-format", po::value<std::string>()->default_value("jpg"),
+			"The format and file extension of the face images")
+		("output-format", po::value<std::string>()->default_value(""),
+			"The format of the output image. If unspecified, use the file extension")
+		("width", po::value<int>(),
+			"The output image width. The height is half of it. (default: "
+			"the width for which the faces are full resolution)")
+		("mapping", po::value<std::string>()->default_value("standard"),
+			"How the pixels are distributed over each face: standard, or eac "
+			"for an equi-angular cubemap")
+		("bands", po::value<int>(),
+			"The number of bands of output rows to decode the faces in "
+			"(default: the fewest which fit in the memory limit)")
+		("mem-limit", po::value<unsigned long>(),
+			"The approximate maximum memory usage in MiB")
+		("quality", po::value<int>()->default_value(80),
+			"The encoder quality, as a percentage")
+		("copy-icc", po::bool_switch(),
+			"Copy the ICC color profile of the front face")
+		;
+
+	addEngineOptions(m_visible, false);
+
+	m_invisible.add_options()
+		("input", po::value<std::string>())
+		("output", po::value<std::string>())
+		;
+
+	m_pos
+		.add("input", 1)
+		.add("output", 1)
+		;
+}
+
+std::string EquirectCommand::getSynopsis() {
+	return "equirect [options] <face-dir> <output>";
+}
+
+std::string EquirectCommand::getName() {
+	return "equirect";
+}
+
+std::string EquirectCommand::getDescription() {
+	return "Rebuild an equirectangular image from six cube faces named b.jpg, "
+		"l.jpg, f.jpg, r.jpg, u.jpg and d.jpg, decoding only the bands of the "
+		"faces needed for each band of output rows.";
+}
+
+int EquirectCommand::doRun() {
+	if (!m_options.count("input") || !m_options.count("output")) {
+		std::cerr << "Error: a face directory and an output filename must be specified.\n";
+		return 1;
+	}
+
+	setMemoryLimit();
+
+	EncoderOptions encoderOptions;
+	encoderOptions.quality = m_options["quality"].as<int>();
+
+	std::string outputPath = m_options["output"].as<std::string>();
+	std::string outputFormat = InputImageFactory::normalizeFormat(
+		outputPath,
+		m_options["output-format"].as<std::string>());
+	if (outputFormat != "jpeg") {
+		std::cerr << "Error: for forwards compatibility, the output file format must be "
+			<< "specified as JPEG, either by the file extension or with --output-format\n";
+		return 1;
+	}
+
+	// The faces must all be square and the same size
+	fs::path faceDir(m_options["input"].as<std::string>());
+	auto & inputFormat = m_options["input-format"].as<std::string>();
+	std::string facePaths[6];
+	InputInfo frontInfo;
+	int cubeSize = 0;
+	for (int face = 0; face < 6; face++) {
+		facePaths[face] = (faceDir / (FaceInfo::getLetter(face) + "." + inputFormat)).string();
+		InputInfo info = InputImageFactory::getInfo(facePaths[face], inputFormat);
+		if (info.width != info.height || (face > 0 && info.width != cubeSize)) {
+			std::cerr << "Error: the faces must be square and the same size\n";
+			return 1;
+		}
+		cubeSize = info.width;
+		if (face == 2) {
+			frontInfo = info;
+		}
+	}
+
+	CubeMapping mapping = getMappingFromName(m_options["mapping"].as<std::string>());
+	int width = m_options.count("width")
+		? m_options["width"].as<int>() : EquirectAssembler::getDefaultWidth(cubeSize, mapping);
+	if (width < 4 || width % 2) {
+		std::cerr << "Error: the width must be even and at least 4\n";
+		return 1;
+	}
+
+	EquirectAssembler assembler(cubeSize, width, mapping);
+	int numBands = m_options.count("bands")
+		? m_options["bands"].as<int>() : assembler.chooseNumBands(getPlanningLimit());
+	if (numBands < 1 || numBands > width / 2) {
+		std::cerr << "Error: the number of bands must be between 1 and the output height\n";
+		return 1;
+	}
+
+	Metadata meta;
+	if (m_options["copy-icc"].as<bool>()) {
+		meta.icc = frontInfo.metadata.icc;
+	}
+	OutputImage output(outputPath, width, width / 2, meta, encoderOptions);
+	assembler.execute(numBands, [&] (int face, const CropRect & cropRect) {
+		return InputImageFactory::create(facePaths[face], inputFormat, cropRect);
+	}, output);
+	return 0;
+}
+
+} // namespace
@@ -0,0 +1,23 @@
+#ifndef PANO_EQUIRECT_COMMAND_H
+#define PANO_EQUIRECT_COMMAND_H
+
+#include "Command.h"
+
+namespace PanoProjector {
+
+/**
+ * Rebuild an equirectangular image from six cube faces
+ */
+class EquirectCommand : public Command {
+public:
+	std::string getName() override;
+	std::string getDescription() override;
+
+protected:
+	void initOptions() override;
+	std::string getSynopsis() override;
+	int doRun() override;
+};
+
+} // namespace
+#endif
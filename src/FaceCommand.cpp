@@ -1,9 +1,13 @@
+#include <cstdio>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
 
 #include "FaceCommand.h"
 #include "FaceInfo.h"
-#include "extractFace.h"
-#include "OutputImage.h"
+#include "InputImageFactory.h"
+#include "Projector.h"
 
 namespace PanoProjector {
 
@@ -27,8 +31,55 @@ void FaceCommand::initOptions() {
 			"The encoder quality, as a percentage")
 		("copy-icc", po::bool_switch(),
 			"Copy the ICC color profile")
+		("variant", po::value<std::vector<std::string>>()->composing(),
+			"Also write the face as SIZE:QUALITY:PATH, where an empty size or "
+			"quality is that of the main output. May be repeated. The face is "
+			"projected once at --size and scaled to each variant size.")
+		("ycbcr", po::bool_switch(),
+			"Project the YCbCr planes of a JPEG input directly, sampling the "
+			"chroma at half resolution, and write 4:2:0 output. Faster and "
+			"smaller, but only with the single strategy")
+		("strategy", po::value<std::string>()->default_value("auto"),
+			"How to decode the input: single, bands, or auto to choose "
+			"the fastest strategy which fits in the memory limit")
+		("plan", po::bool_switch(),
+			"Show the estimated memory and time of each strategy and exit")
+		("pipeline", po::bool_switch(),
+			"Decode the next band ahead, and encode, on separate threads")
+		("precision", po::value<std::string>()->default_value("standard"),
+			"The accuracy of the sampling kernels: fast, standard, exact, or "
+			"mesh to compute the coordinates on a sparse grid and interpolate them")
+		("mapping", po::value<std::string>()->default_value("standard"),
+			"How the pixels are distributed over each face: standard, or eac "
+			"for an equi-angular cubemap, which has uniform angular resolution "
+			"and so needs fewer pixels for the same resolution at the face centre")
+		("yaw", po::value<double>()->default_value(0),
+			"Turn the cube to the right by this angle in degrees, so that the "
+			"front face is centred on this longitude")
+		("pitch", po::value<double>()->default_value(0),
+			"Tilt the cube upwards by this angle in degrees, so that the front "
+			"face is centred on this latitude")
+		("roll", po::value<double>()->default_value(0),
+			"Turn the cube about the centre of the front face by this angle in "
+			"degrees, so that its right edge points higher")
+		("hfov", po::value<double>(),
+			"The horizontal field of view of a partial panorama in degrees "
+			"(default: from the GPano XMP metadata, or 360)")
+		("vfov", po::value<double>(),
+			"The vertical field of view of a partial panorama in degrees "
+			"(default: from the GPano XMP metadata, or from the aspect ratio)")
+		("hoffset", po::value<double>(),
+			"The angle in degrees from the left edge of the full panorama to "
+			"the left edge of the input (default: centred)")
+		("voffset", po::value<double>(),
+			"The angle in degrees from the top edge of the full panorama to "
+			"the top edge of the input (default: centred)")
+		("fill", po::value<std::string>()->default_value("000000"),
+			"The colour of the area outside a partial panorama, as six hex digits")
 		;
 
+	addEngineOptions(m_visible);
+
 	m_invisible.add_options()
 		("input", po::value<std::string>())
 		("output", po::value<std::string>())
@@ -41,7 +92,8 @@ void FaceCommand::initOptions() {
 }
 
 std::string FaceCommand::getSynopsis() {
-	return "face --face=<face> [options] <input> <output>";
+	return "face --face=<face> [options] <input> <output>\n"
+		"Either path may be - for standard input or output.";
 }
 
 std::string FaceCommand::getName() {
@@ -52,6 +104,44 @@ std::string FaceCommand::getDescription() {
 	return "Extract a cube face from an equirectangular source image.";
 }
 
+/**
+ * Parse a --variant value of the form SIZE:QUALITY:PATH, where the size and
+ * quality may be empty to use those of the main output
+ */
+static Projector::FaceVariant parseVariant(const std::string & value,
+	const EncoderOptions & defaultOptions
+) {
+	size_t first = value.find(':');
+	size_t second = first == std::string::npos ? first : value.find(':', first + 1);
+	if (second == std::string::npos || second + 1 == value.size()) {
+		throw std::runtime_error("Invalid variant \"" + value
+			+ "\", must be SIZE:QUALITY:PATH");
+	}
+	Projector::FaceVariant variant;
+	variant.options = defaultOptions;
+	variant.path = value.substr(second + 1);
+	try {
+		std::string size = value.substr(0, first);
+		std::string quality = value.substr(first + 1, second - first - 1);
+		if (!size.empty()) {
+			variant.size = std::stoi(size);
+		}
+		if (!quality.empty()) {
+			variant.options.quality = std::stoi(quality);
+		}
+	} catch (std::logic_error &) {
+		throw std::runtime_error("Invalid variant \"" + value
+			+ "\", the size and quality must be integers");
+	}
+	if (variant.size < 0) {
+		throw std::runtime_error("Invalid variant \"" + value + "\", the size must be positive");
+	}
+	if (InputImageFactory::normalizeFormat(variant.path, "") != "jpeg") {
+		throw std::runtime_error("The variant \"" + variant.path + "\" must be a JPEG file");
+	}
+	return variant;
+}
+
 int FaceCommand::doRun() {
 	if (!m_options.count("input") || !m_options.count("output")) {
 		std::cerr << "Error: an input filename and an output filename must be specified.\n";
@@ -84,10 +174,13 @@ int FaceCommand::doRun() {
 	EncoderOptions encoderOptions;
 	encoderOptions.quality = m_options["quality"].as<int>();
 
+	// A path of "-" is standard input or output, which is JPEG by default
 	std::string outputPath = m_options["output"].as<std::string>();
-	std::string outputFormat = InputImageFactory::normalizeFormat(
-		outputPath,
-		m_options["output-format"].as<std::string>());
+	std::string outputFormat = m_options["output-format"].as<std::string>();
+	if (outputPath == "-" && outputFormat.empty()) {
+		outputFormat = "jpeg";
+	}
+	outputFormat = InputImageFactory::normalizeFormat(outputPath, outputFormat);
 	if (outputFormat != "jpeg")
 	{
 		std::cerr << "Error: for forwards compatibility, the output file format must be "
@@ -95,31 +188,58 @@ int FaceCommand::doRun() {
 		return 1;
 	}
 
-	const CropRect cropRect = FaceInfo::getCropRect(face);
-	std::unique_ptr<InputImage> input(InputImageFactory::create(
-		m_options["input"].as<std::string>(),
-		m_options["input-format"].as<std::string>(),
-		cropRect
-	));
-
-	if (input->getWidth() != input->getHeight() * 2) {
-		std::cerr << "Input image has incorrect aspect ratio, must be 2:1.\n";
-		return 1;
+	auto & inputPath = m_options["input"].as<std::string>();
+	auto & inputFormat = m_options["input-format"].as<std::string>();
+	std::string inputData;
+	if (inputPath == "-") {
+		std::ostringstream buffer;
+		buffer << std::cin.rdbuf();
+		inputData = buffer.str();
 	}
-
-	int size = m_options["size"].as<int>();
-	if (size <= 0) {
-		size = 8 * (int)(input->getWidth() / M_PI / 8);
+	Projector projector(inputPath == "-"
+		? InputSource(inputData.data(), inputData.size(),
+			inputFormat.empty() ? "jpeg" : inputFormat)
+		: InputSource(inputPath, inputFormat));
+
+	CubeMapping mapping = getMappingFromName(m_options["mapping"].as<std::string>());
+	projector.setCoverage(getCoverage(projector.getInfo()));
+	projector.setMapping(mapping);
+	projector.setCubeSize(m_options["size"].as<int>());
+	projector.setPrecision(getPrecisionFromName(m_options["precision"].as<std::string>()));
+	projector.setRotation(getRotation());
+	projector.setEncoderOptions(encoderOptions);
+	projector.setCopyIcc(m_options["copy-icc"].as<bool>());
+	projector.setMemoryLimit(getPlanningLimit());
+	projector.setStrategy(m_options["strategy"].as<std::string>());
+	projector.setYcc(m_options["ycbcr"].as<bool>());
+	projector.setPipelined(m_options["pipeline"].as<bool>());
+	if (m_options["plan"].as<bool>()) {
+		projector.describeFace(face, std::cout);
+		return 0;
 	}
 
-	Metadata meta;
-	if (!m_options.contains("copy-icc")) {
-		meta.icc = input->getMetadata().icc;
+	OutputImage::Sink writeStdout = [] (const uint8_t * data, size_t size) {
+		if (fwrite(data, 1, size, stdout) != size || fflush(stdout) != 0) {
+			throw std::runtime_error("Unable to write to standard output");
+		}
+	};
+	if (m_options.count("variant")) {
+		std::vector<Projector::FaceVariant> variants(1);
+		variants[0].options = encoderOptions;
+		if (outputPath == "-") {
+			variants[0].sink = writeStdout;
+		} else {
+			variants[0].path = outputPath;
+		}
+		for (auto & value : m_options["variant"].as<std::vector<std::string>>()) {
+			variants.push_back(parseVariant(value, encoderOptions));
+		}
+		projector.extractFaceVariants(face, variants);
+	} else if (outputPath == "-") {
+		projector.extractFace(face, writeStdout);
+	} else {
+		projector.extractFace(face, outputPath);
 	}
-
-	OutputImage output(outputPath, size, size, meta, encoderOptions);
-
-	extractFace(face, *input, output);
 	return 0;
 }
 
@@ -1,5 +1,6 @@
 #include <cmath>
 #include "FaceDiagramCommand.h"
+#include "FaceInfo.h"
 #include "OutputImage.h"
 
 namespace PanoProjector {
@@ -107,16 +108,13 @@ void FaceDiagramCommand::makeFaceDiagramNumerical(const std::string & outputPath
 		}
 	}
 	OutputImage output(outputPath, width, height, Metadata(), EncoderOptions());
-	for (int j = 0; j < height; j++) {
-		output.writeRow(buffer + 3 * j * width);
-	}
+	output.writeRows(buffer, height, 3 * width);
 	output.finish();
 	delete[] buffer;
 }
 
 void FaceDiagramCommand::makeFaceDiagramAnalytic(const std::string & outputPath, int width) {
 	int height = width / 2;
-	float pi4 = M_PI / 4;
 	uint8_t buffer[width * 3];
 	uint32_t color;
 	OutputImage output(outputPath, width, height, Metadata(), EncoderOptions());
@@ -125,32 +123,8 @@ void FaceDiagramCommand::makeFaceDiagramAnalytic(const std::string & outputPath,
 		for (int u = 0; u < width; u++) {
 			float theta = u * M_PI / (height - 1) - M_PI;
 			float phi = M_PI_2 - v * M_PI / (height - 1);
-			float evenThreshold = 1 / sqrt(pow(tan(theta), 2) + 1);
-			float oddThreshold = 1 / sqrt(pow(tan(theta), -2) + 1);
-			float tanPhi = tan(phi);
-			int face;
-
-			if (fabs(theta) < pi4 || fabs(theta) >= 3 * pi4) {
-				if (tanPhi >= evenThreshold) {
-					face = 4;
-				} else if (tanPhi < -evenThreshold) {
-					face = 5;
-				} else if (fabs(theta) < pi4) {
-					face = 2;
-				} else {
-					face = 0;
-				}
-			} else {
-				if (tanPhi >= oddThreshold) {
-					face = 4;
-				} else if (tanPhi < -oddThreshold) {
-					face = 5;
-				} else if (theta < 0) {
-					face = 1;
-				} else {
-					face = 3;
-				}
-			}
+			float a, b;
+			int face = FaceInfo::sphereToFace(theta, phi, a, b);
 			if (face==0) {
 				// Red
 				color = 0xff0000;
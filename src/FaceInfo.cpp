@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <vector>
 #include "FaceInfo.h"
 
 namespace PanoProjector::FaceInfo {
@@ -11,6 +13,11 @@ static CropRect g_cropRects[6] = {
 	{ 0, 1, 0.6959132760153 /* 1 - atan(sqrt(2)) / pi */, 1 }
 };
 
+/** The normal of each face, which is the invariant coordinate as set by setInvariant() */
+static const float g_normals[6][3] = {
+	{-1, 0, 0}, {0, -1, 0}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, -1}
+};
+
 static std::string g_letters[6] = {
 	"b", "l", "f", "r", "u", "d"
 };
@@ -31,10 +38,361 @@ int getFaceFromName(const std::string & name) {
 	return -1;
 }
 
+/**
+ * Set a and b from the cartesian coordinates of a point which is in front of
+ * the plane of the given face, with the invariant coordinate being d.
+ */
+template <typename T>
+static inline void cartesianToFace(int face, T x, T y, T z, T d, T & a, T & b) {
+	switch (face) {
+		case 0: a = -y / d; b = -z / d; break;
+		case 1: a = x / d;  b = -z / d; break;
+		case 2: a = y / d;  b = -z / d; break;
+		case 3: a = -x / d; b = -z / d; break;
+		case 4: a = y / d;  b = x / d;  break;
+		case 5: a = y / d;  b = -x / d; break;
+	}
+}
+
+int sphereToFace(float theta, float phi, float & a, float & b) {
+	return directionToFace(cosf(phi) * cosf(theta), cosf(phi) * sinf(theta), sinf(phi), a, b);
+}
+
+int directionToFace(float x, float y, float z, float & a, float & b) {
+	// The face is given by the coordinate with the largest magnitude
+	float ax = fabsf(x), ay = fabsf(y), az = fabsf(z);
+	int face;
+	float d;
+
+	if (az >= ax && az >= ay) {
+		face = z > 0 ? 4 : 5;
+		d = az;
+	} else if (ax >= ay) {
+		face = x < 0 ? 0 : 2;
+		d = ax;
+	} else {
+		face = y < 0 ? 1 : 3;
+		d = ay;
+	}
+	cartesianToFace(face, x, y, z, d, a, b);
+	return face;
+}
+
+bool sphereToFacePlane(int face, float theta, float phi, float & a, float & b) {
+	float x = cosf(phi) * cosf(theta);
+	float y = cosf(phi) * sinf(theta);
+	float z = sinf(phi);
+	float d = x * g_normals[face][0] + y * g_normals[face][1] + z * g_normals[face][2];
+	if (d <= 0) {
+		return false;
+	}
+	cartesianToFace(face, x, y, z, d, a, b);
+	return true;
+}
+
+template <int face>
+static void faceToCartesianTpl(float a, float b, double & x, double & y, double & z) {
+	float fx = 0, fy = 0, fz = 0;
+	setInvariant<face>(fx, fy, fz);
+	setMajor<face>(fx, fy, fz, b);
+	setMinor<face>(fx, fy, fz, a);
+	x = fx;
+	y = fy;
+	z = fz;
+}
+
+/**
+ * Get the cartesian coordinates of a point on a cube face, as in
+ * extractFace()
+ */
+static void faceToCartesian(int face, float a, float b, double & x, double & y, double & z) {
+	switch (face) {
+		case 0: faceToCartesianTpl<0>(a, b, x, y, z); break;
+		case 1: faceToCartesianTpl<1>(a, b, x, y, z); break;
+		case 2: faceToCartesianTpl<2>(a, b, x, y, z); break;
+		case 3: faceToCartesianTpl<3>(a, b, x, y, z); break;
+		case 4: faceToCartesianTpl<4>(a, b, x, y, z); break;
+		case 5: faceToCartesianTpl<5>(a, b, x, y, z); break;
+	}
+}
+
+/**
+ * Get the Euler angles of a point on a cube face, as in extractFace()
+ */
+static void faceToSphere(int face, float a, float b, double & theta, double & phi) {
+	double x = 0, y = 0, z = 0;
+	faceToCartesian(face, a, b, x, y, z);
+	theta = atan2(y, x);
+	phi = atan2(z, hypot(x, y));
+}
+
+/**
+ * Offset a crop rectangle by a fraction of the image width, wrapping it
+ * around the seam, for a rotation about the vertical axis
+ */
+static CropRect shiftCropRect(CropRect rect, double shift) {
+	if (shift == 0 || (rect.left == 0 && rect.right == 1)) {
+		return rect;
+	}
+	rect.left += shift;
+	rect.right += shift;
+	if (rect.left >= 1) {
+		rect.left -= 1;
+	}
+	if (rect.right > 1) {
+		rect.right -= 1;
+	}
+	return rect;
+}
+
+/**
+ * A bound on the error of the rotated cube point computed by extractFace()
+ * in single precision, relative to its length
+ */
+static const double ROTATION_ERROR = 2e-6;
+
+/**
+ * Get the crop rectangle of a region of a face under a general rotation.
+ *
+ * Latitude has no extremum on the sphere except at the poles, so if the
+ * region doesn't contain a pole, its latitude range is that of its edges.
+ * Each edge is a great circle arc, whose latitude is extremal either at its
+ * ends or at the point closest to a pole. Longitude is monotonic along a
+ * great circle arc which doesn't pass through a pole, so the longitude range
+ * of the region is that of its corners, following the edges around.
+ */
+static CropRect getRotatedRegionCropRect(int face, double a0, double a1,
+	double b0, double b1, double angleError, const Rotation & rotation
+) {
+	// The corners in order around the region, rotated and normalized
+	double corners[4][3];
+	const double cornerAB[4][2] = {{a0, b0}, {a1, b0}, {a1, b1}, {a0, b1}};
+	for (int k = 0; k < 4; k++) {
+		double * p = corners[k];
+		faceToCartesian(face, cornerAB[k][0], cornerAB[k][1], p[0], p[1], p[2]);
+		rotation.rotate(p[0], p[1], p[2]);
+		double length = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		for (int c = 0; c < 3; c++) {
+			p[c] /= length;
+		}
+	}
+
+	// Whether each pole projects into the region. The test is slightly
+	// inclusive, since a pole on an edge needs the full longitude range too.
+	const double epsilon = 1e-9;
+	auto containsPole = [&] (double sign) {
+		double x = 0, y = 0, z = sign;
+		rotation.unrotate(x, y, z);
+		double d = x * g_normals[face][0] + y * g_normals[face][1] + z * g_normals[face][2];
+		if (d <= 0) {
+			return false;
+		}
+		double a = 0, b = 0;
+		cartesianToFace(face, x, y, z, d, a, b);
+		return a >= a0 - epsilon && a <= a1 + epsilon
+			&& b >= b0 - epsilon && b <= b1 + epsilon;
+	};
+	bool north = containsPole(1);
+	bool south = containsPole(-1);
+
+	double minPhi = M_PI_2, maxPhi = -M_PI_2;
+	for (int k = 0; k < 4; k++) {
+		const double * p = corners[k];
+		const double * q = corners[(k + 1) % 4];
+		double phi = asin(std::clamp(p[2], -1.0, 1.0));
+		minPhi = std::min(minPhi, phi);
+		maxPhi = std::max(maxPhi, phi);
+
+		// The normal of the great circle through the edge
+		double n[3] = {
+			p[1] * q[2] - p[2] * q[1],
+			p[2] * q[0] - p[0] * q[2],
+			p[0] * q[1] - p[1] * q[0]
+		};
+		double nLength = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		for (int c = 0; c < 3; c++) {
+			n[c] /= nLength;
+		}
+		// The highest point of the great circle is the projection of the
+		// north pole onto its plane, unless the circle is the equator
+		double m[3] = {-n[0] * n[2], -n[1] * n[2], 1 - n[2] * n[2]};
+		if (m[2] <= 0) {
+			continue;
+		}
+		// A point m is on the arc from p to q if p×m and m×q are both in the
+		// direction of the normal p×q. The lowest point is -m.
+		double pm = (p[1] * m[2] - p[2] * m[1]) * n[0]
+			+ (p[2] * m[0] - p[0] * m[2]) * n[1]
+			+ (p[0] * m[1] - p[1] * m[0]) * n[2];
+		double mq = (m[1] * q[2] - m[2] * q[1]) * n[0]
+			+ (m[2] * q[0] - m[0] * q[2]) * n[1]
+			+ (m[0] * q[1] - m[1] * q[0]) * n[2];
+		double extremePhi = acos(std::min(std::fabs(n[2]), 1.0));
+		if (pm >= 0 && mq >= 0) {
+			maxPhi = std::max(maxPhi, extremePhi);
+		} else if (pm <= 0 && mq <= 0) {
+			minPhi = std::min(minPhi, -extremePhi);
+		}
+	}
+	if (north) {
+		maxPhi = M_PI_2;
+	}
+	if (south) {
+		minPhi = -M_PI_2;
+	}
+
+	// The error in the single precision latitude is small, but the error in
+	// the longitude is inversely proportional to the distance from the axis
+	const double marginV = 1e-5 + (angleError + ROTATION_ERROR) / M_PI;
+	const double axisDistance = cos(std::max(std::fabs(minPhi), std::fabs(maxPhi)));
+	const double marginU = 1e-5
+		+ (angleError + ROTATION_ERROR / axisDistance) / (2 * M_PI);
+
+	CropRect rect{};
+	rect.left = 0;
+	rect.right = 1;
+	if (!north && !south) {
+		// Follow the edges around, taking the shorter way between the
+		// longitudes of adjacent corners, since each edge is shorter than a
+		// half circle
+		double theta = atan2(corners[0][1], corners[0][0]);
+		double start = theta, end = theta;
+		for (int k = 1; k < 4; k++) {
+			double next = atan2(corners[k][1], corners[k][0]);
+			theta += remainder(next - theta, 2 * M_PI);
+			start = std::min(start, theta);
+			end = std::max(end, theta);
+		}
+		double width = (end - start) / (2 * M_PI) + 2 * marginU;
+		if (width < 1) {
+			rect.left = (start + M_PI) / (2 * M_PI) - marginU;
+			rect.right = (end + M_PI) / (2 * M_PI) + marginU;
+			// Wrap into 0≤left<1 and 0<right≤1, so that left > right if the
+			// rectangle crosses the seam
+			rect.left -= floor(rect.left);
+			rect.right -= ceil(rect.right) - 1;
+		}
+	}
+	rect.top = std::max((M_PI_2 - maxPhi) / M_PI - marginV, 0.0);
+	rect.bottom = std::min((M_PI_2 - minPhi) / M_PI + marginV, 1.0);
+	return rect;
+}
+
+CropRect getRegionCropRect(int face, double a0, double a1, double b0, double b1,
+	int samples, double angleError, const Rotation & rotation
+) {
+	if (!rotation.isYawOnly()) {
+		return getRotatedRegionCropRect(face, a0, a1, b0, b1, angleError, rotation);
+	}
+
+	const int n = samples;
+	// The margins in units of the image width and height. With 256 samples,
+	// the deviation of an edge from a straight line between samples is much
+	// smaller than 1e-5.
+	const double marginU = 1e-5 + angleError / (2 * M_PI);
+	const double marginV = 1e-5 + angleError / M_PI;
+
+	std::vector<double> thetas;
+	thetas.reserve(4 * (n + 1));
+	double minPhi = M_PI_2, maxPhi = -M_PI_2;
+	auto addPoint = [&] (double a, double b) {
+		double theta = 0, phi = 0;
+		faceToSphere(face, a, b, theta, phi);
+		thetas.push_back(theta);
+		minPhi = std::min(minPhi, phi);
+		maxPhi = std::max(maxPhi, phi);
+	};
+	for (int k = 0; k <= n; k++) {
+		double a = a0 + (a1 - a0) * k / n;
+		double b = b0 + (b1 - b0) * k / n;
+		addPoint(a, b0);
+		addPoint(a, b1);
+		addPoint(a0, b);
+		addPoint(a1, b);
+	}
+
+	CropRect rect{};
+
+	// If the region contains a pole, it covers all longitudes
+	if ((face == 4 || face == 5) && a0 <= 0 && a1 >= 0 && b0 <= 0 && b1 >= 0) {
+		if (face == 4) {
+			maxPhi = M_PI_2;
+		} else {
+			minPhi = -M_PI_2;
+		}
+		rect.left = 0;
+		rect.right = 1;
+	} else {
+		// Otherwise the longitudes of the edges span an arc, which is the
+		// complement of the largest gap between them
+		std::sort(thetas.begin(), thetas.end());
+		double maxGap = thetas.front() + 2 * M_PI - thetas.back();
+		double start = thetas.front(), end = thetas.back();
+		for (size_t k = 1; k < thetas.size(); k++) {
+			double gap = thetas[k] - thetas[k - 1];
+			if (gap > maxGap) {
+				maxGap = gap;
+				start = thetas[k];
+				end = thetas[k - 1];
+			}
+		}
+		// A point on the ±180° seam may be mapped to either edge of the
+		// image, so the margin is allowed to wrap around the seam.
+		double width = (2 * M_PI - maxGap) / (2 * M_PI) + 2 * marginU;
+		if (width >= 1) {
+			rect.left = 0;
+			rect.right = 1;
+		} else {
+			rect.left = (start + M_PI) / (2 * M_PI) - marginU;
+			rect.right = (end + M_PI) / (2 * M_PI) + marginU;
+			if (rect.left < 0) {
+				rect.left += 1;
+			}
+			if (rect.right > 1) {
+				rect.right -= 1;
+			}
+		}
+	}
+	rect.top = std::max((M_PI_2 - maxPhi) / M_PI - marginV, 0.0);
+	rect.bottom = std::min((M_PI_2 - minPhi) / M_PI + marginV, 1.0);
+	return shiftCropRect(rect, rotation.getYaw() / (2 * M_PI));
+}
+
+CropRect getViewCropRect(double scaleA, double scaleB, double angleError,
+	const Rotation & rotation
+) {
+	return getRotatedRegionCropRect(2, -scaleA, scaleA, -scaleB, scaleB,
+		angleError, rotation);
+}
+
 const CropRect & getCropRect(int face) {
 	return g_cropRects[face];
 }
 
+CropRect getCropRect(int face, double angleError, const Rotation & rotation) {
+	if (!rotation.isYawOnly()) {
+		return getRotatedRegionCropRect(face, -1, 1, -1, 1, angleError, rotation);
+	}
+	CropRect rect = g_cropRects[face];
+	double marginU = angleError / (2 * M_PI);
+	double marginV = angleError / M_PI;
+	// The top and bottom faces cover all longitudes. The back face wraps
+	// around the seam, with left > right.
+	if (rect.left != 0 || rect.right != 1) {
+		rect.left -= marginU;
+		rect.right += marginU;
+		if (rect.left < 0) {
+			rect.left += 1;
+		}
+		if (rect.right > 1) {
+			rect.right -= 1;
+		}
+	}
+	rect.top = std::max(rect.top - marginV, 0.0);
+	rect.bottom = std::min(rect.bottom + marginV, 1.0);
+	return shiftCropRect(rect, rotation.getYaw() / (2 * M_PI));
+}
+
 const std::string & getLetter(int face) {
 	return g_letters[face];
 }
@@ -3,6 +3,7 @@
 #include <cmath>
 #include <string>
 #include "CropRect.h"
+#include "Rotation.h"
 
 /**
  * Functions giving information about cube faces
@@ -44,6 +45,40 @@ static inline void reflectTheta(float & theta);
  */
 const CropRect & getCropRect(int face);
 
+/**
+ * Get the crop rectangle for the given cube face, widened to allow for an
+ * error in the computed longitude and latitude of up to the given angle in
+ * radians, with the cube rotated relative to the source image.
+ */
+CropRect getCropRect(int face, double angleError,
+	const Rotation & rotation = Rotation());
+
+/**
+ * Get the bounding equirectangular image rectangle scaled to 0≤u<1 for a
+ * rectangular region of a cube face. The region is given in cube face image
+ * coordinates scaled to -1≤a≤1 and -1≤b≤1, with a0≤a1 and b0≤b1. The
+ * rectangle is found by sampling the edges of the region, with a small margin
+ * to allow for curvature between the samples. With fewer samples, the result
+ * is cheaper but is only an estimate, and may be smaller than the true bounds.
+ * The margin is widened by the angle error in radians, as for getCropRect().
+ *
+ * If the rotation is about the vertical axis only, the unrotated rectangle is
+ * offset by the yaw. Otherwise, the rectangle is computed exactly from the
+ * great circle arcs which the edges project to, and the number of samples is
+ * ignored.
+ */
+CropRect getRegionCropRect(int face, double a0, double a1, double b0, double b1,
+	int samples = 256, double angleError = 0,
+	const Rotation & rotation = Rotation());
+
+/**
+ * Get the crop rectangle for a view rendered by extractView(), which is the
+ * region -scaleA≤a≤scaleA, -scaleB≤b≤scaleB of the plane of the front face,
+ * computed exactly for any rotation
+ */
+CropRect getViewCropRect(double scaleA, double scaleB, double angleError,
+	const Rotation & rotation);
+
 /**
  * Get the letter used by Pannellum to identify the specified cube face. The
  * top and bottom cube faces become (u)p and (d)own to avoid conflicting with
@@ -62,6 +97,27 @@ const std::string & getName(int face);
  */
 int getFaceFromName(const std::string & name);
 
+/**
+ * Given the Euler angles of a point on the sphere, using the same conventions
+ * as extractFace(), determine which cube face the point projects to. Set a
+ * and b to the horizontal and vertical cube face image coordinates, scaled to
+ * |a|≤1 and |b|≤1. This is the inverse of setMinor() and setMajor().
+ */
+int sphereToFace(float theta, float phi, float & a, float & b);
+
+/**
+ * The equivalent of sphereToFace() for a direction given in cartesian
+ * coordinates, which need not be normalized
+ */
+int directionToFace(float x, float y, float z, float & a, float & b);
+
+/**
+ * Project a point on the sphere onto the plane of the given cube face, setting
+ * a and b to the cube face image coordinates, which may be outside the face.
+ * If the point is behind the plane and so has no projection, return false.
+ */
+bool sphereToFacePlane(int face, float theta, float phi, float & a, float & b);
+
 // These functions give a warning about being unused when the header is included
 // into a file that doesn't use them. It's apparently a GCC bug.
 // inline static functions have the unused warning suppressed, but when they are
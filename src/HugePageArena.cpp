@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <new>
+#include <sys/mman.h>
+#include "HugePageArena.h"
+
+namespace PanoProjector {
+
+HugePageArena g_hugePageArena;
+
+HugePageArena::HugePageArena()
+	: m_enabled(true), m_measured(false), m_explicitBytes(0), m_advisedBytes(0),
+	m_transparentBytes(0), m_heapBytes(0), m_cacheSize(0), m_reusedCount(0)
+{}
+
+void HugePageArena::setCacheSize(int numMappings) {
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_cacheSize = (size_t)std::max(numMappings, 0);
+	while (m_cache.size() > m_cacheSize) {
+		unmap(m_cache.front().ptr, m_cache.front().mapSize);
+		m_cache.erase(m_cache.begin());
+	}
+}
+
+void HugePageArena::clearCache() noexcept {
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	for (auto & mapping : m_cache) {
+		unmap(mapping.ptr, mapping.mapSize);
+	}
+	m_cache.clear();
+}
+
+size_t HugePageArena::getMappingSize(size_t size) {
+	return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+bool HugePageArena::useHeap(size_t size) const {
+	return size < HUGE_PAGE_SIZE || !m_enabled;
+}
+
+void * HugePageArena::allocate(size_t size) {
+	if (useHeap(size)) {
+		m_heapBytes += size;
+		return new uint8_t[size];
+	}
+	size_t mapSize = getMappingSize(size);
+
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		for (auto it = m_cache.begin(); it != m_cache.end(); ++it) {
+			if (it->mapSize == mapSize) {
+				void * ptr = it->ptr;
+				m_cache.erase(it);
+				m_reusedCount++;
+				return ptr;
+			}
+		}
+	}
+
+#ifdef MAP_HUGETLB
+	// This fails immediately if the pool doesn't have enough free pages
+	void * hugePtr = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (hugePtr != MAP_FAILED) {
+		m_explicitBytes += mapSize;
+		return hugePtr;
+	}
+#endif
+
+	// Map an extra huge page so that the start can be aligned, then unmap
+	// the excess at each end
+	void * ptr = mmap(nullptr, mapSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+	uintptr_t start = (uintptr_t)ptr;
+	uintptr_t alignedStart = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+	if (alignedStart > start) {
+		munmap(ptr, alignedStart - start);
+	}
+	size_t tail = start + HUGE_PAGE_SIZE - alignedStart;
+	if (tail) {
+		munmap((void*)(alignedStart + mapSize), tail);
+	}
+	ptr = (void*)alignedStart;
+
+#ifdef MADV_HUGEPAGE
+	if (madvise(ptr, mapSize, MADV_HUGEPAGE) == 0) {
+		m_advisedBytes += mapSize;
+	}
+#endif
+	return ptr;
+}
+
+void HugePageArena::deallocate(void * ptr, size_t size) noexcept {
+	if (!ptr) {
+		return;
+	}
+	if (useHeap(size)) {
+		delete[] (uint8_t*)ptr;
+		return;
+	}
+	size_t mapSize = getMappingSize(size);
+	{
+		// Replace the oldest cached mapping, since the sizes of recent
+		// allocations are the most likely to be repeated
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		if (m_cacheSize > 0) {
+			if (m_cache.size() >= m_cacheSize) {
+				unmap(m_cache.front().ptr, m_cache.front().mapSize);
+				m_cache.erase(m_cache.begin());
+			}
+			m_cache.push_back({ptr, mapSize});
+			return;
+		}
+	}
+	unmap(ptr, mapSize);
+}
+
+void HugePageArena::unmap(void * ptr, size_t mapSize) noexcept {
+	if (m_measured) {
+		m_transparentBytes += std::min((unsigned long)mapSize, getTransparentHugeBytes(ptr));
+	}
+	munmap(ptr, mapSize);
+}
+
+unsigned long HugePageArena::getTransparentHugeBytes(void * ptr) {
+	FILE * f = fopen("/proc/self/smaps", "r");
+	if (!f) {
+		return 0;
+	}
+	// Find the mapping which contains the pointer, and read its
+	// AnonHugePages field
+	uintptr_t addr = (uintptr_t)ptr;
+	bool found = false;
+	unsigned long kib = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		uintptr_t start, end;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			if (found) {
+				break;
+			}
+			found = addr >= start && addr < end;
+		} else if (found && sscanf(line, "AnonHugePages: %lu kB", &kib) == 1) {
+			break;
+		}
+	}
+	fclose(f);
+	return found ? kib * 1024 : 0;
+}
+
+void HugePageArena::report(std::ostream & out) const {
+	auto mib = [] (unsigned long bytes) {
+		return bytes / 1048576.0;
+	};
+	out << std::fixed << std::setprecision(1)
+		<< "Huge pages (MiB allocated): "
+		<< "explicit " << mib(m_explicitBytes)
+		<< ", transparent " << mib(m_transparentBytes)
+		<< " of " << mib(m_advisedBytes) << " advised"
+		<< ", heap " << mib(m_heapBytes);
+	if (m_reusedCount) {
+		out << ", reused mappings " << m_reusedCount;
+	}
+	out << "\n";
+}
+
+} // namespace
@@ -0,0 +1,120 @@
+#ifndef PANO_HUGEPAGEARENA_H
+#define PANO_HUGEPAGEARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace PanoProjector {
+
+/**
+ * An allocator for large buffers, such as the decoded input image, which are
+ * backed by 2 MiB huge pages where possible.
+ *
+ * Bilinear sampling of the input strides across rows, especially on the
+ * polar faces, so with 4 KiB pages it misses the TLB on most accesses. Each
+ * allocation is a separate anonymous mapping. Explicit huge pages from the
+ * hugetlbfs pool are tried first, then a 2 MiB aligned mapping with
+ * madvise(MADV_HUGEPAGE) so that transparent huge pages can be used. Small
+ * allocations, and allocations when the arena is disabled, use the heap.
+ *
+ * The counters show how much memory was actually backed by huge pages. For
+ * transparent huge pages this is measured from /proc/self/smaps when the
+ * buffer is unmapped, if enabled with setMeasured(), since reading smaps
+ * costs more than the unmapping.
+ *
+ * When processing many images of the same size, freed mappings can be kept
+ * for reuse, which saves the cost of mapping and zeroing the pages again.
+ */
+class HugePageArena {
+public:
+	/** The huge page size */
+	enum { HUGE_PAGE_SIZE = 2 * 1024 * 1024 };
+
+	HugePageArena();
+
+	/**
+	 * Enable or disable huge pages. If disabled, all allocations use the heap.
+	 * This must not be changed while any buffer is allocated, since it
+	 * determines how the buffer is freed.
+	 */
+	void setEnabled(bool enabled) { m_enabled = enabled; }
+
+	/**
+	 * Enable or disable measuring the transparent huge pages of each mapping
+	 * when it is unmapped, for report(). The default is disabled.
+	 */
+	void setMeasured(bool measured) { m_measured = measured; }
+
+	/**
+	 * Set the maximum number of freed mappings to keep for reuse by an
+	 * allocation of the same size. The default is zero.
+	 */
+	void setCacheSize(int numMappings);
+
+	/**
+	 * Allocate a buffer. Throw std::bad_alloc on failure.
+	 */
+	void * allocate(size_t size);
+
+	/**
+	 * Free a buffer. The size must be the same as was passed to allocate().
+	 */
+	void deallocate(void * ptr, size_t size) noexcept;
+
+	/** Unmap the cached mappings */
+	void clearCache() noexcept;
+
+	/**
+	 * Write the counters
+	 */
+	void report(std::ostream & out) const;
+
+private:
+	/** Get the size of a mapping, rounded up to a whole number of huge pages */
+	static size_t getMappingSize(size_t size);
+
+	/**
+	 * Get the number of bytes in transparent huge pages within the mapping
+	 * starting at the given address
+	 */
+	static unsigned long getTransparentHugeBytes(void * ptr);
+
+	/** Whether a buffer of the given size is allocated from the heap */
+	bool useHeap(size_t size) const;
+
+	/** Unmap a mapping, measuring its transparent huge pages if enabled */
+	void unmap(void * ptr, size_t mapSize) noexcept;
+
+
+	std::atomic<bool> m_enabled;
+	std::atomic<bool> m_measured;
+	/** Allocated bytes in explicit huge pages */
+	std::atomic<unsigned long> m_explicitBytes;
+	/** Allocated bytes in mappings advised to use transparent huge pages */
+	std::atomic<unsigned long> m_advisedBytes;
+	/** Bytes which were found to be in transparent huge pages when freed */
+	std::atomic<unsigned long> m_transparentBytes;
+	/** Allocated bytes from the heap */
+	std::atomic<unsigned long> m_heapBytes;
+
+	struct CachedMapping {
+		void * ptr;
+		size_t mapSize;
+	};
+
+	/** Protects m_cache */
+	std::mutex m_cacheMutex;
+	std::vector<CachedMapping> m_cache;
+	size_t m_cacheSize;
+	/** The number of allocations which reused a cached mapping */
+	std::atomic<unsigned long> m_reusedCount;
+};
+
+extern HugePageArena g_hugePageArena;
+
+} // namespace
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef PANO_IMAGEPLANE_H
+#define PANO_IMAGEPLANE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "Coverage.h"
+#include "CropRect.h"
+#include "IntegerCropRect.h"
+#include "Isa.h"
+
+namespace PanoProjector {
+
+/**
+ * A plane of an image decoded to separate luma and chroma planes, as read
+ * by InputYcc. Each sample has the given number of interleaved channels:
+ * one for luma, or two for Cb and Cr.
+ *
+ * A chroma plane may be subsampled. Its width, height and coverage are
+ * still those of the image, and the coordinates passed to interpolate() are
+ * in units of image pixels, so that the sampling kernels can treat it as an
+ * InputImage. They are converted to plane coordinates with the centred
+ * chroma positions of JFIF, and clamped to the plane, so the seam and the
+ * poles are sampled slightly inside the edge.
+ *
+ * The memory is managed by the owner, and the crop works as for InputImage,
+ * in plane coordinates.
+ */
+template <int channels>
+class ImagePlane {
+public:
+	enum { CHANNELS = channels };
+
+	ImagePlane()
+		: m_data(nullptr), m_width(0), m_height(0), m_planeWidth(0), m_planeHeight(0),
+		m_xFactor(1), m_yFactor(1), m_maxX(0), m_maxY(0), m_fill()
+	{}
+
+	/**
+	 * Set the size of an image and the subsampling factors of the plane, and
+	 * the crop rectangle in image coordinates scaled to 0≤u≤1 and 0≤v≤1.
+	 */
+	void setSize(int width, int height, int xFactor, int yFactor, const CropRect & cropRect) {
+		m_width = width;
+		m_height = height;
+		m_xFactor = xFactor;
+		m_yFactor = yFactor;
+		m_planeWidth = (width + xFactor - 1) / xFactor;
+		m_planeHeight = (height + yFactor - 1) / yFactor;
+		m_maxX = nextafterf((float)(m_planeWidth - 1), 0.0f);
+		m_maxY = nextafterf((float)(m_planeHeight - 1), 0.0f);
+		m_crop = IntegerCropRect(cropRect, m_planeWidth, m_planeHeight);
+	}
+
+	/** Set the buffer, which must hold getDataSize() bytes */
+	void setData(uint8_t * data) {
+		m_data = data;
+	}
+
+	/** Get the size of the buffer for the crop in bytes */
+	size_t getDataSize() const {
+		return (size_t)CHANNELS * m_crop.width * m_crop.height;
+	}
+
+	/** Get the image width */
+	int getWidth() const {
+		return m_width;
+	}
+
+	/** Get the image height */
+	int getHeight() const {
+		return m_height;
+	}
+
+	/** Get the width of the plane, which is less if it is subsampled */
+	int getPlaneWidth() const {
+		return m_planeWidth;
+	}
+
+	/** Get the height of the plane */
+	int getPlaneHeight() const {
+		return m_planeHeight;
+	}
+
+	/** Get the crop rectangle in plane coordinates */
+	const IntegerCropRect & getCrop() const {
+		return m_crop;
+	}
+
+	/** Get the part of the sphere covered by the image */
+	const Coverage & getCoverage() const {
+		return m_coverage;
+	}
+
+	/**
+	 * Set the part of the sphere covered by the image, and the value of the
+	 * samples outside it in this plane
+	 */
+	void setCoverage(const Coverage & coverage, const uint8_t (&fill)[channels]) {
+		m_coverage = coverage;
+		std::copy(fill, fill + channels, m_fill);
+	}
+
+	/** Get the value of the samples outside the covered area */
+	const uint8_t * getFill() const {
+		return m_fill;
+	}
+
+	/** Get a pointer to a sample within the crop, in plane coordinates */
+	uint8_t * pixel(int col, int row) {
+		assert(row >= m_crop.top && row < m_crop.bottom);
+		int colOffset = col - m_crop.left;
+		if (colOffset < 0) {
+			colOffset += m_planeWidth;
+		}
+		assert(colOffset >= 0 && colOffset < m_crop.width);
+		return m_data + ((size_t)(row - m_crop.top) * m_crop.width + colOffset) * CHANNELS;
+	}
+
+	/** Whether a plane column is within the crop */
+	bool containsCol(int col) const {
+		return m_crop.wrap
+			? col >= m_crop.left || col < m_crop.right
+			: col >= m_crop.left && col < m_crop.right;
+	}
+
+	/** Whether a plane row is within the crop */
+	bool containsRow(int row) const {
+		return row >= m_crop.top && row < m_crop.bottom;
+	}
+
+	/**
+	 * Interpolate at the given image coordinates with fixed-point weights,
+	 * truncating as InputImage::interpolate() does
+	 */
+	PANO_KERNEL_INLINE void interpolate(uint8_t * dest, float x, float y) {
+		toPlane(x, y);
+		int x0 = static_cast<int>(floorf(x));
+		int y0 = static_cast<int>(floorf(y));
+		int scale = 256;
+		int mu = scale * (x - x0);
+		int nu = scale * (y - y0);
+		int munu = scale * (x - x0) * (y - y0);
+
+		uint8_t
+			*f00 = pixel(x0, y0),
+			*f01 = pixel(x0, y0 + 1),
+			*f10 = pixel(x0 + 1, y0),
+			*f11 = pixel(x0 + 1, y0 + 1);
+
+		for (int c = 0; c < CHANNELS; c++) {
+			int v =
+				scale * f00[c]
+					+ mu * (f10[c] - f00[c])
+					+ nu * (f01[c] - f00[c])
+					+ munu * (f11[c] - f10[c] - f01[c] + f00[c]);
+			dest[c] = static_cast<uint8_t>(v / scale);
+		}
+	}
+
+	/** Interpolate in floating point, rounding as InputImage::interpolateFloat() does */
+	PANO_KERNEL_INLINE void interpolateFloat(uint8_t * dest, float x, float y) {
+		toPlane(x, y);
+		int x0 = static_cast<int>(floorf(x));
+		int y0 = static_cast<int>(floorf(y));
+		float mu = x - x0, nu = y - y0, munu = mu * nu;
+
+		uint8_t
+			*f00 = pixel(x0, y0),
+			*f01 = pixel(x0, y0 + 1),
+			*f10 = pixel(x0 + 1, y0),
+			*f11 = pixel(x0 + 1, y0 + 1);
+
+		for (int c = 0; c < CHANNELS; c++) {
+			float v = f00[c];
+			v += (f10[c] - f00[c]) * mu;
+			v += (f01[c] - f00[c]) * nu;
+			v += (f11[c] - f10[c] - f01[c] + f00[c]) * munu;
+			dest[c] = static_cast<uint8_t>(v + 0.5f);
+		}
+	}
+
+private:
+	/** Convert image coordinates to plane coordinates */
+	PANO_KERNEL_INLINE void toPlane(float & x, float & y) const {
+		if (m_xFactor != 1) {
+			x = std::clamp((x + 0.5f) / m_xFactor - 0.5f, 0.0f, m_maxX);
+		}
+		if (m_yFactor != 1) {
+			y = std::clamp((y + 0.5f) / m_yFactor - 0.5f, 0.0f, m_maxY);
+		}
+	}
+
+	uint8_t * m_data;
+	int m_width, m_height;
+	int m_planeWidth, m_planeHeight;
+	int m_xFactor, m_yFactor;
+
+	/** The largest plane coordinates, just inside the last sample */
+	float m_maxX, m_maxY;
+
+	IntegerCropRect m_crop;
+	Coverage m_coverage;
+	uint8_t m_fill[channels];
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,13 @@
+#include "InputBlank.h"
+
+namespace PanoProjector {
+
+InputBlank::InputBlank(int width, int height) {
+	// The crop rectangle is left empty
+	m_width = width;
+	m_height = height;
+}
+
+InputBlank::~InputBlank() {}
+
+} // namespace
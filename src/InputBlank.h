@@ -0,0 +1,22 @@
+#ifndef PANO_INPUTBLANK_H
+#define PANO_INPUTBLANK_H
+
+#include "InputImage.h"
+
+namespace PanoProjector {
+
+/**
+ * An input image with no decoded data, for a crop rectangle which lies
+ * entirely outside the area covered by a partial panorama. Every sample is
+ * then filled with the coverage fill colour, so the data is never read.
+ */
+class InputBlank : public InputImage {
+public:
+	InputBlank(int width, int height);
+
+	~InputBlank() override;
+};
+
+} // namespace
+
+#endif
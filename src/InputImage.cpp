@@ -1,4 +1,5 @@
 #include "InputImage.h"
+#include "HugePageArena.h"
 #include "MemoryBudget.h"
 
 #include <stdexcept>
@@ -7,9 +8,38 @@
 namespace PanoProjector {
 
 InputImage::InputImage()
-	: m_data(nullptr), m_width(0), m_height(0)
+	: m_data(nullptr), m_width(0), m_height(0), m_cropAllocated(false)
 {}
 
-InputImage::~InputImage() {}
+InputImage::~InputImage() {
+	releaseCrop();
+}
+
+void InputImage::allocateCrop() {
+	g_memBudget.reserve(MemoryCategory::InputCrop, COMPONENTS, m_crop.width, m_crop.height);
+	try {
+		m_data = (uint8_t*)g_hugePageArena.allocate(getDataSize());
+	} catch (...) {
+		g_memBudget.release(MemoryCategory::InputCrop, COMPONENTS, m_crop.width, m_crop.height);
+		throw;
+	}
+	m_cropAllocated = true;
+}
+
+void InputImage::releaseCrop() {
+	if (m_cropAllocated) {
+		g_hugePageArena.deallocate(m_data, getDataSize());
+		g_memBudget.release(MemoryCategory::InputCrop, COMPONENTS, m_crop.width, m_crop.height);
+		m_data = nullptr;
+		m_cropAllocated = false;
+	}
+}
+
+void InputImage::writeTo(OutputBase & output) {
+	if (m_crop.wrap || m_crop.width != m_width || m_crop.height != m_height) {
+		throw std::runtime_error("The whole input image must be decoded to write it to an output");
+	}
+	output.writeRows(m_data, m_height, (size_t)m_width * COMPONENTS);
+}
 
 } // namespace
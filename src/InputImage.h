@@ -7,24 +7,71 @@
 #include <jerror.h>
 #include <cassert>
 #include <cmath>
+#include "Coverage.h"
 #include "CropRect.h"
+#include "Isa.h"
 #include "IntegerCropRect.h"
 #include "Metadata.h"
+#include "OutputBase.h"
 
 namespace PanoProjector {
 
+/**
+ * Information about an input image which can be found without decoding it
+ */
+struct InputInfo {
+	/** The image width */
+	int width = 0;
+
+	/** The image height */
+	int height = 0;
+
+	/**
+	 * The number of bytes per pixel of decoder working memory which will be
+	 * needed in addition to the crop buffer, for example for progressive JPEG
+	 * coefficients
+	 */
+	int extraBytesPerPixel = 0;
+
+	/**
+	 * The number of bytes of decoder working memory needed regardless of
+	 * the crop size, for example for a TIFF tile
+	 */
+	unsigned long extraBytes = 0;
+
+	/**
+	 * The size of the blocks which the decoder can read independently, such
+	 * as TIFF tiles or strips. If the block height is zero, the rows above
+	 * the crop are read, as for JPEG. If the block width is zero, all
+	 * columns of a row are read.
+	 */
+	int blockWidth = 0;
+	int blockHeight = 0;
+
+	/** Whether the decoder can scale the image down by 2, 4 or 8 */
+	bool scalable = false;
+
+	/** Metadata from the image file */
+	Metadata metadata;
+};
+
 /**
  * The input image base class.
  *
  * The buffer format is shared between subclasses. The methods to access it
  * are non-virtual. However, the memory is managed by the subclass, in case
- * codec libraries want to allocate their own memory.
+ * codec libraries want to allocate their own memory. A subclass which
+ * decodes into a buffer of its own can use allocateCrop(), which accounts
+ * for it in the memory budget, and which is freed on destruction.
  */
 class InputImage {
 protected:
 	InputImage();
 
 public:
+	/** The number of channels of each pixel, as for ImagePlane */
+	enum { CHANNELS = COMPONENTS };
+
 	InputImage(const InputImage & other) = delete;
 
 	virtual ~InputImage() = 0;
@@ -44,6 +91,28 @@ public:
 		return m_metadata;
 	}
 
+	/**
+	 * Get the part of the sphere covered by the image. This is the whole
+	 * sphere unless setCoverage() was called.
+	 */
+	const Coverage & getCoverage() const {
+		return m_coverage;
+	}
+
+	/**
+	 * Set the part of the sphere covered by the image, for a partial
+	 * panorama. The crop rectangle given to the constructor is then in the
+	 * coordinates of the image, as returned by Coverage::getImageCropRect().
+	 */
+	void setCoverage(const Coverage & coverage) {
+		m_coverage = coverage;
+	}
+
+	/** Get the colour of the samples outside the covered area */
+	const uint8_t * getFill() const {
+		return m_coverage.fill;
+	}
+
 	/**
 	 * Get the data of the given image row (scanline).
 	 *
@@ -53,7 +122,7 @@ public:
 	uint8_t * row(int row) {
 		assert(row >= m_crop.top);
 		assert(row < m_crop.bottom);
-		return m_data + (row - m_crop.top) * m_crop.width * COMPONENTS;
+		return m_data + (size_t)(row - m_crop.top) * m_crop.width * COMPONENTS;
 	}
 
 	/**
@@ -68,9 +137,15 @@ public:
 		if (colOffset < 0) {
 			colOffset += m_width;
 		}
-		return m_data + ((row - m_crop.top) * m_crop.width + colOffset) * COMPONENTS;
+		return m_data + ((size_t)(row - m_crop.top) * m_crop.width + colOffset) * COMPONENTS;
 	}
 
+	/**
+	 * Write the decoded image to an output of the same size. The crop
+	 * rectangle must be the whole image.
+	 */
+	void writeTo(OutputBase & output);
+
 	/**
 	 * Assert that the coordinates are within bounds.
 	 */
@@ -94,20 +169,55 @@ public:
 	 * The coordinates must be within the crop rectangle, otherwise it will
 	 * segfault or do some other undefined but probably undesired thing.
 	 */
-	inline void interpolate(uint8_t * dest, float x, float y);
+	PANO_KERNEL_INLINE void interpolate(uint8_t * dest, float x, float y);
+
+	/**
+	 * An alternative implementation of interpolate() in floating point.
+	 * Simple and low instruction count, but a little slower than the
+	 * fixed-point version. The result is rounded to nearest, whereas the
+	 * fixed-point version truncates the weights and the result, so this is
+	 * used for Precision::Exact.
+	 */
+	PANO_KERNEL_INLINE void interpolateFloat(uint8_t * dest, float x, float y);
+
+	/**
+	 * An alternative implementation of interpolate() using GCC vector
+	 * extensions. Complicated and no faster than the plain fixed-point
+	 * version.
+	 */
+	inline void interpolateVector(uint8_t * dest, float x, float y);
 
 protected:
+	/**
+	 * Reserve the crop buffer in the memory budget and allocate it as
+	 * m_data, after m_crop has been set. Throw if the memory limit would be
+	 * exceeded.
+	 */
+	void allocateCrop();
+
+	/**
+	 * Free the buffer allocated by allocateCrop() and release its
+	 * reservation, if it is allocated
+	 */
+	void releaseCrop();
+
+	/** Get the size of the decoded crop buffer in bytes */
+	size_t getDataSize() const {
+		return (size_t)COMPONENTS * m_crop.width * m_crop.height;
+	}
+
 	uint8_t * m_data;
 	int m_width, m_height;
 	IntegerCropRect m_crop;
 	Metadata m_metadata;
-};
-
-#if 0 && use_float
+	Coverage m_coverage;
 
-// Simple and low instruction count, but a litle slower than the fixed-point version
+private:
+	/** Whether m_data was allocated by allocateCrop() */
+	bool m_cropAllocated;
+};
 
-void InputImage::interpolate(uint8_t * dest, float x, float y) {
+void InputImage::interpolateFloat(uint8_t * dest, float x, float y) {
 	int x0 = static_cast<int>(floorf(x));
 	int y0 = static_cast<int>(floorf(y));
 	int x1 = x0 + 1;
@@ -118,27 +228,21 @@ void InputImage::interpolate(uint8_t * dest, float x, float y) {
 	assertBounds(x1, y1);
 
 	uint8_t
-		*f00 = (*this)(x0, y0),
-		*f01 = (*this)(x0, y1),
-		*f10 = (*this)(x1, y0),
-		*f11 = (*this)(x1, y1);
+		*f00 = pixel(x0, y0),
+		*f01 = pixel(x0, y1),
+		*f10 = pixel(x1, y0),
+		*f11 = pixel(x1, y1);
 
 	for (int c = 0; c < COMPONENTS; c++) {
 		float v = f00[c];
-		v = fmaf(f10[c] - f00[c], mu, v);
-		v = fmaf(f01[c] - f00[c], nu, v);
-		v = fmaf(f11[c] - f10[c] - f01[c] + f00[c], munu, v);
-		dest[c] = static_cast<uint8_t>(v);
+		v += (f10[c] - f00[c]) * mu;
+		v += (f01[c] - f00[c]) * nu;
+		v += (f11[c] - f10[c] - f01[c] + f00[c]) * munu;
+		dest[c] = static_cast<uint8_t>(v + 0.5f);
 	}
 }
 
-#endif
-
-#if 0 && __GNUC__
-
-// Complicated and no faster than plain fixed point version
-
-void InputImage::interpolate(uint8_t * dest, float x, float y) {
+void InputImage::interpolateVector(uint8_t * dest, float x, float y) {
 	int x0 = static_cast<int>(floorf(x));
 	int y0 = static_cast<int>(floorf(y));
 	int x1 = x0 + 1;
@@ -155,10 +259,10 @@ void InputImage::interpolate(uint8_t * dest, float x, float y) {
 	typedef uint8_t v4u1 __attribute ((vector_size(4)));
 
 	uint8_t
-		*f00 = (*this)(x0, y0),
-		*f01 = (*this)(x0, y1),
-		*f10 = (*this)(x1, y0),
-		*f11 = (*this)(x1, y1);
+		*f00 = pixel(x0, y0),
+		*f01 = pixel(x0, y1),
+		*f10 = pixel(x1, y0),
+		*f11 = pixel(x1, y1);
 
 	v4i4
 		v00 = {f00[0], f00[1], f00[2], 0},
@@ -180,8 +284,6 @@ void InputImage::interpolate(uint8_t * dest, float x, float y) {
 	}
 }
 
-#endif
-
 // Seems fastest despite executing more instructions
 
 void InputImage::interpolate(uint8_t * dest, float x, float y) {
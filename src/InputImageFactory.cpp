@@ -1,25 +1,98 @@
 #include "InputImageFactory.h"
 #include "InputJpeg.h"
+#include "InputMosaic.h"
+#ifdef PANO_HAVE_TIFF
+#include "InputTiff.h"
+#endif
 #include <filesystem>
 #include <locale>
+#include <memory>
 
 namespace PanoProjector {
 
 namespace fs = std::filesystem;
 
+#ifndef PANO_HAVE_TIFF
+[[noreturn]] static void throwTiffUnsupported() {
+	throw std::runtime_error("TIFF input is not supported by this build: libtiff was not found");
+}
+#endif
+
+static InputImage * createTiff(const InputSource & source, const CropRect & cropRect) {
+#ifdef PANO_HAVE_TIFF
+	return new InputTiff(source, cropRect);
+#else
+	throwTiffUnsupported();
+#endif
+}
+
 InputImage * InputImageFactory::create(
 	const std::string &path,
 	const std::string &format,
-	const PanoProjector::CropRect &cropRect)
+	const PanoProjector::CropRect &cropRect,
+	int scaleDenom)
+{
+	return create(InputSource(path, format), cropRect, scaleDenom);
+}
+
+InputImage * InputImageFactory::create(
+	const InputSource & source,
+	const CropRect & cropRect,
+	int scaleDenom,
+	OutputBase * tee)
+{
+	std::string normalFormat = normalizeFormat(source.path, source.format);
+
+	if (normalFormat.empty()) {
+		throw std::runtime_error("No file extension: use --input-format to specify the input file format");
+	}
+
+	if (normalFormat == "jpg" || normalFormat == "jpeg") {
+		return new InputJpeg(source, cropRect, scaleDenom, tee);
+	}
+
+	std::unique_ptr<InputImage> image;
+	if (scaleDenom != 1) {
+		throw std::runtime_error("Invalid input scale denominator");
+	}
+	if (normalFormat == "tiff") {
+		image.reset(createTiff(source, cropRect));
+	} else if (normalFormat == "mosaic") {
+		image.reset(new InputMosaic(source, cropRect));
+	} else {
+		throw std::runtime_error("Unknown input image format \"" + normalFormat + "\"");
+	}
+	// The other decoders don't write the rows as they go
+	if (tee) {
+		image->writeTo(*tee);
+	}
+	return image.release();
+}
+
+InputInfo InputImageFactory::getInfo(
+	const std::string & path,
+	const std::string & format)
 {
-	std::string normalFormat = normalizeFormat(path, format);
+	return getInfo(InputSource(path, format));
+}
+
+InputInfo InputImageFactory::getInfo(const InputSource & source) {
+	std::string normalFormat = normalizeFormat(source.path, source.format);
 
 	if (normalFormat.empty()) {
 		throw std::runtime_error("No file extension: use --input-format to specify the input file format");
 	}
 
 	if (normalFormat == "jpg" || normalFormat == "jpeg") {
-		return new InputJpeg(path, cropRect);
+		return InputJpeg::readInfo(source);
+	} else if (normalFormat == "tiff") {
+#ifdef PANO_HAVE_TIFF
+		return InputTiff::readInfo(source);
+#else
+		throwTiffUnsupported();
+#endif
+	} else if (normalFormat == "mosaic") {
+		return InputMosaic::readInfo(source);
 	} else {
 		throw std::runtime_error("Unknown input image format \"" + normalFormat + "\"");
 	}
@@ -45,6 +118,8 @@ std::string InputImageFactory::normalizeFormat(const std::string &path, const st
 
 	if (normalFormat == "jpg") {
 		return "jpeg";
+	} else if (normalFormat == "tif") {
+		return "tiff";
 	} else {
 		return normalFormat;
 	}
@@ -2,15 +2,44 @@
 #define PANO_INPUTIMAGEFACTORY_H
 
 #include "InputImage.h"
+#include "InputSource.h"
+#include "OutputBase.h"
 
 namespace PanoProjector {
 
 class InputImageFactory {
 public:
+	/**
+	 * Decode the input image within the crop rectangle. If the scale
+	 * denominator is greater than one, the image is scaled down by that
+	 * factor, if the format supports it, and otherwise an error is thrown.
+	 */
 	static InputImage * create(
 		const std::string & path,
 		const std::string & format,
-		const CropRect & cropRect);
+		const CropRect & cropRect,
+		int scaleDenom = 1);
+
+	/**
+	 * Decode an input image from a file or a buffer, as for create(). If a
+	 * tee is given, the crop rectangle must be the whole image, and each row
+	 * is also written to the tee, as it is decoded where the format allows.
+	 */
+	static InputImage * create(
+		const InputSource & source,
+		const CropRect & cropRect,
+		int scaleDenom = 1,
+		OutputBase * tee = nullptr);
+
+	/**
+	 * Get information about an input image without decoding it
+	 */
+	static InputInfo getInfo(
+		const std::string & path,
+		const std::string & format);
+
+	/** Get information about an input image in a file or a buffer */
+	static InputInfo getInfo(const InputSource & source);
 
 	/**
 	 * Extract a format from a path and format specification. Convert it to
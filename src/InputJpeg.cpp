@@ -1,39 +1,80 @@
 #include "InputJpeg.h"
 #include "MemoryBudget.h"
+#include "Tracer.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cstring>
 #include <iostream>
 
 namespace PanoProjector {
 
-InputJpeg::InputJpeg(const std::string & path, const CropRect & cropRect)
-	: m_cinfo(), m_jerr(), m_extraMem(0)
-{
-	FILE * f = fopen(path.c_str(), "rb");
+/**
+ * Report a libjpeg error by throwing, rather than the default of exiting,
+ * so that an invalid image doesn't terminate a process using the library
+ */
+[[noreturn]] static void throwJpegError(j_common_ptr cinfo) {
+	char message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, message);
+	throw std::runtime_error(std::string("Invalid input image: ") + message);
+}
+
+void InputJpeg::initErrorHandler(struct jpeg_decompress_struct & cinfo,
+	struct jpeg_error_mgr & jerr
+) {
+	cinfo.err = jpeg_std_error(&jerr);
+	jerr.error_exit = throwJpegError;
+}
+
+FILE * InputJpeg::attachSource(struct jpeg_decompress_struct & cinfo, const InputSource & source) {
+	if (source.isMemory()) {
+		jpeg_mem_src(&cinfo, source.data, source.size);
+		return nullptr;
+	}
+	FILE * f = fopen(source.path.c_str(), "rb");
 	if (!f) {
 		throw std::runtime_error(
 			std::string("Unable to open input image: ") +
 				std::string(strerror(errno)));
 	}
+	jpeg_stdio_src(&cinfo, f);
+	return f;
+}
+
+InputJpeg::InputJpeg(const InputSource & source, const CropRect & cropRect,
+	int scaleDenom, OutputBase * tee
+)
+	: m_cinfo(), m_jerr(), m_extraMem(0)
+{
+	PANO_TRACE_SPAN("decode");
 
-	m_cinfo.err = jpeg_std_error(&m_jerr);
+	initErrorHandler(m_cinfo, m_jerr);
 	jpeg_create_decompress(&m_cinfo);
-	jpeg_stdio_src(&m_cinfo, f);
+	FILE * f = nullptr;
+	try {
+		f = attachSource(m_cinfo, source);
+		decode(cropRect, scaleDenom, tee);
+	} catch (...) {
+		jpeg_destroy_decompress(&m_cinfo);
+		if (f) {
+			fclose(f);
+		}
+		release();
+		throw;
+	}
+	jpeg_destroy_decompress(&m_cinfo);
+	if (f) {
+		fclose(f);
+	}
+}
 
-	// Save the ICC profile while reading the header
+void InputJpeg::decode(const CropRect & cropRect, int scaleDenom, OutputBase * tee) {
+	// Save the ICC profile and XMP while reading the header
+	jpeg_save_markers(&m_cinfo, JPEG_APP0 + 1, 0xFFFF);
 	jpeg_save_markers(&m_cinfo, JPEG_APP0 + 2, 0xFFFF);
 	(void)jpeg_read_header(&m_cinfo, TRUE);
 
-	// Read the ICC profile
-	JOCTET * iccData;
-	unsigned int iccDataLength;
-	if (jpeg_read_icc_profile(&m_cinfo, &iccData, &iccDataLength)) {
-		m_metadata.icc = std::string(
-			reinterpret_cast<char*>(iccData),
-			iccDataLength);
-		free(iccData);
-	}
+	readMetadata(m_cinfo, m_metadata);
 
 	// The YCbCr -> RGB converter is actually faster than the "null" converter,
 	// so it doesn't help to use the input color space here
@@ -43,6 +84,12 @@ InputJpeg::InputJpeg(const std::string & path, const CropRect & cropRect)
 		throw std::runtime_error("Invalid input image: wrong number of components");
 	}
 
+	if (scaleDenom != 1 && scaleDenom != 2 && scaleDenom != 4 && scaleDenom != 8) {
+		throw std::runtime_error("Invalid input scale denominator");
+	}
+	m_cinfo.scale_num = 1;
+	m_cinfo.scale_denom = scaleDenom;
+
 	(void)jpeg_start_decompress(&m_cinfo);
 
 	m_width = m_cinfo.output_width;
@@ -61,32 +108,31 @@ InputJpeg::InputJpeg(const std::string & path, const CropRect & cropRect)
 		sourceCropLeft = 0;
 		sourceCropWidth = m_width;
 	} else {
-		sourceCropLeft = m_crop.left;
-		sourceCropWidth = m_crop.right - m_crop.left;
+		// Decode an extra column on each side if possible. Chroma upsampling
+		// replicates the edge of the decoded region, so without this, the
+		// edge pixels would differ from those of an uncropped decode.
+		sourceCropLeft = std::max(m_crop.left - 1, 0);
+		sourceCropWidth = std::min(m_crop.right + 1, m_width) - sourceCropLeft;
 	}
 
 	if (m_crop.width < 0 || m_crop.width >= 65536) {
 		throw std::runtime_error("Invalid cropped width");
 	}
 
+	if (tee && (m_crop.wrap || m_crop.width != m_width || m_crop.height != m_height)) {
+		throw std::runtime_error("The whole input image must be decoded to write it to an output");
+	}
+
 	// Progressive and multi-scan JPEG images require a lot of memory which
 	// needs to be accounted for.
-	if (jpeg_has_multiple_scans(&m_cinfo)) {
-		// The docs say two bytes per coefficient, worst case 6 bytes per pixel.
-		// A progressive image generated by ImageMagick with -interlace and
-		// without -sampling uses 1x1 sampling and does hit that worst case.
-		int bitsPerPixel = 0;
-		for (int c = 0; c < COMPONENTS; c++) {
-			bitsPerPixel += 16 / m_cinfo.comp_info[c].h_samp_factor
-				/ m_cinfo.comp_info[c].v_samp_factor;
-		}
-		int bytesPerPixel = bitsPerPixel / 8;
+	int bytesPerPixel = getCoefficientBytesPerPixel(m_cinfo);
+	if (bytesPerPixel) {
 		std::cerr << "Warning: using " << bytesPerPixel << " bytes per pixel for progressive JPEG input\n";
-		m_extraMem = g_memBudget.reserve(bytesPerPixel, sourceCropWidth, m_crop.height);
+		m_extraMem = g_memBudget.reserve(MemoryCategory::DecodeCoefficients,
+			bytesPerPixel, sourceCropWidth, m_crop.height);
 	}
 
-	g_memBudget.reserve(COMPONENTS, m_crop.width, m_crop.height);
-	m_data = new uint8_t[COMPONENTS * m_crop.width * m_crop.height];
+	allocateCrop();
 
 	if ((int)sourceCropWidth < m_width) {
 		jpeg_crop_scanline(&m_cinfo, &sourceCropLeft, &sourceCropWidth);
@@ -119,19 +165,100 @@ InputJpeg::InputJpeg(const std::string & path, const CropRect & cropRect)
 		while ((int)m_cinfo.output_scanline < m_crop.bottom) {
 			uint8_t * rowptr = row(m_cinfo.output_scanline);
 			(void)jpeg_read_scanlines(&m_cinfo, &rowptr, 1);
+			if (tee) {
+				tee->writeRow(rowptr);
+			}
+		}
+	}
+	// Stop without decoding the rows below the crop
+	jpeg_abort_decompress(&m_cinfo);
+}
+
+void InputJpeg::readMetadata(struct jpeg_decompress_struct & cinfo, Metadata & metadata) {
+	// Read the ICC profile
+	JOCTET * iccData;
+	unsigned int iccDataLength;
+	if (jpeg_read_icc_profile(&cinfo, &iccData, &iccDataLength)) {
+		metadata.icc = std::string(
+			reinterpret_cast<char*>(iccData),
+			iccDataLength);
+		free(iccData);
+	}
+
+	// Read the XMP packet, which is in an APP1 marker with a namespace
+	// prefix, unlike Exif which has "Exif"
+	static const char xmpPrefix[] = "http://ns.adobe.com/xap/1.0/";
+	for (auto marker = cinfo.marker_list; marker; marker = marker->next) {
+		if (marker->marker == JPEG_APP0 + 1
+			&& marker->data_length > sizeof(xmpPrefix)
+			&& memcmp(marker->data, xmpPrefix, sizeof(xmpPrefix)) == 0
+		) {
+			metadata.xmp = std::string(
+				reinterpret_cast<char*>(marker->data) + sizeof(xmpPrefix),
+				marker->data_length - sizeof(xmpPrefix));
+			break;
 		}
 	}
-	jpeg_skip_scanlines(&m_cinfo, m_height - m_cinfo.output_scanline);
-	(void)jpeg_finish_decompress(&m_cinfo);
-	jpeg_destroy_decompress(&m_cinfo);
-	fclose(f);
+}
+
+int InputJpeg::getCoefficientBytesPerPixel(struct jpeg_decompress_struct & cinfo) {
+	if (!jpeg_has_multiple_scans(&cinfo)) {
+		return 0;
+	}
+	// The docs say two bytes per coefficient, worst case 6 bytes per pixel.
+	// A progressive image generated by ImageMagick with -interlace and
+	// without -sampling uses 1x1 sampling and does hit that worst case.
+	int bitsPerPixel = 0;
+	for (int c = 0; c < COMPONENTS; c++) {
+		bitsPerPixel += 16 / cinfo.comp_info[c].h_samp_factor
+			/ cinfo.comp_info[c].v_samp_factor;
+	}
+	return bitsPerPixel / 8;
+}
+
+InputInfo InputJpeg::readInfo(const InputSource & source) {
+	struct jpeg_decompress_struct cinfo{};
+	struct jpeg_error_mgr jerr{};
+	initErrorHandler(cinfo, jerr);
+	jpeg_create_decompress(&cinfo);
+	FILE * f = nullptr;
+	InputInfo info;
+	try {
+		f = attachSource(cinfo, source);
+		jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+		jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xFFFF);
+		(void)jpeg_read_header(&cinfo, TRUE);
+
+		readMetadata(cinfo, info.metadata);
+		info.width = cinfo.image_width;
+		info.height = cinfo.image_height;
+		info.scalable = true;
+		if (cinfo.num_components == COMPONENTS) {
+			info.extraBytesPerPixel = getCoefficientBytesPerPixel(cinfo);
+		}
+	} catch (...) {
+		jpeg_destroy_decompress(&cinfo);
+		if (f) {
+			fclose(f);
+		}
+		throw;
+	}
+	jpeg_destroy_decompress(&cinfo);
+	if (f) {
+		fclose(f);
+	}
+	return info;
 }
 
 InputJpeg::~InputJpeg()
 {
-	g_memBudget.release(COMPONENTS, m_crop.width, m_crop.height);
-	g_memBudget.release(m_extraMem);
-	delete[] m_data;
+	release();
+}
+
+void InputJpeg::release() {
+	releaseCrop();
+	g_memBudget.release(MemoryCategory::DecodeCoefficients, m_extraMem);
+	m_extraMem = 0;
 }
 
-} // namespace
\ No newline at end of file
+} // namespace
@@ -2,20 +2,71 @@
 #define PANO_INPUTJPEG_H
 
 #include "InputImage.h"
+#include "InputSource.h"
 
 namespace PanoProjector {
 
 class InputJpeg : public InputImage {
 public:
 	/**
-	 * Read a JPEG image from a file to a managed buffer. If a crop rectangle
+	 * Read a JPEG image from a file or a buffer to a managed buffer. If a crop rectangle
 	 * is given, only the data within that rectangle will be stored.
+	 *
+	 * If the scale denominator is 2, 4 or 8, the image is scaled down by that
+	 * factor while decoding, using a reduced size IDCT, which is much faster
+	 * than a full decode. The image width and height are then those of the
+	 * scaled image, rounded up.
+	 *
+	 * If a tee is given, each row is also written to it as soon as it is
+	 * decoded, while it is still in the cache. The crop rectangle must then
+	 * be the whole image.
 	 */
-	InputJpeg(const std::string & path, const CropRect & cropRect);
+	InputJpeg(const InputSource & source, const CropRect & cropRect,
+		int scaleDenom = 1, OutputBase * tee = nullptr);
 
 	~InputJpeg() override;
 
+	/**
+	 * Read the header of a JPEG image and get information about it, without
+	 * decoding the image data.
+	 */
+	static InputInfo readInfo(const InputSource & source);
+
+	/**
+	 * Set up a decompressor's error handler to throw std::runtime_error,
+	 * before jpeg_create_decompress()
+	 */
+	static void initErrorHandler(struct jpeg_decompress_struct & cinfo,
+		struct jpeg_error_mgr & jerr);
+
+	/**
+	 * Attach the source to a decompressor, returning the file to close after
+	 * decoding, or null for a buffer. Throw if the file can't be opened.
+	 */
+	static FILE * attachSource(struct jpeg_decompress_struct & cinfo, const InputSource & source);
+
+	/**
+	 * Read metadata from saved markers after the header has been read
+	 */
+	static void readMetadata(struct jpeg_decompress_struct & cinfo, Metadata & metadata);
+
+	/**
+	 * Get the number of bytes per pixel needed for coefficient buffers when
+	 * decoding an image with the given header, or zero if the image has a
+	 * single scan.
+	 */
+	static int getCoefficientBytesPerPixel(struct jpeg_decompress_struct & cinfo);
+
 private:
+	/**
+	 * Decode the image within the crop rectangle after the source has been
+	 * attached
+	 */
+	void decode(const CropRect & cropRect, int scaleDenom, OutputBase * tee);
+
+	/** Release the crop buffer and the memory reservations */
+	void release();
+
 	struct jpeg_decompress_struct m_cinfo;
 	struct jpeg_error_mgr m_jerr;
 	unsigned long m_extraMem;
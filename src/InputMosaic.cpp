@@ -0,0 +1,275 @@
+#include "InputMosaic.h"
+#include "InputImageFactory.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace PanoProjector {
+
+namespace fs = std::filesystem;
+
+/** The number of layouts to keep, for a batch of several mosaics */
+static const size_t MAX_CACHED_LAYOUTS = 8;
+
+/** The largest number of decoding threads per mosaic, or zero for one per core */
+static std::atomic<int> s_maxThreads(0);
+
+void InputMosaic::setMaxThreads(int threads) {
+	s_maxThreads = std::max(threads, 0);
+}
+
+std::shared_ptr<const InputMosaic::Layout> InputMosaic::getLayout(const InputSource & source) {
+	// A file is identified by its path, size and modification time, and a
+	// buffer by its contents, which are short. A change to a tile without a
+	// change to the description is not detected.
+	struct Entry {
+		std::string key;
+		std::uintmax_t size = 0;
+		fs::file_time_type modified;
+		std::shared_ptr<const Layout> layout;
+
+		bool matches(const Entry & other) const {
+			return key == other.key && size == other.size && modified == other.modified;
+		}
+	};
+	static std::mutex mutex;
+	static std::vector<Entry> cache;
+
+	Entry entry;
+	std::string baseDir;
+	bool cacheable = true;
+	if (source.isMemory()) {
+		entry.key = std::string(reinterpret_cast<const char*>(source.data), source.size);
+	} else {
+		std::error_code error;
+		entry.key = source.path;
+		entry.size = fs::file_size(source.path, error);
+		if (!error) {
+			entry.modified = fs::last_write_time(source.path, error);
+		}
+		// Reading the file reports the error
+		cacheable = !error;
+		baseDir = fs::path(source.path).parent_path().string();
+	}
+	if (cacheable) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto it = cache.begin(); it != cache.end(); ++it) {
+			if (it->matches(entry)) {
+				// Move it to the end, which is the most recently used
+				std::rotate(it, it + 1, cache.end());
+				return cache.back().layout;
+			}
+		}
+	}
+
+	std::string text;
+	if (source.isMemory()) {
+		text = entry.key;
+	} else {
+		std::ifstream file(source.path);
+		if (!file) {
+			throw std::runtime_error(
+				std::string("Unable to open input image: ") +
+					std::string(strerror(errno)));
+		}
+		std::ostringstream buffer;
+		buffer << file.rdbuf();
+		text = buffer.str();
+	}
+	entry.layout = std::make_shared<const Layout>(readLayout(text, baseDir));
+	if (cacheable) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (cache.size() == MAX_CACHED_LAYOUTS) {
+			cache.erase(cache.begin());
+		}
+		cache.push_back(entry);
+	}
+	return entry.layout;
+}
+
+InputMosaic::Layout InputMosaic::readLayout(const std::string & text, const std::string & baseDir) {
+	Layout layout;
+	std::istringstream lines(text);
+	std::string line;
+	long area = 0;
+	int lineNumber = 0;
+	while (std::getline(lines, line)) {
+		lineNumber++;
+		std::istringstream fields(line);
+		fields >> std::ws;
+		if (fields.peek() == EOF || fields.peek() == '#') {
+			continue;
+		}
+		Tile tile;
+		std::string path;
+		if (!(fields >> tile.left >> tile.top >> std::ws) || !std::getline(fields, path)
+			|| tile.left < 0 || tile.top < 0
+		) {
+			throw std::runtime_error("Invalid mosaic: syntax error on line "
+				+ std::to_string(lineNumber));
+		}
+		path.erase(path.find_last_not_of(" \t\r") + 1);
+		tile.path = fs::path(path).is_absolute() ? path : (fs::path(baseDir) / path).string();
+		if (InputImageFactory::normalizeFormat(tile.path, "") == "mosaic") {
+			throw std::runtime_error("Invalid mosaic: a tile can't be a mosaic");
+		}
+
+		InputInfo info = InputImageFactory::getInfo(tile.path, "");
+		tile.width = info.width;
+		tile.height = info.height;
+		if ((long)tile.left + tile.width > INT_MAX / COMPONENTS
+			|| (long)tile.top + tile.height > INT_MAX
+		) {
+			throw std::runtime_error("Invalid mosaic: image too large");
+		}
+		if (layout.tiles.empty()) {
+			layout.info.metadata.icc = info.metadata.icc;
+		}
+		layout.info.width = std::max(layout.info.width, tile.left + tile.width);
+		layout.info.height = std::max(layout.info.height, tile.top + tile.height);
+		// Each tile is decoded to its own buffer and then copied
+		layout.info.extraBytesPerPixel = std::max(layout.info.extraBytesPerPixel,
+			COMPONENTS + info.extraBytesPerPixel);
+		layout.info.blockWidth = std::max(layout.info.blockWidth, tile.width);
+		layout.info.blockHeight = std::max(layout.info.blockHeight, tile.height);
+		area += (long)tile.width * tile.height;
+		layout.tiles.push_back(tile);
+	}
+	if (layout.tiles.empty()) {
+		throw std::runtime_error("Invalid mosaic: no tiles");
+	}
+
+	// Check each tile against those which start left of its right edge, in
+	// order of the left edges, so a grid costs a column of tiles per tile
+	std::vector<const Tile*> byLeft;
+	for (const Tile & tile : layout.tiles) {
+		byLeft.push_back(&tile);
+	}
+	std::stable_sort(byLeft.begin(), byLeft.end(), [] (const Tile * a, const Tile * b) {
+		return a->left < b->left;
+	});
+	for (size_t i = 0; i < byLeft.size(); i++) {
+		const Tile & tile = *byLeft[i];
+		for (size_t j = i + 1; j < byLeft.size() && byLeft[j]->left < tile.left + tile.width; j++) {
+			const Tile & other = *byLeft[j];
+			if (tile.top < other.top + other.height && other.top < tile.top + tile.height) {
+				throw std::runtime_error("Invalid mosaic: tiles " + tile.path
+					+ " and " + other.path + " overlap");
+			}
+		}
+	}
+	layout.complete = area == (long)layout.info.width * layout.info.height;
+	return layout;
+}
+
+InputMosaic::InputMosaic(const InputSource & source, const CropRect & cropRect) {
+	PANO_TRACE_SPAN("decode");
+
+	m_layout = getLayout(source);
+	const Layout & layout = *m_layout;
+	m_width = layout.info.width;
+	m_height = layout.info.height;
+	m_metadata = layout.info.metadata;
+	m_crop = IntegerCropRect(cropRect, m_width, m_height);
+
+	// The crop buffer is freed by the destructor of InputImage if a tile
+	// fails to decode
+	allocateCrop();
+	if (!layout.complete) {
+		memset(m_data, 0, getDataSize());
+	}
+
+	// The parts of the tiles to decode, in both parts of the crop if it wraps
+	struct Part {
+		const Tile * tile;
+		int left, right;
+	};
+	std::vector<Part> parts;
+	auto addParts = [&] (int left, int right) {
+		for (const Tile & tile : layout.tiles) {
+			int partLeft = std::max(left, tile.left);
+			int partRight = std::min(right, tile.left + tile.width);
+			if (partLeft < partRight && tile.top < m_crop.bottom
+				&& m_crop.top < tile.top + tile.height
+			) {
+				parts.push_back({&tile, partLeft, partRight});
+			}
+		}
+	};
+	if (m_crop.wrap) {
+		addParts(m_crop.left, m_width);
+		addParts(0, m_crop.right);
+	} else {
+		addParts(m_crop.left, m_crop.right);
+	}
+
+	// Decode the parts on a thread per core, or up to the caller's bound,
+	// each taking the next part
+	std::atomic<size_t> nextPart(0);
+	std::mutex errorMutex;
+	std::exception_ptr error;
+	TraceContext trace;
+	auto work = [&] {
+		trace.apply();
+		for (size_t i; (i = nextPart++) < parts.size();) {
+			try {
+				decodeTile(*parts[i].tile, parts[i].left, parts[i].right);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+				nextPart = parts.size();
+			}
+		}
+	};
+	int maxThreads = s_maxThreads;
+	if (maxThreads == 0) {
+		maxThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+	}
+	int numThreads = (int)std::min((size_t)maxThreads, parts.size());
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++) {
+		threads.emplace_back(work);
+	}
+	work();
+	for (auto & thread : threads) {
+		thread.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+void InputMosaic::decodeTile(const Tile & tile, int left, int right) {
+	int top = std::max(m_crop.top, tile.top);
+	int bottom = std::min(m_crop.bottom, tile.top + tile.height);
+	CropRect tileRect{
+		(double)(left - tile.left) / tile.width,
+		(double)(right - tile.left) / tile.width,
+		(double)(top - tile.top) / tile.height,
+		(double)(bottom - tile.top) / tile.height};
+	std::unique_ptr<InputImage> input(
+		InputImageFactory::create(InputSource(tile.path, ""), tileRect));
+	for (int y = top; y < bottom; y++) {
+		memcpy(pixel(left, y), input->pixel(left - tile.left, y - tile.top),
+			(size_t)(right - left) * COMPONENTS);
+	}
+}
+
+InputInfo InputMosaic::readInfo(const InputSource & source) {
+	return getLayout(source)->info;
+}
+
+} // namespace
@@ -0,0 +1,96 @@
+#ifndef PANO_INPUTMOSAIC_H
+#define PANO_INPUTMOSAIC_H
+
+#include "InputImage.h"
+#include "InputSource.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PanoProjector {
+
+/**
+ * An input image assembled from a mosaic of tile images, for sources too
+ * large to be stored in a single JPEG.
+ *
+ * The mosaic is described by a text file with a line for each tile, giving
+ * the position of its top left corner in the assembled image and its path,
+ * relative to the directory of the description, or for a description in a
+ * buffer, to the working directory:
+ *
+ *     # x y path
+ *     0 0 r0c0.jpg
+ *     30000 0 r0c1.jpg
+ *     0 15000 r1c0.jpg
+ *     30000 15000 r1c1.jpg
+ *
+ * The assembled image is the bounding box of the tiles, which must not
+ * overlap. Pixels not covered by any tile are black.
+ *
+ * Only the tiles which intersect the crop rectangle are decoded, each
+ * cropped to the intersection, and they are decoded in parallel, on up to
+ * the number of threads set with setMaxThreads(). The ICC profile is taken
+ * from the first tile.
+ *
+ * The description and the tile headers are read once and kept for the
+ * following crops of the same mosaic, such as the other bands of a plan.
+ */
+class InputMosaic : public InputImage {
+public:
+	/** Decode the tiles within the crop rectangle into a managed buffer */
+	InputMosaic(const InputSource & source, const CropRect & cropRect);
+
+	/**
+	 * Read the description and the headers of the tiles, and get
+	 * information about the assembled image.
+	 */
+	static InputInfo readInfo(const InputSource & source);
+
+	/**
+	 * Set the largest number of threads which decode the tiles of each
+	 * mosaic, for a caller which decodes several inputs at once, or zero
+	 * for the default of one per core
+	 */
+	static void setMaxThreads(int threads);
+
+private:
+	/** A tile of the mosaic */
+	struct Tile {
+		std::string path;
+		int left, top, width, height;
+	};
+
+	/** The tiles and the information about the assembled image */
+	struct Layout {
+		std::vector<Tile> tiles;
+		InputInfo info;
+
+		/** Whether the tiles cover the whole image */
+		bool complete;
+	};
+
+	/**
+	 * Get the layout of a mosaic from the cache, or read it and add it to
+	 * the cache
+	 */
+	static std::shared_ptr<const Layout> getLayout(const InputSource & source);
+
+	/**
+	 * Parse the description, and read the header of each tile. The paths
+	 * are relative to the given directory. Throw if it is invalid.
+	 */
+	static Layout readLayout(const std::string & text, const std::string & baseDir);
+
+	/**
+	 * Decode the part of a tile within the given columns of the assembled
+	 * image and the crop rows, and copy it to the crop buffer
+	 */
+	void decodeTile(const Tile & tile, int left, int right);
+
+	std::shared_ptr<const Layout> m_layout;
+};
+
+} // namespace
+
+#endif
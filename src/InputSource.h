@@ -0,0 +1,45 @@
+#ifndef PANO_INPUTSOURCE_H
+#define PANO_INPUTSOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace PanoProjector {
+
+/**
+ * Where to read an encoded input image from: a file, or a buffer in memory
+ * which is owned by the caller and must outlive any decoder using it.
+ */
+struct InputSource {
+	/** A file with a format given as for InputImageFactory::normalizeFormat() */
+	InputSource(const std::string & path, const std::string & format)
+		: path(path), format(format)
+	{}
+
+	/** A buffer holding an encoded image in the given format */
+	InputSource(const void * data, size_t size, const std::string & format = "jpeg")
+		: format(format), data(static_cast<const uint8_t*>(data)), size(size)
+	{}
+
+	/** Whether the image is in memory rather than in a file */
+	bool isMemory() const {
+		return data != nullptr;
+	}
+
+	/** The path of the file, or empty for a buffer */
+	std::string path;
+
+	/** The format, or empty to use the file extension */
+	std::string format;
+
+	/** The buffer, or null for a file */
+	const uint8_t * data = nullptr;
+
+	/** The size of the buffer in bytes */
+	size_t size = 0;
+};
+
+} // namespace
+
+#endif
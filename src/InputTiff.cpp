@@ -0,0 +1,315 @@
+#include "InputTiff.h"
+#include "MemoryBudget.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdarg>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <tiffio.h>
+
+namespace PanoProjector {
+
+/**
+ * The last error reported by libtiff on this thread. The error handler is
+ * global in libtiff, so the message is kept per thread and thrown by the
+ * caller of the failing function.
+ */
+static thread_local std::string t_tiffError;
+
+static void saveTiffError(const char * module, const char * format, va_list args) {
+	char message[1024];
+	vsnprintf(message, sizeof(message), format, args);
+	t_tiffError = message;
+}
+
+/** Replace the default handler, which prints errors to stderr */
+static void initErrorHandler() {
+	static std::once_flag once;
+	std::call_once(once, [] {
+		TIFFSetErrorHandler(saveTiffError);
+	});
+	t_tiffError.clear();
+}
+
+[[noreturn]] static void throwTiffError(const std::string & prefix) {
+	throw std::runtime_error(prefix + (t_tiffError.empty() ? "unknown error" : t_tiffError));
+}
+
+/** A buffer being read by libtiff */
+struct TiffMemoryStream {
+	const uint8_t * data;
+	toff_t size;
+	toff_t pos;
+};
+
+static tmsize_t readMemory(thandle_t handle, void * buffer, tmsize_t size) {
+	auto stream = static_cast<TiffMemoryStream*>(handle);
+	toff_t n = std::min((toff_t)size, stream->size - std::min(stream->pos, stream->size));
+	memcpy(buffer, stream->data + stream->pos, n);
+	stream->pos += n;
+	return (tmsize_t)n;
+}
+
+static tmsize_t writeMemory(thandle_t, void *, tmsize_t) {
+	return -1;
+}
+
+static toff_t seekMemory(thandle_t handle, toff_t offset, int whence) {
+	auto stream = static_cast<TiffMemoryStream*>(handle);
+	if (whence == SEEK_CUR) {
+		offset += stream->pos;
+	} else if (whence == SEEK_END) {
+		offset += stream->size;
+	}
+	stream->pos = offset;
+	return offset;
+}
+
+static int closeMemory(thandle_t handle) {
+	delete static_cast<TiffMemoryStream*>(handle);
+	return 0;
+}
+
+static toff_t getMemorySize(thandle_t handle) {
+	return static_cast<TiffMemoryStream*>(handle)->size;
+}
+
+/** Let libtiff read strips and tiles from the buffer without copying */
+static int mapMemory(thandle_t handle, void ** base, toff_t * size) {
+	auto stream = static_cast<TiffMemoryStream*>(handle);
+	*base = const_cast<uint8_t*>(stream->data);
+	*size = stream->size;
+	return 1;
+}
+
+static void unmapMemory(thandle_t, void *, toff_t) {}
+
+TIFF * InputTiff::open(const InputSource & source) {
+	initErrorHandler();
+	TIFF * tif;
+	if (source.isMemory()) {
+		auto stream = new TiffMemoryStream{source.data, source.size, 0};
+		// The close procedure is called on failure as well
+		tif = TIFFClientOpen("memory", "r", stream,
+			readMemory, writeMemory, seekMemory, closeMemory, getMemorySize,
+			mapMemory, unmapMemory);
+	} else {
+		tif = TIFFOpen(source.path.c_str(), "r");
+	}
+	if (!tif) {
+		throwTiffError("Unable to open input image: ");
+	}
+	return tif;
+}
+
+InputTiff::Layout InputTiff::readLayout(TIFF * tif) {
+	uint32_t width = 0, height = 0;
+	uint16_t bitsPerSample, samplesPerPixel, planarConfig, photometric = PHOTOMETRIC_RGB,
+		compression;
+	TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planarConfig);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+	TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+
+	if (width == 0 || height == 0 || width > INT_MAX / COMPONENTS || height > INT_MAX) {
+		throw std::runtime_error("Invalid input image: unsupported TIFF image size");
+	}
+	if (bitsPerSample != 8) {
+		throw std::runtime_error("Invalid input image: TIFF must have 8 bits per sample");
+	}
+	if (samplesPerPixel < COMPONENTS) {
+		throw std::runtime_error("Invalid input image: wrong number of components");
+	}
+	if (planarConfig != PLANARCONFIG_CONTIG) {
+		throw std::runtime_error("Invalid input image: TIFF planes must be interleaved");
+	}
+	if (photometric == PHOTOMETRIC_YCBCR && compression == COMPRESSION_JPEG) {
+		// Let the JPEG codec convert and upsample
+		TIFFSetField(tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+	} else if (photometric != PHOTOMETRIC_RGB) {
+		throw std::runtime_error("Invalid input image: TIFF must be RGB, or YCbCr with JPEG compression");
+	}
+
+	Layout layout;
+	layout.width = width;
+	layout.height = height;
+	layout.tiled = TIFFIsTiled(tif);
+	layout.samplesPerPixel = samplesPerPixel;
+	uint32_t blockWidth = width, blockHeight = 0;
+	if (layout.tiled) {
+		TIFFGetField(tif, TIFFTAG_TILEWIDTH, &blockWidth);
+		TIFFGetField(tif, TIFFTAG_TILELENGTH, &blockHeight);
+	} else {
+		TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &blockHeight);
+	}
+	blockHeight = std::min(blockHeight, height);
+	if (blockWidth == 0 || blockHeight == 0
+		|| (unsigned long)blockWidth * blockHeight > INT_MAX / samplesPerPixel
+	) {
+		throw std::runtime_error("Invalid input image: unsupported TIFF block size");
+	}
+	layout.blockWidth = blockWidth;
+	layout.blockHeight = blockHeight;
+	return layout;
+}
+
+void InputTiff::readMetadata(TIFF * tif, Metadata & metadata) {
+	uint32_t size;
+	void * data;
+	if (TIFFGetField(tif, TIFFTAG_ICCPROFILE, &size, &data)) {
+		metadata.icc = std::string(static_cast<char*>(data), size);
+	}
+	if (TIFFGetField(tif, TIFFTAG_XMLPACKET, &size, &data)) {
+		metadata.xmp = std::string(static_cast<char*>(data), size);
+	}
+}
+
+InputTiff::InputTiff(const InputSource & source, const CropRect & cropRect)
+	: m_blockMem(0)
+{
+	PANO_TRACE_SPAN("decode");
+
+	TIFF * tif = open(source);
+	try {
+		decode(tif, cropRect);
+	} catch (...) {
+		TIFFClose(tif);
+		release();
+		throw;
+	}
+	TIFFClose(tif);
+	// The block buffer is only needed while decoding
+	m_block = std::vector<uint8_t>();
+	g_memBudget.release(MemoryCategory::InputCrop, m_blockMem);
+	m_blockMem = 0;
+}
+
+void InputTiff::decode(TIFF * tif, const CropRect & cropRect) {
+	Layout layout = readLayout(tif);
+	readMetadata(tif, m_metadata);
+
+	m_width = layout.width;
+	m_height = layout.height;
+	m_crop = IntegerCropRect(cropRect, m_width, m_height);
+	if (m_crop.width <= 0 || m_crop.height <= 0) {
+		throw std::runtime_error("Invalid crop rectangle");
+	}
+
+	allocateCrop();
+
+	size_t blockSize = (size_t)layout.blockWidth * layout.blockHeight * layout.samplesPerPixel;
+	m_blockMem = g_memBudget.reserve(MemoryCategory::InputCrop, blockSize);
+	m_block.resize(blockSize);
+
+	// The block columns which intersect the crop, in both parts if it wraps
+	std::vector<int> blockCols;
+	auto addColumns = [&] (int left, int right) {
+		for (int bx = left / layout.blockWidth; bx <= (right - 1) / layout.blockWidth; bx++) {
+			blockCols.push_back(bx);
+		}
+	};
+	if (m_crop.wrap) {
+		addColumns(0, m_crop.right);
+		addColumns(m_crop.left, m_width);
+	} else {
+		addColumns(m_crop.left, m_crop.right);
+	}
+	blockCols.erase(std::unique(blockCols.begin(), blockCols.end()), blockCols.end());
+
+	for (int by = m_crop.top / layout.blockHeight;
+		by <= (m_crop.bottom - 1) / layout.blockHeight; by++
+	) {
+		int blockTop = by * layout.blockHeight;
+		for (int bx : blockCols) {
+			int blockLeft = bx * layout.blockWidth;
+			tmsize_t result;
+			if (layout.tiled) {
+				result = TIFFReadEncodedTile(tif, TIFFComputeTile(tif, blockLeft, blockTop, 0, 0),
+					m_block.data(), blockSize);
+			} else {
+				result = TIFFReadEncodedStrip(tif, TIFFComputeStrip(tif, blockTop, 0),
+					m_block.data(), blockSize);
+			}
+			if (result < 0) {
+				throwTiffError("Invalid input image: ");
+			}
+			copyBlock(layout, m_block.data(), blockLeft, blockTop);
+		}
+	}
+}
+
+void InputTiff::copyBlock(const Layout & layout, const uint8_t * block,
+	int blockLeft, int blockTop
+) {
+	int top = std::max(blockTop, m_crop.top);
+	int bottom = std::min(blockTop + layout.blockHeight, m_crop.bottom);
+	int blockRight = std::min(blockLeft + layout.blockWidth, m_width);
+	int spp = layout.samplesPerPixel;
+	size_t stride = (size_t)layout.blockWidth * spp;
+
+	auto copyColumns = [&] (int left, int right) {
+		left = std::max(left, blockLeft);
+		right = std::min(right, blockRight);
+		if (left >= right) {
+			return;
+		}
+		for (int y = top; y < bottom; y++) {
+			const uint8_t * src = block + (y - blockTop) * stride + (size_t)(left - blockLeft) * spp;
+			uint8_t * dest = pixel(left, y);
+			if (spp == COMPONENTS) {
+				memcpy(dest, src, (size_t)(right - left) * COMPONENTS);
+			} else {
+				// Drop the extra samples
+				for (int x = left; x < right; x++) {
+					memcpy(dest, src, COMPONENTS);
+					dest += COMPONENTS;
+					src += spp;
+				}
+			}
+		}
+	};
+	if (m_crop.wrap) {
+		copyColumns(0, m_crop.right);
+		copyColumns(m_crop.left, m_width);
+	} else {
+		copyColumns(m_crop.left, m_crop.right);
+	}
+}
+
+InputInfo InputTiff::readInfo(const InputSource & source) {
+	TIFF * tif = open(source);
+	InputInfo info;
+	try {
+		Layout layout = readLayout(tif);
+		readMetadata(tif, info.metadata);
+		info.width = layout.width;
+		info.height = layout.height;
+		info.blockWidth = layout.tiled ? layout.blockWidth : 0;
+		info.blockHeight = layout.blockHeight;
+		info.extraBytes = (unsigned long)layout.blockWidth * layout.blockHeight
+			* layout.samplesPerPixel;
+	} catch (...) {
+		TIFFClose(tif);
+		throw;
+	}
+	TIFFClose(tif);
+	return info;
+}
+
+InputTiff::~InputTiff() {
+	release();
+}
+
+void InputTiff::release() {
+	releaseCrop();
+	g_memBudget.release(MemoryCategory::InputCrop, m_blockMem);
+	m_blockMem = 0;
+}
+
+} // namespace
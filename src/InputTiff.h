@@ -0,0 +1,86 @@
+#ifndef PANO_INPUTTIFF_H
+#define PANO_INPUTTIFF_H
+
+#include "InputImage.h"
+#include "InputSource.h"
+
+#include <vector>
+
+typedef struct tiff TIFF;
+
+namespace PanoProjector {
+
+/**
+ * A TIFF or BigTIFF input image, tiled or in strips.
+ *
+ * Unlike JPEG, the blocks of a TIFF image can be decoded independently, so
+ * only the tiles or strips which intersect the crop rectangle are read, and
+ * each of them once. Decoding a band of a gigapixel image costs about as much
+ * as the band, regardless of where it is.
+ *
+ * The image must have 8 bits per sample, with the samples of a pixel
+ * interleaved, in RGB, or YCbCr with JPEG compression. Extra samples such as
+ * alpha are dropped.
+ */
+class InputTiff : public InputImage {
+public:
+	/**
+	 * Read a TIFF image from a file or a buffer to a managed buffer. Only the
+	 * data within the crop rectangle is stored.
+	 */
+	InputTiff(const InputSource & source, const CropRect & cropRect);
+
+	~InputTiff() override;
+
+	/**
+	 * Read the directory of a TIFF image and get information about it,
+	 * without decoding the image data.
+	 */
+	static InputInfo readInfo(const InputSource & source);
+
+private:
+	/**
+	 * The layout of the image data, read from the directory and checked for
+	 * support
+	 */
+	struct Layout {
+		int width, height;
+
+		/** The size of a tile, or the image width and rows per strip */
+		int blockWidth, blockHeight;
+
+		bool tiled;
+		int samplesPerPixel;
+	};
+
+	/**
+	 * Open the source, throwing if it can't be opened or isn't a TIFF image
+	 */
+	static TIFF * open(const InputSource & source);
+
+	/** Read and check the layout, and set up colour conversion */
+	static Layout readLayout(TIFF * tif);
+
+	/** Read the ICC profile and the XMP packet */
+	static void readMetadata(TIFF * tif, Metadata & metadata);
+
+	/** Decode the blocks within the crop rectangle after opening */
+	void decode(TIFF * tif, const CropRect & cropRect);
+
+	/**
+	 * Copy the part of a decoded block which is within the crop rectangle to
+	 * the crop buffer
+	 */
+	void copyBlock(const Layout & layout, const uint8_t * block, int blockLeft, int blockTop);
+
+	/** Release the buffers and the memory reservations */
+	void release();
+
+	/** A decoded tile or strip */
+	std::vector<uint8_t> m_block;
+	unsigned long m_blockMem;
+};
+
+} // namespace
+
+#endif
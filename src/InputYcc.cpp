@@ -0,0 +1,198 @@
+#include "InputYcc.h"
+#include "InputJpeg.h"
+#include "MemoryBudget.h"
+#include "HugePageArena.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace PanoProjector {
+
+InputYcc::InputYcc(const InputSource & source, const CropRect & cropRect)
+	: m_data(nullptr), m_dataSize(0), m_reserved(0), m_extraMem(0)
+{
+	PANO_TRACE_SPAN("decode");
+
+	struct jpeg_decompress_struct cinfo{};
+	struct jpeg_error_mgr jerr{};
+	InputJpeg::initErrorHandler(cinfo, jerr);
+	jpeg_create_decompress(&cinfo);
+	FILE * f = nullptr;
+	try {
+		f = InputJpeg::attachSource(cinfo, source);
+		decode(cinfo, cropRect);
+	} catch (...) {
+		jpeg_destroy_decompress(&cinfo);
+		if (f) {
+			fclose(f);
+		}
+		release();
+		throw;
+	}
+	jpeg_destroy_decompress(&cinfo);
+	if (f) {
+		fclose(f);
+	}
+}
+
+InputYcc::~InputYcc() {
+	release();
+}
+
+void InputYcc::release() {
+	if (m_data) {
+		g_hugePageArena.deallocate(m_data, m_dataSize);
+		m_data = nullptr;
+	}
+	g_memBudget.release(MemoryCategory::InputCrop, m_reserved);
+	g_memBudget.release(MemoryCategory::DecodeCoefficients, m_extraMem);
+	m_reserved = 0;
+	m_extraMem = 0;
+}
+
+/** Copy the cropped part of a decoded luma row to the plane */
+static void copyLumaRow(ImagePlane<1> & plane, int row, const uint8_t * src) {
+	if (!plane.containsRow(row)) {
+		return;
+	}
+	const IntegerCropRect & crop = plane.getCrop();
+	if (crop.wrap) {
+		memcpy(plane.pixel(crop.left, row), src + crop.left, plane.getPlaneWidth() - crop.left);
+		memcpy(plane.pixel(0, row), src, crop.right);
+	} else {
+		memcpy(plane.pixel(crop.left, row), src + crop.left, crop.width);
+	}
+}
+
+/** Interleave the cropped part of decoded Cb and Cr rows into the plane */
+static void copyChromaRow(ImagePlane<2> & plane, int row, const uint8_t * cb, const uint8_t * cr) {
+	if (!plane.containsRow(row)) {
+		return;
+	}
+	const IntegerCropRect & crop = plane.getCrop();
+	auto copy = [&] (int start, int end) {
+		if (start >= end) {
+			return;
+		}
+		uint8_t * dest = plane.pixel(start, row);
+		for (int i = start; i < end; i++) {
+			*dest++ = cb[i];
+			*dest++ = cr[i];
+		}
+	};
+	if (crop.wrap) {
+		copy(crop.left, plane.getPlaneWidth());
+		copy(0, crop.right);
+	} else {
+		copy(crop.left, crop.right);
+	}
+}
+
+void InputYcc::decode(struct jpeg_decompress_struct & cinfo, const CropRect & cropRect) {
+	jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+	jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xFFFF);
+	(void)jpeg_read_header(&cinfo, TRUE);
+	InputJpeg::readMetadata(cinfo, m_metadata);
+
+	if (cinfo.jpeg_color_space != JCS_YCbCr || cinfo.num_components != 3) {
+		throw std::runtime_error("The YCbCr pipeline needs a YCbCr input image");
+	}
+	const jpeg_component_info * comp = cinfo.comp_info;
+	const int xFactor = comp[0].h_samp_factor;
+	const int yFactor = comp[0].v_samp_factor;
+	for (int c = 1; c < 3; c++) {
+		if (comp[c].h_samp_factor != 1 || comp[c].v_samp_factor != 1) {
+			throw std::runtime_error("The YCbCr pipeline doesn't support the chroma "
+				"subsampling of the input image");
+		}
+	}
+	if (xFactor > 2 || yFactor > 2) {
+		throw std::runtime_error("The YCbCr pipeline doesn't support the chroma "
+			"subsampling of the input image");
+	}
+
+	cinfo.raw_data_out = TRUE;
+	cinfo.out_color_space = JCS_YCbCr;
+	(void)jpeg_start_decompress(&cinfo);
+
+	const int width = cinfo.image_width;
+	const int height = cinfo.image_height;
+	m_luma.setSize(width, height, 1, 1, cropRect);
+	m_chroma.setSize(width, height, xFactor, yFactor, cropRect);
+
+	// The coefficients of a progressive image are buffered for the whole
+	// image, since raw data can't be cropped by the decoder
+	int bytesPerPixel = InputJpeg::getCoefficientBytesPerPixel(cinfo);
+	if (bytesPerPixel) {
+		m_extraMem = g_memBudget.reserve(MemoryCategory::DecodeCoefficients,
+			bytesPerPixel, width, height);
+	}
+
+	// The decoder writes an iMCU row of each component at a time, padded to
+	// a whole number of blocks
+	size_t bufferSize = 0;
+	int numRows = 0;
+	for (int c = 0; c < 3; c++) {
+		bufferSize += (size_t)comp[c].v_samp_factor * DCTSIZE * comp[c].width_in_blocks * DCTSIZE;
+		numRows += comp[c].v_samp_factor * DCTSIZE;
+	}
+	m_dataSize = m_luma.getDataSize() + m_chroma.getDataSize();
+	m_reserved = g_memBudget.reserve(MemoryCategory::InputCrop, m_dataSize + bufferSize);
+	m_data = (uint8_t*)g_hugePageArena.allocate(m_dataSize);
+	m_luma.setData(m_data);
+	m_chroma.setData(m_data + m_luma.getDataSize());
+
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[bufferSize]);
+	std::vector<JSAMPROW> rows(numRows);
+	JSAMPARRAY planes[3];
+	uint8_t * bufferPtr = buffer.get();
+	JSAMPROW * rowPtr = rows.data();
+	for (int c = 0; c < 3; c++) {
+		planes[c] = rowPtr;
+		size_t rowSize = (size_t)comp[c].width_in_blocks * DCTSIZE;
+		for (int r = 0; r < comp[c].v_samp_factor * DCTSIZE; r++) {
+			*rowPtr++ = bufferPtr;
+			bufferPtr += rowSize;
+		}
+	}
+
+	// Decode until the last row of both crops, discarding the rows above
+	const int lumaRows = yFactor * DCTSIZE;
+	while ((int)cinfo.output_scanline < height) {
+		int startRow = cinfo.output_scanline;
+		if (startRow >= m_luma.getCrop().bottom
+			&& startRow / yFactor >= m_chroma.getCrop().bottom
+		) {
+			break;
+		}
+		(void)jpeg_read_raw_data(&cinfo, planes, lumaRows);
+		for (int r = 0; r < lumaRows; r++) {
+			copyLumaRow(m_luma, startRow + r, planes[0][r]);
+		}
+		for (int r = 0; r < DCTSIZE; r++) {
+			copyChromaRow(m_chroma, startRow / yFactor + r, planes[1][r], planes[2][r]);
+		}
+	}
+	jpeg_abort_decompress(&cinfo);
+}
+
+void InputYcc::setCoverage(const Coverage & coverage) {
+	// The JFIF conversion, as used by libjpeg
+	const double r = coverage.fill[0], g = coverage.fill[1], b = coverage.fill[2];
+	auto toByte = [] (double v) {
+		return (uint8_t)std::clamp((int)lround(v), 0, 255);
+	};
+	const uint8_t luma[1] = {toByte(0.299 * r + 0.587 * g + 0.114 * b)};
+	const uint8_t chroma[2] = {
+		toByte(128 - 0.168735892 * r - 0.331264108 * g + 0.5 * b),
+		toByte(128 + 0.5 * r - 0.418687589 * g - 0.081312411 * b)};
+	m_luma.setCoverage(coverage, luma);
+	m_chroma.setCoverage(coverage, chroma);
+}
+
+} // namespace
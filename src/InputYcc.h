@@ -0,0 +1,85 @@
+#ifndef PANO_INPUTYCC_H
+#define PANO_INPUTYCC_H
+
+#include "ImagePlane.h"
+#include "InputImage.h"
+#include "InputSource.h"
+
+namespace PanoProjector {
+
+/**
+ * A JPEG image decoded to its YCbCr planes with jpeg_read_raw_data(), for
+ * extractFaceYcc(). Unlike InputJpeg, the colour is not converted to RGB,
+ * and the chroma is stored at its native resolution, so a 4:2:0 image needs
+ * half the memory.
+ *
+ * The luma is stored in one plane, and Cb and Cr are interleaved in a
+ * second plane. The image must be YCbCr with unsubsampled luma and 1x1
+ * chroma sampling factors, that is 4:4:4, 4:2:2, 4:4:0 or 4:2:0, otherwise
+ * an error is thrown.
+ */
+class InputYcc {
+public:
+	/**
+	 * Decode the image within the crop rectangle, in image coordinates
+	 * scaled to 0≤u≤1 and 0≤v≤1
+	 */
+	InputYcc(const InputSource & source, const CropRect & cropRect);
+
+	InputYcc(const InputYcc & other) = delete;
+
+	~InputYcc();
+
+	/** Get the image width */
+	int getWidth() const {
+		return m_luma.getWidth();
+	}
+
+	/** Get the image height */
+	int getHeight() const {
+		return m_luma.getHeight();
+	}
+
+	/** Get metadata from the image file */
+	const Metadata & getMetadata() const {
+		return m_metadata;
+	}
+
+	/** Get the luma plane */
+	ImagePlane<1> & getLuma() {
+		return m_luma;
+	}
+
+	/** Get the interleaved Cb and Cr plane */
+	ImagePlane<2> & getChroma() {
+		return m_chroma;
+	}
+
+	/**
+	 * Set the part of the sphere covered by the image, for a partial
+	 * panorama. The fill colour is converted to YCbCr.
+	 */
+	void setCoverage(const Coverage & coverage);
+
+private:
+	/** Decode the planes after the source has been attached */
+	void decode(struct jpeg_decompress_struct & cinfo, const CropRect & cropRect);
+
+	/** Release the planes and the memory reservations */
+	void release();
+
+	ImagePlane<1> m_luma;
+	ImagePlane<2> m_chroma;
+	Metadata m_metadata;
+
+	/** The buffer holding both planes */
+	uint8_t * m_data;
+	size_t m_dataSize;
+
+	unsigned long m_reserved;
+	unsigned long m_extraMem;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,70 @@
+#include <atomic>
+#include <stdexcept>
+#include "Isa.h"
+
+namespace PanoProjector {
+
+/** The selected ISA level, or -1 if it has not been detected yet */
+static std::atomic<int> g_isa(-1);
+
+Isa detectIsa() {
+#ifdef PANO_MULTI_ISA
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")
+		&& __builtin_cpu_supports("avx512bw")
+		&& __builtin_cpu_supports("avx512dq")
+		&& __builtin_cpu_supports("avx512vl")
+		&& __builtin_cpu_supports("avx2")
+		&& __builtin_cpu_supports("fma")
+		&& __builtin_cpu_supports("bmi2")
+	) {
+		return Isa::Avx512;
+	}
+	if (__builtin_cpu_supports("avx2")
+		&& __builtin_cpu_supports("fma")
+		&& __builtin_cpu_supports("bmi2")
+	) {
+		return Isa::Avx2;
+	}
+#endif
+	return Isa::Baseline;
+}
+
+Isa getIsa() {
+	int isa = g_isa.load(std::memory_order_relaxed);
+	if (isa < 0) {
+		isa = (int)detectIsa();
+		g_isa = isa;
+	}
+	return (Isa)isa;
+}
+
+void setIsa(Isa isa) {
+	if ((int)isa > (int)detectIsa()) {
+		throw std::runtime_error(std::string("The CPU does not support ")
+			+ getIsaName(isa));
+	}
+	g_isa = (int)isa;
+}
+
+Isa getIsaFromName(const std::string & name) {
+	if (name == "baseline") {
+		return Isa::Baseline;
+	} else if (name == "avx2") {
+		return Isa::Avx2;
+	} else if (name == "avx512") {
+		return Isa::Avx512;
+	}
+	throw std::runtime_error("Invalid ISA \"" + name + "\"");
+}
+
+const char * getIsaName(Isa isa) {
+	switch (isa) {
+		case Isa::Baseline: return "baseline";
+		case Isa::Avx2: return "avx2";
+		case Isa::Avx512: return "avx512";
+	}
+	return "unknown";
+}
+
+} // namespace
@@ -0,0 +1,65 @@
+#ifndef PANO_ISA_H
+#define PANO_ISA_H
+
+#include <string>
+
+namespace PanoProjector {
+
+/**
+ * The instruction set levels for which the hot kernels are compiled
+ */
+enum class Isa {
+	/** The compiler's default target, for example x86-64 with SSE2 */
+	Baseline,
+	/** AVX2, FMA and BMI2, as in Haswell and later */
+	Avx2,
+	/** AVX-512 F, BW, DQ and VL, as in Skylake-SP and later */
+	Avx512,
+};
+
+/**
+ * Get the best ISA level supported by the CPU
+ */
+Isa detectIsa();
+
+/**
+ * Get the ISA level used by the kernels. This is detected on first use,
+ * unless it was overridden with setIsa().
+ */
+Isa getIsa();
+
+/**
+ * Override the ISA level used by the kernels. Throw an error if the CPU
+ * doesn't support it.
+ */
+void setIsa(Isa isa);
+
+/**
+ * Get the ISA level for a name accepted by --isa. Throw if it is invalid.
+ */
+Isa getIsaFromName(const std::string & name);
+
+/**
+ * Get the name of an ISA level
+ */
+const char * getIsaName(Isa isa);
+
+} // namespace
+
+// Function attributes for the kernel variants. The ISA extensions are
+// enabled without changing -march, since GCC won't inline functions with a
+// different arch or tune into them. Functions called from a variant must be
+// inlined into it to benefit, since an out-of-line copy of an inline
+// function is compiled for the baseline and shared by all variants.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PANO_MULTI_ISA
+#define PANO_TARGET_AVX2 \
+	__attribute__((target("avx2,fma,bmi,bmi2,lzcnt,popcnt,f16c")))
+#define PANO_TARGET_AVX512 \
+	__attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma,bmi,bmi2,lzcnt,popcnt,f16c")))
+#endif
+
+/** Force a kernel helper to be inlined into each ISA variant */
+#define PANO_KERNEL_INLINE inline __attribute__((always_inline))
+
+#endif
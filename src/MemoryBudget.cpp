@@ -1,6 +1,10 @@
 #include <stdexcept>
 #include <sstream>
 #include <climits>
+#include <cstdio>
+#include <iomanip>
+#include <sys/resource.h>
+#include <unistd.h>
 #include "MemoryBudget.h"
 
 namespace PanoProjector {
@@ -8,14 +12,16 @@ namespace PanoProjector {
 MemoryBudget g_memBudget;
 
 MemoryBudget::MemoryBudget()
-	: m_limit(ULONG_MAX), m_usage(0)
+	: m_limit(ULONG_MAX), m_usage(0), m_highWater(0), m_categories()
 {}
 
 void MemoryBudget::setLimit(unsigned long limit) {
 	m_limit = limit;
 }
 
-unsigned long MemoryBudget::reserve(unsigned long x, unsigned long y, unsigned long z) {
+unsigned long MemoryBudget::reserve(MemoryCategory category,
+	unsigned long x, unsigned long y, unsigned long z
+) {
 	unsigned long increment, newUsage;
 	if (__builtin_umull_overflow(x, y, &increment)) {
 		// Integer overflow
@@ -25,20 +31,98 @@ unsigned long MemoryBudget::reserve(unsigned long x, unsigned long y, unsigned l
 		// Integer overflow
 		throwError(x, y, z);
 	}
-	if (__builtin_uaddl_overflow(increment, m_usage, &newUsage)) {
-		// Integer overflow
-		throwError(x, y, z);
-	}
-	if (newUsage > m_limit) {
-		// Limit exceeded
-		throwError(x, y, z);
-	}
-	m_usage = newUsage;
+	unsigned long oldUsage = m_usage.load();
+	do {
+		if (__builtin_uaddl_overflow(increment, oldUsage, &newUsage)) {
+			// Integer overflow
+			throwError(x, y, z);
+		}
+		if (newUsage > m_limit) {
+			// Limit exceeded
+			throwError(x, y, z);
+		}
+	} while (!m_usage.compare_exchange_weak(oldUsage, newUsage));
+
+	updateHighWater(m_highWater, newUsage);
+	Category & c = m_categories[(int)category];
+	updateHighWater(c.highWater, c.usage += increment);
 	return increment;
 }
 
-void MemoryBudget::release(unsigned long x, unsigned long y, unsigned long z) noexcept {
+void MemoryBudget::release(MemoryCategory category,
+	unsigned long x, unsigned long y, unsigned long z
+) noexcept {
 	m_usage -= x * y * z;
+	m_categories[(int)category].usage -= x * y * z;
+}
+
+void MemoryBudget::updateHighWater(std::atomic<unsigned long> & highWater,
+	unsigned long value
+) noexcept {
+	unsigned long old = highWater.load();
+	while (old < value && !highWater.compare_exchange_weak(old, value)) {
+	}
+}
+
+const char * MemoryBudget::getCategoryName(MemoryCategory category) {
+	switch (category) {
+		case MemoryCategory::DecodeCoefficients:
+			return "decode coefficients";
+		case MemoryCategory::InputCrop:
+			return "input crop";
+		case MemoryCategory::EncoderState:
+			return "encoder state";
+		case MemoryCategory::TileBuffers:
+			return "tile buffers";
+		case MemoryCategory::RemapTables:
+			return "remap tables";
+	}
+	return "unknown";
+}
+
+void MemoryBudget::report(std::ostream & out) const {
+	auto mib = [] (unsigned long bytes) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1) << bytes / 1048576.0;
+		return ss.str();
+	};
+
+	out << "Memory usage (MiB):\n"
+		<< std::setw(24) << std::left << "category"
+		<< std::setw(10) << std::right << "current"
+		<< std::setw(10) << "peak" << "\n";
+	for (int i = 0; i < NUM_CATEGORIES; i++) {
+		auto category = (MemoryCategory)i;
+		out << std::setw(24) << std::left << getCategoryName(category)
+			<< std::setw(10) << std::right << mib(getUsage(category))
+			<< std::setw(10) << mib(getHighWater(category)) << "\n";
+	}
+	out << std::setw(24) << std::left << "total accounted"
+		<< std::setw(10) << std::right << mib(getUsage())
+		<< std::setw(10) << mib(getHighWater()) << "\n";
+
+	// Compare against the actual RSS
+	unsigned long currentRss = 0;
+	FILE * f = fopen("/proc/self/statm", "r");
+	if (f) {
+		unsigned long size, resident;
+		if (fscanf(f, "%lu %lu", &size, &resident) == 2) {
+			currentRss = resident * sysconf(_SC_PAGESIZE);
+		}
+		fclose(f);
+	}
+	struct rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	unsigned long peakRss = usage.ru_maxrss * 1024UL;
+	out << std::setw(24) << std::left << "process RSS"
+		<< std::setw(10) << std::right << mib(currentRss)
+		<< std::setw(10) << mib(peakRss) << "\n";
+	if (peakRss > getHighWater()) {
+		out << "Unaccounted peak: " << mib(peakRss - getHighWater()) << " MiB\n";
+	}
+	if (m_limit != ULONG_MAX) {
+		out << "Limit: " << mib(m_limit) << " MiB\n";
+	}
 }
 
 void MemoryBudget::throwError(unsigned long x, unsigned long y, unsigned long z) const {
@@ -55,4 +139,4 @@ void MemoryBudget::throwError(unsigned long x, unsigned long y, unsigned long z)
 	throw std::runtime_error(ss.str());
 }
 
-} // PanoProjector
\ No newline at end of file
+} // PanoProjector
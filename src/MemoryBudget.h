@@ -1,17 +1,44 @@
 #ifndef PANO_MEMORYBUDGET_H
 #define PANO_MEMORYBUDGET_H
 
+#include <atomic>
+#include <ostream>
+
 namespace PanoProjector {
 
+/**
+ * The kinds of allocation tracked by MemoryBudget
+ */
+enum class MemoryCategory {
+	/** Coefficient buffers for progressive and multi-scan JPEG decoding */
+	DecodeCoefficients,
+	/** The decoded input image crop */
+	InputCrop,
+	/** Encoder working memory, for each open output image */
+	EncoderState,
+	/** Row buffers in the output pipeline */
+	TileBuffers,
+	/** Precomputed coordinate tables */
+	RemapTables,
+};
+
 /**
  * Memory accounting
  *
- * Currently we are only accounting for memory which is proportional to the
- * image area. Memory which is proportional to the width is considered to be
- * insignificant.
+ * Allocations are accounted in named categories, and the limit applies to the
+ * total. The counters are atomic so that the budget can be shared by
+ * multiple threads.
+ *
+ * Memory which is proportional to the image area is accounted exactly.
+ * Encoder working memory is an estimate, since libjpeg does not report it.
+ * Small fixed-size allocations are not accounted, so the process RSS will
+ * be somewhat larger than the accounted usage. report() shows the difference.
  */
 class MemoryBudget {
 public:
+	/** The number of values in MemoryCategory */
+	enum { NUM_CATEGORIES = 5 };
+
 	MemoryBudget();
 
 	/**
@@ -19,32 +46,105 @@ public:
 	 */
 	void setLimit(unsigned long limit);
 
+	/**
+	 * Get the memory limit, or ULONG_MAX if there is no limit
+	 */
+	unsigned long getLimit() const { return m_limit; }
+
 	/**
 	 * Reserve an amount of memory specified in bytes by multiplying up to
 	 * three numbers, with integer overflow protection. If the limit is
-	 * exceeded, throw an error.
+	 * exceeded, throw an error. Return the number of bytes reserved.
 	 */
-	unsigned long reserve(unsigned long x, unsigned long y = 1, unsigned long z = 1);
+	unsigned long reserve(MemoryCategory category,
+		unsigned long x, unsigned long y = 1, unsigned long z = 1);
 
 	/**
 	 * Release previously reserved memory.
 	 */
-	void release(unsigned long x, unsigned long y = 1, unsigned long z = 1) noexcept;
+	void release(MemoryCategory category,
+		unsigned long x, unsigned long y = 1, unsigned long z = 1) noexcept;
 
 	/**
 	 * Get current accounted memory usage
 	 */
 	unsigned long getUsage() const { return m_usage; }
 
+	/**
+	 * Get current accounted memory usage in a category
+	 */
+	unsigned long getUsage(MemoryCategory category) const {
+		return m_categories[(int)category].usage;
+	}
+
+	/**
+	 * Get the maximum total accounted memory usage so far
+	 */
+	unsigned long getHighWater() const { return m_highWater; }
+
+	/**
+	 * Get the maximum accounted memory usage in a category so far
+	 */
+	unsigned long getHighWater(MemoryCategory category) const {
+		return m_categories[(int)category].highWater;
+	}
+
+	/**
+	 * Get the name of a category, for reporting
+	 */
+	static const char * getCategoryName(MemoryCategory category);
+
+	/**
+	 * Write a report of the current and peak usage in each category,
+	 * compared to the peak RSS of the process.
+	 */
+	void report(std::ostream & out) const;
+
 private:
+	struct Category {
+		std::atomic<unsigned long> usage;
+		std::atomic<unsigned long> highWater;
+	};
+
+	/** Raise a high water mark to at least the given value */
+	static void updateHighWater(std::atomic<unsigned long> & highWater,
+		unsigned long value) noexcept;
+
 	void throwError(unsigned long x, unsigned long y, unsigned long z) const;
 
-	unsigned long m_limit;
-	unsigned long m_usage;
+	std::atomic<unsigned long> m_limit;
+	std::atomic<unsigned long> m_usage;
+	std::atomic<unsigned long> m_highWater;
+	Category m_categories[NUM_CATEGORIES];
 };
 
 extern MemoryBudget g_memBudget;
 
+/**
+ * A reservation in g_memBudget which is released when it goes out of scope,
+ * for buffers which are held while a function runs, including when it
+ * throws
+ */
+class MemoryReservation {
+public:
+	/** Reserve memory as for MemoryBudget::reserve() */
+	MemoryReservation(MemoryCategory category,
+		unsigned long x, unsigned long y = 1, unsigned long z = 1)
+		: m_category(category), m_bytes(g_memBudget.reserve(category, x, y, z))
+	{}
+
+	MemoryReservation(const MemoryReservation & other) = delete;
+	MemoryReservation & operator=(const MemoryReservation & other) = delete;
+
+	~MemoryReservation() {
+		g_memBudget.release(m_category, m_bytes);
+	}
+
+private:
+	MemoryCategory m_category;
+	unsigned long m_bytes;
+};
+
 } // namespace
 
 #endif
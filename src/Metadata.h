@@ -23,6 +23,12 @@ enum { COMPONENTS = 3 };
 
 struct Metadata {
 	std::string icc;
+
+	/**
+	 * The XMP packet. It is read for the GPano properties of a partial
+	 * panorama, and written to identify the mapping of a cube face.
+	 */
+	std::string xmp;
 };
 
 } // namespace
@@ -6,4 +6,10 @@ namespace PanoProjector {
 	 * linker error.
 	 */
 	OutputBase::~OutputBase() {}
+
+	void OutputBase::writeRows(uint8_t * data, int count, size_t stride) {
+		for (int j = 0; j < count; j++) {
+			writeRow(data + j * stride);
+		}
+	}
 }
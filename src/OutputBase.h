@@ -1,10 +1,19 @@
 #ifndef PANO_OUTPUT_BASE_H
 #define PANO_OUTPUT_BASE_H
 
+#include <cstddef>
 #include <cstdint>
 
 namespace PanoProjector {
 
+/**
+ * The number of rows which producers pass to OutputBase::writeRows() at
+ * once, where they have the choice. This is the height of an iMCU row of a
+ * JPEG with 4:2:0 subsampling, so OutputImage can encode each batch with a
+ * single libjpeg call.
+ */
+const int OUTPUT_BATCH_ROWS = 16;
+
 /**
  * The abstract base for classes that can write image data.
  */
@@ -19,6 +28,13 @@ public:
 	 */
 	virtual void writeRow(uint8_t * data) = 0;
 
+	/**
+	 * Write a batch of rows, each starting stride bytes after the previous
+	 * one. The default calls writeRow() for each row, and subclasses
+	 * override it to save the per-row calls and copies.
+	 */
+	virtual void writeRows(uint8_t * data, int count, size_t stride);
+
 	/**
 	 * Notify the subclass that writing of rows is done. If writeRow() has not
 	 * been called the correct number of times, bad things will happen.
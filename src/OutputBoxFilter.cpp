@@ -0,0 +1,114 @@
+#include "OutputBoxFilter.h"
+#include "MemoryBudget.h"
+#include "Metadata.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace PanoProjector {
+
+/** Get the first source index of each cell, with the size at the end */
+static std::vector<int> getCellStarts(int size, int destSize) {
+	std::vector<int> start(destSize + 1);
+	for (int d = 0; d <= destSize; d++) {
+		start[d] = (int)((long)d * size / destSize);
+	}
+	return start;
+}
+
+OutputBoxFilter::OutputBoxFilter(int width, int height, OutputBase * dest)
+	: m_width(width), m_height(height), m_dest(dest),
+	m_rowIndex(0), m_destRowIndex(0), m_reserved(0)
+{
+	const int destWidth = dest->getWidth();
+	const int destHeight = dest->getHeight();
+	try {
+		if (destWidth < 1 || destHeight < 1 || destWidth > width || destHeight > height) {
+			throw std::runtime_error("A box filter can only reduce the image");
+		}
+		// The largest cell total must fit in 32 bits
+		long cellWidth = (width + destWidth - 1) / destWidth;
+		long cellHeight = (height + destHeight - 1) / destHeight;
+		if (cellWidth * cellHeight > (long)(UINT32_MAX / 256)) {
+			throw std::runtime_error("The box filter reduction is too large");
+		}
+		m_reserved = g_memBudget.reserve(MemoryCategory::TileBuffers,
+			estimateMemory(destWidth));
+	} catch (...) {
+		delete m_dest;
+		throw;
+	}
+	m_colStart = getCellStarts(width, destWidth);
+	m_rowStart = getCellStarts(height, destHeight);
+	m_sums.resize((size_t)destWidth * COMPONENTS);
+	m_destRow.resize((size_t)destWidth * COMPONENTS);
+}
+
+OutputBoxFilter::~OutputBoxFilter() {
+	g_memBudget.release(MemoryCategory::TileBuffers, m_reserved);
+	delete m_dest;
+}
+
+unsigned long OutputBoxFilter::estimateMemory(int destWidth) {
+	return (unsigned long)destWidth * COMPONENTS * (sizeof(uint32_t) + 1);
+}
+
+void OutputBoxFilter::writeRow(uint8_t * data) {
+	{
+		PANO_TRACE_STAGE(Downsample);
+		const int n = m_dest->getWidth();
+		const int * start = m_colStart.data();
+		const uint8_t * src = data;
+		uint32_t * sums = m_sums.data();
+		for (int d = 0; d < n; d++) {
+			uint32_t r = 0, g = 0, b = 0;
+			for (int x = start[d]; x < start[d + 1]; x++) {
+				r += src[0];
+				g += src[1];
+				b += src[2];
+				src += COMPONENTS;
+			}
+			sums[0] += r;
+			sums[1] += g;
+			sums[2] += b;
+			sums += COMPONENTS;
+		}
+	}
+	m_rowIndex++;
+	if (m_rowIndex == m_rowStart[m_destRowIndex + 1]) {
+		flushRow();
+	}
+}
+
+void OutputBoxFilter::flushRow() {
+	{
+		PANO_TRACE_STAGE(Downsample);
+		const int n = m_dest->getWidth();
+		const uint32_t cellHeight = m_rowStart[m_destRowIndex + 1] - m_rowStart[m_destRowIndex];
+		for (int d = 0; d < n; d++) {
+			uint32_t count = (m_colStart[d + 1] - m_colStart[d]) * cellHeight;
+			for (int c = 0; c < COMPONENTS; c++) {
+				uint32_t & sum = m_sums[(size_t)d * COMPONENTS + c];
+				m_destRow[(size_t)d * COMPONENTS + c] = (uint8_t)((sum + count / 2) / count);
+				sum = 0;
+			}
+		}
+	}
+	m_dest->writeRow(m_destRow.data());
+	m_destRowIndex++;
+}
+
+void OutputBoxFilter::finish() {
+	m_dest->finish();
+}
+
+int OutputBoxFilter::getWidth() const {
+	return m_width;
+}
+
+int OutputBoxFilter::getHeight() const {
+	return m_height;
+}
+
+} // namespace
@@ -0,0 +1,69 @@
+#ifndef PANO_OUTPUT_BOX_FILTER_H
+#define PANO_OUTPUT_BOX_FILTER_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "OutputBase.h"
+
+namespace PanoProjector {
+
+/**
+ * An image output class that reduces the image by any ratio with a box
+ * filter and writes it to another output, as the rows arrive.
+ *
+ * Each destination pixel is the average of the source pixels in its cell,
+ * with the cell boundaries rounded down to whole source pixels. Each row is
+ * summed into a row of cell totals as it is written, so it costs a few
+ * additions per source pixel and no row buffers. This is meant for
+ * previews of a large image while it is being decoded, where the quality
+ * of OutputResampler isn't worth its cost.
+ */
+class OutputBoxFilter : public OutputBase {
+public:
+	/**
+	 * Constructor. The source image has the given size, and the destination
+	 * defines the size to reduce to, which must be no larger. The
+	 * destination should be allocated with "new" and becomes owned by
+	 * OutputBoxFilter.
+	 */
+	OutputBoxFilter(int width, int height, OutputBase * dest);
+
+	/** Not copyable since it owns the destination */
+	OutputBoxFilter(const OutputBoxFilter & other) = delete;
+
+	~OutputBoxFilter() override;
+
+	void writeRow(uint8_t * data) override;
+	void finish() override;
+	int getWidth() const override;
+	int getHeight() const override;
+
+	/**
+	 * Estimate the memory used by the cell totals for a destination width,
+	 * excluding the destination
+	 */
+	static unsigned long estimateMemory(int destWidth);
+
+private:
+	/** Write the average of the current row of cells to the destination */
+	void flushRow();
+
+	int m_width, m_height;
+	OutputBase * m_dest;
+
+	/** The first source column and row of each cell, and the size at the end */
+	std::vector<int> m_colStart, m_rowStart;
+
+	/** The number of source rows written, and destination rows flushed */
+	int m_rowIndex, m_destRowIndex;
+
+	/** The totals of each component of the current row of cells */
+	std::vector<uint32_t> m_sums;
+
+	std::vector<uint8_t> m_destRow;
+	unsigned long m_reserved;
+};
+
+} // namespace
+#endif
@@ -0,0 +1,45 @@
+#include "OutputFanout.h"
+
+namespace PanoProjector {
+
+OutputFanout::OutputFanout(int width, int height)
+	: m_width(width), m_height(height)
+{}
+
+OutputFanout::~OutputFanout() {
+	for (auto & output : m_outputs) {
+		delete output;
+	}
+}
+
+void OutputFanout::writeRow(uint8_t * data) {
+	for (auto & output : m_outputs) {
+		output->writeRow(data);
+	}
+}
+
+void OutputFanout::writeRows(uint8_t * data, int count, size_t stride) {
+	for (auto & output : m_outputs) {
+		output->writeRows(data, count, stride);
+	}
+}
+
+void OutputFanout::finish() {
+	for (auto & output : m_outputs) {
+		output->finish();
+	}
+}
+
+int OutputFanout::getWidth() const {
+	return m_width;
+}
+
+int OutputFanout::getHeight() const {
+	return m_height;
+}
+
+void OutputFanout::addOutput(OutputBase * output) {
+	m_outputs.push_back(output);
+}
+
+} // namespace
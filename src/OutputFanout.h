@@ -0,0 +1,46 @@
+#ifndef PANO_OUTPUT_FANOUT_H
+#define PANO_OUTPUT_FANOUT_H
+#include <cstdint>
+#include <vector>
+
+#include "OutputBase.h"
+
+namespace PanoProjector {
+
+/**
+ * An image output class that writes each row to several outputs of the same
+ * size, so that one projection can be encoded with different options, or at
+ * different sizes with an OutputResampler in front of each output.
+ */
+class OutputFanout : public OutputBase {
+public:
+	/**
+	 * Constructor. After calling this, addOutput() must be called for each
+	 * output.
+	 */
+	OutputFanout(int width, int height);
+
+	/** Not copyable since it owns the outputs */
+	OutputFanout(const OutputFanout & other) = delete;
+
+	~OutputFanout() override;
+
+	void writeRow(uint8_t * data) override;
+	void writeRows(uint8_t * data, int count, size_t stride) override;
+	void finish() override;
+	int getWidth() const override;
+	int getHeight() const override;
+
+	/**
+	 * Add an output, which must have the same size. The object should be
+	 * allocated with "new" and becomes owned by OutputFanout.
+	 */
+	void addOutput(OutputBase * output);
+
+private:
+	int m_width, m_height;
+	std::vector<OutputBase*> m_outputs;
+};
+
+} // namespace
+#endif
@@ -1,26 +1,155 @@
 #include "OutputImage.h"
+#include "MemoryBudget.h"
+#include "Tracer.h"
+#include <algorithm>
 #include <stdexcept>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 namespace PanoProjector {
 
+/**
+ * Compression objects kept for reuse by the next OutputImage on the same
+ * thread. A pyramid opens an encoder for every tile, so this saves creating
+ * the libjpeg memory manager and tables each time. An idle object only
+ * holds its permanent pool, since jpeg_abort_compress() frees the rest.
+ */
+struct EncoderCache {
+	/**
+	 * The idle encoders for files and for memory, which are kept apart since
+	 * libjpeg refuses to change the type of an encoder's destination
+	 */
+	std::vector<std::pair<jpeg_compress_struct*, jpeg_error_mgr*>> encoders[2];
+
+	~EncoderCache() {
+		for (auto & list : encoders) {
+			for (auto & encoder : list) {
+				jpeg_destroy_compress(encoder.first);
+				delete encoder.first;
+				delete encoder.second;
+			}
+		}
+	}
+};
+
+static thread_local EncoderCache t_encoderCache;
+
+/** The number of idle encoders to keep on each thread */
+static const size_t MAX_CACHED_ENCODERS = 64;
+
+/**
+ * Report a libjpeg error by throwing, rather than the default of exiting.
+ * The encoder is aborted when the OutputImage is destroyed, so it can be
+ * reused afterwards.
+ */
+[[noreturn]] static void throwEncoderError(j_common_ptr cinfo) {
+	char message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, message);
+	throw std::runtime_error(std::string("Unable to write output image: ") + message);
+}
+
+/**
+ * The buffer written by jpeg_mem_dest(), at a fixed address so that the
+ * OutputImage can be moved while the encoder refers to it
+ */
+struct OutputImage::MemoryDestination {
+	unsigned char * buffer = nullptr;
+	unsigned long size = 0;
+
+	~MemoryDestination() {
+		free(buffer);
+	}
+};
+
 OutputImage::OutputImage(const std::string & name, int width, int height,
 	const Metadata & metadata, const EncoderOptions & options)
+	: m_path(name), m_tempPath(name + ".tmp")
 {
-	m_file = fopen(name.c_str(), "wb");
+	// libjpeg doesn't report its memory usage. With the default 2x2 chroma
+	// subsampling, the preprocessing and downsampling buffers hold about two
+	// iMCU rows of 16 scanlines each.
+	m_reserved = g_memBudget.reserve(MemoryCategory::EncoderState,
+		2 * 16 * COMPONENTS, width);
+
+	m_file = fopen(m_tempPath.c_str(), "wb");
 	if (m_file == nullptr) {
+		g_memBudget.release(MemoryCategory::EncoderState, m_reserved);
 		throw std::runtime_error(
-			"Unable to open output file \"" + name + "\": " +
+			"Unable to open output file \"" + m_tempPath + "\": " +
 			std::string(strerror(errno))
 		);
 	}
-	m_cinfo = new struct jpeg_compress_struct();
-	m_jerr = new struct jpeg_error_mgr();
-	m_cinfo->err = jpeg_std_error(m_jerr);
-	jpeg_create_compress(m_cinfo);
-	jpeg_stdio_dest(m_cinfo, m_file);
-	m_cinfo->in_color_space = JCS_RGB;
+	acquireEncoder();
+	try {
+		jpeg_stdio_dest(m_cinfo, m_file);
+		start(width, height, metadata, options);
+	} catch (...) {
+		fclose(m_file);
+		remove(m_tempPath.c_str());
+		releaseEncoder();
+		g_memBudget.release(MemoryCategory::EncoderState, m_reserved);
+		throw;
+	}
+}
+
+OutputImage::OutputImage(const Sink & sink, int width, int height,
+	const Metadata & metadata, const EncoderOptions & options)
+	: m_file(nullptr), m_sink(sink), m_memory(std::make_unique<MemoryDestination>())
+{
+	// As for a file. The encoded image is not accounted for, since its size
+	// is not known in advance.
+	m_reserved = g_memBudget.reserve(MemoryCategory::EncoderState,
+		2 * 16 * COMPONENTS, width);
+	acquireEncoder();
+	try {
+		jpeg_mem_dest(m_cinfo, &m_memory->buffer, &m_memory->size);
+		start(width, height, metadata, options);
+	} catch (...) {
+		releaseEncoder();
+		g_memBudget.release(MemoryCategory::EncoderState, m_reserved);
+		throw;
+	}
+}
+
+void OutputImage::acquireEncoder() {
+	auto & cache = t_encoderCache.encoders[isMemory()];
+	if (!cache.empty()) {
+		m_cinfo = cache.back().first;
+		m_jerr = cache.back().second;
+		cache.pop_back();
+	} else {
+		m_cinfo = new struct jpeg_compress_struct();
+		m_jerr = new struct jpeg_error_mgr();
+		m_cinfo->err = jpeg_std_error(m_jerr);
+		m_jerr->error_exit = throwEncoderError;
+		jpeg_create_compress(m_cinfo);
+	}
+}
+
+void OutputImage::releaseEncoder() {
+	auto & cache = t_encoderCache.encoders[isMemory()];
+	if (cache.size() < MAX_CACHED_ENCODERS) {
+		// Also resets an encoder which stopped at an error
+		jpeg_abort_compress(m_cinfo);
+		cache.emplace_back(m_cinfo, m_jerr);
+	} else {
+		jpeg_destroy_compress(m_cinfo);
+		delete m_cinfo;
+		delete m_jerr;
+	}
+	m_cinfo = nullptr;
+	m_jerr = nullptr;
+}
+
+void OutputImage::start(int width, int height, const Metadata & metadata,
+	const EncoderOptions & options
+) {
+	m_cinfo->in_color_space = options.rawYcc ? JCS_YCbCr : JCS_RGB;
 	jpeg_set_defaults(m_cinfo);
+	// The default sampling for YCbCr is 2x2 luma, which writeRawRows() expects
+	m_cinfo->raw_data_in = options.rawYcc;
 	jpeg_set_quality(m_cinfo, options.quality, FALSE);
 	m_cinfo->image_width = width;
 	m_cinfo->image_height = height;
@@ -34,39 +163,94 @@ OutputImage::OutputImage(const std::string & name, int width, int height,
 			reinterpret_cast<const JOCTET*>(metadata.icc.data()),
 			static_cast<unsigned int>(metadata.icc.length()));
 	}
+
+	// The XMP packet goes in an APP1 marker after a namespace prefix, and
+	// must fit in a single marker
+	static const char xmpPrefix[] = "http://ns.adobe.com/xap/1.0/";
+	if (!metadata.xmp.empty() && sizeof(xmpPrefix) + metadata.xmp.length() <= 65533) {
+		std::string marker = std::string(xmpPrefix, sizeof(xmpPrefix)) + metadata.xmp;
+		jpeg_write_marker(m_cinfo, JPEG_APP0 + 1,
+			reinterpret_cast<const JOCTET*>(marker.data()),
+			static_cast<unsigned int>(marker.length()));
+	}
 }
 
 OutputImage::OutputImage(OutputImage && other) noexcept
-	: m_file(other.m_file),
+	: m_path(std::move(other.m_path)),
+	m_tempPath(std::move(other.m_tempPath)),
+	m_file(other.m_file),
+	m_sink(std::move(other.m_sink)),
+	m_memory(std::move(other.m_memory)),
+	m_reserved(other.m_reserved),
 	m_cinfo(other.m_cinfo),
 	m_jerr(other.m_jerr)
 {
 	other.m_file = nullptr;
 	other.m_cinfo = nullptr;
 	other.m_jerr = nullptr;
+	other.m_reserved = 0;
 }
 
 OutputImage::~OutputImage() {
 	if (m_file) {
+		// Not finished, so discard the partial file
 		fclose(m_file);
 		m_file = nullptr;
+		remove(m_tempPath.c_str());
 	}
 	if (m_cinfo) {
-		jpeg_destroy_compress(m_cinfo);
-		delete m_cinfo;
-		delete m_jerr;
+		releaseEncoder();
 	}
+	g_memBudget.release(MemoryCategory::EncoderState, m_reserved);
 }
 
 void OutputImage::writeRow(uint8_t * data)
 {
+	PANO_TRACE_STAGE(Encode);
 	jpeg_write_scanlines(m_cinfo, &data, 1);
 }
 
+void OutputImage::writeRows(uint8_t * data, int count, size_t stride) {
+	PANO_TRACE_STAGE(Encode);
+	JSAMPROW rows[OUTPUT_BATCH_ROWS];
+	while (count > 0) {
+		int n = std::min(count, OUTPUT_BATCH_ROWS);
+		for (int j = 0; j < n; j++) {
+			rows[j] = data + j * stride;
+		}
+		n = jpeg_write_scanlines(m_cinfo, rows, n);
+		data += n * stride;
+		count -= n;
+	}
+}
+
+void OutputImage::writeRawRows(JSAMPIMAGE planes) {
+	PANO_TRACE_STAGE(Encode);
+	jpeg_write_raw_data(m_cinfo, planes, 2 * DCTSIZE);
+}
+
 void OutputImage::finish() {
-	jpeg_finish_compress(m_cinfo);
-	fclose(m_file);
+	{
+		PANO_TRACE_STAGE(Encode);
+		jpeg_finish_compress(m_cinfo);
+	}
+	if (isMemory()) {
+		m_sink(m_memory->buffer, m_memory->size);
+		return;
+	}
+	int result = fclose(m_file);
 	m_file = nullptr;
+	if (result != 0) {
+		remove(m_tempPath.c_str());
+		throw std::runtime_error(
+			"Unable to write output file \"" + m_tempPath + "\": " +
+			std::string(strerror(errno)));
+	}
+	if (rename(m_tempPath.c_str(), m_path.c_str()) != 0) {
+		throw std::runtime_error(
+			"Unable to rename output file to \"" + m_path + "\": " +
+			std::string(strerror(errno)));
+	}
 }
 
 int OutputImage::getWidth() const {
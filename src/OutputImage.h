@@ -3,6 +3,8 @@
 
 #include <string>
 #include <cstdio>
+#include <functional>
+#include <memory>
 #include <jpeglib.h>
 #include <jerror.h>
 
@@ -13,16 +15,33 @@
 namespace PanoProjector {
 
 /**
- * An output class that writes to a JPEG file.
+ * An output class that writes to a JPEG file, or to memory.
+ *
+ * The data is written to a temporary file in the same directory, which is
+ * renamed to the final name when finish() is called. So a file with the
+ * final name is always complete, even if the process is killed.
  */
 class OutputImage : public OutputBase {
 public:
+	/**
+	 * A function which receives the encoded image when finish() is called.
+	 * The buffer is freed after it returns.
+	 */
+	typedef std::function<void(const uint8_t * data, size_t size)> Sink;
+
 	/**
 	 * Open the file and begin the JPEG compression
 	 */
 	OutputImage(const std::string & name, int width, int height,
 		const Metadata & metadata, const EncoderOptions & options);
 
+	/**
+	 * Begin the JPEG compression to a buffer in memory, which will be passed
+	 * to the sink
+	 */
+	OutputImage(const Sink & sink, int width, int height,
+		const Metadata & metadata, const EncoderOptions & options);
+
 	/** Not copyable due to resource and memory ownership */
 	OutputImage(const OutputImage & other) = delete;
 
@@ -31,12 +50,44 @@ public:
 
 	~OutputImage() override;
 	void writeRow(uint8_t * data) override;
+	void writeRows(uint8_t * data, int count, size_t stride) override;
+
+	/**
+	 * Write an iMCU row of YCbCr planes: 16 rows of luma, and 8 rows each of
+	 * Cb and Cr, padded to multiples of 16 and 8 samples respectively. Rows
+	 * below the bottom of the image are ignored. The encoder must have been
+	 * created with EncoderOptions::rawYcc.
+	 */
+	void writeRawRows(JSAMPIMAGE planes);
+
 	void finish() override;
 	int getWidth() const override;
 	int getHeight() const override;
 
 private:
+	struct MemoryDestination;
+
+	/** Whether the image is written to memory rather than a file */
+	bool isMemory() const {
+		return m_memory != nullptr;
+	}
+
+	/** Take an encoder from the thread's cache, or create one */
+	void acquireEncoder();
+
+	/** Abort the compression and return the encoder to the thread's cache */
+	void releaseEncoder();
+
+	/** Set the parameters and begin the compression, after the destination */
+	void start(int width, int height, const Metadata & metadata,
+		const EncoderOptions & options);
+
+	std::string m_path;
+	std::string m_tempPath;
 	FILE * m_file;
+	Sink m_sink;
+	std::unique_ptr<MemoryDestination> m_memory;
+	unsigned long m_reserved;
 	struct jpeg_compress_struct * m_cinfo;
 	struct jpeg_error_mgr * m_jerr;
 };
@@ -1,27 +1,77 @@
 #include "OutputPyramid.h"
+#include "Isa.h"
+#include "MemoryBudget.h"
+#include "Metadata.h"
+#include "OutputThread.h"
+#include "Tracer.h"
 
+#include <algorithm>
+#include <bit>
 #include <cstring>
 
 namespace PanoProjector {
 
+/**
+ * The number of level 0 rows mixed at a time, so that level 1 receives
+ * batches of OUTPUT_BATCH_ROWS
+ */
+static const int BATCH_ROWS = 2 * OUTPUT_BATCH_ROWS;
+
 OutputPyramid::OutputPyramid(int levels, int width, int height)
 	: m_levels(levels), m_width(width), m_height(height),
-	m_nextRowIndex(0)
+	m_levelRows(levels)
 {
+	size_t bufferSize = 0;
+	for (int level = 0; level < m_levels; level++) {
+		bufferSize += getLevelRowSize(level) * (1 + (level ? getLevelBatchRows(level) : 0));
+	}
+	m_reserved = g_memBudget.reserve(MemoryCategory::TileBuffers, bufferSize);
+
 	m_savedRows = new uint8_t*[levels];
 	m_mixResults = new uint8_t*[levels];
 	for (int level = 0; level < m_levels; level++) {
 		m_savedRows[level] = new uint8_t[getLevelRowSize(level)];
-		m_mixResults[level] = new uint8_t[getLevelRowSize(level)];
+		m_mixResults[level] = level ?
+			new uint8_t[getLevelRowSize(level) * getLevelBatchRows(level)] : nullptr;
 	}
 	m_outputs.reserve(levels);
 }
 
+int OutputPyramid::getLevelBatchRows(int level) {
+	return std::max(BATCH_ROWS >> level, 1);
+}
+
+int OutputPyramid::getDefaultLevels(int size, int tileSize) {
+	int levels = std::bit_width((unsigned)((size - 1)/ tileSize)) + 1;
+	if (levels > 1 && size / (1 << (levels - 2)) == tileSize) {
+		// Due to rounding, we can fit slightly larger source images in a
+		// given number of levels than would be expected by just looking at
+		// the base-2 logarithm.
+		levels -= 1;
+	}
+	return levels;
+}
+
+unsigned long OutputPyramid::estimateMemory(int size, int levels, bool pipelined) {
+	unsigned long memory = pipelined ? OutputThread::estimateMemory(size) : 0;
+	for (int level = 0; level < levels; level++) {
+		unsigned long rowSize = (unsigned long)(size >> level) * COMPONENTS;
+		// OutputPyramid row buffers, and encoders as in OutputImage
+		unsigned long batchRows = level ? getLevelBatchRows(level) : 0;
+		memory += (1 + batchRows) * rowSize + 2 * 16 * rowSize;
+		if (pipelined) {
+			memory += OutputThread::estimateMemory(size >> level);
+		}
+	}
+	return memory;
+}
+
 OutputPyramid::~OutputPyramid() {
 	for (int level = 0; level < m_levels; level++) {
 		delete[] m_savedRows[level];
 		delete[] m_mixResults[level];
 	}
+	g_memBudget.release(MemoryCategory::TileBuffers, m_reserved);
 	delete[] m_savedRows;
 	delete[] m_mixResults;
 
@@ -31,27 +81,58 @@ OutputPyramid::~OutputPyramid() {
 }
 
 void OutputPyramid::writeRow(uint8_t * data) {
-	int j = m_nextRowIndex++;
-	flushRow(0, data);
-	for (int level = 1; level < m_levels; level++) {
-		if (j & (1 << (level - 1))) {
-			data = mixRow(level, data);
-			flushRow(level, data);
-		} else {
-			saveRow(level - 1, data);
-			break;
-		}
+	writeRows(data, 1, getLevelRowSize(0));
+}
+
+void OutputPyramid::writeRows(uint8_t * data, int count, size_t stride) {
+	for (int j = 0; j < count; j += BATCH_ROWS) {
+		writeLevelRows(0, data + j * stride, std::min(count - j, BATCH_ROWS), stride);
 	}
 }
 
-void OutputPyramid::flushRow(int level, uint8_t * data) {
-	m_outputs[level]->writeRow(data);
+void OutputPyramid::writeLevelRows(int level, uint8_t * data, int count, size_t stride) {
+	{
+		PANO_TRACE_LEVEL(level);
+		m_outputs[level]->writeRows(data, count, stride);
+	}
+	int j = 0;
+	bool odd = m_levelRows[level] & 1;
+	m_levelRows[level] += count;
+	if (level + 1 >= m_levels) {
+		return;
+	}
+
+	// Mix the pairs of rows directly from the batch, so only a row without
+	// a pair is copied
+	uint8_t * result = m_mixResults[level + 1];
+	const size_t resultSize = getLevelRowSize(level + 1);
+	int numResults = 0;
+	if (odd) {
+		mixRow(level + 1, m_savedRows[level], data, result);
+		numResults++;
+		j++;
+	}
+	for (; j + 1 < count; j += 2) {
+		mixRow(level + 1, data + j * stride, data + (j + 1) * stride,
+			result + numResults * resultSize);
+		numResults++;
+	}
+	if (j < count) {
+		memcpy(m_savedRows[level], data + j * stride, getLevelRowSize(level));
+	}
+	if (numResults) {
+		writeLevelRows(level + 1, result, numResults, resultSize);
+	}
 }
 
-uint8_t * OutputPyramid::mixRow(int level, const uint8_t * data) {
-	uint8_t * oldData = m_savedRows[level - 1];
-	uint8_t * result = m_mixResults[level];
-	int n = getLevelWidth(level);
+/**
+ * Average 2x2 blocks of two rows into a row of width n. If the source width
+ * is odd, the last pixel averages a 1x2 block. This is inlined into a
+ * variant for each ISA level.
+ */
+static PANO_KERNEL_INLINE void mixRowKernel(const uint8_t * oldData, const uint8_t * data,
+	uint8_t * result, int n
+) {
 	for (int si = 0, di = 0; di < n; si += 2, di++) {
 		for (int c = 0; c < 3; c++) {
 			if (si < 2 * n - 1) {
@@ -71,15 +152,45 @@ uint8_t * OutputPyramid::mixRow(int level, const uint8_t * data) {
 			}
 		}
 	}
-	return result;
 }
 
-void OutputPyramid::saveRow(int level, uint8_t * data) {
-	memcpy(m_savedRows[level], data, getLevelRowSize(level));
+static void mixRowBaseline(const uint8_t * oldData, const uint8_t * data,
+	uint8_t * result, int n
+) {
+	mixRowKernel(oldData, data, result, n);
+}
+
+#ifdef PANO_MULTI_ISA
+PANO_TARGET_AVX2 static void mixRowAvx2(const uint8_t * oldData, const uint8_t * data,
+	uint8_t * result, int n
+) {
+	mixRowKernel(oldData, data, result, n);
+}
+
+PANO_TARGET_AVX512 static void mixRowAvx512(const uint8_t * oldData, const uint8_t * data,
+	uint8_t * result, int n
+) {
+	mixRowKernel(oldData, data, result, n);
+}
+#endif
+
+void OutputPyramid::mixRow(int level, const uint8_t * oldData, const uint8_t * data,
+	uint8_t * result
+) {
+	PANO_TRACE_STAGE(Downsample, level);
+	int n = getLevelWidth(level);
+	switch (getIsa()) {
+#ifdef PANO_MULTI_ISA
+		case Isa::Avx512: mixRowAvx512(oldData, data, result, n); break;
+		case Isa::Avx2: mixRowAvx2(oldData, data, result, n); break;
+#endif
+		default: mixRowBaseline(oldData, data, result, n); break;
+	}
 }
 
 void OutputPyramid::finish() {
 	for (int level = 0; level < m_levels; level++) {
+		PANO_TRACE_LEVEL(level);
 		m_outputs[level]->finish();
 	}
 }
@@ -26,6 +26,7 @@ public:
 	~OutputPyramid() override;
 
 	void writeRow(uint8_t * data) override;
+	void writeRows(uint8_t * data, int count, size_t stride) override;
 	void finish() override;
 	int getWidth() const override;
 	int getHeight() const override;
@@ -39,6 +40,19 @@ public:
 	 * OutputPyramid. It will be deleted when OutputPyramid is destroyed.
 	 */
 	void addLevelOutput(OutputBase * output);
+
+	/**
+	 * Get the default number of levels for a square image, so that the last
+	 * level has a single tile
+	 */
+	static int getDefaultLevels(int size, int tileSize);
+
+	/**
+	 * Estimate the memory used by a pyramid of a square image with a tiler
+	 * for each level, and if pipelined, an OutputThread in front of the
+	 * pyramid and each tiler
+	 */
+	static unsigned long estimateMemory(int size, int levels, bool pipelined = false);
 private:
 	/** Get the size of a destination row, in bytes */
 	size_t getLevelRowSize(int level) const {
@@ -50,27 +64,34 @@ private:
 		return m_width >> level;
 	}
 
-	/** Write data to the destination */
-	void flushRow(int level, uint8_t * data);
+	/** Get the number of rows in the mix result buffer of a level */
+	static int getLevelBatchRows(int level);
 
 	/**
-	 * Mix the saved row data from level-1 (the previous 2x scale level)
-	 * with the specified level-1 data (also 2x scale), and produce a
-	 * destination row for the specified level, by simple block averaging.
-	 * The result will be stored to a temporary buffer and the address of
-	 * that buffer will be returned.
+	 * Write a batch of rows to the output of a level, and mix them in pairs,
+	 * with the saved row left over from the previous batch if there is one,
+	 * to produce the rows of the next level. The last row is saved if it
+	 * has no pair yet. The results are written to the next level in turn.
 	 */
-	uint8_t * mixRow(int level, const uint8_t * data);
+	void writeLevelRows(int level, uint8_t * data, int count, size_t stride);
 
 	/**
-	 * Save a row of data so that it can be mixed with a subsequent row by
-	 * mixRow().
+	 * Mix two rows of level-1 (the previous 2x scale level) and produce a
+	 * destination row for the specified level, by simple block averaging.
 	 */
-	void saveRow(int level, uint8_t * data);
+	void mixRow(int level, const uint8_t * oldData, const uint8_t * data, uint8_t * result);
 
-	int m_levels, m_width, m_height, m_nextRowIndex;
+	int m_levels, m_width, m_height;
+	unsigned long m_reserved;
 	std::vector<OutputBase*> m_outputs;
+
+	/** The number of rows written to each level so far */
+	std::vector<int> m_levelRows;
+
+	/** The last row of each level, when it is waiting for its pair */
 	uint8_t ** m_savedRows;
+
+	/** The batch of rows of each level above 0, as they are mixed */
 	uint8_t ** m_mixResults;
 };
 
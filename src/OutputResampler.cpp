@@ -0,0 +1,221 @@
+#include "OutputResampler.h"
+#include "Isa.h"
+#include "MemoryBudget.h"
+#include "Metadata.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace PanoProjector {
+
+/** The number of fractional bits of the filter weights */
+static const int WEIGHT_BITS = 14;
+
+int OutputResampler::Filter::getMaxTaps(int size, int destSize) {
+	// The filter is nonzero on an open interval of width 2*radius, which
+	// contains at most ceil(2*radius) source pixels
+	double radius = std::max((double)size / destSize, 1.0);
+	return std::min((int)std::ceil(2 * radius), size);
+}
+
+OutputResampler::Filter::Filter(int size, int destSize)
+	: taps(getMaxTaps(size, destSize)), start(destSize), weights((size_t)destSize * taps)
+{
+	const double scale = (double)size / destSize;
+	const double radius = std::max(scale, 1.0);
+	std::vector<double> exact(taps);
+	for (int d = 0; d < destSize; d++) {
+		// The pixel centres are aligned, as in OutputPyramid
+		double centre = (d + 0.5) * scale - 0.5;
+		int lo = std::max((int)std::floor(centre - radius) + 1, 0);
+		int hi = std::min((int)std::ceil(centre + radius) - 1, size - 1);
+		int first = std::min(lo, size - taps);
+		start[d] = first;
+
+		double sum = 0;
+		std::fill(exact.begin(), exact.end(), 0.0);
+		for (int s = lo; s <= hi; s++) {
+			exact[s - first] = 1 - std::fabs(s - centre) / radius;
+			sum += exact[s - first];
+		}
+
+		// Round the weights, and add the rounding error to the largest, so
+		// that a uniform colour is unchanged
+		int16_t * w = &weights[(size_t)d * taps];
+		int total = 0, largest = 0;
+		for (int k = 0; k < taps; k++) {
+			w[k] = (int16_t)lround(exact[k] / sum * (1 << WEIGHT_BITS));
+			total += w[k];
+			if (w[k] > w[largest]) {
+				largest = k;
+			}
+		}
+		w[largest] += (1 << WEIGHT_BITS) - total;
+	}
+}
+
+OutputResampler::OutputResampler(int width, int height, OutputBase * dest)
+	: m_width(width), m_height(height), m_dest(dest),
+	m_xFilter(width, dest->getWidth()), m_yFilter(height, dest->getHeight()),
+	m_nextRowIndex(0), m_nextDestRowIndex(0)
+{
+	size_t rowSize = (size_t)dest->getWidth() * COMPONENTS;
+	m_reserved = g_memBudget.reserve(MemoryCategory::TileBuffers,
+		m_yFilter.taps + 1, rowSize);
+	m_window.resize(m_yFilter.taps * rowSize);
+	m_destRow.resize(rowSize);
+}
+
+OutputResampler::~OutputResampler() {
+	g_memBudget.release(MemoryCategory::TileBuffers, m_reserved);
+	delete m_dest;
+}
+
+unsigned long OutputResampler::estimateMemory(int height, int destWidth, int destHeight) {
+	return (unsigned long)(Filter::getMaxTaps(height, destHeight) + 1)
+		* destWidth * COMPONENTS;
+}
+
+/**
+ * Scale a row horizontally to a row of width n. This is inlined into a
+ * variant for each ISA level.
+ */
+static PANO_KERNEL_INLINE void scaleRowKernel(const uint8_t * data, uint8_t * result, int n,
+	const int * start, const int16_t * weights, int taps
+) {
+	for (int di = 0; di < n; di++) {
+		const uint8_t * src = data + COMPONENTS * start[di];
+		const int16_t * w = weights + (size_t)di * taps;
+		int sum[COMPONENTS];
+		for (int c = 0; c < COMPONENTS; c++) {
+			sum[c] = 1 << (WEIGHT_BITS - 1);
+		}
+		for (int k = 0; k < taps; k++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				sum[c] += w[k] * src[COMPONENTS * k + c];
+			}
+		}
+		for (int c = 0; c < COMPONENTS; c++) {
+			result[COMPONENTS * di + c] = (uint8_t)(sum[c] >> WEIGHT_BITS);
+		}
+	}
+}
+
+/**
+ * Sum the rows of the window with the given weights into a row of n bytes.
+ * The weights are non-negative and sum to 1 << WEIGHT_BITS, so the result
+ * can't overflow.
+ */
+static PANO_KERNEL_INLINE void blendRowsKernel(const uint8_t * const * rows,
+	const int16_t * weights, int taps, uint8_t * result, size_t n
+) {
+	for (size_t i = 0; i < n; i++) {
+		int sum = 1 << (WEIGHT_BITS - 1);
+		for (int k = 0; k < taps; k++) {
+			sum += weights[k] * rows[k][i];
+		}
+		result[i] = (uint8_t)(sum >> WEIGHT_BITS);
+	}
+}
+
+static void scaleRowBaseline(const uint8_t * data, uint8_t * result, int n,
+	const int * start, const int16_t * weights, int taps
+) {
+	scaleRowKernel(data, result, n, start, weights, taps);
+}
+
+static void blendRowsBaseline(const uint8_t * const * rows,
+	const int16_t * weights, int taps, uint8_t * result, size_t n
+) {
+	blendRowsKernel(rows, weights, taps, result, n);
+}
+
+#ifdef PANO_MULTI_ISA
+PANO_TARGET_AVX2 static void scaleRowAvx2(const uint8_t * data, uint8_t * result, int n,
+	const int * start, const int16_t * weights, int taps
+) {
+	scaleRowKernel(data, result, n, start, weights, taps);
+}
+
+PANO_TARGET_AVX2 static void blendRowsAvx2(const uint8_t * const * rows,
+	const int16_t * weights, int taps, uint8_t * result, size_t n
+) {
+	blendRowsKernel(rows, weights, taps, result, n);
+}
+
+PANO_TARGET_AVX512 static void scaleRowAvx512(const uint8_t * data, uint8_t * result, int n,
+	const int * start, const int16_t * weights, int taps
+) {
+	scaleRowKernel(data, result, n, start, weights, taps);
+}
+
+PANO_TARGET_AVX512 static void blendRowsAvx512(const uint8_t * const * rows,
+	const int16_t * weights, int taps, uint8_t * result, size_t n
+) {
+	blendRowsKernel(rows, weights, taps, result, n);
+}
+#endif
+
+void OutputResampler::writeRow(uint8_t * data) {
+	int j = m_nextRowIndex++;
+	{
+		PANO_TRACE_STAGE(Downsample);
+		const int n = m_dest->getWidth();
+		uint8_t * result = &m_window[(size_t)(j % m_yFilter.taps) * n * COMPONENTS];
+		const int * start = m_xFilter.start.data();
+		const int16_t * weights = m_xFilter.weights.data();
+		const int taps = m_xFilter.taps;
+		switch (getIsa()) {
+#ifdef PANO_MULTI_ISA
+			case Isa::Avx512: scaleRowAvx512(data, result, n, start, weights, taps); break;
+			case Isa::Avx2: scaleRowAvx2(data, result, n, start, weights, taps); break;
+#endif
+			default: scaleRowBaseline(data, result, n, start, weights, taps); break;
+		}
+	}
+	flushRows();
+}
+
+void OutputResampler::flushRows() {
+	const int taps = m_yFilter.taps;
+	const size_t rowSize = m_destRow.size();
+	while (m_nextDestRowIndex < m_dest->getHeight()
+		&& m_yFilter.start[m_nextDestRowIndex] + taps <= m_nextRowIndex
+	) {
+		{
+			PANO_TRACE_STAGE(Downsample);
+			const int first = m_yFilter.start[m_nextDestRowIndex];
+			const uint8_t * rows[taps];
+			for (int k = 0; k < taps; k++) {
+				rows[k] = &m_window[(size_t)((first + k) % taps) * rowSize];
+			}
+			const int16_t * weights = &m_yFilter.weights[(size_t)m_nextDestRowIndex * taps];
+			uint8_t * result = m_destRow.data();
+			switch (getIsa()) {
+#ifdef PANO_MULTI_ISA
+				case Isa::Avx512: blendRowsAvx512(rows, weights, taps, result, rowSize); break;
+				case Isa::Avx2: blendRowsAvx2(rows, weights, taps, result, rowSize); break;
+#endif
+				default: blendRowsBaseline(rows, weights, taps, result, rowSize); break;
+			}
+		}
+		m_dest->writeRow(m_destRow.data());
+		m_nextDestRowIndex++;
+	}
+}
+
+void OutputResampler::finish() {
+	flushRows();
+	m_dest->finish();
+}
+
+int OutputResampler::getWidth() const {
+	return m_width;
+}
+
+int OutputResampler::getHeight() const {
+	return m_height;
+}
+
+} // namespace
@@ -0,0 +1,91 @@
+#ifndef PANO_OUTPUT_RESAMPLER_H
+#define PANO_OUTPUT_RESAMPLER_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "OutputBase.h"
+
+namespace PanoProjector {
+
+/**
+ * An image output class that scales the image by any ratio and writes it to
+ * another output, as the rows arrive. Unlike OutputPyramid, the ratio need
+ * not be a power of 2, and the aspect ratio may change.
+ *
+ * The filter is separable. Each row is scaled horizontally as it is
+ * written and kept in a window as tall as the vertical filter, and each
+ * destination row is written as soon as the last source row it needs has
+ * arrived. When reducing, the filter is a triangle twice as wide as a
+ * destination pixel, so every source pixel contributes. When enlarging, it
+ * is bilinear interpolation.
+ */
+class OutputResampler : public OutputBase {
+public:
+	/**
+	 * Constructor. The source image has the given size, and the destination
+	 * defines the size to scale to. The destination should be allocated
+	 * with "new" and becomes owned by OutputResampler.
+	 */
+	OutputResampler(int width, int height, OutputBase * dest);
+
+	/** Not copyable since it owns the destination */
+	OutputResampler(const OutputResampler & other) = delete;
+
+	~OutputResampler() override;
+
+	void writeRow(uint8_t * data) override;
+	void finish() override;
+	int getWidth() const override;
+	int getHeight() const override;
+
+	/**
+	 * Estimate the memory used by the row buffers for scaling an image of the
+	 * given height to a destination size, excluding the destination
+	 */
+	static unsigned long estimateMemory(int height, int destWidth, int destHeight);
+
+private:
+	/**
+	 * The fixed-point filter weights along one axis. Every destination
+	 * pixel has the same number of taps, starting at a source index which is
+	 * non-decreasing, with zero weights padding the shorter ones.
+	 */
+	struct Filter {
+		Filter(int size, int destSize);
+
+		/** Get the maximum number of taps for scaling a size */
+		static int getMaxTaps(int size, int destSize);
+
+		/** The number of taps of each destination pixel */
+		int taps;
+
+		/** The first source index of each destination pixel */
+		std::vector<int> start;
+
+		/** The weights of the taps of each destination pixel, summing to 1 << 14 */
+		std::vector<int16_t> weights;
+	};
+
+	/** Write the destination rows whose source rows have all arrived */
+	void flushRows();
+
+	int m_width, m_height;
+	OutputBase * m_dest;
+	Filter m_xFilter, m_yFilter;
+
+	/** The number of source rows written, and destination rows flushed */
+	int m_nextRowIndex, m_nextDestRowIndex;
+
+	/**
+	 * The horizontally scaled source rows within the vertical filter, with
+	 * source row j in slot j % taps
+	 */
+	std::vector<uint8_t> m_window;
+
+	std::vector<uint8_t> m_destRow;
+	unsigned long m_reserved;
+};
+
+} // namespace
+#endif
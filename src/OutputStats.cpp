@@ -0,0 +1,66 @@
+#include "OutputStats.h"
+#include "Metadata.h"
+
+#include <iomanip>
+
+namespace PanoProjector {
+
+OutputStats::OutputStats(int width, int height)
+	: m_width(width), m_height(height), m_pixels(0), m_histograms()
+{}
+
+void OutputStats::writeRow(uint8_t * data) {
+	uint64_t * red = m_histograms[RED];
+	uint64_t * green = m_histograms[GREEN];
+	uint64_t * blue = m_histograms[BLUE];
+	uint64_t * luma = m_histograms[LUMA];
+	for (int i = 0; i < m_width; i++) {
+		int r = data[0], g = data[1], b = data[2];
+		red[r]++;
+		green[g]++;
+		blue[b]++;
+		// The JPEG conversion, 0.299 R + 0.587 G + 0.114 B, in 16-bit fixed point
+		luma[(19595 * r + 38470 * g + 7471 * b + 32768) >> 16]++;
+		data += COMPONENTS;
+	}
+	m_pixels += m_width;
+}
+
+void OutputStats::finish() {}
+
+double OutputStats::getMean(Channel channel) const {
+	if (!m_pixels) {
+		return 0;
+	}
+	uint64_t sum = 0;
+	for (int v = 0; v < 256; v++) {
+		sum += v * m_histograms[channel][v];
+	}
+	return (double)sum / m_pixels;
+}
+
+void OutputStats::writeJson(std::ostream & out) const {
+	static const char * names[NUM_CHANNELS] = {"red", "green", "blue", "luma"};
+	out << "{\"width\": " << m_width << ", \"height\": " << m_height
+		<< ", \"pixels\": " << m_pixels;
+	out << std::fixed << std::setprecision(3);
+	for (int c = 0; c < NUM_CHANNELS; c++) {
+		out << ",\n \"" << names[c] << "\": {\"mean\": " << getMean((Channel)c)
+			<< ", \"histogram\": [";
+		for (int v = 0; v < 256; v++) {
+			out << (v ? ", " : "") << m_histograms[c][v];
+		}
+		out << "]}";
+	}
+	out << "}\n";
+}
+
+int OutputStats::getWidth() const {
+	return m_width;
+}
+
+int OutputStats::getHeight() const {
+	return m_height;
+}
+
+} // namespace
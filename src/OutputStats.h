@@ -0,0 +1,51 @@
+#ifndef PANO_OUTPUT_STATS_H
+#define PANO_OUTPUT_STATS_H
+#include <cstdint>
+#include <ostream>
+
+#include "OutputBase.h"
+
+namespace PanoProjector {
+
+/**
+ * An image output class that computes statistics of the rows written to it:
+ * a histogram and the mean of each component and of the luma.
+ */
+class OutputStats : public OutputBase {
+public:
+	/** The channels of the statistics */
+	enum Channel {
+		RED,
+		GREEN,
+		BLUE,
+		/** The luma, with the Rec. 601 weights as in JPEG */
+		LUMA,
+		NUM_CHANNELS
+	};
+
+	OutputStats(int width, int height);
+
+	void writeRow(uint8_t * data) override;
+	void finish() override;
+	int getWidth() const override;
+	int getHeight() const override;
+
+	/** Get the number of pixels with each value of a channel */
+	const uint64_t * getHistogram(Channel channel) const {
+		return m_histograms[channel];
+	}
+
+	/** Get the mean value of a channel, from 0 to 255 */
+	double getMean(Channel channel) const;
+
+	/** Write the statistics as a JSON object */
+	void writeJson(std::ostream & out) const;
+
+private:
+	int m_width, m_height;
+	uint64_t m_pixels;
+	uint64_t m_histograms[NUM_CHANNELS][256];
+};
+
+} // namespace
+#endif
@@ -0,0 +1,125 @@
+#include "OutputThread.h"
+#include "MemoryBudget.h"
+#include "Metadata.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace PanoProjector {
+
+OutputThread::OutputThread(OutputBase * dest, int depth)
+	: m_dest(dest),
+	m_queue(depth ? depth : RowQueue::getDefaultDepth((size_t)dest->getWidth() * COMPONENTS),
+		(size_t)dest->getWidth() * COMPONENTS),
+	m_reserved(0), m_finishing(false), m_failed(false)
+{
+	try {
+		m_reserved = g_memBudget.reserve(MemoryCategory::TileBuffers,
+			RowQueue::getMemory(m_queue.getDepth(), m_queue.getRowSize()));
+	} catch (...) {
+		delete m_dest;
+		throw;
+	}
+	m_thread = std::thread([this] {
+		run();
+	});
+}
+
+OutputThread::~OutputThread() {
+	stop(false);
+	g_memBudget.release(MemoryCategory::TileBuffers, m_reserved);
+	delete m_dest;
+}
+
+unsigned long OutputThread::estimateMemory(int width) {
+	return RowQueue::getMemory(RowQueue::MAX_DEPTH, (size_t)width * COMPONENTS);
+}
+
+void OutputThread::writeRow(uint8_t * data) {
+	writeRows(data, 1, m_queue.getRowSize());
+}
+
+void OutputThread::writeRows(uint8_t * data, int count, size_t stride) {
+	checkError();
+	const size_t rowSize = m_queue.getRowSize();
+	while (count > 0) {
+		int n = std::min(count, OUTPUT_BATCH_ROWS);
+		RowQueue::Batch & batch = m_queue.beginPush();
+		if (stride == rowSize) {
+			memcpy(batch.data, data, n * rowSize);
+		} else {
+			for (int j = 0; j < n; j++) {
+				memcpy(batch.data + j * rowSize, data + j * stride, rowSize);
+			}
+		}
+		batch.count = n;
+		batch.trace = TraceContext();
+		m_queue.endPush();
+		data += n * stride;
+		count -= n;
+	}
+}
+
+void OutputThread::run() {
+	for (;;) {
+		RowQueue::Batch & batch = m_queue.beginPop();
+		if (!batch.count) {
+			bool finishing = m_finishing;
+			m_queue.endPop();
+			if (finishing && !m_failed.load(std::memory_order_relaxed)) {
+				try {
+					m_dest->finish();
+				} catch (...) {
+					m_error = std::current_exception();
+					m_failed.store(true, std::memory_order_release);
+				}
+			}
+			return;
+		}
+		// After an error, the rows are discarded until the end of the stream
+		if (!m_failed.load(std::memory_order_relaxed)) {
+			batch.trace.apply();
+			try {
+				m_dest->writeRows(batch.data, batch.count, m_queue.getRowSize());
+			} catch (...) {
+				m_error = std::current_exception();
+				m_failed.store(true, std::memory_order_release);
+			}
+		}
+		m_queue.endPop();
+	}
+}
+
+void OutputThread::stop(bool finishing) {
+	if (!m_thread.joinable()) {
+		return;
+	}
+	m_finishing = finishing;
+	RowQueue::Batch & batch = m_queue.beginPush();
+	batch.count = 0;
+	m_queue.endPush();
+	m_thread.join();
+}
+
+void OutputThread::checkError() {
+	if (m_failed.load(std::memory_order_acquire)) {
+		stop(false);
+		std::rethrow_exception(m_error);
+	}
+}
+
+void OutputThread::finish() {
+	stop(true);
+	checkError();
+}
+
+int OutputThread::getWidth() const {
+	return m_dest->getWidth();
+}
+
+int OutputThread::getHeight() const {
+	return m_dest->getHeight();
+}
+
+} // namespace
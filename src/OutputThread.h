@@ -0,0 +1,85 @@
+#ifndef PANO_OUTPUT_THREAD_H
+#define PANO_OUTPUT_THREAD_H
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <exception>
+#include <thread>
+
+#include "OutputBase.h"
+#include "RowQueue.h"
+
+namespace PanoProjector {
+
+/**
+ * An image output class that runs another output on its own thread, so that
+ * downsampling or encoding overlaps with the stage writing the rows.
+ *
+ * The rows are copied to a RowQueue, which the thread drains into the
+ * destination in batches. When the queue is full, writeRows() waits for the
+ * thread to catch up, so the memory used is bounded by the queue depth. An
+ * error thrown by the destination is rethrown by the next call to
+ * writeRows() or finish().
+ */
+class OutputThread : public OutputBase {
+public:
+	/**
+	 * Constructor. The destination should be allocated with "new" and
+	 * becomes owned by OutputThread. If the depth is zero, it is chosen by
+	 * RowQueue::getDefaultDepth().
+	 */
+	explicit OutputThread(OutputBase * dest, int depth = 0);
+
+	/** Not copyable since it owns the destination and the thread */
+	OutputThread(const OutputThread & other) = delete;
+
+	/**
+	 * Destructor. If finish() was not called, the thread is stopped without
+	 * finishing the destination.
+	 */
+	~OutputThread() override;
+
+	void writeRow(uint8_t * data) override;
+	void writeRows(uint8_t * data, int count, size_t stride) override;
+	void finish() override;
+	int getWidth() const override;
+	int getHeight() const override;
+
+	/**
+	 * Estimate the memory used by the queue for an image of the given
+	 * width, excluding the destination
+	 */
+	static unsigned long estimateMemory(int width);
+
+private:
+	/** The main loop of the thread */
+	void run();
+
+	/**
+	 * Send the end of the stream and wait for the thread to exit. The thread
+	 * finishes the destination if finishing is true.
+	 */
+	void stop(bool finishing);
+
+	/** Stop the thread and rethrow the error of the destination, if any */
+	void checkError();
+
+	OutputBase * m_dest;
+	RowQueue m_queue;
+	unsigned long m_reserved;
+
+	/**
+	 * Whether the thread should finish the destination at the end of the
+	 * stream. It is set before the last batch is pushed.
+	 */
+	bool m_finishing;
+
+	/** The error thrown by the destination, set before m_failed */
+	std::exception_ptr m_error;
+	std::atomic<bool> m_failed;
+
+	std::thread m_thread;
+};
+
+} // namespace
+#endif
@@ -1,5 +1,6 @@
 #include "OutputTiler.h"
 
+#include <algorithm>
 #include <string>
 
 namespace PanoProjector {
@@ -16,22 +17,40 @@ OutputTiler::OutputTiler(const std::string & prefix, const std::string & suffix,
 	  m_numTilesWide(width / tileWidth + (width % tileWidth ? 1 : 0)),
 	  m_numTilesHigh(height / tileHeight + (height % tileHeight ? 1 : 0)),
 	  m_rowIndex(0),
-	  m_prefix(prefix), m_suffix(suffix)
+	  m_prefix(prefix), m_suffix(suffix),
+	  m_mask(nullptr), m_maskLevel(0), m_stripOpen(false), m_stripRow(0)
 {}
 
+OutputTiler::OutputTiler(const TileSink & sink,
+	int width, int height, int tileWidth, int tileHeight,
+	const Metadata & metadata, const EncoderOptions & options
+)
+	: OutputTiler("", "", width, height, tileWidth, tileHeight, metadata, options)
+{
+	m_tileSink = sink;
+}
+
 OutputTiler::OutputTiler(OutputTiler && other) noexcept
 	: m_width(other.m_width),
 	  m_height(other.m_height),
 	  m_tileWidth(other.m_tileWidth),
 	  m_tileHeight(other.m_tileHeight),
 	  m_metadata(other.m_metadata),
+	  m_options(other.m_options),
 	  m_numTilesWide(other.m_numTilesWide),
 	  m_numTilesHigh(other.m_numTilesHigh),
-	  m_rowIndex(other.m_rowIndex)
+	  m_rowIndex(other.m_rowIndex),
+	  m_tileSink(std::move(other.m_tileSink)),
+	  m_mask(other.m_mask),
+	  m_maskLevel(other.m_maskLevel),
+	  m_stripDoneCallback(std::move(other.m_stripDoneCallback)),
+	  m_stripOpen(other.m_stripOpen),
+	  m_stripRow(other.m_stripRow)
 {
 	m_prefix.swap(other.m_prefix);
 	m_suffix.swap(other.m_suffix);
 	m_outputs.swap(other.m_outputs);
+	m_outputCols.swap(other.m_outputCols);
 }
 
 OutputTiler::~OutputTiler()
@@ -39,8 +58,8 @@ OutputTiler::~OutputTiler()
 
 void OutputTiler::writeRow(uint8_t * data) {
 	openStrip();
-	for (int t = 0; t < m_numTilesWide; t++) {
-		m_outputs[t].writeRow(data + 3 * t * m_tileWidth);
+	for (size_t i = 0; i < m_outputs.size(); i++) {
+		m_outputs[i].writeRow(data + 3 * m_outputCols[i] * m_tileWidth);
 	}
 	if (m_rowIndex % m_tileHeight == m_tileHeight - 1) {
 		closeStrip();
@@ -48,6 +67,23 @@ void OutputTiler::writeRow(uint8_t * data) {
 	m_rowIndex++;
 }
 
+void OutputTiler::writeRows(uint8_t * data, int count, size_t stride) {
+	while (count > 0) {
+		// Pass each tile the part of the batch within the current strip
+		int n = std::min(count, m_tileHeight - m_rowIndex % m_tileHeight);
+		openStrip();
+		for (size_t i = 0; i < m_outputs.size(); i++) {
+			m_outputs[i].writeRows(data + 3 * m_outputCols[i] * m_tileWidth, n, stride);
+		}
+		m_rowIndex += n;
+		if (m_rowIndex % m_tileHeight == 0) {
+			closeStrip();
+		}
+		data += n * stride;
+		count -= n;
+	}
+}
+
 void OutputTiler::finish() {
 	if (isStripOpen()) {
 		closeStrip();
@@ -58,22 +94,37 @@ void OutputTiler::openStrip() {
 	if (isStripOpen()) {
 		return;
 	}
+	m_stripOpen = true;
+	m_stripRow = m_rowIndex / m_tileHeight;
 	for (int t = 0; t < m_numTilesWide; t++) {
-		std::string path = m_prefix
-			+ to_string(m_rowIndex / m_tileHeight)
-			+ "_" + to_string(t) + m_suffix;
+		if (!isTileSelected(m_stripRow, t)) {
+			continue;
+		}
 		int tileWidth, tileHeight;
 		if (t == m_numTilesWide - 1) {
 			tileWidth = m_width - m_tileWidth * (m_numTilesWide -1);
 		} else {
 			tileWidth = m_tileWidth;
 		}
-		if (m_rowIndex / m_tileHeight == m_numTilesHigh - 1) {
+		if (m_stripRow == m_numTilesHigh - 1) {
 			tileHeight = m_height - m_tileHeight * (m_numTilesHigh - 1);
 		} else {
 			tileHeight = m_tileHeight;
 		}
-		m_outputs.emplace_back(path, tileWidth, tileHeight, m_metadata, m_options);
+		if (m_tileSink) {
+			OutputImage::Sink sink = [tileSink = m_tileSink, row = m_stripRow, t]
+				(const uint8_t * data, size_t size)
+			{
+				tileSink(row, t, data, size);
+			};
+			m_outputs.emplace_back(sink, tileWidth, tileHeight, m_metadata, m_options);
+		} else {
+			std::string path = m_prefix
+				+ to_string(m_stripRow)
+				+ "_" + to_string(t) + m_suffix;
+			m_outputs.emplace_back(path, tileWidth, tileHeight, m_metadata, m_options);
+		}
+		m_outputCols.push_back(t);
 	}
 }
 
@@ -82,6 +133,11 @@ void OutputTiler::closeStrip() {
 		output.finish();
 	}
 	m_outputs.clear();
+	m_outputCols.clear();
+	m_stripOpen = false;
+	if (m_stripDoneCallback) {
+		m_stripDoneCallback(m_stripRow);
+	}
 }
 
 int OutputTiler::getWidth() const {
@@ -92,4 +148,13 @@ int OutputTiler::getHeight() const {
 	return m_height;
 }
 
+void OutputTiler::setTileMask(const TileMask * mask, int level) {
+	m_mask = mask;
+	m_maskLevel = level;
+}
+
+void OutputTiler::setStripDoneCallback(std::function<void(int)> callback) {
+	m_stripDoneCallback = std::move(callback);
+}
+
 }
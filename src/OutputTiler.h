@@ -1,9 +1,11 @@
 #ifndef PANO_OUTPUT_TILER_H
 #define PANO_OUTPUT_TILER_H
 
+#include <functional>
 #include <string>
 #include <vector>
 #include "OutputImage.h"
+#include "TileMask.h"
 
 namespace PanoProjector {
 
@@ -15,6 +17,12 @@ namespace PanoProjector {
  */
 class OutputTiler : public OutputBase {
 public:
+	/**
+	 * A function which receives an encoded tile with its zero-based row and
+	 * column index
+	 */
+	typedef std::function<void(int row, int col, const uint8_t * data, size_t size)> TileSink;
+
 	/**
 	 * Create an OutputTiler. Images will be saved at the path
 	 *
@@ -27,6 +35,11 @@ public:
 		int width, int height, int tileWidth, int tileHeight,
 		const Metadata & metadata, const EncoderOptions & options);
 
+	/** Create an OutputTiler which passes the tiles to a function */
+	OutputTiler(const TileSink & sink,
+		int width, int height, int tileWidth, int tileHeight,
+		const Metadata & metadata, const EncoderOptions & options);
+
 	/** Not copyable because OutputImage is not copyable */
 	OutputTiler(const OutputTiler & other) = delete;
 
@@ -35,17 +48,35 @@ public:
 
 	~OutputTiler() override;
 	void writeRow(uint8_t * data) override;
+	void writeRows(uint8_t * data, int count, size_t stride) override;
 	void finish() override;
 	int getWidth() const override;
 	int getHeight() const override;
 
+	/**
+	 * Only write the tiles which are marked in the given level of the mask.
+	 * Rows for unmarked tiles are discarded. The mask must outlive the tiler.
+	 */
+	void setTileMask(const TileMask * mask, int level);
+
+	/**
+	 * Set a function to be called with the tile row index after each strip
+	 * of tiles has been completely written.
+	 */
+	void setStripDoneCallback(std::function<void(int)> callback);
+
 private:
 	/**
 	 * Determine if the row of tiles containing the source pixel coordinate
 	 * m_rowIndex is present in m_outputs.
 	 */
 	bool isStripOpen() const {
-		return !m_outputs.empty();
+		return m_stripOpen;
+	}
+
+	/** Determine whether the tile at the given position should be written */
+	bool isTileSelected(int row, int col) const {
+		return !m_mask || m_mask->isMarked(m_maskLevel, row, col);
 	}
 
 	/**
@@ -74,7 +105,30 @@ private:
 	int m_rowIndex;
 
 	std::string m_prefix, m_suffix;
+
+	/** The function receiving the tiles, or empty to write files */
+	TileSink m_tileSink;
+
+	/** The selected tiles, or null to write all tiles */
+	const TileMask * m_mask;
+
+	/** The level of m_mask which corresponds to this tiler */
+	int m_maskLevel;
+
+	/** The function to call when a strip is complete */
+	std::function<void(int)> m_stripDoneCallback;
+
+	/** Whether openStrip() has been called for the current strip */
+	bool m_stripOpen;
+
+	/** The tile row index of the current strip */
+	int m_stripRow;
+
+	/** The open images in the current strip */
 	std::vector<OutputImage> m_outputs;
+
+	/** The tile column index of each image in m_outputs */
+	std::vector<int> m_outputCols;
 };
 
 } // namespace
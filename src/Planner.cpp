@@ -0,0 +1,478 @@
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <stdexcept>
+#include <thread>
+
+#include "Planner.h"
+#include "FaceInfo.h"
+#include "InputBlank.h"
+#include "InputImageFactory.h"
+#include "IntegerCropRect.h"
+#include "MemoryBudget.h"
+#include "Tracer.h"
+#include "extractFace.h"
+
+namespace PanoProjector {
+
+/** Pixels per second skipped above the crop, which only need entropy decoding */
+static const double ENTROPY_RATE = 450e6;
+
+/** Pixels per second within the crop, which need IDCT and color conversion */
+static const double RECONSTRUCT_RATE = 300e6;
+
+/** Output pixels per second for projection and encoding */
+static const double PROJECT_RATE = 25e6;
+
+/** The seconds of overhead for each decode, for reading headers and tables */
+static const double DECODE_OVERHEAD = 0.002;
+
+/** Memory used by the process regardless of the image size */
+static const unsigned long BASE_MEMORY = 8 * 1048576;
+
+/**
+ * The number of samples on each edge of a cell when estimating its crop
+ * rectangle. Planning is a small fraction of the run time with this.
+ */
+static const int ESTIMATE_SAMPLES = 16;
+
+/**
+ * The band grids to try, in approximate order of increasing cost. Beyond
+ * these, the time grows much faster than the memory shrinks.
+ */
+static const int g_bandGrids[][2] = {
+	{2, 1}, {4, 1}, {8, 1}, {4, 2}, {8, 2}, {16, 2}, {8, 4}, {16, 4},
+	{32, 4}, {16, 8}, {32, 8}
+};
+
+Planner::Planner(const InputInfo & info, const std::vector<int> & faces,
+	int cubeSize, unsigned long outputMemory
+)
+	: m_info(info), m_faces(faces), m_cubeSize(cubeSize),
+	m_outputMemory(outputMemory), m_precision(Precision::Standard),
+	m_mapping(CubeMapping::Standard), m_pipelined(false), m_tee(nullptr)
+{}
+
+InputImage * Planner::createInput(const InputSource & source, const CropRect & cropRect,
+	OutputBase * tee
+) const {
+	CropRect imageRect;
+	InputImage * input;
+	if (m_coverage.getImageCropRect(cropRect, imageRect)) {
+		input = InputImageFactory::create(source, imageRect, 1, tee);
+	} else {
+		input = new InputBlank(m_info.width, m_info.height);
+	}
+	input->setCoverage(m_coverage);
+	return input;
+}
+
+unsigned long Planner::getDecodeMemory(const CropRect & cropRect) const {
+	CropRect imageRect;
+	if (!m_coverage.getImageCropRect(cropRect, imageRect)) {
+		return 0;
+	}
+	IntegerCropRect crop(imageRect, m_info.width, m_info.height);
+	unsigned long sourceWidth = crop.wrap ? m_info.width : crop.width;
+	return (unsigned long)crop.height
+		* (COMPONENTS * crop.width + m_info.extraBytesPerPixel * sourceWidth)
+		+ m_info.extraBytes;
+}
+
+/** Get the extent of the blocks of the given size covering a range */
+static double getBlockSpan(int start, int end, int blockSize) {
+	return (double)((end + blockSize - 1) / blockSize - start / blockSize) * blockSize;
+}
+
+double Planner::getDecodedWidth(const IntegerCropRect & crop) const {
+	int blockWidth = m_info.blockWidth;
+	if (!blockWidth) {
+		return m_info.width;
+	}
+	return crop.wrap
+		? getBlockSpan(0, crop.right, blockWidth) + getBlockSpan(crop.left, m_info.width, blockWidth)
+		: getBlockSpan(crop.left, crop.right, blockWidth);
+}
+
+double Planner::getDecodeTime(const CropRect & cropRect) const {
+	CropRect imageRect;
+	if (!m_coverage.getImageCropRect(cropRect, imageRect)) {
+		return 0;
+	}
+	IntegerCropRect crop(imageRect, m_info.width, m_info.height);
+	if (m_info.blockHeight) {
+		// Only the blocks which intersect the crop are decoded
+		return DECODE_OVERHEAD + getBlockSpan(crop.top, crop.bottom, m_info.blockHeight)
+			* getDecodedWidth(crop) / RECONSTRUCT_RATE;
+	}
+	// Rows above the crop are skipped, and rows below are not read. All
+	// columns need entropy decoding, but only the cropped columns are
+	// reconstructed, unless the crop wraps around.
+	double sourceWidth = crop.wrap ? m_info.width : crop.width;
+	return DECODE_OVERHEAD
+		+ (double)crop.bottom * m_info.width / ENTROPY_RATE
+		+ (double)crop.height * sourceWidth / RECONSTRUCT_RATE;
+}
+
+CropRect Planner::getCellCropRect(int face, int bandRows, int bandCols, int row, int col,
+	bool estimate
+) const {
+	double scale = 2.0 / m_cubeSize;
+	auto toPlane = [&] (int pixel) {
+		return mappingToPlane(m_mapping, pixel * scale - 1);
+	};
+	return FaceInfo::getRegionCropRect(face,
+		toPlane(getBandStart(bandCols, col)),
+		toPlane(getBandStart(bandCols, col + 1)),
+		toPlane(getBandStart(bandRows, row)),
+		toPlane(getBandStart(bandRows, row + 1)),
+		estimate ? ESTIMATE_SAMPLES : 256,
+		getMaxAngleError(m_precision),
+		m_rotation);
+}
+
+CropRect Planner::getFaceCropRect(int face) const {
+	return FaceInfo::getCropRect(face, getMaxAngleError(m_precision), m_rotation);
+}
+
+CropRect Planner::getSingleCropRect() const {
+	return m_faces.size() == 1 && !m_tee ? getFaceCropRect(m_faces[0]) : CropRect{0, 1, 0, 1};
+}
+
+void Planner::estimate(ExecutionPlan & plan) const {
+	unsigned long decodeMemory = 0, previousMemory = 0;
+	double decodeTime = 0;
+	int numInputs = 0;
+	auto addInput = [&] (const CropRect & cropRect) {
+		unsigned long memory = getDecodeMemory(cropRect);
+		// When pipelined, the previous input is in use while this one is decoded
+		decodeMemory = std::max(decodeMemory, memory + (m_pipelined ? previousMemory : 0));
+		previousMemory = memory;
+		decodeTime += getDecodeTime(cropRect);
+		numInputs++;
+	};
+	switch (plan.strategy) {
+		case DecodeStrategy::Single:
+			addInput(getSingleCropRect());
+			break;
+		case DecodeStrategy::PerFace:
+			for (int face : m_faces) {
+				addInput(getFaceCropRect(face));
+			}
+			break;
+		case DecodeStrategy::Bands:
+			for (int face : m_faces) {
+				for (int row = 0; row < plan.bandRows; row++) {
+					for (int col = 0; col < plan.bandCols; col++) {
+						addInput(getCellCropRect(face,
+							plan.bandRows, plan.bandCols, row, col, true));
+					}
+				}
+			}
+			break;
+	}
+	// The buffer for a batch of output rows, or for a band of them if the
+	// bands are decoded in cells
+	unsigned long bufferRows = OUTPUT_BATCH_ROWS;
+	if (plan.strategy == DecodeStrategy::Bands && plan.bandCols > 1) {
+		bufferRows = getBandStart(plan.bandRows, 1);
+	}
+	decodeMemory += bufferRows * m_cubeSize * COMPONENTS;
+	plan.memory = BASE_MEMORY + m_outputMemory + decodeMemory;
+	double projectTime = (double)m_cubeSize * m_cubeSize * m_faces.size() / PROJECT_RATE;
+	if (m_pipelined && numInputs > 1 && std::thread::hardware_concurrency() > 1) {
+		// With a spare core, only the first input is decoded before the
+		// projection starts
+		plan.seconds = std::max(decodeTime, projectTime) + decodeTime / numInputs;
+	} else {
+		plan.seconds = decodeTime + projectTime;
+	}
+}
+
+std::vector<ExecutionPlan> Planner::getPlans() const {
+	PANO_TRACE_SPAN("plan");
+	std::vector<ExecutionPlan> plans;
+	ExecutionPlan plan;
+	plan.strategy = DecodeStrategy::Single;
+	estimate(plan);
+	plans.push_back(plan);
+	if (m_tee) {
+		return plans;
+	}
+	if (m_faces.size() > 1) {
+		plan.strategy = DecodeStrategy::PerFace;
+		estimate(plan);
+		plans.push_back(plan);
+	}
+	for (auto & grid : g_bandGrids) {
+		if (grid[0] > m_cubeSize || grid[1] > m_cubeSize) {
+			break;
+		}
+		plan.strategy = DecodeStrategy::Bands;
+		plan.bandRows = grid[0];
+		plan.bandCols = grid[1];
+		estimate(plan);
+		plans.push_back(plan);
+	}
+	std::stable_sort(plans.begin(), plans.end(),
+		[] (const ExecutionPlan & a, const ExecutionPlan & b) {
+			return a.seconds < b.seconds;
+		});
+	return plans;
+}
+
+ExecutionPlan Planner::choosePlan(unsigned long limit) const {
+	auto plans = getPlans();
+	for (auto & plan : plans) {
+		if (plan.memory <= limit) {
+			return plan;
+		}
+	}
+	return *std::min_element(plans.begin(), plans.end(),
+		[] (const ExecutionPlan & a, const ExecutionPlan & b) {
+			return a.memory < b.memory;
+		});
+}
+
+ExecutionPlan Planner::getPlanByName(const std::string & name, unsigned long limit) const {
+	if (name == "auto") {
+		return choosePlan(limit);
+	}
+	DecodeStrategy strategy;
+	if (name == "single") {
+		strategy = DecodeStrategy::Single;
+	} else if (name == "per-face") {
+		strategy = DecodeStrategy::PerFace;
+	} else if (name == "bands") {
+		strategy = DecodeStrategy::Bands;
+	} else {
+		throw std::runtime_error("Invalid strategy \"" + name + "\", must be one of: "
+			"auto, single, per-face, bands");
+	}
+	// Choose the fastest plan of the given strategy which fits, or the
+	// smallest one if none fit
+	const ExecutionPlan * chosen = nullptr;
+	auto plans = getPlans();
+	for (auto & plan : plans) {
+		if (plan.strategy != strategy) {
+			continue;
+		}
+		if (plan.memory <= limit) {
+			return plan;
+		}
+		if (!chosen || plan.memory < chosen->memory) {
+			chosen = &plan;
+		}
+	}
+	if (!chosen) {
+		// PerFace with a single face is the same as Single
+		return choosePlan(limit);
+	}
+	return *chosen;
+}
+
+std::string Planner::getStrategyName(const ExecutionPlan & plan) {
+	switch (plan.strategy) {
+		case DecodeStrategy::Single:
+			return "single";
+		case DecodeStrategy::PerFace:
+			return "per-face";
+		case DecodeStrategy::Bands:
+			return "bands " + std::to_string(plan.bandRows) + "x"
+				+ std::to_string(plan.bandCols);
+	}
+	return "unknown";
+}
+
+void Planner::describe(std::ostream & out, unsigned long limit) const {
+	auto plans = getPlans();
+	auto chosen = choosePlan(limit);
+	out << std::fixed << std::setprecision(1);
+	if (limit == ULONG_MAX) {
+		out << "Memory limit: none\n";
+	} else {
+		out << "Memory limit: " << limit / 1048576.0 << " MiB\n";
+	}
+	out << std::setw(16) << std::left << "strategy"
+		<< std::setw(14) << std::right << "memory (MiB)"
+		<< std::setw(10) << "time (s)" << "\n";
+	for (auto & plan : plans) {
+		out << std::setw(16) << std::left << getStrategyName(plan)
+			<< std::setw(14) << std::right << plan.memory / 1048576.0
+			<< std::setw(10) << std::setprecision(2) << plan.seconds
+			<< std::setprecision(1)
+			<< (plan.memory > limit ? "  (does not fit)" : "") << "\n";
+	}
+	out << "Chosen: " << getStrategyName(chosen) << "\n";
+}
+
+void Planner::execute(const ExecutionPlan & plan, const InputSource & source,
+	const OutputFactory & makeOutput
+) const {
+	switch (plan.strategy) {
+		case DecodeStrategy::Single: {
+			std::unique_ptr<InputImage> input(
+				createInput(source, getSingleCropRect(), m_tee));
+			for (int face : m_faces) {
+				auto output = makeOutput(face);
+				extractFace(face, *input, *output, m_precision, m_rotation, m_mapping);
+			}
+			break;
+		}
+		case DecodeStrategy::PerFace:
+			forEachInput((int)m_faces.size(), [&] (int i) {
+				return createInput(source, getFaceCropRect(m_faces[i]));
+			}, [&] (int i, InputImage & input) {
+				auto output = makeOutput(m_faces[i]);
+				extractFace(m_faces[i], input, *output, m_precision, m_rotation, m_mapping);
+			});
+			break;
+		case DecodeStrategy::Bands:
+			for (int face : m_faces) {
+				PANO_TRACE_SPAN("face", face);
+				auto output = makeOutput(face);
+				executeBands(plan, face, source, *output);
+			}
+			break;
+	}
+}
+
+InputImage * Planner::createSharedInput(const InputSource & source) const {
+	return createInput(source, getSingleCropRect());
+}
+
+bool Planner::getSharedImageCropRect(CropRect & imageRect) const {
+	return m_coverage.getImageCropRect(getSingleCropRect(), imageRect);
+}
+
+void Planner::executeFace(int face, InputImage & input, OutputBase & output) const {
+	extractFace(face, input, output, m_precision, m_rotation, m_mapping);
+}
+
+void Planner::executeFace(const ExecutionPlan & plan, int face, const InputSource & source,
+	OutputBase & output
+) const {
+	if (plan.strategy == DecodeStrategy::Bands) {
+		PANO_TRACE_SPAN("face", face);
+		executeBands(plan, face, source, output);
+		return;
+	}
+	CropRect cropRect = plan.strategy == DecodeStrategy::Single
+		? getSingleCropRect() : getFaceCropRect(face);
+	std::unique_ptr<InputImage> input(createInput(source, cropRect));
+	extractFace(face, *input, output, m_precision, m_rotation, m_mapping);
+}
+
+void Planner::forEachInput(int count, const std::function<InputImage*(int)> & create,
+	const std::function<void(int, InputImage &)> & process
+) const {
+	if (!m_pipelined) {
+		for (int i = 0; i < count; i++) {
+			std::unique_ptr<InputImage> input(create(i));
+			process(i, *input);
+		}
+		return;
+	}
+	// The decoder thread inherits the face for tracing
+	TraceContext trace;
+	auto decode = [&create, trace] (int i) {
+		trace.apply();
+		return std::unique_ptr<InputImage>(create(i));
+	};
+	auto next = std::async(std::launch::async, decode, 0);
+	for (int i = 0; i < count; i++) {
+		std::unique_ptr<InputImage> input = next.get();
+		if (i + 1 < count) {
+			next = std::async(std::launch::async, decode, i + 1);
+		}
+		process(i, *input);
+	}
+}
+
+void Planner::executeBands(const ExecutionPlan & plan, int face,
+	const InputSource & source, OutputBase & output
+) const {
+	size_t rowSize = (size_t)m_cubeSize * COMPONENTS;
+	int maxBandHeight = getBandStart(plan.bandRows, 1) + 1;
+	unsigned long bufferRows = plan.bandCols > 1 ? maxBandHeight : OUTPUT_BATCH_ROWS;
+	MemoryReservation reserved(MemoryCategory::TileBuffers, bufferRows, rowSize);
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[bufferRows * rowSize]);
+
+	// Decode the cells in row order
+	forEachInput(plan.bandRows * plan.bandCols, [&] (int cell) {
+		return createInput(source, getCellCropRect(face, plan.bandRows, plan.bandCols,
+			cell / plan.bandCols, cell % plan.bandCols));
+	}, [&] (int cell, InputImage & input) {
+		PANO_TRACE_SPAN("cell");
+		int row = cell / plan.bandCols;
+		int col = cell % plan.bandCols;
+		int startRow = getBandStart(plan.bandRows, row);
+		int endRow = getBandStart(plan.bandRows, row + 1);
+		if (plan.bandCols == 1) {
+			// Stream the rows directly to the output
+			for (int j = startRow; j < endRow; j += OUTPUT_BATCH_ROWS) {
+				int batchEnd = std::min(j + OUTPUT_BATCH_ROWS, endRow);
+				extractFaceRegion(face, input, m_cubeSize, j, batchEnd, 0, m_cubeSize,
+					buffer.get(), rowSize, m_precision, m_rotation, m_mapping);
+				output.writeRows(buffer.get(), batchEnd - j, rowSize);
+			}
+		} else {
+			// Fill the band buffer one cell at a time
+			int startCol = getBandStart(plan.bandCols, col);
+			extractFaceRegion(face, input, m_cubeSize, startRow, endRow,
+				startCol, getBandStart(plan.bandCols, col + 1),
+				buffer.get() + startCol * COMPONENTS, rowSize, m_precision, m_rotation,
+				m_mapping);
+			if (col == plan.bandCols - 1) {
+				output.writeRows(buffer.get(), endRow - startRow, rowSize);
+			}
+		}
+	});
+	output.finish();
+}
+
+/**
+ * Read a single number from a file, or return ULONG_MAX if the file doesn't
+ * exist or contains something else, such as "max"
+ */
+static unsigned long readLimitFile(const std::string & path) {
+	std::ifstream in(path);
+	unsigned long value;
+	if (in >> value) {
+		return value;
+	}
+	return ULONG_MAX;
+}
+
+unsigned long Planner::getDefaultLimit() {
+	unsigned long limit = ULONG_MAX;
+
+	// cgroup v2: find our cgroup from the "0::" line
+	std::ifstream cgroups("/proc/self/cgroup");
+	std::string line;
+	while (std::getline(cgroups, line)) {
+		if (line.starts_with("0::")) {
+			limit = std::min(limit,
+				readLimitFile("/sys/fs/cgroup" + line.substr(3) + "/memory.max"));
+		}
+	}
+	limit = std::min(limit, readLimitFile("/sys/fs/cgroup/memory.max"));
+
+	// cgroup v1 reports a huge number when there is no limit
+	limit = std::min(limit,
+		readLimitFile("/sys/fs/cgroup/memory/memory.limit_in_bytes"));
+
+	// The available RAM, in KiB
+	std::ifstream meminfo("/proc/meminfo");
+	while (std::getline(meminfo, line)) {
+		if (line.starts_with("MemAvailable:")) {
+			limit = std::min(limit, std::stoul(line.substr(13)) * 1024);
+			break;
+		}
+	}
+	return limit;
+}
+
+} // namespace
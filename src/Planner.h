@@ -0,0 +1,275 @@
+#ifndef PANO_PLANNER_H
+#define PANO_PLANNER_H
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Coverage.h"
+#include "CubeMapping.h"
+#include "InputImage.h"
+#include "InputSource.h"
+#include "OutputBase.h"
+#include "Precision.h"
+#include "Rotation.h"
+
+namespace PanoProjector {
+
+/**
+ * The ways in which the input can be decoded to extract a set of faces
+ */
+enum class DecodeStrategy {
+	/** Decode the input once, cropped to the union of the faces */
+	Single,
+	/** Decode the input once per face, cropped to the face */
+	PerFace,
+	/**
+	 * Split each face into a grid of cells, and decode the input once per
+	 * cell, cropped to the cell. Rows of cells are buffered so that the output
+	 * is still written in row order.
+	 */
+	Bands,
+};
+
+/**
+ * A strategy with its parameters and estimated cost
+ */
+struct ExecutionPlan {
+	DecodeStrategy strategy = DecodeStrategy::Single;
+
+	/** The number of rows of cells per face, for DecodeStrategy::Bands */
+	int bandRows = 1;
+
+	/** The number of columns of cells per face, for DecodeStrategy::Bands */
+	int bandCols = 1;
+
+	/** The estimated peak memory usage in bytes */
+	unsigned long memory = 0;
+
+	/** The estimated run time in seconds */
+	double seconds = 0;
+};
+
+/**
+ * Choose how to decode the input so that extracting a set of faces fits in a
+ * memory limit, and then do it.
+ *
+ * The estimates are based on the crop rectangles the decoder would use. The
+ * time estimate is rough, with throughput figures measured on a single
+ * recent x86-64 core, but it is only used to rank the plans.
+ */
+class Planner {
+public:
+	/**
+	 * A function which creates the output for a face. extractFace() will
+	 * call finish() on it when the face is complete.
+	 */
+	typedef std::function<std::unique_ptr<OutputBase>(int face)> OutputFactory;
+
+	/**
+	 * Constructor
+	 *
+	 * @param info The input image information
+	 * @param faces The faces to be extracted
+	 * @param cubeSize The face width and height in pixels
+	 * @param outputMemory The estimated memory used by the output for each
+	 *   face, for example encoders and row buffers
+	 */
+	Planner(const InputInfo & info, const std::vector<int> & faces, int cubeSize,
+		unsigned long outputMemory);
+
+	/**
+	 * Set the precision of the sampling kernels. The crop rectangles are
+	 * widened by the maximum angle error of the tier.
+	 */
+	void setPrecision(Precision precision) {
+		m_precision = precision;
+	}
+
+	/**
+	 * Set how the pixels are distributed over each face. The crop
+	 * rectangles of bands and cells are mapped with it.
+	 */
+	void setMapping(CubeMapping mapping) {
+		m_mapping = mapping;
+	}
+
+	/**
+	 * Set the orientation of the cube. The crop rectangles are rotated with
+	 * it.
+	 */
+	void setRotation(const Rotation & rotation) {
+		m_rotation = rotation;
+	}
+
+	/**
+	 * Set the part of the sphere covered by the input, for a partial
+	 * panorama. The crop rectangles are clipped to it, and an input which
+	 * would be cropped to nothing is not decoded.
+	 */
+	void setCoverage(const Coverage & coverage) {
+		m_coverage = coverage;
+	}
+
+	/**
+	 * Set whether to decode ahead. With DecodeStrategy::PerFace and
+	 * DecodeStrategy::Bands, the input for the next face or cell is then
+	 * decoded on another thread while the current one is projected, so two
+	 * inputs are held at once.
+	 */
+	void setPipelined(bool pipelined) {
+		m_pipelined = pipelined;
+	}
+
+	/**
+	 * Set an output of the input image size, to which each row of the whole
+	 * input is written as it is decoded, for a preview or statistics. Only
+	 * DecodeStrategy::Single decodes the whole input, so it becomes the only
+	 * plan. The caller owns the tee and finishes it after execute().
+	 */
+	void setDecodeTee(OutputBase * tee) {
+		m_tee = tee;
+	}
+
+	/**
+	 * Get the candidate plans, in order of increasing estimated time
+	 */
+	std::vector<ExecutionPlan> getPlans() const;
+
+	/**
+	 * Get the fastest plan which fits within the memory limit, or if none
+	 * fit, the plan with the least memory.
+	 */
+	ExecutionPlan choosePlan(unsigned long limit) const;
+
+	/**
+	 * Get the plan using the given strategy name, as accepted by --strategy,
+	 * or choose a plan if the name is "auto". Throw if the name is invalid.
+	 */
+	ExecutionPlan getPlanByName(const std::string & name, unsigned long limit) const;
+
+	/**
+	 * Write the candidate plans and the chosen plan, for --plan
+	 */
+	void describe(std::ostream & out, unsigned long limit) const;
+
+	/**
+	 * Extract the faces according to the plan
+	 */
+	void execute(const ExecutionPlan & plan, const InputSource & source,
+		const OutputFactory & makeOutput) const;
+
+	/**
+	 * Decode the input once for all of the faces, as in
+	 * DecodeStrategy::Single, for extracting the faces concurrently with
+	 * executeFace()
+	 */
+	InputImage * createSharedInput(const InputSource & source) const;
+
+	/**
+	 * Get the image crop rectangle which createSharedInput() decodes, for a
+	 * decoder other than InputImageFactory. Returns false if the faces lie
+	 * outside the covered area, so nothing needs to be decoded.
+	 */
+	bool getSharedImageCropRect(CropRect & imageRect) const;
+
+	/**
+	 * Extract one face from an input created by createSharedInput(). This
+	 * may be called concurrently for different faces.
+	 */
+	void executeFace(int face, InputImage & input, OutputBase & output) const;
+
+	/**
+	 * Extract one face according to the plan, decoding the input for that
+	 * face alone. This may be called concurrently for different faces, each
+	 * using the memory of the plan. For DecodeStrategy::Single, it is
+	 * cheaper to share an input from createSharedInput().
+	 */
+	void executeFace(const ExecutionPlan & plan, int face, const InputSource & source,
+		OutputBase & output) const;
+
+	/**
+	 * Get the name of a strategy
+	 */
+	static std::string getStrategyName(const ExecutionPlan & plan);
+
+	/**
+	 * Get the memory limit to use if none was specified: the cgroup memory
+	 * limit or the available RAM, whichever is smaller.
+	 */
+	static unsigned long getDefaultLimit();
+
+private:
+	/**
+	 * Get the crop rectangle of a cell, for DecodeStrategy::Bands. If
+	 * estimate is true, the rectangle is cheaper to compute, but may be
+	 * slightly too small to decode the cell.
+	 */
+	CropRect getCellCropRect(int face, int bandRows, int bandCols, int row, int col,
+		bool estimate = false) const;
+
+	/**
+	 * Get the crop rectangle of a face, or if there are multiple faces, the
+	 * whole image, for DecodeStrategy::Single
+	 */
+	CropRect getSingleCropRect() const;
+
+	/** Get the crop rectangle of a face, for DecodeStrategy::PerFace */
+	CropRect getFaceCropRect(int face) const;
+
+	/** Get the row or column index of the start of a band */
+	int getBandStart(int numBands, int band) const {
+		return (int)((long)m_cubeSize * band / numBands);
+	}
+
+	/**
+	 * Decode the input within a crop rectangle in full panorama coordinates,
+	 * or if it lies outside the covered area, create a blank input
+	 */
+	InputImage * createInput(const InputSource & source, const CropRect & cropRect,
+		OutputBase * tee = nullptr) const;
+
+	/** Estimate the decoder memory usage for a crop, in bytes */
+	unsigned long getDecodeMemory(const CropRect & cropRect) const;
+
+	/**
+	 * Get the number of columns decoded for a crop by a block decoder, which
+	 * is all of them if the blocks are strips
+	 */
+	double getDecodedWidth(const IntegerCropRect & crop) const;
+
+	/** Estimate the decode time for a crop, in seconds */
+	double getDecodeTime(const CropRect & cropRect) const;
+
+	/** Get the estimated cost of a plan */
+	void estimate(ExecutionPlan & plan) const;
+
+	/**
+	 * Create a number of inputs in order, and pass each one to a function
+	 * before deleting it. If pipelined, the next input is created on another
+	 * thread while the function runs.
+	 */
+	void forEachInput(int count, const std::function<InputImage*(int)> & create,
+		const std::function<void(int, InputImage &)> & process) const;
+
+	/** Execute DecodeStrategy::Bands for one face */
+	void executeBands(const ExecutionPlan & plan, int face, const InputSource & source,
+		OutputBase & output) const;
+
+	InputInfo m_info;
+	std::vector<int> m_faces;
+	int m_cubeSize;
+	unsigned long m_outputMemory;
+	Precision m_precision;
+	CubeMapping m_mapping;
+	Rotation m_rotation;
+	Coverage m_coverage;
+	bool m_pipelined;
+	OutputBase * m_tee;
+};
+
+} // namespace
+
+#endif
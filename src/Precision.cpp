@@ -0,0 +1,52 @@
+#include <stdexcept>
+#include "Precision.h"
+
+namespace PanoProjector {
+
+static double s_meshTolerance = 0.05;
+
+Precision getPrecisionFromName(const std::string & name) {
+	if (name == "fast") {
+		return Precision::Fast;
+	} else if (name == "standard") {
+		return Precision::Standard;
+	} else if (name == "exact") {
+		return Precision::Exact;
+	} else if (name == "mesh") {
+		return Precision::Mesh;
+	}
+	throw std::runtime_error("Invalid precision \"" + name + "\"");
+}
+
+const char * getPrecisionName(Precision precision) {
+	switch (precision) {
+		case Precision::Fast: return "fast";
+		case Precision::Standard: return "standard";
+		case Precision::Exact: return "exact";
+		case Precision::Mesh: return "mesh";
+	}
+	return "unknown";
+}
+
+double getMaxAngleError(Precision precision) {
+	switch (precision) {
+		case Precision::Fast: return FastPrecision::MAX_ANGLE_ERROR;
+		case Precision::Standard: return StandardPrecision::MAX_ANGLE_ERROR;
+		case Precision::Exact: return ExactPrecision::MAX_ANGLE_ERROR;
+		case Precision::Mesh: return MeshPrecision::MAX_ANGLE_ERROR;
+	}
+	return 0;
+}
+
+void setMeshTolerance(double pixels) {
+	if (!(pixels > 0)) {
+		throw std::runtime_error("The mesh tolerance must be positive");
+	}
+	s_meshTolerance = pixels;
+}
+
+double getMeshTolerance() {
+	return s_meshTolerance;
+}
+
+} // namespace
@@ -0,0 +1,122 @@
+#ifndef PANO_PRECISION_H
+#define PANO_PRECISION_H
+
+#include <cmath>
+#include <string>
+#include "InputImage.h"
+#include "atanApprox.h"
+
+namespace PanoProjector {
+
+/**
+ * The accuracy tiers of the sampling kernels, selected with --precision
+ */
+enum class Precision {
+	/** A 5th order arctangent polynomial and fixed-point interpolation */
+	Fast,
+	/** An 11th order arctangent polynomial and fixed-point interpolation */
+	Standard,
+	/** atan2f() and floating point interpolation rounded to nearest */
+	Exact,
+	/**
+	 * Standard at the points of a sparse grid, with the source coordinates
+	 * interpolated linearly in between
+	 */
+	Mesh,
+};
+
+/**
+ * Kernel policies for extractFaceTpl(). Each provides atan2() and
+ * interpolate() for an InputImage or an ImagePlane, and MAX_ANGLE_ERROR, a
+ * bound on the error of atan2() in radians, including float rounding, which
+ * is used to widen the crop rectangles so that the sample points always fall
+ * inside them. MESH_STEP is the spacing of the grid in face pixels at which
+ * the coordinates are computed, or zero to compute them at every pixel.
+ */
+struct FastPrecision {
+	static constexpr Precision PRECISION = Precision::Fast;
+	static constexpr double MAX_ANGLE_ERROR = 7e-4;
+	static constexpr int MESH_STEP = 0;
+
+	PANO_KERNEL_INLINE static float atan2(float y, float x) {
+		return atan2f_approx<atan_approx_fast>(y, x);
+	}
+
+	template <class Image>
+	PANO_KERNEL_INLINE static void interpolate(Image & input, uint8_t * dest, float x, float y) {
+		input.interpolate(dest, x, y);
+	}
+};
+
+struct StandardPrecision {
+	static constexpr Precision PRECISION = Precision::Standard;
+	static constexpr double MAX_ANGLE_ERROR = 5e-6;
+	static constexpr int MESH_STEP = 0;
+
+	PANO_KERNEL_INLINE static float atan2(float y, float x) {
+		return atan2f_approx(y, x);
+	}
+
+	template <class Image>
+	PANO_KERNEL_INLINE static void interpolate(Image & input, uint8_t * dest, float x, float y) {
+		input.interpolate(dest, x, y);
+	}
+};
+
+struct ExactPrecision {
+	static constexpr Precision PRECISION = Precision::Exact;
+	static constexpr double MAX_ANGLE_ERROR = 1e-6;
+	static constexpr int MESH_STEP = 0;
+
+	PANO_KERNEL_INLINE static float atan2(float y, float x) {
+		return atan2f(y, x);
+	}
+
+	template <class Image>
+	PANO_KERNEL_INLINE static void interpolate(Image & input, uint8_t * dest, float x, float y) {
+		input.interpolateFloat(dest, x, y);
+	}
+};
+
+/**
+ * The standard policy evaluated on a grid of 16x16 pixel cells. A cell is
+ * interpolated only if, at its centre and the midpoints of its edges, the
+ * interpolated coordinates are within the mesh tolerance of the computed
+ * ones, and within MAX_ANGLE_ERROR. Otherwise, as across the seam and
+ * around the poles, every pixel of the cell is computed.
+ */
+struct MeshPrecision : StandardPrecision {
+	static constexpr Precision PRECISION = Precision::Mesh;
+	static constexpr double MAX_ANGLE_ERROR = 1e-3;
+	static constexpr int MESH_STEP = 16;
+};
+
+/**
+ * Get the tier for a name accepted by --precision. Throw if it is invalid.
+ */
+Precision getPrecisionFromName(const std::string & name);
+
+/**
+ * Get the name of a tier
+ */
+const char * getPrecisionName(Precision precision);
+
+/**
+ * Get MAX_ANGLE_ERROR of the policy for a tier
+ */
+double getMaxAngleError(Precision precision);
+
+/**
+ * Set the largest error in source pixels of the coordinates interpolated by
+ * Precision::Mesh, as selected with --mesh-tolerance. The default is 0.05.
+ */
+void setMeshTolerance(double pixels);
+
+/**
+ * Get the mesh tolerance in source pixels
+ */
+double getMeshTolerance();
+
+} // namespace
+
+#endif
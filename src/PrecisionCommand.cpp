@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "PrecisionCommand.h"
+#include "FaceInfo.h"
+
+namespace PanoProjector {
+
+/**
+ * A small input image filled with random pixels, for measuring the
+ * interpolation error
+ */
+class NoiseInput : public InputImage {
+public:
+	NoiseInput(int width, int height) {
+		m_width = width;
+		m_height = height;
+		m_crop = IntegerCropRect(CropRect{0, 1, 0, 1}, width, height);
+		m_data = new uint8_t[(size_t)width * height * COMPONENTS];
+		std::minstd_rand rng(1);
+		for (size_t i = 0; i < (size_t)width * height * COMPONENTS; i++) {
+			m_data[i] = (uint8_t)rng();
+		}
+	}
+
+	~NoiseInput() override {
+		delete[] m_data;
+	}
+};
+
+void PrecisionCommand::initOptions() {
+	m_visible.add_options()
+		("help",
+			"Show help message and exit")
+		("samples", po::value<int>()->default_value(1024),
+			"The number of sample points across each face")
+		("width", po::value<int>()->default_value(16384),
+			"The input image width for which to show the maximum sample "
+			"position error in pixels")
+		("mesh-tolerance", po::value<double>()->default_value(0.05, "0.05"),
+			"The mesh tolerance in input pixels for which to measure the mesh "
+			"precision")
+		;
+}
+
+std::string PrecisionCommand::getSynopsis() {
+	return "precision [options]";
+}
+
+std::string PrecisionCommand::getName() {
+	return "precision";
+}
+
+std::string PrecisionCommand::getDescription() {
+	return "Measure the maximum and mean error of each --precision tier.";
+}
+
+int PrecisionCommand::doRun() {
+	int samples = m_options["samples"].as<int>();
+	int width = m_options["width"].as<int>();
+	if (samples < 2 || width < 2) {
+		std::cerr << "Error: the sample count and width must be at least 2\n";
+		return 1;
+	}
+
+	std::cout << std::setw(10) << std::left << "tier"
+		<< std::setw(12) << std::right << "max angle"
+		<< std::setw(12) << "mean angle"
+		<< std::setw(12) << "max coord"
+		<< std::setw(12) << "bound"
+		<< std::setw(12) << "max shift"
+		<< std::setw(12) << "max interp"
+		<< std::setw(12) << "mean interp" << "\n"
+		<< std::setw(10) << ""
+		<< std::setw(12) << "(rad)"
+		<< std::setw(12) << "(rad)"
+		<< std::setw(12) << "(rad)"
+		<< std::setw(12) << "(rad)"
+		<< std::setw(12) << "(px)"
+		<< std::setw(12) << "(levels)"
+		<< std::setw(12) << "(levels)" << "\n";
+	reportTier<FastPrecision>(std::cout, samples, width);
+	reportTier<StandardPrecision>(std::cout, samples, width);
+	reportTier<ExactPrecision>(std::cout, samples, width);
+	reportTier<MeshPrecision>(std::cout, samples, width);
+	return 0;
+}
+
+template <class Policy>
+void PrecisionCommand::reportTier(std::ostream & out, int samples, int width) {
+	Errors errors;
+	measureAngles<Policy>(samples, width, errors);
+	measureInterpolation<Policy>(samples * samples, errors);
+
+	// A longitude error of one radian moves the sample point by width/2π
+	// pixels, and so does a latitude error, since the height is width/2
+	double shift = errors.maxCoordinate * (width - 1) / (2 * M_PI);
+	out << std::setw(10) << std::left << getPrecisionName(Policy::PRECISION)
+		<< std::right << std::scientific << std::setprecision(2)
+		<< std::setw(12) << errors.maxAngle
+		<< std::setw(12) << errors.meanAngle
+		<< std::setw(12) << errors.maxCoordinate
+		<< std::setw(12) << Policy::MAX_ANGLE_ERROR
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(12) << shift
+		<< std::setw(12) << errors.maxInterpolation
+		<< std::setw(12) << errors.meanInterpolation
+		<< (errors.maxCoordinate > Policy::MAX_ANGLE_ERROR ? "  (exceeds bound)" : "")
+		<< "\n";
+}
+
+/**
+ * The sample directions of a tier for the points of a face, computed as in
+ * extractFace(). For Precision::Mesh, the source coordinates are computed on
+ * the grid and checked as in updateMesh() for an input image of the given
+ * width, and interpolated in the cells which passed.
+ */
+template <int face, class Policy>
+class FaceSampler {
+public:
+	FaceSampler(int size, int width)
+		: m_size(size), m_xScale((float)width), m_yScale(width / 2.0f)
+	{
+		if constexpr (STEP > 0) {
+			initMesh();
+		}
+	}
+
+	/**
+	 * Get the longitude and latitude sampled for face pixel i, j, where i is
+	 * the minor and j the major coordinate
+	 */
+	void getAngles(int i, int j, double & theta, double & phi) const {
+		if constexpr (STEP > 0) {
+			const int col = std::min(i / STEP, m_cells - 1);
+			const int row = std::min(j / STEP, m_cells - 1);
+			if (!m_exact[row * m_cells + col]) {
+				const int left = col * STEP, top = row * STEP;
+				const float s = (float)(i - left) / (std::min(left + STEP, m_size) - left);
+				const float r = (float)(j - top) / (std::min(top + STEP, m_size) - top);
+				float x, y;
+				interpolate(col, row, s, r, x, y);
+				theta = x / m_xScale * (2 * M_PI) - M_PI;
+				phi = M_PI_2 - y / m_yScale * M_PI;
+				return;
+			}
+		}
+		float x = 0, y = 0, z = 0;
+		getPoint((float)i, (float)j, x, y, z);
+		theta = Policy::atan2(y, x);
+		phi = Policy::atan2(z, hypotf(x, y));
+	}
+
+private:
+	static constexpr int STEP = Policy::MESH_STEP;
+
+	void getPoint(float p, float q, float & x, float & y, float & z) const {
+		FaceInfo::setInvariant<face>(x, y, z);
+		FaceInfo::setMajor<face>(x, y, z, (2.0f * q) / m_size - 1.0f);
+		FaceInfo::setMinor<face>(x, y, z, (2.0f * p) / m_size - 1.0f);
+	}
+
+	/** Get the source coordinates of a face position, as in getSourceCoords() */
+	void getCoords(float p, float q, float & uf, float & vf) const {
+		const float pi = M_PI;
+		const float pi_2 = M_PI_2;
+		const float pi_x2 = M_PI * 2;
+		float x = 0, y = 0, z = 0;
+		getPoint(p, q, x, y, z);
+		float r = hypotf(x, y);
+		float theta = r > 0 ? Policy::atan2(y, x) : 0.0f;
+		float phi = Policy::atan2(z, r);
+		uf = (theta + pi) / pi_x2 * m_xScale;
+		vf = (pi_2 - phi) / pi * m_yScale;
+	}
+
+	/** Interpolate the source coordinates within a cell */
+	void interpolate(int col, int row, float s, float r, float & uf, float & vf) const {
+		const float * t = &m_nodes[2 * (row * (m_cells + 1) + col)];
+		const float * b = t + 2 * (m_cells + 1);
+		uf = (1 - r) * ((1 - s) * t[0] + s * t[2]) + r * ((1 - s) * b[0] + s * b[2]);
+		vf = (1 - r) * ((1 - s) * t[1] + s * t[3]) + r * ((1 - s) * b[1] + s * b[3]);
+	}
+
+	void initMesh() {
+		m_cells = (m_size + STEP - 1) / STEP;
+		m_nodes.resize(2 * (m_cells + 1) * (m_cells + 1));
+		m_exact.resize(m_cells * m_cells);
+		for (int row = 0; row <= m_cells; row++) {
+			for (int col = 0; col <= m_cells; col++) {
+				float * node = &m_nodes[2 * (row * (m_cells + 1) + col)];
+				getCoords((float)std::min(col * STEP, m_size), (float)std::min(row * STEP, m_size),
+					node[0], node[1]);
+			}
+		}
+
+		const double margin = Policy::MAX_ANGLE_ERROR - StandardPrecision::MAX_ANGLE_ERROR;
+		const float tolX = (float)std::min(getMeshTolerance(), margin * m_xScale / (2 * M_PI));
+		const float tolY = (float)std::min(getMeshTolerance(), margin * m_yScale / M_PI);
+		const float checks[5][2] = {{0.5f, 0.5f}, {0.5f, 0}, {0.5f, 1}, {0, 0.5f}, {1, 0.5f}};
+		for (int row = 0; row < m_cells; row++) {
+			const int top = row * STEP;
+			const int bottom = std::min(top + STEP, m_size);
+			for (int col = 0; col < m_cells; col++) {
+				const int left = col * STEP;
+				const int right = std::min(left + STEP, m_size);
+				const float * t = &m_nodes[2 * (row * (m_cells + 1) + col)];
+				const float * b = t + 2 * (m_cells + 1);
+				const float minX = std::min({t[0], t[2], b[0], b[2]});
+				const float maxX = std::max({t[0], t[2], b[0], b[2]});
+				bool ok = maxX - minX <= m_xScale / 2;
+				for (int k = 0; ok && k < 5; k++) {
+					const float s = checks[k][0], r = checks[k][1];
+					float uf, vf, iu, iv;
+					getCoords(left + s * (right - left), top + r * (bottom - top), uf, vf);
+					interpolate(col, row, s, r, iu, iv);
+					ok = std::fabs(iu - uf) <= tolX && std::fabs(iv - vf) <= tolY;
+				}
+				m_exact[row * m_cells + col] = !ok;
+			}
+		}
+	}
+
+	int m_size;
+	float m_xScale, m_yScale;
+	int m_cells = 0;
+	std::vector<float> m_nodes;
+	std::vector<uint8_t> m_exact;
+};
+
+/**
+ * Get the sample directions of a tier and in double precision for a face
+ * point, and update the error statistics
+ */
+template <int face, class Policy>
+static void measureFace(int samples, int width, double & maxAngle, double & sumAngle,
+	double & maxCoordinate, long & count
+) {
+	FaceSampler<face, Policy> sampler(samples, width);
+	for (int j = 0; j < samples; j++) {
+		float x = 0, y = 0, z = 0;
+		FaceInfo::setInvariant<face>(x, y, z);
+		FaceInfo::setMajor<face>(x, y, z, (2.0f * j) / samples - 1.0f);
+		for (int i = 0; i < samples; i++) {
+			FaceInfo::setMinor<face>(x, y, z, (2.0f * i) / samples - 1.0f);
+			if (x == 0 && y == 0) {
+				// The longitude of a pole is undefined. extractFace() doesn't
+				// sample it directly, it reflects the pixel to its left.
+				continue;
+			}
+
+			double theta, phi;
+			sampler.getAngles(i, j, theta, phi);
+			double refTheta = atan2((double)y, (double)x);
+			double refPhi = atan2((double)z, hypot((double)x, (double)y));
+
+			double thetaError = std::fabs(remainder(theta - refTheta, 2 * M_PI));
+			double phiError = std::fabs(phi - refPhi);
+			maxCoordinate = std::max({maxCoordinate, thetaError, phiError});
+
+			// The great circle distance, which is well conditioned for small
+			// angles when computed from the cross product
+			double u[3] = {cos(phi) * cos(theta), cos(phi) * sin(theta), sin(phi)};
+			double v[3] = {cos(refPhi) * cos(refTheta), cos(refPhi) * sin(refTheta), sin(refPhi)};
+			double cx = u[1] * v[2] - u[2] * v[1];
+			double cy = u[2] * v[0] - u[0] * v[2];
+			double cz = u[0] * v[1] - u[1] * v[0];
+			double dot = u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+			double angle = atan2(sqrt(cx * cx + cy * cy + cz * cz), dot);
+			maxAngle = std::max(maxAngle, angle);
+			sumAngle += angle;
+			count++;
+		}
+	}
+}
+
+template <class Policy>
+void PrecisionCommand::measureAngles(int samples, int width, Errors & errors) {
+	double maxAngle = 0, sumAngle = 0, maxCoordinate = 0;
+	long count = 0;
+	measureFace<0, Policy>(samples, width, maxAngle, sumAngle, maxCoordinate, count);
+	measureFace<1, Policy>(samples, width, maxAngle, sumAngle, maxCoordinate, count);
+	measureFace<2, Policy>(samples, width, maxAngle, sumAngle, maxCoordinate, count);
+	measureFace<3, Policy>(samples, width, maxAngle, sumAngle, maxCoordinate, count);
+	measureFace<4, Policy>(samples, width, maxAngle, sumAngle, maxCoordinate, count);
+	measureFace<5, Policy>(samples, width, maxAngle, sumAngle, maxCoordinate, count);
+	errors.maxAngle = maxAngle;
+	errors.meanAngle = sumAngle / count;
+	errors.maxCoordinate = maxCoordinate;
+}
+
+template <class Policy>
+void PrecisionCommand::measureInterpolation(int samples, Errors & errors) {
+	const int width = 64, height = 32;
+	NoiseInput input(width, height);
+	std::minstd_rand rng(2);
+	// Keep away from the right and bottom edges, where the neighbours would
+	// be out of bounds
+	std::uniform_real_distribution<float> xDist(0, width - 2);
+	std::uniform_real_distribution<float> yDist(0, height - 2);
+
+	double maxError = 0, sumError = 0;
+	for (int k = 0; k < samples; k++) {
+		float x = xDist(rng), y = yDist(rng);
+		uint8_t result[COMPONENTS];
+		Policy::interpolate(input, result, x, y);
+
+		int x0 = (int)floorf(x);
+		int y0 = (int)floorf(y);
+		double mu = x - x0, nu = y - y0;
+		uint8_t
+			*f00 = input.pixel(x0, y0),
+			*f01 = input.pixel(x0, y0 + 1),
+			*f10 = input.pixel(x0 + 1, y0),
+			*f11 = input.pixel(x0 + 1, y0 + 1);
+		for (int c = 0; c < COMPONENTS; c++) {
+			double ref = (1 - mu) * (1 - nu) * f00[c] + mu * (1 - nu) * f10[c]
+				+ (1 - mu) * nu * f01[c] + mu * nu * f11[c];
+			double error = std::fabs(result[c] - ref);
+			maxError = std::max(maxError, error);
+			sumError += error;
+		}
+	}
+	errors.maxInterpolation = maxError;
+	errors.meanInterpolation = sumError / (double)(samples * COMPONENTS);
+}
+
+} // namespace
@@ -0,0 +1,59 @@
+#ifndef PANO_PRECISION_COMMAND_H
+#define PANO_PRECISION_COMMAND_H
+
+#include <ostream>
+#include "Command.h"
+#include "Precision.h"
+
+namespace PanoProjector {
+
+/**
+ * Report the angular and interpolation error of each precision tier
+ */
+class PrecisionCommand : public Command {
+public:
+	std::string getName() override;
+	std::string getDescription() override;
+
+protected:
+	void initOptions() override;
+	std::string getSynopsis() override;
+	int doRun() override;
+
+private:
+	/** The measured error of a tier */
+	struct Errors {
+		/** The great circle distance between the sampled and true directions */
+		double maxAngle = 0;
+		double meanAngle = 0;
+		/** The largest error in the longitude or latitude */
+		double maxCoordinate = 0;
+		/** The interpolation error in 8-bit levels */
+		double maxInterpolation = 0;
+		double meanInterpolation = 0;
+	};
+
+	/**
+	 * Compare the sample directions of a tier on a grid of points on each
+	 * face with the directions computed in double precision. The grid is
+	 * the face image, at the size of the number of samples, and the mesh
+	 * tolerance applies to an input image of the given width.
+	 */
+	template <class Policy>
+	static void measureAngles(int samples, int width, Errors & errors);
+
+	/**
+	 * Compare the interpolated values of a tier at random points with
+	 * bilinear interpolation in double precision
+	 */
+	template <class Policy>
+	static void measureInterpolation(int samples, Errors & errors);
+
+	/** Measure and write a row of the report */
+	template <class Policy>
+	static void reportTier(std::ostream & out, int samples, int width);
+};
+
+} // namespace
+
+#endif
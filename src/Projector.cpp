@@ -0,0 +1,219 @@
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include "Projector.h"
+#include "extractFace.h"
+#include "InputImageFactory.h"
+#include "InputYcc.h"
+#include "OutputFanout.h"
+#include "OutputPyramid.h"
+#include "OutputResampler.h"
+#include "OutputThread.h"
+#include "OutputTiler.h"
+
+namespace PanoProjector {
+
+Projector::Projector(const InputSource & source)
+	: m_source(source), m_info(InputImageFactory::getInfo(source))
+{
+	m_encoderOptions.quality = 80;
+	m_hasCoverage = Coverage::fromXmp(m_info.metadata.xmp, m_info.width, m_info.height,
+		m_coverage);
+	if (!m_hasCoverage && m_info.width >= 2 * m_info.height) {
+		double vfov = 360.0 * m_info.height / m_info.width;
+		m_coverage = Coverage::fromAngles(360, vfov, 0, (180 - vfov) / 2);
+		m_hasCoverage = true;
+	}
+}
+
+int Projector::getCubeSize() const {
+	if (m_cubeSize > 0) {
+		return m_cubeSize;
+	}
+	return getDefaultCubeSize(m_mapping, m_coverage.getFullWidth(m_info.width));
+}
+
+unsigned long Projector::getPlanningLimit() const {
+	return m_memoryLimit ? m_memoryLimit : Planner::getDefaultLimit();
+}
+
+Metadata Projector::getOutputMetadata() const {
+	Metadata meta;
+	if (m_copyIcc) {
+		meta.icc = m_info.metadata.icc;
+	}
+	setMappingXmp(m_mapping, meta);
+	return meta;
+}
+
+Planner Projector::createPlanner(const std::vector<int> & faces,
+	unsigned long outputMemory
+) const {
+	if (!m_hasCoverage) {
+		throw std::runtime_error("The input image is narrower than 2:1, so its "
+			"field of view must be given");
+	}
+	Planner planner(m_info, faces, getCubeSize(), outputMemory);
+	planner.setPrecision(m_precision);
+	planner.setRotation(m_rotation);
+	planner.setCoverage(m_coverage);
+	planner.setMapping(m_mapping);
+	planner.setPipelined(m_pipelined);
+	return planner;
+}
+
+/**
+ * The encoder buffers one iMCU row of the output, and when pipelined, it is
+ * fed by a queue
+ */
+static unsigned long getFaceOutputMemory(int cubeSize, bool pipelined) {
+	return 2UL * 16 * cubeSize * COMPONENTS
+		+ (pipelined ? OutputThread::estimateMemory(cubeSize) : 0);
+}
+
+/** Wrap an output in an OutputThread if pipelined */
+static OutputBase * makeThread(OutputBase * output, bool pipelined) {
+	return pipelined ? new OutputThread(output) : output;
+}
+
+/**
+ * Wrap a sink so that the calls from several encoder threads are serialized
+ * by a mutex
+ */
+template <class Sink>
+static Sink serialize(const Sink & sink, const std::shared_ptr<std::mutex> & mutex) {
+	return [sink, mutex] (auto && ... args) {
+		std::lock_guard<std::mutex> lock(*mutex);
+		sink(args...);
+	};
+}
+
+void Projector::describeFace(int face, std::ostream & out) const {
+	createPlanner({face}, getFaceOutputMemory(getCubeSize(), m_pipelined))
+		.describe(out, getPlanningLimit());
+}
+
+void Projector::extractFace(int face, const FaceOutputFactory & makeOutput) const {
+	if (m_ycc) {
+		extractFaceYcc(face, makeOutput);
+		return;
+	}
+	Planner planner = createPlanner({face}, getFaceOutputMemory(getCubeSize(), m_pipelined));
+	ExecutionPlan plan = planner.getPlanByName(m_strategy, getPlanningLimit());
+	planner.execute(plan, m_source, [&] (int) -> std::unique_ptr<OutputBase> {
+		return std::unique_ptr<OutputBase>(
+			makeThread(makeOutput(m_encoderOptions).release(), m_pipelined));
+	});
+}
+
+void Projector::extractFaceYcc(int face, const FaceOutputFactory & makeOutput) const {
+	if (m_strategy != "auto" && m_strategy != "single") {
+		throw std::runtime_error("The YCbCr pipeline only supports the single strategy");
+	}
+	Planner planner = createPlanner({face}, getFaceOutputMemory(getCubeSize(), false));
+	CropRect imageRect;
+	if (!planner.getSharedImageCropRect(imageRect)) {
+		// The face is outside the covered area, so it is blank either way
+		Projector rgb(*this);
+		rgb.m_ycc = false;
+		rgb.extractFace(face, makeOutput);
+		return;
+	}
+	InputYcc input(m_source, imageRect);
+	input.setCoverage(m_coverage);
+	EncoderOptions options = m_encoderOptions;
+	options.rawYcc = true;
+	std::unique_ptr<OutputImage> output = makeOutput(options);
+	PanoProjector::extractFaceYcc(face, input, *output, m_precision, m_rotation, m_mapping);
+}
+
+void Projector::extractFace(int face, const std::string & path) const {
+	int size = getCubeSize();
+	Metadata meta = getOutputMetadata();
+	extractFace(face, [&] (const EncoderOptions & options) {
+		return std::make_unique<OutputImage>(path, size, size, meta, options);
+	});
+}
+
+void Projector::extractFace(int face, const OutputImage::Sink & sink) const {
+	int size = getCubeSize();
+	Metadata meta = getOutputMetadata();
+	extractFace(face, [&] (const EncoderOptions & options) {
+		return std::make_unique<OutputImage>(sink, size, size, meta, options);
+	});
+}
+
+void Projector::extractFaceVariants(int face, const std::vector<FaceVariant> & variants) const {
+	if (m_ycc) {
+		throw std::runtime_error("The YCbCr pipeline can't write multiple variants");
+	}
+	const int cubeSize = getCubeSize();
+	auto getSize = [cubeSize] (const FaceVariant & variant) {
+		return variant.size > 0 ? variant.size : cubeSize;
+	};
+	unsigned long outputMemory = 0;
+	for (auto & variant : variants) {
+		int size = getSize(variant);
+		outputMemory += getFaceOutputMemory(size, m_pipelined);
+		if (size != cubeSize) {
+			outputMemory += OutputResampler::estimateMemory(cubeSize, size, size);
+		}
+	}
+
+	Metadata meta = getOutputMetadata();
+	Planner planner = createPlanner({face}, outputMemory);
+	ExecutionPlan plan = planner.getPlanByName(m_strategy, getPlanningLimit());
+	auto mutex = std::make_shared<std::mutex>();
+	planner.execute(plan, m_source, [&] (int) -> std::unique_ptr<OutputBase> {
+		auto fanout = std::make_unique<OutputFanout>(cubeSize, cubeSize);
+		for (auto & variant : variants) {
+			int size = getSize(variant);
+			OutputBase * output = variant.sink
+				? new OutputImage(m_pipelined ? serialize(variant.sink, mutex) : variant.sink,
+					size, size, meta, variant.options)
+				: new OutputImage(variant.path, size, size, meta, variant.options);
+			if (size != cubeSize) {
+				output = new OutputResampler(cubeSize, cubeSize, output);
+			}
+			fanout->addOutput(makeThread(output, m_pipelined));
+		}
+		return fanout;
+	});
+}
+
+void Projector::extractPyramid(const std::vector<int> & faces, int tileSize, int levels,
+	const TileSink & sink
+) const {
+	if (tileSize <= 0) {
+		throw std::runtime_error("The tile size must be positive");
+	}
+	int cubeSize = getCubeSize();
+	if (levels <= 0) {
+		levels = OutputPyramid::getDefaultLevels(cubeSize, tileSize);
+	}
+	Metadata meta = getOutputMetadata();
+	Planner planner = createPlanner(faces,
+		OutputPyramid::estimateMemory(cubeSize, levels, m_pipelined));
+	ExecutionPlan plan = planner.getPlanByName(m_strategy, getPlanningLimit());
+	TileSink tileSink = m_pipelined ? serialize(sink, std::make_shared<std::mutex>()) : sink;
+	planner.execute(plan, m_source, [&] (int face) -> std::unique_ptr<OutputBase> {
+		auto pyramid = std::make_unique<OutputPyramid>(levels, cubeSize, cubeSize);
+		int levelSize = cubeSize;
+		for (int level = 0; level < levels; level++) {
+			int levelNumber = levels - level;
+			pyramid->addLevelOutput(makeThread(new OutputTiler(
+				[&tileSink, levelNumber, face] (int row, int col, const uint8_t * data, size_t size) {
+					tileSink(levelNumber, face, row, col, data, size);
+				},
+				levelSize, levelSize,
+				tileSize, tileSize,
+				meta,
+				m_encoderOptions), m_pipelined));
+			levelSize /= 2;
+		}
+		return std::unique_ptr<OutputBase>(makeThread(pyramid.release(), m_pipelined));
+	});
+}
+
+} // namespace
@@ -0,0 +1,214 @@
+#ifndef PANO_PROJECTOR_H
+#define PANO_PROJECTOR_H
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Coverage.h"
+#include "CubeMapping.h"
+#include "EncoderOptions.h"
+#include "InputImage.h"
+#include "InputSource.h"
+#include "OutputImage.h"
+#include "Planner.h"
+#include "Precision.h"
+#include "Rotation.h"
+
+namespace PanoProjector {
+
+/**
+ * The entry point for using PanoProjector as a library: extract cube faces
+ * or tile pyramids from an equirectangular image in a file or in memory,
+ * and write them as JPEG files or pass the encoded images to a function.
+ *
+ * The options are set as for Planner, and default to those of the face
+ * and pyramid commands. Errors, including an invalid input image, are
+ * thrown as std::runtime_error. A Projector may be used from several
+ * threads at once, but the memory budget and the huge page arena are shared
+ * by the whole process.
+ */
+class Projector {
+public:
+	/**
+	 * A function which receives an encoded tile. The level is numbered as
+	 * the directories written by the pyramid command, so level 1 is the
+	 * smallest, and the row and column are zero-based tile indexes.
+	 */
+	typedef std::function<void(int level, int face, int row, int col,
+		const uint8_t * data, size_t size)> TileSink;
+
+	/**
+	 * An encoding of a face for extractFaceVariants(): its size, or zero for
+	 * the cube size, its encoder options, and the file to write it to, or if
+	 * the sink is set, the function to pass the encoded image to
+	 */
+	struct FaceVariant {
+		int size = 0;
+		EncoderOptions options;
+		std::string path;
+		OutputImage::Sink sink;
+	};
+
+	/**
+	 * Read the header of the input. A buffer must outlive the Projector.
+	 */
+	explicit Projector(const InputSource & source);
+
+	/** Get information about the input image */
+	const InputInfo & getInfo() const {
+		return m_info;
+	}
+
+	/**
+	 * Set the face width and height in pixels, or zero for the default, which
+	 * has about the same resolution as the input at the face centre
+	 */
+	void setCubeSize(int cubeSize) {
+		m_cubeSize = cubeSize;
+	}
+
+	/** Set the accuracy of the sampling kernels */
+	void setPrecision(Precision precision) {
+		m_precision = precision;
+	}
+
+	/** Set how the pixels are distributed over each face */
+	void setMapping(CubeMapping mapping) {
+		m_mapping = mapping;
+	}
+
+	/** Set the orientation of the cube */
+	void setRotation(const Rotation & rotation) {
+		m_rotation = rotation;
+	}
+
+	/**
+	 * Set the part of the sphere covered by the input. By default, it is
+	 * read from the GPano XMP metadata, or if there is none, the input is
+	 * taken to be 360° wide with square pixels, centred vertically.
+	 */
+	void setCoverage(const Coverage & coverage) {
+		m_coverage = coverage;
+		m_hasCoverage = true;
+	}
+
+	/** Set the JPEG encoder options of the output */
+	void setEncoderOptions(const EncoderOptions & options) {
+		m_encoderOptions = options;
+	}
+
+	/** Set whether to copy the ICC colour profile of the input to the output */
+	void setCopyIcc(bool copyIcc) {
+		m_copyIcc = copyIcc;
+	}
+
+	/**
+	 * Set the memory limit in bytes for choosing how to decode the input, or
+	 * zero for the default of Planner::getDefaultLimit()
+	 */
+	void setMemoryLimit(unsigned long limit) {
+		m_memoryLimit = limit;
+	}
+
+	/**
+	 * Set the decode strategy by name, as accepted by
+	 * Planner::getPlanByName(). The default is "auto".
+	 */
+	void setStrategy(const std::string & strategy) {
+		m_strategy = strategy;
+	}
+
+	/**
+	 * Set whether extractFace() keeps the image in YCbCr, decoding the
+	 * planes without converting them to RGB and sampling the chroma at half
+	 * the face size, as extractFaceYcc() does. This is faster and needs less
+	 * memory, but the output always has 4:2:0 subsampling, and the input is
+	 * decoded once, as for the "single" strategy.
+	 */
+	void setYcc(bool ycc) {
+		m_ycc = ycc;
+	}
+
+	/**
+	 * Set whether to run the stages on separate threads: the input for the
+	 * next face or band is decoded while the current one is projected, and
+	 * the downsampling and each encoder run on their own threads. The sinks
+	 * are then called from the encoder threads, but never concurrently. This
+	 * doesn't apply to the YCbCr pipeline.
+	 */
+	void setPipelined(bool pipelined) {
+		m_pipelined = pipelined;
+	}
+
+	/** Get the face width and height in pixels */
+	int getCubeSize() const;
+
+	/** Write the candidate plans for extracting a face, as for --plan */
+	void describeFace(int face, std::ostream & out) const;
+
+	/** Extract a face to a JPEG file */
+	void extractFace(int face, const std::string & path) const;
+
+	/** Extract a face, passing the encoded JPEG image to the sink */
+	void extractFace(int face, const OutputImage::Sink & sink) const;
+
+	/**
+	 * Extract a face once at the cube size, and encode it as each of the
+	 * variants, scaling it with OutputResampler to the sizes which differ.
+	 * Enlarging only interpolates, so the cube size should be at least the
+	 * largest size. The YCbCr pipeline is not supported.
+	 */
+	void extractFaceVariants(int face, const std::vector<FaceVariant> & variants) const;
+
+	/**
+	 * Extract faces and tile them at multiple resolutions, passing each
+	 * encoded tile to the sink as soon as its strip is complete. If the
+	 * number of levels is zero, the last level has a single tile.
+	 */
+	void extractPyramid(const std::vector<int> & faces, int tileSize, int levels,
+		const TileSink & sink) const;
+
+private:
+	/** Get the memory limit for choosing an execution plan */
+	unsigned long getPlanningLimit() const;
+
+	/** Get the ICC profile and mapping metadata of the output */
+	Metadata getOutputMetadata() const;
+
+	/** Create a planner for the faces with the options */
+	Planner createPlanner(const std::vector<int> & faces, unsigned long outputMemory) const;
+
+	/** A function creating a face output with the given encoder options */
+	typedef std::function<std::unique_ptr<OutputImage>(const EncoderOptions &)> FaceOutputFactory;
+
+	/** Extract a face to an output created by the function */
+	void extractFace(int face, const FaceOutputFactory & makeOutput) const;
+
+	/** Extract a face with the YCbCr pipeline */
+	void extractFaceYcc(int face, const FaceOutputFactory & makeOutput) const;
+
+	InputSource m_source;
+	InputInfo m_info;
+	int m_cubeSize = 0;
+	Precision m_precision = Precision::Standard;
+	CubeMapping m_mapping = CubeMapping::Standard;
+	Rotation m_rotation;
+	Coverage m_coverage;
+
+	/** Whether m_coverage was set or read from the metadata */
+	bool m_hasCoverage = false;
+
+	EncoderOptions m_encoderOptions;
+	bool m_copyIcc = false;
+	unsigned long m_memoryLimit = 0;
+	std::string m_strategy = "auto";
+	bool m_ycc = false;
+	bool m_pipelined = false;
+};
+
+} // namespace
+
+#endif
@@ -1,11 +1,20 @@
+#include <cmath>
 #include <iostream>
-#include <bit>
 #include <vector>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
 
 #include "PyramidCommand.h"
 #include "OutputTiler.h"
+#include "OutputBoxFilter.h"
+#include "OutputFanout.h"
+#include "OutputImage.h"
 #include "OutputPyramid.h"
+#include "OutputThread.h"
+#include "ChangedBlocks.h"
+#include "PyramidJournal.h"
+#include "Planner.h"
 #include "FaceInfo.h"
 #include "extractFace.h"
 #include "MemoryBudget.h"
@@ -49,8 +58,63 @@ void PyramidCommand::initOptions() {
 			"The encoder quality, as a percentage")
 		("copy-icc", po::bool_switch(),
 		 	"Copy the ICC color profile")
+		("changed-from", po::value<std::string>(),
+			"A previous version of the input image, which was used to generate "
+			"the existing contents of the output directory. Only the tiles "
+			"affected by the changes will be written.")
+		("resume", po::bool_switch(),
+			"Resume an interrupted job, skipping the tiles which were recorded "
+			"as complete in the journal file in the output directory")
+		("strategy", po::value<std::string>()->default_value("auto"),
+			"How to decode the input: single, per-face, bands, or auto to choose "
+			"the fastest strategy which fits in the memory limit")
+		("plan", po::bool_switch(),
+			"Show the estimated memory and time of each strategy and exit")
+		("pipeline", po::bool_switch(),
+			"Decode ahead, and downsample and encode each level, on separate threads")
+		("preview", po::value<std::string>(),
+			"Also write a reduced copy of the whole input image to this JPEG "
+			"file, while decoding it. The input is decoded in a single pass.")
+		("preview-width", po::value<int>()->default_value(2048),
+			"The width of the preview in pixels")
+		("stats", po::value<std::string>(),
+			"Write the histogram and the mean of each component and of the "
+			"luma of the input image to this file as JSON, while decoding it. "
+			"The input is decoded in a single pass.")
+		("precision", po::value<std::string>()->default_value("standard"),
+			"The accuracy of the sampling kernels: fast, standard, exact, or "
+			"mesh to compute the coordinates on a sparse grid and interpolate them")
+		("mapping", po::value<std::string>()->default_value("standard"),
+			"How the pixels are distributed over each face: standard, or eac "
+			"for an equi-angular cubemap, which has uniform angular resolution "
+			"and so needs fewer pixels for the same resolution at the face centre")
+		("yaw", po::value<double>()->default_value(0),
+			"Turn the cube to the right by this angle in degrees, so that the "
+			"front face is centred on this longitude")
+		("pitch", po::value<double>()->default_value(0),
+			"Tilt the cube upwards by this angle in degrees, so that the front "
+			"face is centred on this latitude")
+		("roll", po::value<double>()->default_value(0),
+			"Turn the cube about the centre of the front face by this angle in "
+			"degrees, so that its right edge points higher")
+		("hfov", po::value<double>(),
+			"The horizontal field of view of a partial panorama in degrees "
+			"(default: from the GPano XMP metadata, or 360)")
+		("vfov", po::value<double>(),
+			"The vertical field of view of a partial panorama in degrees "
+			"(default: from the GPano XMP metadata, or from the aspect ratio)")
+		("hoffset", po::value<double>(),
+			"The angle in degrees from the left edge of the full panorama to "
+			"the left edge of the input (default: centred)")
+		("voffset", po::value<double>(),
+			"The angle in degrees from the top edge of the full panorama to "
+			"the top edge of the input (default: centred)")
+		("fill", po::value<std::string>()->default_value("000000"),
+			"The colour of the area outside a partial panorama, as six hex digits")
 		;
 
+	addEngineOptions(m_visible);
+
 	m_invisible.add_options()
 		("input", po::value<std::string>())
 		("outDir", po::value<std::string>())
@@ -62,16 +126,19 @@ void PyramidCommand::initOptions() {
 		;
 }
 
-static void doFace(
+std::unique_ptr<OutputBase> PyramidCommand::makeFaceOutput(
 	int face,
-	InputImage & input,
+	const Metadata & metadata,
 	const fs::path & outDir,
 	int levels,
 	int cubeSize,
 	int tileSize,
-	const EncoderOptions & options
+	const EncoderOptions & options,
+	const TileMask & mask,
+	PyramidJournal * journal,
+	bool pipelined
 ) {
-	OutputPyramid pyramid(levels, cubeSize, cubeSize);
+	auto pyramid = std::make_unique<OutputPyramid>(levels, cubeSize, cubeSize);
 
 	int levelSize = cubeSize;
 	for (int level = 0; level < levels; level++) {
@@ -79,17 +146,105 @@ static void doFace(
 		if (!fs::is_directory(levelDir)) {
 			fs::create_directory(levelDir);
 		}
-		pyramid.addLevelOutput(new OutputTiler(
+		auto tiler = new OutputTiler(
 			levelDir / FaceInfo::getLetter(face),
 			".jpg",
 			levelSize, levelSize,
 			tileSize, tileSize,
-			input.getMetadata(),
-			options));
+			metadata,
+			options);
+		tiler->setTileMask(&mask, level);
+		if (journal) {
+			tiler->setStripDoneCallback([journal, face, level] (int row) {
+				journal->setStripDone(face, level, row);
+			});
+		}
+		if (pipelined) {
+			pyramid->addLevelOutput(new OutputThread(tiler));
+		} else {
+			pyramid->addLevelOutput(tiler);
+		}
 		levelSize /= 2;
 	}
+	if (pipelined) {
+		return std::make_unique<OutputThread>(pyramid.release());
+	}
+	return pyramid;
+}
+
+std::unique_ptr<OutputBase> PyramidCommand::makeDecodeTee(const InputInfo & info,
+	const Metadata & metadata, const EncoderOptions & options, bool pipelined,
+	OutputStats *& stats)
+{
+	stats = nullptr;
+	if (!m_options.count("preview") && !m_options.count("stats")) {
+		return nullptr;
+	}
+	auto fanout = std::make_unique<OutputFanout>(info.width, info.height);
+	if (m_options.count("preview")) {
+		int width, height;
+		getPreviewSize(info, width, height);
+		// The preview is written when it is complete, so that planning
+		// doesn't create it
+		std::string path = m_options["preview"].as<std::string>();
+		auto sink = [path] (const uint8_t * data, size_t size) {
+			std::ofstream file(path, std::ios::binary);
+			file.write(reinterpret_cast<const char*>(data), size);
+			if (!file.flush()) {
+				throw std::runtime_error("Unable to write the preview \"" + path + "\"");
+			}
+		};
+		fanout->addOutput(new OutputBoxFilter(info.width, info.height,
+			new OutputImage(sink, width, height, metadata, options)));
+	}
+	if (m_options.count("stats")) {
+		stats = new OutputStats(info.width, info.height);
+		fanout->addOutput(stats);
+	}
+	if (pipelined) {
+		return std::make_unique<OutputThread>(fanout.release());
+	}
+	return fanout;
+}
+
+void PyramidCommand::getPreviewSize(const InputInfo & info, int & width, int & height) {
+	width = std::min(m_options["preview-width"].as<int>(), info.width);
+	if (width < 1) {
+		throw std::runtime_error("The preview width must be positive");
+	}
+	height = std::max((int)lround((double)width * info.height / info.width), 1);
+}
+
+unsigned long PyramidCommand::estimateDecodeTeeMemory(const InputInfo & info, bool pipelined) {
+	unsigned long memory = 0;
+	if (m_options.count("preview")) {
+		int width, height;
+		getPreviewSize(info, width, height);
+		// The box filter, and the encoder as in OutputImage with the
+		// compressed image in memory
+		memory += OutputBoxFilter::estimateMemory(width)
+			+ 2 * 16 * (unsigned long)width * COMPONENTS
+			+ (unsigned long)width * height;
+	}
+	if (pipelined && memory) {
+		memory += OutputThread::estimateMemory(info.width);
+	}
+	return memory;
+}
+
+int PyramidCommand::getCubeSize(int inputWidth, CubeMapping mapping) {
+	if (m_options.count("cube-size")) {
+		return m_options["cube-size"].as<int>();
+	} else {
+		return getDefaultCubeSize(mapping, inputWidth);
+	}
+}
 
-	extractFace(face, input, pyramid);
+int PyramidCommand::getLevels(int cubeSize, int tileSize) {
+	if (m_options.count("levels")) {
+		return m_options["levels"].as<int>();
+	}
+	return OutputPyramid::getDefaultLevels(cubeSize, tileSize);
 }
 
 int PyramidCommand::doRun() {
@@ -100,11 +255,10 @@ int PyramidCommand::doRun() {
 
 	setMemoryLimit();
 
-	CropRect cropRect{};
-	int face;
+	std::vector<int> faces;
 	if (m_options.count("face")) {
 		auto & faceName = m_options["face"].as<std::string>();
-		face = FaceInfo::getFaceFromName(faceName);
+		int face = FaceInfo::getFaceFromName(faceName);
 		if (face == -1) {
 			std::cerr << "Error: invalid face name \"" << faceName << "\", must be one of: ";
 			for (int f = 0; f < 6; f++) {
@@ -119,62 +273,188 @@ int PyramidCommand::doRun() {
 			std::cerr << "\n";
 			return 1;
 		}
-
-		cropRect = FaceInfo::getCropRect(face);
+		faces.push_back(face);
 	} else {
-		cropRect = {0, 1, 0, 1};
-		face = -1;
+		for (int face = 0; face < 6; face++) {
+			faces.push_back(face);
+		}
 	}
 
-	std::unique_ptr<InputImage> input(InputImageFactory::create(
-		m_options["input"].as<std::string>(),
-		m_options["input-format"].as<std::string>(),
-		cropRect
-	));
+	auto & inputPath = m_options["input"].as<std::string>();
+	auto & inputFormat = m_options["input-format"].as<std::string>();
+	int tileSize = m_options["tile-size"].as<int>();
 
-	if (input->getWidth() != input->getHeight() * 2) {
-		std::cerr << "Input image has incorrect aspect ratio, must be 2:1.\n";
-		return 1;
-	}
+	InputInfo info = InputImageFactory::getInfo(inputPath, inputFormat);
+	Coverage coverage = getCoverage(info);
 
-	int cubeSize;
-	if (m_options.count("cube-size")) {
-		cubeSize = m_options["cube-size"].as<int>();
+	CubeMapping mapping = getMappingFromName(m_options["mapping"].as<std::string>());
+	int cubeSize = getCubeSize(coverage.getFullWidth(info.width), mapping);
+	Rotation rotation = getRotation();
+	int levels = getLevels(cubeSize, tileSize);
+
+	// Determine which tiles need to be written. In incremental mode, these are
+	// the tiles affected by the changes.
+	std::vector<TileMask> masks;
+	for (int face = 0; face < 6; face++) {
+		masks.emplace_back(levels, cubeSize, tileSize);
+	}
+	if (m_options.count("changed-from")) {
+		if (InputImageFactory::normalizeFormat(inputPath, inputFormat) != "jpeg") {
+			std::cerr << "Error: --changed-from requires JPEG input\n";
+			return 1;
+		}
+		ChangedBlocks changes(m_options["changed-from"].as<std::string>(), inputPath);
+		changes.markTiles(masks, cubeSize, rotation, coverage, mapping);
 	} else {
-		cubeSize = 8 * (int)(input->getWidth() / M_PI / 8);
+		for (auto & mask : masks) {
+			mask.markAll();
+		}
 	}
 
-	int tileSize = m_options["tile-size"].as<int>();
+	fs::path outDir(m_options["outDir"].as<std::string>());
+	EncoderOptions encoderOptions;
+	encoderOptions.quality = m_options["quality"].as<int>();
 
-	int levels;
-	if (m_options.count("levels")) {
-		levels = m_options["levels"].as<int>();
-	} else {
-		levels = std::bit_width((unsigned)((cubeSize - 1)/ tileSize)) + 1;
-		if (cubeSize / (1 << (levels - 2)) == tileSize) {
-			// Due to rounding, we can fit slightly larger source images in a
-			// given number of levels than would be expected by just looking at
-			// the base-2 logarithm.
-			levels -= 1;
+	// When resuming, skip the strips which were previously completed
+	PyramidJournal journal(outDir / ".pano-projector-journal",
+		getJobKey(cubeSize, tileSize, levels, encoderOptions, coverage));
+	bool resuming = m_options["resume"].as<bool>() && journal.load();
+	if (resuming) {
+		for (int face : faces) {
+			for (int level = 0; level < levels; level++) {
+				for (int row = 0; row < masks[face].getNumRows(level); row++) {
+					if (journal.isStripDone(face, level, row)) {
+						masks[face].unmarkRow(level, row);
+					}
+				}
+			}
 		}
 	}
 
-	fs::path outDir(m_options["outDir"].as<std::string>());
+	// Skip the tiles which lie entirely outside a partial panorama
+	double angleError = getMaxAngleError(getPrecisionFromName(
+		m_options["precision"].as<std::string>()));
+	for (int face : faces) {
+		coverage.unmarkUncoveredTiles(masks[face], face, cubeSize, tileSize,
+			angleError, rotation, mapping);
+	}
+
+	std::erase_if(faces, [&](int face) {
+		return masks[face].isEmpty();
+	});
+
+	// The input XMP describes the input, so only the mapping is written
+	Metadata outputMeta;
+	outputMeta.icc = info.metadata.icc;
+	setMappingXmp(mapping, outputMeta);
+
+	bool pipelined = m_options["pipeline"].as<bool>();
+	Metadata previewMeta;
+	previewMeta.icc = info.metadata.icc;
+	OutputStats * stats;
+	auto tee = makeDecodeTee(info, previewMeta, encoderOptions, pipelined, stats);
+	auto & strategy = m_options["strategy"].as<std::string>();
+	if (tee && strategy != "auto" && strategy != "single") {
+		std::cerr << "Error: --preview and --stats need the single strategy\n";
+		return 1;
+	}
+
+	Planner planner(info, faces, cubeSize,
+		OutputPyramid::estimateMemory(cubeSize, levels, pipelined)
+			+ estimateDecodeTeeMemory(info, pipelined));
+	planner.setDecodeTee(tee.get());
+	planner.setPrecision(getPrecisionFromName(m_options["precision"].as<std::string>()));
+	planner.setRotation(rotation);
+	planner.setCoverage(coverage);
+	planner.setMapping(mapping);
+	planner.setPipelined(pipelined);
+	unsigned long limit = getPlanningLimit();
+	if (m_options["plan"].as<bool>()) {
+		std::cout << "Faces to write: " << faces.size() << "\n";
+		planner.describe(std::cout, limit);
+		return 0;
+	}
+
 	if (!fs::is_directory(outDir)) {
 		fs::create_directory(outDir);
 	}
+	if (resuming) {
+		removeTempFiles(outDir, levels);
+	}
 
-	EncoderOptions encoderOptions;
-	encoderOptions.quality = m_options["quality"].as<int>();
-
-	if (face == -1) {
-		for (face = 0; face < 6; face++) {
-			doFace(face, *input, outDir, levels, cubeSize, tileSize, encoderOptions);
+	// Even if no faces need to be written, the input is decoded for the tee
+	if (!faces.empty() || tee) {
+		ExecutionPlan plan = planner.getPlanByName(strategy, limit);
+		planner.execute(plan, InputSource(inputPath, inputFormat), [&] (int face) {
+			return makeFaceOutput(face, outputMeta, outDir, levels, cubeSize,
+				tileSize, encoderOptions, masks[face], &journal, pipelined);
+		});
+	}
+	if (tee) {
+		tee->finish();
+	}
+	if (stats) {
+		std::ofstream file(m_options["stats"].as<std::string>());
+		stats->writeJson(file);
+		if (!file.flush()) {
+			throw std::runtime_error("Unable to write the statistics");
 		}
-	} else {
-		doFace(face, *input, outDir, levels, cubeSize, tileSize, encoderOptions);
 	}
+	journal.remove();
 	return 0;
 }
 
+std::string PyramidCommand::getJobKey(int cubeSize, int tileSize, int levels,
+	const EncoderOptions & options, const Coverage & coverage
+) {
+	auto & inputPath = m_options["input"].as<std::string>();
+	std::stringstream ss;
+	ss << "pano-projector-journal-1"
+		<< " input=" << fs::canonical(inputPath).string()
+		<< " size=" << fs::file_size(inputPath)
+		<< " mtime=" << fs::last_write_time(inputPath).time_since_epoch().count()
+		<< " cube-size=" << cubeSize
+		<< " tile-size=" << tileSize
+		<< " levels=" << levels
+		<< " quality=" << options.quality;
+	// Only non-default values are included, so that existing journals remain valid
+	auto & precision = m_options["precision"].as<std::string>();
+	if (precision != "standard") {
+		ss << " precision=" << precision;
+	}
+	auto & mapping = m_options["mapping"].as<std::string>();
+	if (mapping != "standard") {
+		ss << " mapping=" << mapping;
+	}
+	for (const char * angle : {"yaw", "pitch", "roll"}) {
+		if (m_options[angle].as<double>() != 0) {
+			ss << " " << angle << "=" << m_options[angle].as<double>();
+		}
+	}
+	if (!coverage.isFull()) {
+		ss << " coverage=" << coverage.left << "," << coverage.right
+			<< "," << coverage.top << "," << coverage.bottom
+			<< " fill=" << m_options["fill"].as<std::string>();
+	}
+	if (m_options.count("changed-from")) {
+		ss << " changed-from="
+			<< fs::canonical(m_options["changed-from"].as<std::string>()).string();
+	}
+	return ss.str();
+}
+
+void PyramidCommand::removeTempFiles(const fs::path & outDir, int levels) {
+	for (int level = 0; level < levels; level++) {
+		fs::path levelDir = outDir / std::to_string(levels - level);
+		if (!fs::is_directory(levelDir)) {
+			continue;
+		}
+		for (auto & entry : fs::directory_iterator(levelDir)) {
+			if (entry.path().extension() == ".tmp") {
+				fs::remove(entry.path());
+			}
+		}
+	}
+}
+
 } // namespace
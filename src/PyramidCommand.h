@@ -1,7 +1,14 @@
 #ifndef PANO_FACE_PYRAMID_COMMAND_H
 #define PANO_FACE_PYRAMID_COMMAND_H
 
+#include <filesystem>
 #include "Command.h"
+#include "CubeMapping.h"
+#include "EncoderOptions.h"
+#include "OutputBase.h"
+#include "OutputStats.h"
+#include "PyramidJournal.h"
+#include "TileMask.h"
 
 namespace PanoProjector {
 
@@ -9,11 +16,60 @@ class PyramidCommand : public Command {
 public:
 	std::string getName() override;
 	std::string getDescription() override;
+
+	/**
+	 * Create the output pipeline for a face, writing the tiles selected by
+	 * the mask, and recording the completed strips in the journal if it is
+	 * not null. If pipelined, the downsampling and the encoder of each level
+	 * run on their own threads.
+	 */
+	static std::unique_ptr<OutputBase> makeFaceOutput(int face, const Metadata & metadata,
+		const std::filesystem::path & outDir, int levels, int cubeSize, int tileSize,
+		const EncoderOptions & options, const TileMask & mask, PyramidJournal * journal,
+		bool pipelined = false);
 protected:
 	void initOptions() override;
 	std::string getSynopsis() override;
 	int doRun() override;
 
+private:
+	/**
+	 * Get the cube size from the options or the width of the full panorama
+	 * at the input scale and the mapping
+	 */
+	int getCubeSize(int inputWidth, CubeMapping mapping);
+
+	/** Get the number of levels from the options or the cube size */
+	int getLevels(int cubeSize, int tileSize);
+
+	/**
+	 * Create the output for --preview and --stats, to which the rows of the
+	 * whole input are written while it is decoded, or null if neither was
+	 * given. The statistics, owned by the returned output, are stored in
+	 * stats. The preview is written to its file when it is finished.
+	 */
+	std::unique_ptr<OutputBase> makeDecodeTee(const InputInfo & info,
+		const Metadata & metadata, const EncoderOptions & options, bool pipelined,
+		OutputStats *& stats);
+
+	/** Get the size of the preview from the options and the input size */
+	void getPreviewSize(const InputInfo & info, int & width, int & height);
+
+	/** Estimate the memory used by the output of makeDecodeTee() */
+	unsigned long estimateDecodeTeeMemory(const InputInfo & info, bool pipelined);
+
+	/**
+	 * Get a string identifying the input and the output parameters, so that
+	 * a journal written by a different job can be ignored.
+	 */
+	std::string getJobKey(int cubeSize, int tileSize, int levels,
+		const EncoderOptions & options, const Coverage & coverage);
+
+	/**
+	 * Remove temporary files left behind by OutputImage in the level
+	 * directories when a job was killed
+	 */
+	static void removeTempFiles(const std::filesystem::path & outDir, int levels);
 };
 
 } // namespace
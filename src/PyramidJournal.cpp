@@ -0,0 +1,58 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "PyramidJournal.h"
+
+namespace PanoProjector {
+
+namespace fs = std::filesystem;
+
+PyramidJournal::PyramidJournal(const fs::path & path, const std::string & jobKey)
+	: m_path(path), m_jobKey(jobKey)
+{}
+
+bool PyramidJournal::load() {
+	std::ifstream in(m_path);
+	if (!in) {
+		return false;
+	}
+	std::string line;
+	if (!std::getline(in, line) || line != m_jobKey) {
+		return false;
+	}
+	int face, level, row;
+	while (in >> face >> level >> row) {
+		m_done.insert({face, level, row});
+	}
+	return true;
+}
+
+void PyramidJournal::setStripDone(int face, int level, int row) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_done.insert({face, level, row}).second) {
+		write();
+	}
+}
+
+void PyramidJournal::write() {
+	fs::path tempPath = m_path;
+	tempPath += ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::trunc);
+		out << m_jobKey << '\n';
+		for (auto & [face, level, row] : m_done) {
+			out << face << ' ' << level << ' ' << row << '\n';
+		}
+		out.close();
+		if (!out) {
+			throw std::runtime_error("Unable to write journal file \"" + tempPath.string() + "\"");
+		}
+	}
+	fs::rename(tempPath, m_path);
+}
+
+void PyramidJournal::remove() {
+	fs::remove(m_path);
+}
+
+} // namespace
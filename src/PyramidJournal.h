@@ -0,0 +1,62 @@
+#ifndef PANO_PYRAMIDJOURNAL_H
+#define PANO_PYRAMIDJOURNAL_H
+
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+
+namespace PanoProjector {
+
+/**
+ * A record of the tile strips completed by a pyramid job, so that a job
+ * which was killed can be resumed.
+ *
+ * A strip is a row of tiles in a single level of a single face. The journal
+ * starts with a key identifying the job parameters, and a journal with a
+ * different key is ignored when it is loaded. The file is replaced
+ * atomically by writing a temporary file and renaming it. Strips may be
+ * recorded from several threads at once, such as the encoder threads of a
+ * pipelined pyramid.
+ */
+class PyramidJournal {
+public:
+	/**
+	 * Constructor. The file is not accessed until load() or setStripDone() is
+	 * called.
+	 */
+	PyramidJournal(const std::filesystem::path & path, const std::string & jobKey);
+
+	/**
+	 * Load the existing journal file. If there is no journal, or it has a
+	 * different job key, return false.
+	 */
+	bool load();
+
+	/** Determine whether a strip was recorded as complete */
+	bool isStripDone(int face, int level, int row) const {
+		return m_done.contains({face, level, row});
+	}
+
+	/** Record a strip as complete and write the journal file */
+	void setStripDone(int face, int level, int row);
+
+	/** Delete the journal file, after the whole job is done */
+	void remove();
+
+private:
+	/** Write the journal file atomically */
+	void write();
+
+	std::filesystem::path m_path;
+	std::string m_jobKey;
+	std::set<std::tuple<int, int, int>> m_done;
+
+	/** Protects m_done and the file in setStripDone() */
+	std::mutex m_mutex;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,77 @@
+#include <cmath>
+#include "Rotation.h"
+
+namespace PanoProjector {
+
+/** Normalize an angle in degrees to 0≤angle<360 */
+static double normalizeDegrees(double angle) {
+	angle = fmod(angle, 360);
+	return angle < 0 ? angle + 360 : angle;
+}
+
+Rotation::Rotation()
+	: Rotation(0, 0, 0)
+{}
+
+Rotation::Rotation(double yaw, double pitch, double roll) {
+	yaw = normalizeDegrees(yaw);
+	pitch = normalizeDegrees(pitch);
+	roll = normalizeDegrees(roll);
+	m_yaw = yaw * M_PI / 180;
+	m_yawOnly = pitch == 0 && roll == 0;
+
+	double cy = cos(m_yaw), sy = sin(m_yaw);
+	double cp = cos(pitch * M_PI / 180), sp = sin(pitch * M_PI / 180);
+	double cr = cos(roll * M_PI / 180), sr = sin(roll * M_PI / 180);
+
+	// Rz(yaw) * Ry(pitch) * Rx(roll), where Ry(pitch) takes +x towards +z
+	// and Rx(roll) takes +y towards +z
+	m_matrix[0][0] = cy * cp;
+	m_matrix[0][1] = cy * -sp * sr - sy * cr;
+	m_matrix[0][2] = cy * -sp * cr + sy * sr;
+	m_matrix[1][0] = sy * cp;
+	m_matrix[1][1] = sy * -sp * sr + cy * cr;
+	m_matrix[1][2] = sy * -sp * cr - cy * sr;
+	m_matrix[2][0] = sp;
+	m_matrix[2][1] = cp * sr;
+	m_matrix[2][2] = cp * cr;
+}
+
+void Rotation::rotate(double & x, double & y, double & z) const {
+	const auto & m = m_matrix;
+	double rx = m[0][0] * x + m[0][1] * y + m[0][2] * z;
+	double ry = m[1][0] * x + m[1][1] * y + m[1][2] * z;
+	double rz = m[2][0] * x + m[2][1] * y + m[2][2] * z;
+	x = rx;
+	y = ry;
+	z = rz;
+}
+
+void Rotation::unrotate(double & x, double & y, double & z) const {
+	// The inverse of a rotation matrix is its transpose
+	const auto & m = m_matrix;
+	double rx = m[0][0] * x + m[1][0] * y + m[2][0] * z;
+	double ry = m[0][1] * x + m[1][1] * y + m[2][1] * z;
+	double rz = m[0][2] * x + m[1][2] * y + m[2][2] * z;
+	x = rx;
+	y = ry;
+	z = rz;
+}
+
+void Rotation::unrotateAngles(float & theta, float & phi) const {
+	if (isIdentity()) {
+		return;
+	}
+	if (m_yawOnly) {
+		theta = (float)remainder(theta - m_yaw, 2 * M_PI);
+		return;
+	}
+	double x = cos(phi) * cos(theta);
+	double y = cos(phi) * sin(theta);
+	double z = sin(phi);
+	unrotate(x, y, z);
+	theta = (float)atan2(y, x);
+	phi = (float)atan2(z, hypot(x, y));
+}
+
+} // namespace
@@ -0,0 +1,70 @@
+#ifndef PANO_ROTATION_H
+#define PANO_ROTATION_H
+
+namespace PanoProjector {
+
+/**
+ * The orientation of the cube relative to the source panorama, given by
+ * yaw, pitch and roll angles in degrees, as set with --yaw, --pitch and
+ * --roll.
+ *
+ * The rotations are applied to the cube in the order roll, pitch, yaw. The
+ * yaw turns the front face to the right, the pitch tilts it upwards, and the
+ * roll turns it about its centre so that its right edge points higher. So
+ * the centre of the front face is at longitude yaw and latitude pitch.
+ *
+ * A rotation maps a direction in cube coordinates, as set by
+ * FaceInfo::setInvariant() etc., to a direction in source coordinates.
+ */
+class Rotation {
+public:
+	/** The identity rotation */
+	Rotation();
+
+	/** Construct from the angles in degrees */
+	Rotation(double yaw, double pitch, double roll);
+
+	/** Whether the rotation leaves every direction unchanged */
+	bool isIdentity() const {
+		return m_yawOnly && m_yaw == 0;
+	}
+
+	/**
+	 * Whether the rotation is about the vertical axis only, so that it can be
+	 * applied as an offset to the source longitude
+	 */
+	bool isYawOnly() const {
+		return m_yawOnly;
+	}
+
+	/** Get the yaw in radians, normalized to 0≤yaw<2π */
+	double getYaw() const {
+		return m_yaw;
+	}
+
+	/** Get the matrix which maps cube coordinates to source coordinates */
+	const double (&getMatrix() const)[3][3] {
+		return m_matrix;
+	}
+
+	/** Map a direction in cube coordinates to source coordinates */
+	void rotate(double & x, double & y, double & z) const;
+
+	/** Map a direction in source coordinates to cube coordinates */
+	void unrotate(double & x, double & y, double & z) const;
+
+	/**
+	 * Map the longitude and latitude of a point in the source image to the
+	 * corresponding angles in the unrotated cube frame
+	 */
+	void unrotateAngles(float & theta, float & phi) const;
+
+private:
+	double m_yaw;
+	bool m_yawOnly;
+	double m_matrix[3][3];
+};
+
+} // namespace
+
+#endif
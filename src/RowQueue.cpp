@@ -0,0 +1,70 @@
+#include "RowQueue.h"
+#include "MemoryBudget.h"
+#include "OutputBase.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+
+namespace PanoProjector {
+
+/** A queue uses at most 1/BUDGET_FRACTION of the memory left in the budget */
+static const unsigned long BUDGET_FRACTION = 16;
+
+RowQueue::RowQueue(int depth, size_t rowSize)
+	: m_depth(depth), m_rowSize(rowSize),
+	m_data(new uint8_t[getMemory(depth, rowSize)]),
+	m_batches(depth), m_head(0), m_tail(0)
+{
+	for (int i = 0; i < depth; i++) {
+		m_batches[i].data = m_data.get() + (size_t)i * OUTPUT_BATCH_ROWS * rowSize;
+	}
+}
+
+unsigned long RowQueue::getMemory(int depth, size_t rowSize) {
+	return (unsigned long)depth * OUTPUT_BATCH_ROWS * rowSize;
+}
+
+int RowQueue::getDefaultDepth(size_t rowSize) {
+	unsigned long limit = g_memBudget.getLimit();
+	if (limit == ULONG_MAX) {
+		return MAX_DEPTH;
+	}
+	unsigned long usage = g_memBudget.getUsage();
+	unsigned long left = limit > usage ? limit - usage : 0;
+	unsigned long depth = left / BUDGET_FRACTION / getMemory(1, rowSize);
+	depth = std::clamp(depth, (unsigned long)MIN_DEPTH, (unsigned long)MAX_DEPTH);
+	return (int)std::bit_floor(depth);
+}
+
+RowQueue::Batch & RowQueue::beginPush() {
+	uint32_t tail = m_tail.load(std::memory_order_relaxed);
+	uint32_t head = m_head.load(std::memory_order_acquire);
+	while (tail - head == (uint32_t)m_depth) {
+		m_head.wait(head, std::memory_order_acquire);
+		head = m_head.load(std::memory_order_acquire);
+	}
+	return m_batches[tail % m_depth];
+}
+
+void RowQueue::endPush() {
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	m_tail.notify_one();
+}
+
+RowQueue::Batch & RowQueue::beginPop() {
+	uint32_t head = m_head.load(std::memory_order_relaxed);
+	uint32_t tail = m_tail.load(std::memory_order_acquire);
+	while (tail == head) {
+		m_tail.wait(tail, std::memory_order_acquire);
+		tail = m_tail.load(std::memory_order_acquire);
+	}
+	return m_batches[head % m_depth];
+}
+
+void RowQueue::endPop() {
+	m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	m_head.notify_one();
+}
+
+} // namespace
@@ -0,0 +1,103 @@
+#ifndef PANO_ROWQUEUE_H
+#define PANO_ROWQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Tracer.h"
+
+namespace PanoProjector {
+
+/**
+ * A bounded queue of row batches between one producer thread and one
+ * consumer thread, connecting the stages of a pipeline.
+ *
+ * The queue is a ring of slots, each holding up to OUTPUT_BATCH_ROWS rows.
+ * The producer fills the slot at the tail and publishes it by advancing the
+ * tail index, and the consumer processes the slot at the head in place and
+ * frees it by advancing the head index, so no locks are needed. A thread
+ * which finds the queue full or empty sleeps in std::atomic::wait() until
+ * the other thread advances its index, so a slow consumer holds back the
+ * producer.
+ */
+class RowQueue {
+public:
+	enum {
+		/** The smallest and largest number of slots chosen by getDefaultDepth() */
+		MIN_DEPTH = 2,
+		MAX_DEPTH = 8,
+	};
+
+	/** A slot of the queue */
+	struct Batch {
+		/** The rows, each getRowSize() bytes after the previous one */
+		uint8_t * data;
+
+		/** The number of rows, or zero at the end of the stream */
+		int count;
+
+		/** The trace face and level of the producer when it pushed the batch */
+		TraceContext trace;
+	};
+
+	/**
+	 * Constructor. Allocate the given number of slots, which must be a power
+	 * of 2 so that the slot index is continuous when the counters wrap.
+	 */
+	RowQueue(int depth, size_t rowSize);
+
+	RowQueue(const RowQueue & other) = delete;
+
+	/** Get the slot at the tail, waiting while the queue is full */
+	Batch & beginPush();
+
+	/** Publish the slot returned by beginPush() */
+	void endPush();
+
+	/** Get the slot at the head, waiting while the queue is empty */
+	Batch & beginPop();
+
+	/** Free the slot returned by beginPop() */
+	void endPop();
+
+	/** Get the number of bytes in a row */
+	size_t getRowSize() const {
+		return m_rowSize;
+	}
+
+	/** Get the number of slots */
+	int getDepth() const {
+		return m_depth;
+	}
+
+	/** Get the number of bytes in the slots of a queue */
+	static unsigned long getMemory(int depth, size_t rowSize);
+
+	/**
+	 * Choose the number of slots for a queue of rows of the given size, so
+	 * that it uses no more than a small part of the memory left in
+	 * g_memBudget
+	 */
+	static int getDefaultDepth(size_t rowSize);
+
+private:
+	int m_depth;
+	size_t m_rowSize;
+	std::unique_ptr<uint8_t[]> m_data;
+	std::vector<Batch> m_batches;
+
+	/**
+	 * The number of batches popped and pushed. They only increase, and the
+	 * difference is the number of batches in the queue. They are on
+	 * separate cache lines, since each is written by a different thread.
+	 */
+	alignas(64) std::atomic<uint32_t> m_head;
+	alignas(64) std::atomic<uint32_t> m_tail;
+};
+
+} // namespace
+
+#endif
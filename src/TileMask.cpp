@@ -0,0 +1,87 @@
+#include <algorithm>
+#include "TileMask.h"
+
+namespace PanoProjector {
+
+TileMask::TileMask(int levels, int size, int tileSize)
+	: m_size(size), m_tileSize(tileSize), m_numMarked(0)
+{
+	m_levels.reserve(levels);
+	for (int level = 0; level < levels; level++) {
+		// Same tile counts as OutputTiler
+		int levelSize = size >> level;
+		int n = levelSize / tileSize + (levelSize % tileSize ? 1 : 0);
+		m_levels.push_back(Level{n, n, std::vector<bool>(n * n)});
+	}
+}
+
+void TileMask::markRect(int left, int top, int right, int bottom) {
+	left = std::max(left, 0);
+	top = std::max(top, 0);
+	right = std::min(right, m_size);
+	bottom = std::min(bottom, m_size);
+	if (left >= right || top >= bottom) {
+		return;
+	}
+
+	for (int level = 0; level < (int)m_levels.size(); level++) {
+		Level & l = m_levels[level];
+		if (l.numTilesWide == 0) {
+			break;
+		}
+		// OutputPyramid discards the odd last row and column when it scales
+		// down, so the tile index has to be clamped.
+		int levelTileSize = m_tileSize << level;
+		int col0 = std::min(left / levelTileSize, l.numTilesWide - 1);
+		int col1 = std::min((right - 1) / levelTileSize, l.numTilesWide - 1);
+		int row0 = std::min(top / levelTileSize, l.numTilesHigh - 1);
+		int row1 = std::min((bottom - 1) / levelTileSize, l.numTilesHigh - 1);
+		for (int row = row0; row <= row1; row++) {
+			for (int col = col0; col <= col1; col++) {
+				int i = row * l.numTilesWide + col;
+				if (!l.marked[i]) {
+					l.marked[i] = true;
+					m_numMarked++;
+				}
+			}
+		}
+	}
+}
+
+void TileMask::markAll() {
+	markRect(0, 0, m_size, m_size);
+}
+
+void TileMask::unmarkRow(int level, int row) {
+	Level & l = m_levels[level];
+	for (int col = 0; col < l.numTilesWide; col++) {
+		int i = row * l.numTilesWide + col;
+		if (l.marked[i]) {
+			l.marked[i] = false;
+			m_numMarked--;
+		}
+	}
+}
+
+void TileMask::intersect(const TileMask & other) {
+	for (int level = 0; level < (int)m_levels.size(); level++) {
+		Level & l = m_levels[level];
+		const Level & o = other.m_levels[level];
+		for (size_t i = 0; i < l.marked.size(); i++) {
+			if (l.marked[i] && !o.marked[i]) {
+				l.marked[i] = false;
+				m_numMarked--;
+			}
+		}
+	}
+}
+
+int TileMask::getNumTiles() const {
+	int n = 0;
+	for (auto & l : m_levels) {
+		n += l.numTilesWide * l.numTilesHigh;
+	}
+	return n;
+}
+
+} // namespace
@@ -0,0 +1,78 @@
+#ifndef PANO_TILEMASK_H
+#define PANO_TILEMASK_H
+
+#include <vector>
+
+namespace PanoProjector {
+
+/**
+ * A set of selected tiles in every level of a pyramid, for a single cube face.
+ *
+ * Level 0 is the full resolution level, as in OutputPyramid. Tiles are
+ * selected by marking rectangles in level 0 pixel coordinates, and the
+ * selection is propagated to the tiles covering the same area in each
+ * downscaled level.
+ */
+class TileMask {
+public:
+	TileMask(int levels, int size, int tileSize);
+
+	/**
+	 * Select all tiles in every level which contain any part of the given
+	 * rectangle in level 0 pixel coordinates. The right and bottom coordinates
+	 * are past-the-end. The rectangle is clipped to the image.
+	 */
+	void markRect(int left, int top, int right, int bottom);
+
+	/** Select every tile in every level */
+	void markAll();
+
+	/** Deselect a row of tiles in the given level */
+	void unmarkRow(int level, int row);
+
+	/** Deselect every tile which is not selected in the other mask */
+	void intersect(const TileMask & other);
+
+	/** Get the number of levels */
+	int getNumLevels() const {
+		return (int)m_levels.size();
+	}
+
+	/** Get the number of rows of tiles in the given level */
+	int getNumRows(int level) const {
+		return m_levels[level].numTilesHigh;
+	}
+
+	/** Determine whether a tile in the given level is selected */
+	bool isMarked(int level, int row, int col) const {
+		const Level & l = m_levels[level];
+		return l.marked[row * l.numTilesWide + col];
+	}
+
+	/** Determine whether any tile is selected */
+	bool isEmpty() const {
+		return m_numMarked == 0;
+	}
+
+	/** Get the total number of selected tiles in all levels */
+	int getNumMarked() const {
+		return m_numMarked;
+	}
+
+	/** Get the total number of tiles in all levels */
+	int getNumTiles() const;
+
+private:
+	struct Level {
+		int numTilesWide;
+		int numTilesHigh;
+		std::vector<bool> marked;
+	};
+
+	int m_size, m_tileSize, m_numMarked;
+	std::vector<Level> m_levels;
+};
+
+} // namespace
+
+#endif
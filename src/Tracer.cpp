@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Tracer.h"
+
+namespace PanoProjector {
+
+Tracer g_tracer;
+
+thread_local int Tracer::t_face = -1;
+thread_local int Tracer::t_level = -1;
+thread_local Tracer::CounterGroup Tracer::t_counters;
+
+/** The perf_event_open() type and config of each counter */
+static const struct {
+	const char * name;
+	uint32_t type;
+	uint64_t config;
+} counterEvents[TraceCounters::NUM_COUNTERS] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{"dtlb_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+/** The track ID of the first accumulated stage */
+static const int STAGE_TRACK_BASE = 1000;
+
+Tracer::Tracer()
+	: m_enabled(false), m_startTime(0), m_counterMask(0), m_accumulators()
+{}
+
+void Tracer::start(const std::string & path) {
+	m_file.open(path);
+	if (!m_file) {
+		throw std::runtime_error("Unable to open trace file \"" + path + "\"");
+	}
+	start();
+	if (!m_counterError.empty()) {
+		std::cerr << "Warning: " << (m_counterMask ? "some " : "")
+			<< "hardware counters are not available: " << m_counterError << "\n";
+	}
+}
+
+void Tracer::start() {
+	m_startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	// Open the counters for this thread now, so that a failure can be reported
+	if (!t_counters.opened) {
+		t_counters.open();
+	}
+	int error = t_counters.error;
+	unsigned mask = 0;
+	for (int k = 0; k < t_counters.count; k++) {
+		mask |= 1u << t_counters.order[k];
+	}
+	m_counterMask = mask;
+	if (error) {
+		m_counterError = strerror(error);
+	}
+	m_enabled = true;
+}
+
+uint64_t Tracer::now() const {
+	uint64_t t = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	return t - m_startTime;
+}
+
+Tracer::CounterGroup::~CounterGroup() {
+	for (int k = 0; k < count; k++) {
+		close(fds[order[k]]);
+	}
+}
+
+void Tracer::CounterGroup::open() {
+	opened = true;
+	for (int i = 0; i < TraceCounters::NUM_COUNTERS; i++) {
+		fds[i] = -1;
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counterEvents[i].type;
+		attr.config = counterEvents[i].config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		// Kernel time can't be counted by unprivileged users with the default
+		// perf_event_paranoid setting
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		// The calling thread on any CPU
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+		if (fd < 0) {
+			if (!error) {
+				error = errno;
+			}
+			continue;
+		}
+		if (leader < 0) {
+			leader = fd;
+		}
+		fds[i] = fd;
+		order[count++] = i;
+	}
+}
+
+void Tracer::readCounters(TraceCounters & counters) {
+	CounterGroup & group = t_counters;
+	if (!group.opened) {
+		group.open();
+	}
+	if (group.leader < 0) {
+		return;
+	}
+	uint64_t values[1 + TraceCounters::NUM_COUNTERS];
+	ssize_t n = read(group.leader, values, sizeof(values));
+	if (n < (ssize_t)sizeof(uint64_t)) {
+		return;
+	}
+	int count = std::min((int)values[0], group.count);
+	for (int k = 0; k < count; k++) {
+		counters.values[group.order[k]] = values[1 + k];
+	}
+}
+
+uint64_t Tracer::getThreadCpuTime() {
+	timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int Tracer::getThreadId() {
+	static std::atomic<int> nextId(1);
+	thread_local int id = nextId++;
+	return id;
+}
+
+const char * Tracer::getStageName(TraceStage stage) {
+	switch (stage) {
+		case TraceStage::Sample: return "sample";
+		case TraceStage::Downsample: return "downsample";
+		case TraceStage::Encode: return "encode";
+	}
+	return "unknown";
+}
+
+void Tracer::addSpan(const char * name, int face, int level, uint64_t start, uint64_t end,
+	const TraceCounters & startCounters, const TraceCounters & endCounters
+) {
+	Span span{name, face, level, getThreadId(), start, end, {}};
+	for (int i = 0; i < TraceCounters::NUM_COUNTERS; i++) {
+		span.counters.values[i] = endCounters.values[i] - startCounters.values[i];
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_spans.push_back(span);
+}
+
+void Tracer::accumulate(TraceStage stage, int face, int level, uint64_t start, uint64_t end,
+	uint64_t cpuNanoseconds, const TraceCounters & startCounters,
+	const TraceCounters & endCounters
+) {
+	int faceSlot = std::clamp(face + 1, 0, FACE_SLOTS - 1);
+	int levelSlot = std::clamp(level + 1, 0, LEVEL_SLOTS - 1);
+	Accumulator & acc = m_accumulators[(int)stage][faceSlot][levelSlot];
+
+	acc.calls.fetch_add(1, std::memory_order_relaxed);
+	acc.nanoseconds.fetch_add(end - start, std::memory_order_relaxed);
+	acc.cpuNanoseconds.fetch_add(cpuNanoseconds, std::memory_order_relaxed);
+	for (int i = 0; i < TraceCounters::NUM_COUNTERS; i++) {
+		acc.counters[i].fetch_add(endCounters.values[i] - startCounters.values[i],
+			std::memory_order_relaxed);
+	}
+
+	// Zero means unset. The start time can only be zero at the first
+	// nanosecond after start(), which doesn't matter.
+	uint64_t first = acc.firstStart.load(std::memory_order_relaxed);
+	while ((first == 0 || start < first)
+		&& !acc.firstStart.compare_exchange_weak(first, start, std::memory_order_relaxed)
+	) {}
+	uint64_t last = acc.lastEnd.load(std::memory_order_relaxed);
+	while (end > last
+		&& !acc.lastEnd.compare_exchange_weak(last, end, std::memory_order_relaxed)
+	) {}
+}
+
+Tracer::StageTotals Tracer::getStageTotals(TraceStage stage) const {
+	StageTotals totals;
+	for (auto & levels : m_accumulators[(int)stage]) {
+		for (auto & acc : levels) {
+			totals.calls += acc.calls.load(std::memory_order_relaxed);
+			totals.nanoseconds += acc.nanoseconds.load(std::memory_order_relaxed);
+			totals.cpuNanoseconds += acc.cpuNanoseconds.load(std::memory_order_relaxed);
+		}
+	}
+	return totals;
+}
+
+void Tracer::writeArgs(std::ostream & out, int face, int level,
+	const TraceCounters & counters, const std::string & extra
+) {
+	bool first = true;
+	auto sep = [&] () -> std::ostream & {
+		out << (first ? "" : ", ");
+		first = false;
+		return out;
+	};
+	out << "\"args\": {";
+	if (!extra.empty()) {
+		sep() << extra;
+	}
+	if (face >= 0) {
+		sep() << "\"face\": " << face;
+	}
+	if (level >= 0) {
+		sep() << "\"level\": " << level;
+	}
+	unsigned mask = m_counterMask;
+	for (int i = 0; i < TraceCounters::NUM_COUNTERS; i++) {
+		if (mask & (1u << i)) {
+			sep() << "\"" << counterEvents[i].name << "\": " << counters.values[i];
+		}
+	}
+	if ((mask & (1u << TraceCounters::CYCLES)) && (mask & (1u << TraceCounters::INSTRUCTIONS))
+		&& counters.values[TraceCounters::CYCLES]
+	) {
+		sep() << "\"ipc\": " << std::setprecision(3)
+			<< (double)counters.values[TraceCounters::INSTRUCTIONS]
+				/ counters.values[TraceCounters::CYCLES];
+	}
+	out << "}";
+}
+
+void Tracer::writeThreadName(std::ostream & out, int tid, const std::string & name) {
+	out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << getpid()
+		<< ", \"tid\": " << tid
+		<< ", \"args\": {\"name\": \"" << name << "\"}}";
+}
+
+void Tracer::finish() {
+	if (!m_enabled) {
+		return;
+	}
+	m_enabled = false;
+	if (!m_file.is_open()) {
+		return;
+	}
+
+	std::ostream & out = m_file;
+	int pid = getpid();
+	bool first = true;
+	auto sep = [&] () -> std::ostream & {
+		out << (first ? "\n" : ",\n");
+		first = false;
+		return out;
+	};
+
+	out << "{\"displayTimeUnit\": \"ms\",\n"
+		<< "\"otherData\": {\"counters\": \"";
+	if (m_counterMask) {
+		const char * comma = "";
+		for (int i = 0; i < TraceCounters::NUM_COUNTERS; i++) {
+			if (m_counterMask & (1u << i)) {
+				out << comma << counterEvents[i].name;
+				comma = ", ";
+			}
+		}
+	} else {
+		out << "unavailable: " << m_counterError;
+	}
+	out << "\"},\n\"traceEvents\": [";
+
+	// Timestamps are in microseconds
+	out << std::fixed;
+	auto writeTimes = [&] (uint64_t start, uint64_t duration) {
+		out << std::setprecision(3)
+			<< ", \"ts\": " << start / 1000.0
+			<< ", \"dur\": " << duration / 1000.0;
+	};
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto & span : m_spans) {
+		sep() << "{\"name\": \"" << span.name << "\", \"cat\": \"span\", \"ph\": \"X\""
+			<< ", \"pid\": " << pid << ", \"tid\": " << span.thread;
+		writeTimes(span.start, span.end - span.start);
+		out << ", ";
+		writeArgs(out, span.face, span.level, span.counters);
+		out << "}";
+	}
+
+	// Each stage and level has its own track, since the rows of all levels
+	// are interleaved in time
+	for (int stage = 0; stage < NUM_STAGES; stage++) {
+		for (int levelSlot = 0; levelSlot < LEVEL_SLOTS; levelSlot++) {
+			int tid = STAGE_TRACK_BASE + stage * LEVEL_SLOTS + levelSlot;
+			bool named = false;
+			for (int faceSlot = 0; faceSlot < FACE_SLOTS; faceSlot++) {
+				Accumulator & acc = m_accumulators[stage][faceSlot][levelSlot];
+				if (!acc.calls) {
+					continue;
+				}
+				if (!named) {
+					std::string name = getStageName((TraceStage)stage);
+					if (levelSlot) {
+						name += " level " + std::to_string(levelSlot - 1);
+					}
+					writeThreadName(sep(), tid, name + " (accumulated)");
+					named = true;
+				}
+				TraceCounters counters;
+				for (int i = 0; i < TraceCounters::NUM_COUNTERS; i++) {
+					counters.values[i] = acc.counters[i];
+				}
+				sep() << "{\"name\": \"" << getStageName((TraceStage)stage)
+					<< "\", \"cat\": \"stage\", \"ph\": \"X\""
+					<< ", \"pid\": " << pid << ", \"tid\": " << tid;
+				writeTimes(acc.firstStart, acc.nanoseconds);
+				std::ostringstream extra;
+				extra << std::fixed << std::setprecision(3)
+					<< "\"calls\": " << acc.calls
+					<< ", \"elapsed_us\": " << (acc.lastEnd - acc.firstStart) / 1000.0
+					<< ", \"cpu_us\": " << acc.cpuNanoseconds / 1000.0;
+				out << ", ";
+				writeArgs(out, faceSlot - 1, levelSlot - 1, counters, extra.str());
+				out << "}";
+			}
+		}
+	}
+	out << "\n]}\n";
+	m_file.close();
+}
+
+void TraceSpan::begin(const char * name, int face, int level) {
+	m_name = name;
+	m_face = face < 0 ? Tracer::t_face : face;
+	m_level = level < 0 ? Tracer::t_level : level;
+	m_savedFace = Tracer::t_face;
+	Tracer::t_face = m_face;
+	g_tracer.readCounters(m_startCounters);
+	m_start = g_tracer.now();
+}
+
+void TraceSpan::end() {
+	uint64_t end = g_tracer.now();
+	TraceCounters endCounters;
+	g_tracer.readCounters(endCounters);
+	Tracer::t_face = m_savedFace;
+	g_tracer.addSpan(m_name, m_face, m_level, m_start, end, m_startCounters, endCounters);
+}
+
+} // namespace
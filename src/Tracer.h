@@ -0,0 +1,347 @@
+#ifndef PANO_TRACER_H
+#define PANO_TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace PanoProjector {
+
+/**
+ * Stages which run once per row. They are too frequent to record as
+ * individual spans, so their time and counters are accumulated.
+ */
+enum class TraceStage {
+	/** Sampling the input to compute a row of a cube face */
+	Sample,
+	/** Averaging two rows into a row of the next pyramid level */
+	Downsample,
+	/** Compressing rows of an output image */
+	Encode,
+};
+
+#ifdef PANO_TRACING
+/**
+ * Hardware counter values
+ */
+struct TraceCounters {
+	enum { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, NUM_COUNTERS };
+
+	uint64_t values[NUM_COUNTERS] = {};
+};
+
+/**
+ * Per-stage tracing
+ *
+ * When started, scoped spans are recorded as Chrome trace event JSON, which
+ * can be loaded in chrome://tracing or Perfetto. Spans cover coarse units of
+ * work such as decoding the input or extracting a face. Per-row stages are
+ * accumulated by stage, face and level, and each total is written as a
+ * single event on a separate track, starting at the first call.
+ *
+ * Where perf_event_open() permits it, the cycles, instructions, last level
+ * cache misses and data TLB misses of user space code in the calling thread
+ * are recorded for each span and stage.
+ *
+ * Instrumentation points use the PANO_TRACE_* macros, which compile to
+ * nothing unless PANO_TRACING is defined, as does the tracer itself. When
+ * compiled in but not started, each scope costs a load and a branch.
+ */
+class Tracer {
+public:
+	enum {
+		NUM_STAGES = 3,
+		/** Accumulator slots for faces, plus one for no face */
+		FACE_SLOTS = 7,
+		/** Accumulator slots for levels, plus one for no level */
+		LEVEL_SLOTS = 33,
+	};
+
+	/** The totals of a per-row stage over all faces and levels */
+	struct StageTotals {
+		uint64_t calls = 0;
+		/** The sum of the wall time of the calls */
+		uint64_t nanoseconds = 0;
+		/** The sum of the CPU time of the calling threads during the calls */
+		uint64_t cpuNanoseconds = 0;
+	};
+
+	Tracer();
+
+	/**
+	 * Start recording, and open the trace file. Throw an error if the file
+	 * can't be opened.
+	 */
+	void start(const std::string & path);
+
+	/**
+	 * Start recording without a trace file, so that only the stage totals
+	 * can be read
+	 */
+	void start();
+
+	/**
+	 * Write the recorded events to the trace file, if any, and stop recording
+	 */
+	void finish();
+
+	/**
+	 * Get the totals of a stage since recording started. The difference
+	 * between two calls gives the time spent in the stage in between.
+	 */
+	StageTotals getStageTotals(TraceStage stage) const;
+
+	bool isEnabled() const {
+		return m_enabled.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get the time since start() in nanoseconds
+	 */
+	uint64_t now() const;
+
+	/**
+	 * Read the hardware counters of the calling thread. The values are
+	 * left at zero if counters are not available.
+	 */
+	void readCounters(TraceCounters & counters);
+
+	/** Get the CPU time of the calling thread in nanoseconds */
+	static uint64_t getThreadCpuTime();
+
+	/**
+	 * Record a span
+	 */
+	void addSpan(const char * name, int face, int level, uint64_t start, uint64_t end,
+		const TraceCounters & startCounters, const TraceCounters & endCounters);
+
+	/**
+	 * Add a call of a per-row stage to its accumulator
+	 */
+	void accumulate(TraceStage stage, int face, int level, uint64_t start, uint64_t end,
+		uint64_t cpuNanoseconds, const TraceCounters & startCounters,
+		const TraceCounters & endCounters);
+
+	/**
+	 * Get the name of a stage, for reporting
+	 */
+	static const char * getStageName(TraceStage stage);
+
+	/** The face which the calling thread is working on, or -1 */
+	static thread_local int t_face;
+
+	/** The pyramid level which the calling thread is writing, or -1 */
+	static thread_local int t_level;
+
+private:
+	struct Span {
+		const char * name;
+		int face;
+		int level;
+		int thread;
+		uint64_t start;
+		uint64_t end;
+		TraceCounters counters;
+	};
+
+	struct Accumulator {
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> nanoseconds;
+		std::atomic<uint64_t> cpuNanoseconds;
+		std::atomic<uint64_t> firstStart;
+		std::atomic<uint64_t> lastEnd;
+		std::atomic<uint64_t> counters[TraceCounters::NUM_COUNTERS];
+	};
+
+	/** The hardware counters of a thread */
+	struct CounterGroup {
+		/** The file descriptor of each counter, or -1 */
+		int fds[TraceCounters::NUM_COUNTERS];
+		/** The counter at each position in a group read */
+		int order[TraceCounters::NUM_COUNTERS];
+		/** The group leader, or -1 if no counters could be opened */
+		int leader = -1;
+		/** The number of counters in the group */
+		int count = 0;
+		/** The errno of the first counter which failed to open, or zero */
+		int error = 0;
+		bool opened = false;
+
+		~CounterGroup();
+
+		/** Open the counters */
+		void open();
+	};
+
+	/** Get a small sequential ID for the calling thread */
+	static int getThreadId();
+
+	/**
+	 * Write the arguments of an event, starting with the given preformatted
+	 * key/value pairs if any
+	 */
+	void writeArgs(std::ostream & out, int face, int level,
+		const TraceCounters & counters, const std::string & extra = "");
+
+	/** Write a metadata event naming a track */
+	static void writeThreadName(std::ostream & out, int tid, const std::string & name);
+
+	std::atomic<bool> m_enabled;
+	std::ofstream m_file;
+	uint64_t m_startTime;
+	std::mutex m_mutex;
+	std::vector<Span> m_spans;
+	/** Counters which were successfully opened by the first thread */
+	std::atomic<unsigned> m_counterMask;
+	std::string m_counterError;
+	Accumulator m_accumulators[NUM_STAGES][FACE_SLOTS][LEVEL_SLOTS];
+
+	static thread_local CounterGroup t_counters;
+};
+
+extern Tracer g_tracer;
+
+/**
+ * Record a span from construction to destruction. If a face is given, it
+ * becomes the current face of the thread for the lifetime of the span.
+ */
+class TraceSpan {
+public:
+	TraceSpan(const char * name, int face = -1, int level = -1) {
+		m_active = g_tracer.isEnabled();
+		if (m_active) {
+			begin(name, face, level);
+		}
+	}
+
+	~TraceSpan() {
+		if (m_active) {
+			end();
+		}
+	}
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan & operator=(const TraceSpan &) = delete;
+
+private:
+	void begin(const char * name, int face, int level);
+	void end();
+
+	bool m_active;
+	const char * m_name;
+	int m_face;
+	int m_level;
+	int m_savedFace;
+	uint64_t m_start;
+	TraceCounters m_startCounters;
+};
+
+/**
+ * Add the time from construction to destruction to a per-row stage. If the
+ * level is -1, the current level of the thread is used.
+ */
+class TraceStageScope {
+public:
+	TraceStageScope(TraceStage stage, int level = -1) {
+		m_active = g_tracer.isEnabled();
+		if (m_active) {
+			m_stage = stage;
+			m_level = level < 0 ? Tracer::t_level : level;
+			g_tracer.readCounters(m_startCounters);
+			m_cpuStart = Tracer::getThreadCpuTime();
+			m_start = g_tracer.now();
+		}
+	}
+
+	~TraceStageScope() {
+		if (m_active) {
+			uint64_t end = g_tracer.now();
+			uint64_t cpuEnd = Tracer::getThreadCpuTime();
+			TraceCounters endCounters;
+			g_tracer.readCounters(endCounters);
+			g_tracer.accumulate(m_stage, Tracer::t_face, m_level, m_start, end,
+				cpuEnd - m_cpuStart, m_startCounters, endCounters);
+		}
+	}
+
+	TraceStageScope(const TraceStageScope &) = delete;
+	TraceStageScope & operator=(const TraceStageScope &) = delete;
+
+private:
+	bool m_active;
+	TraceStage m_stage;
+	int m_level;
+	uint64_t m_start;
+	uint64_t m_cpuStart;
+	TraceCounters m_startCounters;
+};
+
+/**
+ * Set the current pyramid level of the thread, so that stages in the level
+ * outputs, which don't know their level, are accumulated separately
+ */
+class TraceLevelScope {
+public:
+	explicit TraceLevelScope(int level)
+		: m_savedLevel(Tracer::t_level)
+	{
+		Tracer::t_level = level;
+	}
+
+	~TraceLevelScope() {
+		Tracer::t_level = m_savedLevel;
+	}
+
+	TraceLevelScope(const TraceLevelScope &) = delete;
+	TraceLevelScope & operator=(const TraceLevelScope &) = delete;
+
+private:
+	int m_savedLevel;
+};
+#endif
+
+/**
+ * The face and level of the current thread, captured on construction, so
+ * that a thread continuing its work can record under the same face and level
+ */
+struct TraceContext {
+#ifdef PANO_TRACING
+	int face = Tracer::t_face;
+	int level = Tracer::t_level;
+
+	/** Make the captured face and level current in the calling thread */
+	void apply() const {
+		Tracer::t_face = face;
+		Tracer::t_level = level;
+	}
+#else
+	void apply() const {}
+#endif
+};
+
+} // namespace
+
+#define PANO_TRACE_CONCAT_(a, b) a ## b
+#define PANO_TRACE_CONCAT(a, b) PANO_TRACE_CONCAT_(a, b)
+
+#ifdef PANO_TRACING
+/** Record a span until the end of the enclosing scope */
+#define PANO_TRACE_SPAN(...) \
+	::PanoProjector::TraceSpan PANO_TRACE_CONCAT(traceSpan_, __LINE__)(__VA_ARGS__)
+/** Accumulate a per-row stage until the end of the enclosing scope */
+#define PANO_TRACE_STAGE(stage, ...) \
+	::PanoProjector::TraceStageScope PANO_TRACE_CONCAT(traceStage_, __LINE__)( \
+		::PanoProjector::TraceStage::stage, ##__VA_ARGS__)
+/** Set the current pyramid level until the end of the enclosing scope */
+#define PANO_TRACE_LEVEL(level) \
+	::PanoProjector::TraceLevelScope PANO_TRACE_CONCAT(traceLevel_, __LINE__)(level)
+#else
+#define PANO_TRACE_SPAN(...) do {} while (0)
+#define PANO_TRACE_STAGE(stage, ...) do {} while (0)
+#define PANO_TRACE_LEVEL(level) do {} while (0)
+#endif
+
+#endif
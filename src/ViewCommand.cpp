@@ -0,0 +1,169 @@
+#include <cmath>
+#include <iostream>
+
+#include "ViewCommand.h"
+#include "FaceInfo.h"
+#include "InputBlank.h"
+#include "OutputImage.h"
+#include "Precision.h"
+#include "extractFace.h"
+
+namespace PanoProjector {
+
+void ViewCommand::initOptions() {
+	m_visible.add_options()
+		("help",
+			"Show help message and exit")
+		("input-format", po::value<std::string>()->default_value(""),
+			"The format of the input image. If unspecified, use the file extension")
+		("output-format", po::value<std::string>()->default_value(""),
+			"The format of the output image. If unspecified, use the file extension")
+		("width", po::value<int>()->default_value(1200),
+			"The output image width")
+		("height", po::value<int>()->default_value(630),
+			"The output image height")
+		("fov", po::value<double>()->default_value(90),
+			"The horizontal field of view in degrees, less than 180")
+		("yaw", po::value<double>()->default_value(0),
+			"The heading of the view centre in degrees, to the right of the "
+			"centre of the input")
+		("pitch", po::value<double>()->default_value(0),
+			"The latitude of the view centre in degrees")
+		("roll", po::value<double>()->default_value(0),
+			"Turn the view about its centre by this angle in degrees, so that "
+			"its right edge points higher")
+		("mem-limit", po::value<unsigned long>(),
+			"The approximate maximum memory usage in MiB")
+		("no-dct-scaling", po::bool_switch(),
+			"Decode the input at full resolution, even if the view needs less")
+		("quality", po::value<int>()->default_value(80),
+			"The encoder quality, as a percentage")
+		("copy-icc", po::bool_switch(),
+			"Copy the ICC color profile")
+		("precision", po::value<std::string>()->default_value("standard"),
+			"The accuracy of the sampling kernels: fast, standard, exact, or "
+			"mesh to compute the coordinates on a sparse grid and interpolate them")
+		("hfov", po::value<double>(),
+			"The horizontal field of view of a partial panorama in degrees "
+			"(default: from the GPano XMP metadata, or 360)")
+		("vfov", po::value<double>(),
+			"The vertical field of view of a partial panorama in degrees "
+			"(default: from the GPano XMP metadata, or from the aspect ratio)")
+		("hoffset", po::value<double>(),
+			"The angle in degrees from the left edge of the full panorama to "
+			"the left edge of the input (default: centred)")
+		("voffset", po::value<double>(),
+			"The angle in degrees from the top edge of the full panorama to "
+			"the top edge of the input (default: centred)")
+		("fill", po::value<std::string>()->default_value("000000"),
+			"The colour of the area outside a partial panorama, as six hex digits")
+		;
+
+	addEngineOptions(m_visible);
+
+	m_invisible.add_options()
+		("input", po::value<std::string>())
+		("output", po::value<std::string>())
+		;
+
+	m_pos
+		.add("input", 1)
+		.add("output", 1)
+		;
+}
+
+std::string ViewCommand::getSynopsis() {
+	return "view [options] <input> <output>";
+}
+
+std::string ViewCommand::getName() {
+	return "view";
+}
+
+std::string ViewCommand::getDescription() {
+	return "Render a rectilinear view from an equirectangular source image, "
+		"decoding only the part of the input which it covers.";
+}
+
+int ViewCommand::getScaleDenom(int srcWidth, int viewWidth, double scaleA) {
+	// The focal length in output pixels, which is the number of pixels per
+	// radian at the centre of the view
+	double focal = viewWidth / 2.0 / scaleA;
+	// Keep twice the density of the view, so that the bilinear sampling
+	// still has some detail to interpolate between
+	int denom = 1;
+	while (denom < 8 && srcWidth / (denom * 2) / (2 * M_PI) >= 2 * focal) {
+		denom *= 2;
+	}
+	return denom;
+}
+
+int ViewCommand::doRun() {
+	if (!m_options.count("input") || !m_options.count("output")) {
+		std::cerr << "Error: an input filename and an output filename must be specified.\n";
+		return 1;
+	}
+
+	int width = m_options["width"].as<int>();
+	int height = m_options["height"].as<int>();
+	double fov = m_options["fov"].as<double>();
+	if (width <= 0 || height <= 0) {
+		std::cerr << "Error: the width and height must be positive\n";
+		return 1;
+	}
+	if (!(fov > 0 && fov < 180)) {
+		std::cerr << "Error: the field of view must be between 0 and 180 degrees\n";
+		return 1;
+	}
+
+	setMemoryLimit();
+
+	EncoderOptions encoderOptions;
+	encoderOptions.quality = m_options["quality"].as<int>();
+
+	std::string outputPath = m_options["output"].as<std::string>();
+	std::string outputFormat = InputImageFactory::normalizeFormat(
+		outputPath,
+		m_options["output-format"].as<std::string>());
+	if (outputFormat != "jpeg") {
+		std::cerr << "Error: for forwards compatibility, the output file format must be "
+			<< "specified as JPEG, either by the file extension or with --output-format\n";
+		return 1;
+	}
+
+	auto & inputPath = m_options["input"].as<std::string>();
+	auto & inputFormat = m_options["input-format"].as<std::string>();
+	InputInfo info = InputImageFactory::getInfo(inputPath, inputFormat);
+	Coverage coverage = getCoverage(info);
+
+	// The tangents of half the fields of view, with square pixels
+	double scaleA = tan(fov * M_PI / 360);
+	double scaleB = scaleA * height / width;
+
+	Precision precision = getPrecisionFromName(m_options["precision"].as<std::string>());
+	Rotation rotation = getRotation();
+	int scaleDenom = m_options["no-dct-scaling"].as<bool>() || !info.scalable
+		? 1 : getScaleDenom(coverage.getFullWidth(info.width), width, scaleA);
+
+	CropRect cropRect = FaceInfo::getViewCropRect(scaleA, scaleB,
+		getMaxAngleError(precision), rotation);
+	CropRect imageRect;
+	std::unique_ptr<InputImage> input;
+	if (coverage.getImageCropRect(cropRect, imageRect)) {
+		input.reset(InputImageFactory::create(inputPath, inputFormat, imageRect, scaleDenom));
+	} else {
+		// The view is entirely outside a partial panorama
+		input.reset(new InputBlank(info.width, info.height));
+	}
+	input->setCoverage(coverage);
+
+	Metadata meta;
+	if (m_options["copy-icc"].as<bool>()) {
+		meta.icc = info.metadata.icc;
+	}
+	OutputImage output(outputPath, width, height, meta, encoderOptions);
+	extractView(*input, output, rotation, scaleA, scaleB, precision);
+	return 0;
+}
+
+} // namespace
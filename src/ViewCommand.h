@@ -0,0 +1,32 @@
+#ifndef PANO_VIEW_COMMAND_H
+#define PANO_VIEW_COMMAND_H
+
+#include "Command.h"
+
+namespace PanoProjector {
+
+/**
+ * Render a rectilinear (perspective) view, for thumbnails and previews
+ */
+class ViewCommand : public Command {
+public:
+	std::string getName() override;
+	std::string getDescription() override;
+
+protected:
+	void initOptions() override;
+	std::string getSynopsis() override;
+	int doRun() override;
+
+private:
+	/**
+	 * Get the largest JPEG scale denominator, up to 8, for which the scaled
+	 * source still has at least twice as many pixels per radian at the
+	 * equator as the centre of the view, which is where the view is most
+	 * detailed
+	 */
+	static int getScaleDenom(int srcWidth, int viewWidth, double scaleA);
+};
+
+} // namespace
+#endif
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <thread>
+#include "WorkStealingPool.h"
+
+namespace PanoProjector {
+
+static thread_local int t_workerIndex = -1;
+
+WorkStealingPool::WorkStealingPool(int numThreads) {
+	for (int i = 0; i < std::max(numThreads, 1); i++) {
+		m_workers.push_back(std::make_unique<Worker>());
+	}
+}
+
+int WorkStealingPool::getWorkerIndex() {
+	return t_workerIndex;
+}
+
+void WorkStealingPool::submit(Task task) {
+	{
+		// The task is pushed under m_mutex, so that a worker which didn't
+		// find it sees the generation change before it waits
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending++;
+		if (t_workerIndex < 0) {
+			m_shared.push_back(std::move(task));
+		} else {
+			Worker & worker = *m_workers[t_workerIndex];
+			std::lock_guard<std::mutex> workerLock(worker.mutex);
+			worker.tasks.push_back(std::move(task));
+		}
+		m_generation++;
+	}
+	m_cond.notify_one();
+}
+
+void WorkStealingPool::run() {
+	std::vector<std::thread> threads;
+	for (int i = 0; i < getNumThreads(); i++) {
+		threads.emplace_back(&WorkStealingPool::work, this, i);
+	}
+	for (auto & thread : threads) {
+		thread.join();
+	}
+}
+
+bool WorkStealingPool::takeTask(int index, Task & task) {
+	const int numWorkers = getNumThreads();
+	for (int k = 0; k < numWorkers; k++) {
+		Worker & worker = *m_workers[(index + k) % numWorkers];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.tasks.empty()) {
+			if (k == 0) {
+				task = std::move(worker.tasks.back());
+				worker.tasks.pop_back();
+			} else {
+				task = std::move(worker.tasks.front());
+				worker.tasks.pop_front();
+			}
+			return true;
+		}
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_shared.empty()) {
+		task = std::move(m_shared.front());
+		m_shared.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void WorkStealingPool::work(int index) {
+	t_workerIndex = index;
+	for (;;) {
+		unsigned long generation;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			generation = m_generation;
+		}
+		Task task;
+		if (takeTask(index, task)) {
+			task();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_pending == 0) {
+				m_cond.notify_all();
+			}
+			continue;
+		}
+
+		// Wait for a task to be submitted since the search started, or for
+		// all tasks to finish
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [&] {
+			return m_pending == 0 || m_generation != generation;
+		});
+		if (m_pending == 0) {
+			break;
+		}
+	}
+	t_workerIndex = -1;
+}
+
+} // namespace
@@ -0,0 +1,92 @@
+#ifndef PANO_WORKSTEALINGPOOL_H
+#define PANO_WORKSTEALINGPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PanoProjector {
+
+/**
+ * A pool of worker threads which run tasks, with work stealing.
+ *
+ * Tasks submitted before run() go in a shared queue, and are started in
+ * order. Tasks submitted by a running task go in the deque of the worker
+ * which submitted them, and the worker runs the newest of its own tasks
+ * first. A worker with no tasks of its own steals the oldest task of
+ * another worker, and only when there are none does it start a task from
+ * the shared queue. So the tasks spawned by a task are finished before new
+ * work is started, and the amount of work in progress stays bounded by the
+ * number of workers.
+ *
+ * Tasks must not throw.
+ */
+class WorkStealingPool {
+public:
+	typedef std::function<void()> Task;
+
+	/**
+	 * Constructor
+	 *
+	 * @param numThreads The number of worker threads, at least 1
+	 */
+	explicit WorkStealingPool(int numThreads);
+
+	/**
+	 * Add a task. Called from a task, it goes in the worker's own deque,
+	 * otherwise in the shared queue.
+	 */
+	void submit(Task task);
+
+	/**
+	 * Run the tasks until all of them, including those submitted by other
+	 * tasks, are done. The calling thread waits for the workers.
+	 */
+	void run();
+
+	/** Get the number of worker threads */
+	int getNumThreads() const {
+		return (int)m_workers.size();
+	}
+
+	/** Get the index of the calling worker thread, or -1 if it is not a worker */
+	static int getWorkerIndex();
+
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	/** The main loop of a worker thread */
+	void work(int index);
+
+	/**
+	 * Take the next task for a worker: its own newest task, or the oldest
+	 * task of another worker, or the oldest task in the shared queue
+	 */
+	bool takeTask(int index, Task & task);
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	/**
+	 * Protects m_shared, m_pending and m_generation, and is held while
+	 * pushing to any queue. Workers lock their own mutex within it.
+	 */
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Task> m_shared;
+
+	/** The number of tasks submitted but not yet finished */
+	long m_pending = 0;
+
+	/** The number of tasks submitted, so that waiting workers can see new ones */
+	unsigned long m_generation = 0;
+};
+
+} // namespace
+
+#endif
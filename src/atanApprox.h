@@ -0,0 +1,56 @@
+#ifndef PANO_ATANAPPROX_H
+#define PANO_ATANAPPROX_H
+
+#include <cmath>
+#include "Isa.h"
+
+namespace PanoProjector {
+
+// The polynomials are evaluated with separate multiplies and adds rather
+// than fmaf(), which is a libm call in the baseline variant of the kernels.
+// Contraction is disabled, so every ISA level rounds the same way.
+
+// Based on https://gist.github.com/bitonic/d0f5a0a44e37d4f0be03d34d47acb6cf
+PANO_KERNEL_INLINE float atan_approx(float x) {
+	float a1  =  0.99997726f;
+	float a3  = -0.33262347f;
+	float a5  =  0.19354346f;
+	float a7  = -0.11643287f;
+	float a9  =  0.05265332f;
+	float a11 = -0.01172120f;
+	float x_sq = x*x;
+	return
+		x * ((((((a11 * x_sq + a9) * x_sq + a7) * x_sq + a5) * x_sq + a3) * x_sq) + a1);
+}
+
+// A 5th order minimax polynomial, for |x| <= 1. The maximum error is about
+// 6.1e-4 radians, compared to 1.7e-6 for atan_approx().
+PANO_KERNEL_INLINE float atan_approx_fast(float x) {
+	float a1 =  0.99535795f;
+	float a3 = -0.28869024f;
+	float a5 =  0.07933904f;
+	float x_sq = x*x;
+	return x * ((a5 * x_sq + a3) * x_sq + a1);
+}
+
+// Based on https://gist.github.com/bitonic/d0f5a0a44e37d4f0be03d34d47acb6cf
+// The arctangent approximation for |x| <= 1 is a template parameter.
+template <float (*atan_fn)(float) = atan_approx>
+PANO_KERNEL_INLINE float atan2f_approx(float y, float x) {
+	const float pi = M_PI;
+	const float pi_2 = M_PI_2;
+	bool swap = std::fabs(x) < std::fabs(y);
+	float atan_input = (swap ? x : y) / (swap ? y : x);
+	float res = atan_fn(atan_input);
+	res = swap ? copysignf(pi_2, atan_input) - res : res;
+	// Test the sign bit so that x = -0 is handled like x < 0, as in atan2f().
+	// This happens in the middle row of the down face.
+	if (std::signbit(x)) {
+		res = copysignf(pi, y) + res;
+	}
+	return res;
+}
+
+} // namespace
+
+#endif
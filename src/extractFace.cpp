@@ -1,87 +1,864 @@
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <memory>
 #include <stdexcept>
+#include <vector>
 
 #include "extractFace.h"
 #include "FaceInfo.h"
+#include "InputYcc.h"
+#include "OutputImage.h"
+#include "atanApprox.h"
+#include "Isa.h"
+#include "MemoryBudget.h"
+#include "Tracer.h"
 
 namespace PanoProjector {
 
-// Based on https://gist.github.com/bitonic/d0f5a0a44e37d4f0be03d34d47acb6cf
-static inline float atan_approx(float x) {
-	float a1  =  0.99997726f;
-	float a3  = -0.33262347f;
-	float a5  =  0.19354346f;
-	float a7  = -0.11643287f;
-	float a9  =  0.05265332f;
-	float a11 = -0.01172120f;
-	float x_sq = x*x;
-	return
-		x * fmaf(x_sq, fmaf(x_sq, fmaf(x_sq, fmaf(x_sq, fmaf(x_sq, a11, a9), a7), a5), a3), a1);
-}
-
-// Based on https://gist.github.com/bitonic/d0f5a0a44e37d4f0be03d34d47acb6cf
-static float atan2f_approx(float y, float x) {
-	const float pi = M_PI;
-	const float pi_2 = M_PI_2;
-	bool swap = std::fabs(x) < std::fabs(y);
-	float atan_input = (swap ? x : y) / (swap ? y : x);
-	float res = atan_approx(atan_input);
-	res = swap ? copysignf(pi_2, atan_input) - res : res;
-	if (x < 0.0f) {
-		res = copysignf(pi, y) + res;
+template <class Policy, class Mapping>
+static void extractFaceWith(int face, InputImage & input, OutputBase & output,
+	const Rotation & rotation
+) {
+	// The code runs much faster if the face index is a compile-time constant.
+	if (face == 0) extractFaceTpl<0, Policy, Mapping>(input, output, rotation);
+	if (face == 1) extractFaceTpl<1, Policy, Mapping>(input, output, rotation);
+	if (face == 2) extractFaceTpl<2, Policy, Mapping>(input, output, rotation);
+	if (face == 3) extractFaceTpl<3, Policy, Mapping>(input, output, rotation);
+	if (face == 4) extractFaceTpl<4, Policy, Mapping>(input, output, rotation);
+	if (face == 5) extractFaceTpl<5, Policy, Mapping>(input, output, rotation);
+}
+
+template <class Policy>
+static void extractFaceWith(int face, InputImage & input, OutputBase & output,
+	const Rotation & rotation, CubeMapping mapping
+) {
+	switch (mapping) {
+		case CubeMapping::Standard:
+			extractFaceWith<Policy, StandardMapping>(face, input, output, rotation);
+			break;
+		case CubeMapping::EquiAngular:
+			extractFaceWith<Policy, EquiAngularMapping>(face, input, output, rotation);
+			break;
 	}
-	return res;
 }
 
-void extractFace(int face, InputImage & input, OutputBase & output) {
-	// The code runs much faster if the face index is a compile-time constant.
-	if (face == 0) extractFaceTpl<0>(input, output);
-	if (face == 1) extractFaceTpl<1>(input, output);
-	if (face == 2) extractFaceTpl<2>(input, output);
-	if (face == 3) extractFaceTpl<3>(input, output);
-	if (face == 4) extractFaceTpl<4>(input, output);
-	if (face == 5) extractFaceTpl<5>(input, output);
+void extractFace(int face, InputImage & input, OutputBase & output,
+	Precision precision, const Rotation & rotation, CubeMapping mapping
+) {
+	PANO_TRACE_SPAN("face", face);
+
+	switch (precision) {
+		case Precision::Fast: extractFaceWith<FastPrecision>(face, input, output, rotation, mapping); break;
+		case Precision::Standard: extractFaceWith<StandardPrecision>(face, input, output, rotation, mapping); break;
+		case Precision::Exact: extractFaceWith<ExactPrecision>(face, input, output, rotation, mapping); break;
+		case Precision::Mesh: extractFaceWith<MeshPrecision>(face, input, output, rotation, mapping); break;
+	}
 }
 
-template <int face>
-void extractFaceTpl(InputImage & input, OutputBase & output) {
-	const int destWidth = output.getWidth();
-	const int destHeight = output.getHeight();
-	const int srcWidth = input.getWidth();
-	const int srcHeight = input.getHeight();
+template <class Policy, class Mapping>
+static void extractFaceRegionWith(int face, InputImage & input, int size,
+	int startRow, int endRow, int startCol, int endCol,
+	uint8_t * dest, size_t destStride, const Rotation & rotation
+) {
+	if (face == 0) extractFaceRegionTpl<0, Policy, Mapping>(input, size, startRow, endRow, startCol, endCol, dest, destStride, rotation);
+	if (face == 1) extractFaceRegionTpl<1, Policy, Mapping>(input, size, startRow, endRow, startCol, endCol, dest, destStride, rotation);
+	if (face == 2) extractFaceRegionTpl<2, Policy, Mapping>(input, size, startRow, endRow, startCol, endCol, dest, destStride, rotation);
+	if (face == 3) extractFaceRegionTpl<3, Policy, Mapping>(input, size, startRow, endRow, startCol, endCol, dest, destStride, rotation);
+	if (face == 4) extractFaceRegionTpl<4, Policy, Mapping>(input, size, startRow, endRow, startCol, endCol, dest, destStride, rotation);
+	if (face == 5) extractFaceRegionTpl<5, Policy, Mapping>(input, size, startRow, endRow, startCol, endCol, dest, destStride, rotation);
+}
+
+template <class Policy>
+static void extractFaceRegionWith(int face, InputImage & input, int size,
+	int startRow, int endRow, int startCol, int endCol,
+	uint8_t * dest, size_t destStride, const Rotation & rotation, CubeMapping mapping
+) {
+	switch (mapping) {
+		case CubeMapping::Standard:
+			extractFaceRegionWith<Policy, StandardMapping>(face, input, size,
+				startRow, endRow, startCol, endCol, dest, destStride, rotation);
+			break;
+		case CubeMapping::EquiAngular:
+			extractFaceRegionWith<Policy, EquiAngularMapping>(face, input, size,
+				startRow, endRow, startCol, endCol, dest, destStride, rotation);
+			break;
+	}
+}
+
+void extractFaceRegion(int face, InputImage & input, int size,
+	int startRow, int endRow, int startCol, int endCol,
+	uint8_t * dest, size_t destStride, Precision precision, const Rotation & rotation,
+	CubeMapping mapping
+) {
+	switch (precision) {
+		case Precision::Fast:
+			extractFaceRegionWith<FastPrecision>(face, input, size,
+				startRow, endRow, startCol, endCol, dest, destStride, rotation, mapping);
+			break;
+		case Precision::Standard:
+			extractFaceRegionWith<StandardPrecision>(face, input, size,
+				startRow, endRow, startCol, endCol, dest, destStride, rotation, mapping);
+			break;
+		case Precision::Exact:
+			extractFaceRegionWith<ExactPrecision>(face, input, size,
+				startRow, endRow, startCol, endCol, dest, destStride, rotation, mapping);
+			break;
+		case Precision::Mesh:
+			extractFaceRegionWith<MeshPrecision>(face, input, size,
+				startRow, endRow, startCol, endCol, dest, destStride, rotation, mapping);
+			break;
+	}
+}
+
+/**
+ * The grid of source coordinates for Precision::Mesh, for one row of cells
+ * at a time. It is computed as the rows of a face are extracted in order,
+ * and each node is at a fixed face position, so the output doesn't depend on
+ * which rows and columns are extracted.
+ *
+ * The columns are indexed by the horizontal face position p, where pixel i
+ * is sampled at a = 2p/width - 1. For the left half p = i, and for the right
+ * half p = i + 1, since it mirrors the left half.
+ */
+struct MeshCache {
+	/** The face size the grid was computed for */
+	int width = 0, height = 0;
+
+	/** The row of cells whose top and bottom nodes are cached, or -1 */
+	int cellRow = -1;
+
+	/** The source x and y of the nodes on the top and bottom of the cells */
+	std::vector<float> top, bottom;
+
+	/**
+	 * The source x and y at the nodes, interpolated to the current row, and
+	 * their change per pixel within each cell
+	 */
+	std::vector<float> row, slope;
+
+	/** Whether each cell of the row is computed at every pixel */
+	std::vector<uint8_t> exact;
+};
+
+/**
+ * The rotation and source mapping as applied by the row kernels, derived
+ * from a Rotation and the input image
+ */
+struct KernelParams {
+	/**
+	 * The offset added to the source x coordinate, for a rotation about the
+	 * vertical axis only, or zero for the identity
+	 */
+	float uOffset = 0;
+
+	/** The rotation matrix, for other rotations */
+	float matrix[3][3];
+
+	/**
+	 * The scale from the full panorama u and v, as in CropRect, to source x
+	 * and y, and the source coordinates of u=0 and v=0. For a partial
+	 * panorama, the origin is outside the source image.
+	 */
+	float xScale, xOrigin, yScale, yOrigin;
+
+	/** Whether samples can fall outside the source, for a partial panorama */
+	bool partial;
+
+	/**
+	 * The range of source coordinates which can be interpolated, infinite at
+	 * the edges of the full panorama
+	 */
+	float minX, maxX, minY, maxY;
+
+	/** The colour of samples outside the source */
+	uint8_t fill[COMPONENTS];
+
+	/** The grid for Precision::Mesh, filled in by the row kernel */
+	mutable MeshCache mesh;
+
+	template <class Image>
+	KernelParams(const Rotation & rotation, const Image & input) {
+		setSource(input);
+		if (rotation.isYawOnly()) {
+			uOffset = (float)(rotation.getYaw() / (2 * M_PI) * xScale);
+		}
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 3; c++) {
+				matrix[r][c] = (float)rotation.getMatrix()[r][c];
+			}
+		}
+	}
+
+	/**
+	 * For a view through the plane of the front face, where the horizontal
+	 * and vertical face coordinates are scaled by the given factors before
+	 * rotating. The front face has x invariant, y minor and z major.
+	 */
+	template <class Image>
+	KernelParams(const Rotation & rotation, double scaleA, double scaleB,
+		const Image & input
+	) {
+		setSource(input);
+		const double scale[3] = {1, scaleA, scaleB};
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 3; c++) {
+				matrix[r][c] = (float)(rotation.getMatrix()[r][c] * scale[c]);
+			}
+		}
+	}
+
+private:
+	template <class Image>
+	void setSource(const Image & input) {
+		const Coverage & coverage = input.getCoverage();
+		const int width = input.getWidth();
+		const int height = input.getHeight();
+		// For a full panorama, the scale is exactly width-1 and the origin
+		// is zero, so the samples are the same as without coverage
+		double xs = (width - 1) / (coverage.right - coverage.left);
+		double ys = (height - 1) / (coverage.bottom - coverage.top);
+		xScale = (float)xs;
+		xOrigin = (float)(coverage.left * xs);
+		yScale = (float)ys;
+		yOrigin = (float)(coverage.top * ys);
+		partial = !coverage.isFull();
+		minX = coverage.left == 0 ? -INFINITY : 0;
+		maxX = coverage.right == 1 ? INFINITY : width - 1;
+		minY = coverage.top == 0 ? -INFINITY : 0;
+		maxY = coverage.bottom == 1 ? INFINITY : height - 1;
+		for (int c = 0; c < Image::CHANNELS; c++) {
+			fill[c] = input.getFill()[c];
+		}
+	}
+};
+
+/**
+ * Interpolate the source at the given coordinates, or for a partial
+ * panorama, use the fill colour if they are outside the source.
+ */
+template <class Policy, class Image>
+static PANO_KERNEL_INLINE void sampleSource(Image & input, uint8_t * dest,
+	float x, float y, const KernelParams & params
+) {
+	if (params.partial
+		&& !(x >= params.minX && x < params.maxX && y >= params.minY && y < params.maxY)
+	) {
+		for (int c = 0; c < Image::CHANNELS; c++) {
+			dest[c] = params.fill[c];
+		}
+	} else {
+		Policy::interpolate(input, dest, x, y);
+	}
+}
+
+/**
+ * Extract columns startCol to endCol-1 of row j of a cube face, and write
+ * them to the start of the buffer.
+ *
+ * Each pixel i in the left half is computed together with its reflection
+ * in the right half, since reflecting the horizontal cube face coordinate
+ * only changes theta. A pixel in the right half is always derived from its
+ * reflection in the left half, even if that is outside the requested
+ * columns, so that the result doesn't depend on the requested columns.
+ *
+ * A rotation about the vertical axis is applied by offsetting the source x
+ * coordinate, wrapping around the seam, which preserves the reflection.
+ *
+ * The mapping policy converts the face image coordinates to face plane
+ * coordinates. It is odd, so it preserves the reflection too.
+ *
+ * This is inlined into a variant for each ISA level. The arctangent and
+ * interpolation functions are small enough that the compiler inlines them
+ * too.
+ */
+template <int face, class Policy, class Mapping, class Image>
+static PANO_KERNEL_INLINE void extractFaceRow(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
 	const float pi = M_PI;
 	const float pi_2 = M_PI_2;
 	const float pi_x2 = M_PI * 2;
+	const float uOffset = params.uOffset;
+	const float xScale = params.xScale;
+	const float xOrigin = params.xOrigin;
+	const float maxU = xScale;
 
-	uint8_t buffer[destWidth * COMPONENTS];
+	// Offset the full panorama x coordinate by the yaw, wrapping it into
+	// 0≤u≤maxU. This is skipped for the identity so that its output is
+	// unchanged.
+	auto rotateU = [uOffset, maxU] (float uf) {
+		if (uOffset != 0) {
+			uf += uOffset;
+			if (uf > maxU) {
+				uf -= maxU;
+			}
+		}
+		return uf;
+	};
 
 	// Cartesian coords on the 2x2x2 cube |x|<=1, |y|<=1, |z|<=1
 	float x = 0, y = 0, z = 0;
 
 	FaceInfo::setInvariant<face>(x, y, z);
+	FaceInfo::setMajor<face>(x, y, z, Mapping::toPlane((2.0f * j) / destHeight - 1.0f));
 
-	for (int j = 0; j < destHeight; j++) {
-		FaceInfo::setMajor<face>(x, y, z, (2.0f * j) / destHeight - 1.0f);
+	// The left half columns which are either requested or have a requested
+	// reflection. If the width is odd, the middle column is its own
+	// reflection, and is included in the left half.
+	const int half = (destWidth + 1) / 2;
+	int iStart = startCol, iEnd = std::min(endCol, half);
+	const int reflectedStart = std::max(destWidth - endCol, 0);
+	const int reflectedEnd = std::min(destWidth - startCol, half);
+	if (iStart >= iEnd) {
+		iStart = reflectedStart;
+		iEnd = reflectedEnd;
+	} else if (reflectedStart < reflectedEnd) {
+		iStart = std::min(iStart, reflectedStart);
+		iEnd = std::max(iEnd, reflectedEnd);
+	}
 
-		for (int i = 0; i < destWidth / 2; i++) {
-			FaceInfo::setMinor<face>(x, y, z, (2.0f * i) / destWidth - 1.0f);
+	for (int i = iStart; i < iEnd; i++) {
+		FaceInfo::setMinor<face>(x, y, z, Mapping::toPlane((2.0f * i) / destWidth - 1.0f));
 
-			float theta = atan2f_approx(y, x);
-			float phi = atan2f_approx(z, hypotf(x, y));
+		float theta = Policy::atan2(y, x);
+		float phi = Policy::atan2(z, hypotf(x, y));
 
-			// Source image coords
-			float uf = (theta + pi) / pi_x2 * (srcWidth - 1);
-			float vf = (pi_2 - phi) / pi * (srcHeight - 1);
-			input.interpolate(&buffer[COMPONENTS * i], uf, vf);
+		// Source image coords
+		float uf;
+		float vf = (pi_2 - phi) / pi * params.yScale - params.yOrigin;
+		if (i >= startCol && i < endCol) {
+			uf = rotateU((theta + pi) / pi_x2 * xScale) - xOrigin;
+			sampleSource<Policy>(input, &buffer[Image::CHANNELS * (i - startCol)], uf, vf, params);
+		}
 
-			// Reflect the horizontal destination coordinate and repeat
-			int ii = destWidth - i - 1;
+		// Reflect the horizontal destination coordinate and repeat
+		int ii = destWidth - i - 1;
+		if (ii > i && ii >= startCol && ii < endCol) {
 			// Reflecting i does not change phi, we only have to reflect theta
 			FaceInfo::reflectTheta<face>(theta);
-			uf = (theta + pi) / pi_x2 * (srcWidth - 1);
-			input.interpolate(&buffer[COMPONENTS * ii], uf, vf);
+			uf = rotateU((theta + pi) / pi_x2 * xScale) - xOrigin;
+			sampleSource<Policy>(input, &buffer[Image::CHANNELS * (ii - startCol)], uf, vf, params);
+		}
+	}
+}
+
+/**
+ * The equivalent of extractFaceRow() for a general rotation. The reflection
+ * doesn't commute with the rotation, so every pixel is computed directly,
+ * but at the same points as extractFaceRow(), with the right half mirroring
+ * the left half. Along a row, the rotated cube point is a linear function of
+ * the horizontal cube face coordinate.
+ */
+template <int face, class Policy, class Mapping, class Image>
+static PANO_KERNEL_INLINE void extractFaceRowRotated(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
+	const float pi = M_PI;
+	const float pi_2 = M_PI_2;
+	const float pi_x2 = M_PI * 2;
+	const auto & m = params.matrix;
+
+	// The cube point at the centre of the row, and the change in it per unit
+	// of the horizontal cube face coordinate
+	float x0 = 0, y0 = 0, z0 = 0;
+	FaceInfo::setInvariant<face>(x0, y0, z0);
+	FaceInfo::setMajor<face>(x0, y0, z0, Mapping::toPlane((2.0f * j) / destHeight - 1.0f));
+	FaceInfo::setMinor<face>(x0, y0, z0, 0.0f);
+	float dx = 0, dy = 0, dz = 0;
+	FaceInfo::setMinor<face>(dx, dy, dz, 1.0f);
+
+	const float ox = m[0][0] * x0 + m[0][1] * y0 + m[0][2] * z0;
+	const float oy = m[1][0] * x0 + m[1][1] * y0 + m[1][2] * z0;
+	const float oz = m[2][0] * x0 + m[2][1] * y0 + m[2][2] * z0;
+	const float sx = m[0][0] * dx + m[0][1] * dy + m[0][2] * dz;
+	const float sy = m[1][0] * dx + m[1][1] * dy + m[1][2] * dz;
+	const float sz = m[2][0] * dx + m[2][1] * dy + m[2][2] * dz;
+
+	const int half = (destWidth + 1) / 2;
+	for (int i = startCol; i < endCol; i++) {
+		float a = Mapping::toPlane(i < half
+			? (2.0f * i) / destWidth - 1.0f
+			: -((2.0f * (destWidth - 1 - i)) / destWidth - 1.0f));
+		float x = ox + a * sx;
+		float y = oy + a * sy;
+		float z = oz + a * sz;
+
+		// The longitude of a pole is undefined, and the approximations would
+		// return NaN for it
+		float r = hypotf(x, y);
+		float theta = r > 0 ? Policy::atan2(y, x) : 0.0f;
+		float phi = Policy::atan2(z, r);
+
+		float uf = (theta + pi) / pi_x2 * params.xScale - params.xOrigin;
+		float vf = (pi_2 - phi) / pi * params.yScale - params.yOrigin;
+		sampleSource<Policy>(input, &buffer[Image::CHANNELS * (i - startCol)], uf, vf, params);
+	}
+}
+
+/**
+ * Get the source coordinates of a face point, given in face image
+ * coordinates scaled to -1≤a≤1 and -1≤b≤1, as computed by
+ * extractFaceRowRotated() or, with the reflection applied directly,
+ * extractFaceRow()
+ */
+template <int face, class Policy, class Mapping, bool rotated>
+static PANO_KERNEL_INLINE void getSourceCoords(float a, float b, const KernelParams & params,
+	float & uf, float & vf
+) {
+	const float pi = M_PI;
+	const float pi_2 = M_PI_2;
+	const float pi_x2 = M_PI * 2;
+
+	float x = 0, y = 0, z = 0;
+	FaceInfo::setInvariant<face>(x, y, z);
+	FaceInfo::setMajor<face>(x, y, z, Mapping::toPlane(b));
+	FaceInfo::setMinor<face>(x, y, z, Mapping::toPlane(a));
+	if constexpr (rotated) {
+		const auto & m = params.matrix;
+		const float rx = m[0][0] * x + m[0][1] * y + m[0][2] * z;
+		const float ry = m[1][0] * x + m[1][1] * y + m[1][2] * z;
+		const float rz = m[2][0] * x + m[2][1] * y + m[2][2] * z;
+		x = rx;
+		y = ry;
+		z = rz;
+	}
+
+	float r = hypotf(x, y);
+	float theta = r > 0 ? Policy::atan2(y, x) : 0.0f;
+	float phi = Policy::atan2(z, r);
+
+	uf = (theta + pi) / pi_x2 * params.xScale;
+	if (!rotated && params.uOffset != 0) {
+		uf += params.uOffset;
+		if (uf > params.xScale) {
+			uf -= params.xScale;
+		}
+	}
+	uf -= params.xOrigin;
+	vf = (pi_2 - phi) / pi * params.yScale - params.yOrigin;
+}
+
+/**
+ * Compute the nodes on the top and bottom of a row of mesh cells, and check
+ * each cell. The nodes on the top are reused from the previous row of cells.
+ *
+ * A cell is interpolated only if the interpolated coordinates are within the
+ * tolerance at the centre and the midpoints of the edges, where the error of
+ * bilinear interpolation of a smooth function is largest. The tolerance is
+ * also capped so that the error stays within the crop margin. A cell whose
+ * nodes lie either side of the seam always fails, since its longitudes wrap.
+ * This is called once per row of cells, so it isn't inlined.
+ */
+template <int face, class Policy, class Mapping, bool rotated>
+static void updateMesh(MeshCache & mesh, int cellRow, int destWidth, int destHeight,
+	const KernelParams & params
+) {
+	const int step = Policy::MESH_STEP;
+	const int cells = (destWidth + step - 1) / step;
+	if (mesh.width != destWidth || mesh.height != destHeight) {
+		mesh.width = destWidth;
+		mesh.height = destHeight;
+		mesh.cellRow = -1;
+		mesh.top.resize(2 * (cells + 1));
+		mesh.bottom.resize(2 * (cells + 1));
+		mesh.row.resize(2 * (cells + 1));
+		mesh.slope.resize(2 * cells);
+		mesh.exact.resize(cells);
+	}
+
+	auto getCoords = [&] (float p, float q, float & uf, float & vf) {
+		getSourceCoords<face, Policy, Mapping, rotated>(
+			(2.0f * p) / destWidth - 1.0f, (2.0f * q) / destHeight - 1.0f, params, uf, vf);
+	};
+	auto getNodes = [&] (int q, std::vector<float> & nodes) {
+		for (int col = 0; col <= cells; col++) {
+			getCoords((float)std::min(col * step, destWidth), (float)q,
+				nodes[2 * col], nodes[2 * col + 1]);
+		}
+	};
+
+	const int top = cellRow * step;
+	const int bottom = std::min(top + step, destHeight);
+	if (cellRow == mesh.cellRow + 1) {
+		std::swap(mesh.top, mesh.bottom);
+	} else {
+		getNodes(top, mesh.top);
+	}
+	getNodes(bottom, mesh.bottom);
+	mesh.cellRow = cellRow;
+
+	// A longitude error of one radian is xScale/2π source pixels, and a
+	// latitude error is yScale/π
+	const double margin = Policy::MAX_ANGLE_ERROR - StandardPrecision::MAX_ANGLE_ERROR;
+	const float tolX = (float)std::min(getMeshTolerance(), margin * params.xScale / (2 * M_PI));
+	const float tolY = (float)std::min(getMeshTolerance(), margin * params.yScale / M_PI);
+	const float checks[5][2] = {{0.5f, 0.5f}, {0.5f, 0}, {0.5f, 1}, {0, 0.5f}, {1, 0.5f}};
+
+	for (int cell = 0; cell < cells; cell++) {
+		const int left = cell * step;
+		const int right = std::min(left + step, destWidth);
+		const float * t = &mesh.top[2 * cell];
+		const float * b = &mesh.bottom[2 * cell];
+		const float minX = std::min({t[0], t[2], b[0], b[2]});
+		const float maxX = std::max({t[0], t[2], b[0], b[2]});
+		bool ok = maxX - minX <= params.xScale / 2;
+		for (int k = 0; ok && k < 5; k++) {
+			const float s = checks[k][0], r = checks[k][1];
+			float uf, vf;
+			getCoords(left + s * (right - left), top + r * (bottom - top), uf, vf);
+			float iu = (1 - r) * ((1 - s) * t[0] + s * t[2]) + r * ((1 - s) * b[0] + s * b[2]);
+			float iv = (1 - r) * ((1 - s) * t[1] + s * t[3]) + r * ((1 - s) * b[1] + s * b[3]);
+			// Written so that NaN fails
+			ok = std::fabs(iu - uf) <= tolX && std::fabs(iv - vf) <= tolY;
+		}
+		mesh.exact[cell] = !ok;
+	}
+}
+
+/**
+ * The equivalent of extractFaceRow() or extractFaceRowRotated() for
+ * Precision::Mesh. The source coordinates are interpolated from the nodes of
+ * the grid with a multiply-add per coordinate, so the row costs little more
+ * than the memory access of the interpolation, except in the cells which
+ * failed the check.
+ */
+template <int face, class Policy, class Mapping, bool rotated, class Image>
+static PANO_KERNEL_INLINE void extractFaceRowMesh(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
+	const int step = Policy::MESH_STEP;
+	const int cells = (destWidth + step - 1) / step;
+	const int cellRow = j / step;
+	MeshCache & mesh = params.mesh;
+	if (mesh.cellRow != cellRow || mesh.width != destWidth || mesh.height != destHeight) {
+		updateMesh<face, Policy, Mapping, rotated>(mesh, cellRow, destWidth, destHeight, params);
+	}
+
+	// Interpolate the nodes vertically to this row
+	const int top = cellRow * step;
+	const float r = (float)(j - top) / (std::min(top + step, destHeight) - top);
+	float * row = mesh.row.data();
+	float * slope = mesh.slope.data();
+	for (int k = 0; k < 2 * (cells + 1); k++) {
+		row[k] = mesh.top[k] + r * (mesh.bottom[k] - mesh.top[k]);
+	}
+	for (int cell = 0; cell < cells; cell++) {
+		const float width = (float)(std::min((cell + 1) * step, destWidth) - cell * step);
+		slope[2 * cell] = (row[2 * cell + 2] - row[2 * cell]) / width;
+		slope[2 * cell + 1] = (row[2 * cell + 3] - row[2 * cell + 1]) / width;
+	}
+
+	const float b = (2.0f * j) / destHeight - 1.0f;
+	const int half = (destWidth + 1) / 2;
+	for (int i = startCol; i < endCol; i++) {
+		const int p = i < half ? i : i + 1;
+		const int cell = std::min(p / step, cells - 1);
+		float uf, vf;
+		if (mesh.exact[cell]) {
+			getSourceCoords<face, Policy, Mapping, rotated>((2.0f * p) / destWidth - 1.0f, b,
+				params, uf, vf);
+		} else {
+			const float d = (float)(p - cell * step);
+			uf = row[2 * cell] + d * slope[2 * cell];
+			vf = row[2 * cell + 1] + d * slope[2 * cell + 1];
+		}
+		sampleSource<Policy>(input, &buffer[Image::CHANNELS * (i - startCol)], uf, vf, params);
+	}
+}
+
+/**
+ * Extract columns startCol to endCol-1 of row j of the chroma of a face
+ * subsampled 2x2, for extractFaceYcc(). The destination size is that of the
+ * luma.
+ *
+ * As in JFIF, each chroma sample is centred on the 2x2 luma samples it
+ * covers, so it is taken at the mean of their face coordinates, as computed
+ * by extractFaceRowRotated(). For an odd size, the last column and row also
+ * cover a sample beyond the edge. The mean of two columns either side of
+ * the middle has no reflection among the luma samples, so every sample is
+ * computed directly. There are only a quarter as many as for the luma.
+ */
+template <int face, class Policy, class Mapping, bool rotated, class Image>
+static PANO_KERNEL_INLINE void extractChromaRow(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
+	const int half = (destWidth + 1) / 2;
+	auto getA = [destWidth, half] (int i) {
+		return i < half
+			? (2.0f * i) / destWidth - 1.0f
+			: -((2.0f * (destWidth - 1 - i)) / destWidth - 1.0f);
+	};
+	const float b = (4.0f * j + 1.0f) / destHeight - 1.0f;
+	for (int i = startCol; i < endCol; i++) {
+		float uf, vf;
+		getSourceCoords<face, Policy, Mapping, rotated>(
+			0.5f * (getA(2 * i) + getA(2 * i + 1)), b, params, uf, vf);
+		sampleSource<Policy>(input, &buffer[Image::CHANNELS * (i - startCol)], uf, vf, params);
+	}
+}
+
+/**
+ * Call extractChromaRow() for the chroma planes of the YCbCr pipeline, or
+ * extractFaceRowMesh(), extractFaceRowRotated() or extractFaceRow(). This is
+ * inlined into the variant for each ISA level.
+ */
+template <int face, class Policy, class Mapping, bool rotated, class Image>
+static PANO_KERNEL_INLINE void extractFaceRowAny(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
+	if constexpr (Image::CHANNELS == 2) {
+		extractChromaRow<face, Policy, Mapping, rotated>(input, buffer, j, destWidth,
+			destHeight, startCol, endCol, params);
+	} else if constexpr (Policy::MESH_STEP > 0) {
+		extractFaceRowMesh<face, Policy, Mapping, rotated>(input, buffer, j, destWidth,
+			destHeight, startCol, endCol, params);
+	} else if constexpr (rotated) {
+		extractFaceRowRotated<face, Policy, Mapping>(input, buffer, j, destWidth, destHeight,
+			startCol, endCol, params);
+	} else {
+		extractFaceRow<face, Policy, Mapping>(input, buffer, j, destWidth, destHeight,
+			startCol, endCol, params);
+	}
+}
+
+/**
+ * A row kernel sampling an InputImage, or an ImagePlane for the YCbCr
+ * pipeline. For the chroma plane, the row and columns are those of the
+ * subsampled chroma, but the destination size is that of the luma.
+ */
+template <class Image = InputImage>
+using RowFunction = void (*)(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol,
+	const KernelParams & params);
+
+template <int face, class Policy, class Mapping, bool rotated, class Image>
+static void extractFaceRowBaseline(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
+	extractFaceRowAny<face, Policy, Mapping, rotated>(input, buffer, j, destWidth, destHeight,
+		startCol, endCol, params);
+}
+
+#ifdef PANO_MULTI_ISA
+template <int face, class Policy, class Mapping, bool rotated, class Image>
+PANO_TARGET_AVX2 static void extractFaceRowAvx2(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
+	extractFaceRowAny<face, Policy, Mapping, rotated>(input, buffer, j, destWidth, destHeight,
+		startCol, endCol, params);
+}
+
+template <int face, class Policy, class Mapping, bool rotated, class Image>
+PANO_TARGET_AVX512 static void extractFaceRowAvx512(Image & input, uint8_t * buffer, int j,
+	int destWidth, int destHeight, int startCol, int endCol, const KernelParams & params
+) {
+	extractFaceRowAny<face, Policy, Mapping, rotated>(input, buffer, j, destWidth, destHeight,
+		startCol, endCol, params);
+}
+#endif
+
+/**
+ * Get the variant of the row kernel for the selected ISA level
+ */
+template <int face, class Policy, class Mapping, bool rotated, class Image = InputImage>
+static RowFunction<Image> getRowFunction() {
+	switch (getIsa()) {
+#ifdef PANO_MULTI_ISA
+		case Isa::Avx512: return extractFaceRowAvx512<face, Policy, Mapping, rotated, Image>;
+		case Isa::Avx2: return extractFaceRowAvx2<face, Policy, Mapping, rotated, Image>;
+#endif
+		default: return extractFaceRowBaseline<face, Policy, Mapping, rotated, Image>;
+	}
+}
+
+/**
+ * Get the row kernel for the selected ISA level and the type of rotation
+ */
+template <int face, class Policy, class Mapping, class Image = InputImage>
+static RowFunction<Image> getRowFunction(const Rotation & rotation) {
+	if (rotation.isYawOnly()) {
+		return getRowFunction<face, Policy, Mapping, false, Image>();
+	} else {
+		return getRowFunction<face, Policy, Mapping, true, Image>();
+	}
+}
+
+/**
+ * Write every row of the output using a row kernel
+ */
+static void extractRows(InputImage & input, OutputBase & output,
+	RowFunction<> extractRow, const KernelParams & params
+) {
+	const int destWidth = output.getWidth();
+	const int destHeight = output.getHeight();
+
+	const size_t rowSize = (size_t)destWidth * COMPONENTS;
+	MemoryReservation reserved(MemoryCategory::TileBuffers, OUTPUT_BATCH_ROWS, rowSize);
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[OUTPUT_BATCH_ROWS * rowSize]);
+
+	for (int j = 0; j < destHeight; j += OUTPUT_BATCH_ROWS) {
+		int count = std::min(OUTPUT_BATCH_ROWS, destHeight - j);
+		{
+			PANO_TRACE_STAGE(Sample);
+			for (int k = 0; k < count; k++) {
+				extractRow(input, buffer.get() + k * rowSize, j + k,
+					destWidth, destHeight, 0, destWidth, params);
+			}
+		}
+		output.writeRows(buffer.get(), count, rowSize);
+	}
+	output.finish();
+}
+
+template <int face, class Policy, class Mapping>
+void extractFaceTpl(InputImage & input, OutputBase & output, const Rotation & rotation) {
+	extractRows(input, output, getRowFunction<face, Policy, Mapping>(rotation),
+		KernelParams(rotation, input));
+}
+
+void extractView(InputImage & input, OutputBase & output, const Rotation & rotation,
+	double scaleA, double scaleB, Precision precision
+) {
+	PANO_TRACE_SPAN("view");
+
+	// The view is a region of the front face plane, which is sampled like
+	// the face with a general rotation
+	RowFunction<> extractRow = nullptr;
+	switch (precision) {
+		case Precision::Fast: extractRow = getRowFunction<2, FastPrecision, StandardMapping, true>(); break;
+		case Precision::Standard: extractRow = getRowFunction<2, StandardPrecision, StandardMapping, true>(); break;
+		case Precision::Exact: extractRow = getRowFunction<2, ExactPrecision, StandardMapping, true>(); break;
+		case Precision::Mesh: extractRow = getRowFunction<2, MeshPrecision, StandardMapping, true>(); break;
+	}
+	extractRows(input, output, extractRow, KernelParams(rotation, scaleA, scaleB, input));
+}
+
+template <int face, class Policy, class Mapping>
+void extractFaceRegionTpl(InputImage & input, int size,
+	int startRow, int endRow, int startCol, int endCol,
+	uint8_t * dest, size_t destStride, const Rotation & rotation
+) {
+	const RowFunction<> extractRow = getRowFunction<face, Policy, Mapping>(rotation);
+	const KernelParams params(rotation, input);
+	for (int j = startRow; j < endRow; j++) {
+		PANO_TRACE_STAGE(Sample);
+		extractRow(input, dest, j, size, size, startCol, endCol, params);
+		dest += destStride;
+	}
+}
+
+/**
+ * Get the row kernel for a face and options which are only known at run
+ * time, for sampling the planes of an InputYcc
+ */
+template <class Image, class Policy, class Mapping>
+static RowFunction<Image> selectRowFunction(int face, const Rotation & rotation) {
+	switch (face) {
+		case 0: return getRowFunction<0, Policy, Mapping, Image>(rotation);
+		case 1: return getRowFunction<1, Policy, Mapping, Image>(rotation);
+		case 2: return getRowFunction<2, Policy, Mapping, Image>(rotation);
+		case 3: return getRowFunction<3, Policy, Mapping, Image>(rotation);
+		case 4: return getRowFunction<4, Policy, Mapping, Image>(rotation);
+		default: return getRowFunction<5, Policy, Mapping, Image>(rotation);
+	}
+}
+
+template <class Image, class Policy>
+static RowFunction<Image> selectRowFunction(int face, const Rotation & rotation,
+	CubeMapping mapping
+) {
+	switch (mapping) {
+		case CubeMapping::EquiAngular:
+			return selectRowFunction<Image, Policy, EquiAngularMapping>(face, rotation);
+		default:
+			return selectRowFunction<Image, Policy, StandardMapping>(face, rotation);
+	}
+}
+
+template <class Image>
+static RowFunction<Image> selectRowFunction(int face, Precision precision,
+	const Rotation & rotation, CubeMapping mapping
+) {
+	switch (precision) {
+		case Precision::Fast:
+			return selectRowFunction<Image, FastPrecision>(face, rotation, mapping);
+		case Precision::Exact:
+			return selectRowFunction<Image, ExactPrecision>(face, rotation, mapping);
+		case Precision::Mesh:
+			return selectRowFunction<Image, MeshPrecision>(face, rotation, mapping);
+		default:
+			return selectRowFunction<Image, StandardPrecision>(face, rotation, mapping);
+	}
+}
+
+void extractFaceYcc(int face, InputYcc & input, OutputImage & output,
+	Precision precision, const Rotation & rotation, CubeMapping mapping
+) {
+	PANO_TRACE_SPAN("face", face);
+
+	ImagePlane<1> & luma = input.getLuma();
+	ImagePlane<2> & chroma = input.getChroma();
+	const RowFunction<ImagePlane<1>> lumaRow =
+		selectRowFunction<ImagePlane<1>>(face, precision, rotation, mapping);
+	const RowFunction<ImagePlane<2>> chromaRow =
+		selectRowFunction<ImagePlane<2>>(face, precision, rotation, mapping);
+	const KernelParams lumaParams(rotation, luma);
+	const KernelParams chromaParams(rotation, chroma);
+
+	// The encoder takes an iMCU row at a time: 16 rows of luma and 8 of each
+	// chroma component, padded to whole blocks by repeating the last column
+	// and row, as libjpeg pads RGB input
+	const int size = output.getWidth();
+	const int chromaSize = (size + 1) / 2;
+	const int lumaStride = (size + 2 * DCTSIZE - 1) / (2 * DCTSIZE) * (2 * DCTSIZE);
+	const int chromaStride = lumaStride / 2;
+	std::vector<uint8_t> lumaBuffer(2 * DCTSIZE * lumaStride);
+	std::vector<uint8_t> cbBuffer(DCTSIZE * chromaStride);
+	std::vector<uint8_t> crBuffer(DCTSIZE * chromaStride);
+	std::vector<uint8_t> chromaRowBuffer(2 * chromaSize);
+
+	JSAMPROW lumaRows[2 * DCTSIZE], cbRows[DCTSIZE], crRows[DCTSIZE];
+	for (int r = 0; r < 2 * DCTSIZE; r++) {
+		lumaRows[r] = &lumaBuffer[r * lumaStride];
+	}
+	for (int r = 0; r < DCTSIZE; r++) {
+		cbRows[r] = &cbBuffer[r * chromaStride];
+		crRows[r] = &crBuffer[r * chromaStride];
+	}
+	JSAMPARRAY planes[3] = {lumaRows, cbRows, crRows};
+
+	for (int startRow = 0; startRow < size; startRow += 2 * DCTSIZE) {
+		for (int r = 0; r < 2 * DCTSIZE; r++) {
+			uint8_t * row = lumaRows[r];
+			if (startRow + r < size) {
+				PANO_TRACE_STAGE(Sample);
+				lumaRow(luma, row, startRow + r, size, size, 0, size, lumaParams);
+				memset(row + size, row[size - 1], lumaStride - size);
+			} else {
+				memcpy(row, lumaRows[r - 1], lumaStride);
+			}
+		}
+		for (int r = 0; r < DCTSIZE; r++) {
+			int j = startRow / 2 + r;
+			uint8_t * cb = cbRows[r];
+			uint8_t * cr = crRows[r];
+			if (j < chromaSize) {
+				PANO_TRACE_STAGE(Sample);
+				chromaRow(chroma, chromaRowBuffer.data(), j, size, size,
+					0, chromaSize, chromaParams);
+				for (int i = 0; i < chromaSize; i++) {
+					cb[i] = chromaRowBuffer[2 * i];
+					cr[i] = chromaRowBuffer[2 * i + 1];
+				}
+				memset(cb + chromaSize, cb[chromaSize - 1], chromaStride - chromaSize);
+				memset(cr + chromaSize, cr[chromaSize - 1], chromaStride - chromaSize);
+			} else {
+				memcpy(cb, cbRows[r - 1], chromaStride);
+				memcpy(cr, crRows[r - 1], chromaStride);
+			}
 		}
-		output.writeRow(buffer);
+		output.writeRawRows(planes);
 	}
 	output.finish();
 }
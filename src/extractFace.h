@@ -1,24 +1,91 @@
 #ifndef PANO_EXTRACT_FACE_H
 #define PANO_EXTRACT_FACE_H
 
+#include "CubeMapping.h"
 #include "InputImage.h"
 #include "OutputBase.h"
+#include "Precision.h"
+#include "Rotation.h"
 
 namespace PanoProjector {
 
+	class InputYcc;
+	class OutputImage;
+
+	/**
+	 * Given an equirectangular source image, extract the given cube face and
+	 * write it to the given destination image, which must be square. The
+	 * source covers the whole sphere with a 2:1 aspect ratio, unless it has a
+	 * partial coverage set with InputImage::setCoverage(), in which case
+	 * samples outside it are filled with the fill colour. The pixels are
+	 * distributed over the face according to the mapping.
+	 *
+	 * The input crop must cover the face crop rectangle widened for the
+	 * precision and rotated, as returned by
+	 * FaceInfo::getCropRect(face, angleError, rotation), converted with
+	 * Coverage::getImageCropRect() for a partial panorama.
+	 */
+	void extractFace(int face, InputImage & input, OutputBase & output,
+		Precision precision = Precision::Standard,
+		const Rotation & rotation = Rotation(),
+		CubeMapping mapping = CubeMapping::Standard);
+
+	/**
+	 * Equivalent of extractFace() but with the face, the kernel policy and
+	 * the mapping policy as template parameters. The code runs much faster
+	 * if the face index is a compile-time constant.
+	 */
+	template <int face, class Policy = StandardPrecision, class Mapping = StandardMapping>
+	void extractFaceTpl(InputImage & input, OutputBase & output,
+		const Rotation & rotation = Rotation());
+
+	/**
+	 * Extract a rectangular region of a square cube face of the given size,
+	 * and write it to a buffer. The region is rows startRow to endRow-1 and
+	 * columns startCol to endCol-1. The pixels are identical to the
+	 * corresponding pixels written by extractFace(). The input image crop
+	 * need only cover the region.
+	 */
+	void extractFaceRegion(int face, InputImage & input, int size,
+		int startRow, int endRow, int startCol, int endCol,
+		uint8_t * dest, size_t destStride, Precision precision = Precision::Standard,
+		const Rotation & rotation = Rotation(),
+		CubeMapping mapping = CubeMapping::Standard);
+
+	/**
+	 * Render a rectilinear (perspective) view from an equirectangular source
+	 * image to the given destination image. The view is the region
+	 * -scaleA≤a≤scaleA, -scaleB≤b≤scaleB of the plane of the front face, after
+	 * rotating the cube. So scaleA and scaleB are the tangents of half the
+	 * horizontal and vertical fields of view.
+	 *
+	 * The input crop must cover the rectangle returned by
+	 * FaceInfo::getViewCropRect() for the same parameters.
+	 */
+	void extractView(InputImage & input, OutputBase & output, const Rotation & rotation,
+		double scaleA, double scaleB, Precision precision = Precision::Standard);
+
 	/**
-	 * Given an equirectangular 360°x180° source image, which must have a 2:1
-	 * aspect ratio, extract the given cube face and write it to the given
-	 * destination image, which must be square.
+	 * Equivalent of extractFace() for an input decoded to YCbCr planes. The
+	 * luma is sampled at the face size and the chroma at half of it, centred
+	 * between the luma samples as in JFIF, so the face is never converted to
+	 * RGB, and is written with OutputImage::writeRawRows() with 4:2:0
+	 * subsampling. The output must have been created with
+	 * EncoderOptions::rawYcc.
 	 */
-	void extractFace(int face, InputImage & input, OutputBase & output);
+	void extractFaceYcc(int face, InputYcc & input, OutputImage & output,
+		Precision precision = Precision::Standard,
+		const Rotation & rotation = Rotation(),
+		CubeMapping mapping = CubeMapping::Standard);
 
 	/**
-	 * Equivalent of extractFace() but with the face as a template parameter.
-	 * The code runs much faster if the face index is a compile-time constant.
+	 * Equivalent of extractFaceRegion() with the face, the kernel policy and
+	 * the mapping policy as template parameters.
 	 */
-	template <int face>
-	void extractFaceTpl(InputImage & input, OutputBase & output);
+	template <int face, class Policy = StandardPrecision, class Mapping = StandardMapping>
+	void extractFaceRegionTpl(InputImage & input, int size,
+		int startRow, int endRow, int startCol, int endCol,
+		uint8_t * dest, size_t destStride, const Rotation & rotation = Rotation());
 
 }
 #endif
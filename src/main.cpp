@@ -1,7 +1,12 @@
 #include <iostream>
+#include "BatchCommand.h"
+#include "BenchCommand.h"
+#include "EquirectCommand.h"
 #include "FaceCommand.h"
 #include "FaceDiagramCommand.h"
+#include "PrecisionCommand.h"
 #include "PyramidCommand.h"
+#include "ViewCommand.h"
 
 using namespace PanoProjector;
 
@@ -21,6 +26,16 @@ int main(int argc, char** argv) {
 		return FaceDiagramCommand().run(cmdArgc, cmdArgv);
 	} else if (cmd == "pyramid") {
 		return PyramidCommand().run(cmdArgc, cmdArgv);
+	} else if (cmd == "equirect") {
+		return EquirectCommand().run(cmdArgc, cmdArgv);
+	} else if (cmd == "batch") {
+		return BatchCommand().run(cmdArgc, cmdArgv);
+	} else if (cmd == "bench") {
+		return BenchCommand().run(cmdArgc, cmdArgv);
+	} else if (cmd == "precision") {
+		return PrecisionCommand().run(cmdArgc, cmdArgv);
+	} else if (cmd == "view") {
+		return ViewCommand().run(cmdArgc, cmdArgv);
 	} else {
 		usage();
 		return 1;
@@ -35,11 +50,21 @@ void showCommandUsage(const Command & cmd) {
 }
 
 void usage() {
-	std::cerr << "Usage: pano-projector <face|face-diagram|pyramid> ...\n\n";
+	std::cerr << "Usage: pano-projector <face|face-diagram|pyramid|view|equirect|batch|bench|precision> ...\n\n";
 	showCommandUsage(FaceCommand());
 	std::cerr << "\n";
 	showCommandUsage(FaceDiagramCommand());
 	std::cerr << "\n";
 	showCommandUsage(PyramidCommand());
+	std::cerr << "\n";
+	showCommandUsage(ViewCommand());
+	std::cerr << "\n";
+	showCommandUsage(EquirectCommand());
+	std::cerr << "\n";
+	showCommandUsage(BatchCommand());
+	std::cerr << "\n";
+	showCommandUsage(BenchCommand());
+	std::cerr << "\n";
+	showCommandUsage(PrecisionCommand());
 }
 
@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include "InputImageFactory.h"
+
+using namespace PanoProjector;
+
+/**
+ * Compare two images of the same size, for tests of outputs which are only
+ * expected to be close to a reference. Write the mean and the largest
+ * absolute difference of the components to stdout.
+ */
+int main(int argc, char ** argv) {
+	if (argc != 3) {
+		std::cerr << "Usage: image-diff <image> <image>\n";
+		return 1;
+	}
+	try {
+		CropRect whole{0, 1, 0, 1};
+		std::unique_ptr<InputImage> a(InputImageFactory::create(argv[1], "", whole));
+		std::unique_ptr<InputImage> b(InputImageFactory::create(argv[2], "", whole));
+		if (a->getWidth() != b->getWidth() || a->getHeight() != b->getHeight()) {
+			std::cerr << "Error: the image sizes differ: "
+				<< a->getWidth() << "x" << a->getHeight() << " and "
+				<< b->getWidth() << "x" << b->getHeight() << "\n";
+			return 1;
+		}
+		double total = 0;
+		int peak = 0;
+		const size_t rowSize = (size_t)a->getWidth() * COMPONENTS;
+		for (int y = 0; y < a->getHeight(); y++) {
+			const uint8_t * rowA = a->row(y);
+			const uint8_t * rowB = b->row(y);
+			for (size_t i = 0; i < rowSize; i++) {
+				int diff = std::abs(rowA[i] - rowB[i]);
+				total += diff;
+				peak = std::max(peak, diff);
+			}
+		}
+		std::cout << total / ((double)rowSize * a->getHeight()) << " " << peak << "\n";
+	} catch (std::exception & e) {
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
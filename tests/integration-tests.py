@@ -3,11 +3,41 @@ import sys
 import os
 import shutil
 import filecmp
+import json
+import re
 
 def run(args):
     print('+ ' + ' '.join(args))
     return subprocess.run(args)
 
+def compareImages(resultFile, expectFile, maxMean):
+    # The mean absolute difference of the components must be within the
+    # tolerance, for outputs which are resampled more than the reference
+    res = subprocess.run([binDir + '/tests/image-diff', resultFile, expectFile],
+        stdout=subprocess.PIPE)
+    if res.returncode:
+        print("image-diff exited with return code %d" % res.returncode)
+        return False
+    mean, peak = res.stdout.split()
+    if float(mean) > maxMean:
+        print("Mean difference %s exceeds %g, largest %s" % (mean.decode(), maxMean,
+            peak.decode()))
+        return False
+    return True
+
+def compareTree(expected, actual):
+    # Each tile in the level directories of the expected pyramid must be the
+    # same in the actual one. The files at the top level are single faces.
+    res = True
+    for dirPath, dirNames, fileNames in os.walk(expected):
+        for fileName in fileNames:
+            rel = os.path.relpath(dirPath + '/' + fileName, expected)
+            if '/' in rel and not filecmp.cmp(actual + '/' + rel, expected + '/' + rel,
+                    shallow=False):
+                print("File comparison mismatch in file " + rel)
+                res = False
+    return res
+
 def testFace(face):
     global sourceDir, binDir, resultDir
     resultFile = resultDir + '/' + face + '.jpg'
@@ -57,11 +87,1042 @@ def testPyramid():
 
     return res
 
+def testIncremental():
+    global sourceDir, binDir, resultDir
+    fullDir = resultDir + '/incremental-full'
+    incDir = resultDir + '/incremental'
+    inputDir = sourceDir + '/tests/data/input'
+
+    for args in [
+        [inputDir + '/bass-edited.jpg', fullDir],
+        [inputDir + '/bass.jpg', incDir],
+        ['--changed-from=' + inputDir + '/bass.jpg', inputDir + '/bass-edited.jpg', incDir]
+    ]:
+        res = run([binDir + '/src/pano-projector', 'pyramid', '--tile-size=64'] + args)
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+
+    res = True
+    for dirPath, dirNames, fileNames in os.walk(fullDir):
+        for fileName in fileNames:
+            rel = os.path.relpath(dirPath + '/' + fileName, fullDir)
+            if not filecmp.cmp(fullDir + '/' + rel, incDir + '/' + rel, shallow=False):
+                print("File comparison mismatch in file " + rel)
+                res = False
+
+    # An invalid previous image is an error rather than exiting from libjpeg
+    invalid = resultDir + '/incremental-invalid.jpg'
+    with open(invalid, 'wb') as f:
+        f.write(b'not a jpeg')
+    ret = subprocess.run([binDir + '/src/pano-projector', 'pyramid', '--tile-size=64',
+        '--changed-from=' + invalid, inputDir + '/bass-edited.jpg',
+        resultDir + '/incremental-invalid'], stderr=subprocess.PIPE)
+    if ret.returncode != 1 or b'Invalid input image' not in ret.stderr:
+        print("The invalid previous image was not reported")
+        res = False
+    return res
+
+def testResume():
+    global sourceDir, binDir, resultDir
+    resumeDir = resultDir + '/resume'
+    args = [
+        binDir + '/src/pano-projector',
+        'pyramid',
+        '--tile-size=128',
+        sourceDir + '/tests/data/input/bass.jpg',
+        resumeDir]
+
+    # Make the job fail part way through by putting a directory where the
+    # temporary file for the front face thumbnail needs to go
+    os.makedirs(resumeDir + '/1/f0_0.jpg.tmp')
+    res = run(args)
+    if res.returncode == 0:
+        print("pano-projector unexpectedly succeeded")
+        return False
+    if not os.path.exists(resumeDir + '/.pano-projector-journal'):
+        print("No journal was written")
+        return False
+
+    res = run(args[0:2] + ['--resume'] + args[2:])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if os.path.exists(resumeDir + '/.pano-projector-journal'):
+        print("The journal was not removed")
+        return False
+
+    return compareTree(sourceDir + '/tests/data/expected', resumeDir)
+
+def testStrategies():
+    global sourceDir, binDir, resultDir
+    res = True
+    for strategy in ['per-face', 'bands']:
+        strategyDir = resultDir + '/strategy-' + strategy
+        ret = run([
+            binDir + '/src/pano-projector',
+            'pyramid',
+            '--tile-size=128',
+            '--strategy=' + strategy,
+            '--mem-limit=1',
+            sourceDir + '/tests/data/input/bass.jpg',
+            strategyDir])
+        if ret.returncode:
+            print("pano-projector exited with return code %d" % ret.returncode)
+            return False
+
+        if not compareTree(sourceDir + '/tests/data/expected', strategyDir):
+            print("Mismatch with strategy " + strategy)
+            res = False
+    return res
+
+def testPipeline():
+    global sourceDir, binDir, resultDir
+    # Decoding ahead and encoding on separate threads doesn't change the output
+    res = True
+    for strategy in ['single', 'bands']:
+        pipelineDir = resultDir + '/pipeline-' + strategy
+        ret = run([
+            binDir + '/src/pano-projector',
+            'pyramid',
+            '--tile-size=128',
+            '--pipeline',
+            '--strategy=' + strategy,
+            sourceDir + '/tests/data/input/bass.jpg',
+            pipelineDir])
+        if ret.returncode:
+            print("pano-projector exited with return code %d" % ret.returncode)
+            return False
+
+        if not compareTree(sourceDir + '/tests/data/expected', pipelineDir):
+            print("Mismatch with strategy " + strategy)
+            res = False
+
+    faceFile = resultDir + '/pipeline-f.jpg'
+    ret = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--pipeline',
+        '--strategy=bands',
+        sourceDir + '/tests/data/input/bass.jpg',
+        faceFile])
+    if ret.returncode:
+        print("pano-projector exited with return code %d" % ret.returncode)
+        return False
+    if not filecmp.cmp(faceFile, sourceDir + '/tests/data/expected/f.jpg', shallow=False):
+        print("File comparison mismatch for the face")
+        res = False
+    return res
+
+def testMemReport():
+    global sourceDir, binDir, resultDir
+    # The report goes to stderr after the output is written, with a row for
+    # each category, the totals, the limit and the huge page counters
+    reportDir = resultDir + '/mem-report'
+    args = [
+        binDir + '/src/pano-projector',
+        'pyramid',
+        '--tile-size=128',
+        '--mem-limit=100',
+        '--mem-report',
+        sourceDir + '/tests/data/input/bass.jpg',
+        reportDir]
+    print('+ ' + ' '.join(args))
+    res = subprocess.run(args, stderr=subprocess.PIPE, universal_newlines=True)
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if not compareTree(sourceDir + '/tests/data/expected', reportDir):
+        return False
+
+    lines = res.stderr.splitlines()
+    if 'Memory usage (MiB):' not in lines:
+        print("Missing memory report")
+        return False
+    lines = lines[lines.index('Memory usage (MiB):') + 1:]
+    number = r'\s+(\d+\.\d)'
+    expected = [r'category\s+current\s+peak$']
+    for category in ['decode coefficients', 'input crop', 'encoder state',
+            'tile buffers', 'remap tables', 'total accounted', 'process RSS']:
+        expected.append(category + number + number + '$')
+    # The process RSS includes the code and the libraries, so it is always
+    # more than the accounted peak
+    expected += [
+        r'Unaccounted peak: \d+\.\d MiB$',
+        r'Limit: 100\.0 MiB$',
+        r'Huge pages \(MiB allocated\): explicit \d+\.\d, transparent \d+\.\d'
+            + r' of \d+\.\d advised, heap \d+\.\d(, reused mappings \d+)?$']
+    if len(lines) != len(expected):
+        print("The memory report has %d lines, expected %d" % (len(lines), len(expected)))
+        return False
+    for line, pattern in zip(lines, expected):
+        if not re.match(pattern, line):
+            print("Unexpected memory report line: " + line)
+            return False
+
+    # Every buffer is released by the end, and the input was accounted for
+    crop = re.match('input crop' + number + number, lines[2])
+    total = re.match('total accounted' + number + number, lines[6])
+    if float(total.group(1)) != 0 or float(crop.group(2)) == 0:
+        print("Unexpected memory report values")
+        return False
+    return True
+
+def testPlan():
+    global sourceDir, binDir, resultDir
+    # --plan lists the estimate of each plan without writing anything. The
+    # first plan which fits is chosen, or the smallest if none does.
+    for limit in ['100', '1']:
+        planDir = resultDir + '/plan-' + limit
+        args = [
+            binDir + '/src/pano-projector',
+            'pyramid',
+            '--tile-size=128',
+            '--plan',
+            '--mem-limit=' + limit,
+            sourceDir + '/tests/data/input/bass.jpg',
+            planDir]
+        print('+ ' + ' '.join(args))
+        res = subprocess.run(args, stdout=subprocess.PIPE, universal_newlines=True)
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+        if os.path.exists(planDir):
+            print("The output was written with --plan")
+            return False
+
+        lines = res.stdout.splitlines()
+        if (len(lines) < 5 or lines[0] != 'Faces to write: 6'
+                or lines[1] != 'Memory limit: %s.0 MiB' % limit
+                or not re.match(r'strategy\s+memory \(MiB\)\s+time \(s\)$', lines[2])):
+            print("Unexpected plan header: " + ' / '.join(lines[0:3]))
+            return False
+        plans = []
+        for line in lines[3:-1]:
+            match = re.match(
+                r'(single|per-face|bands \d+x\d+)\s+(\d+\.\d)\s+(\d+\.\d\d)(  \(does not fit\))?$',
+                line)
+            if not match:
+                print("Unexpected plan line: " + line)
+                return False
+            plans.append((match.group(1), float(match.group(2)), not match.group(4)))
+        if [plan[0] for plan in plans[0:2]] != ['single', 'per-face']:
+            print("The plans are not in order of preference")
+            return False
+        # The memory is rounded, so several plans may appear to be smallest
+        fitting = [plan[0] for plan in plans if plan[2]]
+        smallest = min(plan[1] for plan in plans)
+        expected = fitting[0:1] or [plan[0] for plan in plans if plan[1] == smallest]
+        if lines[-1][len('Chosen: '):] not in expected:
+            print("Unexpected choice for limit %s: %s" % (limit, lines[-1]))
+            return False
+        if (limit == '100') != (expected == ['single']):
+            print("Unexpected plan fit for limit " + limit)
+            return False
+    return True
+
+def testHugePages():
+    global sourceDir, binDir, resultDir
+    # The input must be at least a huge page to be mapped, so rebuild a
+    # larger panorama from the expected faces. Normal pages give the same
+    # output byte for byte.
+    inputFile = resultDir + '/huge-pages-input.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'equirect',
+        '--width=2048',
+        sourceDir + '/tests/data/expected',
+        inputFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+
+    counters = []
+    for option in ['', '--no-huge-pages']:
+        outDir = resultDir + '/huge-pages' + option
+        args = [
+            binDir + '/src/pano-projector',
+            'pyramid',
+            '--tile-size=256',
+            '--mem-report'] + ([option] if option else []) + [inputFile, outDir]
+        print('+ ' + ' '.join(args))
+        res = subprocess.run(args, stderr=subprocess.PIPE, universal_newlines=True)
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+        match = re.search(r'Huge pages \(MiB allocated\): explicit (\d+\.\d), '
+            + r'transparent \d+\.\d of (\d+\.\d) advised, heap (\d+\.\d)', res.stderr)
+        if not match:
+            print("Missing huge page counters")
+            return False
+        counters.append([float(value) for value in match.groups()])
+
+    # The decoded input is mapped by default, and on the heap when disabled
+    if counters[0][0] + counters[0][1] == 0 or counters[1][0] + counters[1][1] != 0:
+        print("Unexpected huge page counters: %s" % counters)
+        return False
+
+    return compareTree(resultDir + '/huge-pages', resultDir + '/huge-pages--no-huge-pages')
+
+def testPrecision():
+    global sourceDir, binDir, resultDir
+    res = run([binDir + '/src/pano-projector', 'precision', '--samples=64'])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+
+    # The crop margins allow for the error of each tier, so the decode
+    # strategy must not change the output
+    for precision in ['fast', 'exact']:
+        files = []
+        for strategy in ['single', 'bands']:
+            resultFile = resultDir + '/precision-' + precision + '-' + strategy + '.jpg'
+            res = run([
+                binDir + '/src/pano-projector',
+                'face',
+                '--face=d',
+                '--precision=' + precision,
+                '--strategy=' + strategy,
+                '--mem-limit=1',
+                sourceDir + '/tests/data/input/bass.jpg',
+                resultFile])
+            if res.returncode:
+                print("pano-projector exited with return code %d" % res.returncode)
+                return False
+            files.append(resultFile)
+        if not filecmp.cmp(files[0], files[1], shallow=False):
+            print("Strategies differ with precision " + precision)
+            return False
+    return True
+
+def testMesh():
+    global sourceDir, binDir, resultDir
+    # The grid is at fixed face positions, so decoding in bands, which
+    # extracts the face in regions, gives the same output. The face is large
+    # enough that most cells are interpolated, and rotated so that the seam
+    # and a pole cross it.
+    files = []
+    for strategy in ['single', 'bands']:
+        resultFile = resultDir + '/mesh-' + strategy + '.jpg'
+        res = run([
+            binDir + '/src/pano-projector',
+            'face',
+            '--face=u',
+            '--size=1000',
+            '--pitch=-30',
+            '--precision=mesh',
+            '--mesh-tolerance=0.2',
+            '--strategy=' + strategy,
+            '--mem-limit=1',
+            sourceDir + '/tests/data/input/bass.jpg',
+            resultFile])
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+        files.append(resultFile)
+    if not filecmp.cmp(files[0], files[1], shallow=False):
+        print("Strategies differ with the mesh")
+        return False
+
+    # The mesh moves each sample by at most the tolerance, so it must be
+    # closer to the standard precision than the standard precision is to
+    # itself with the cube pitched by the tolerance. The input is 400 pixels
+    # high, so the tolerance is 0.2 * 180 / 400 degrees of latitude.
+    references = []
+    for pitch in ['-30', str(-30 + 0.2 * 180 / 400)]:
+        resultFile = resultDir + '/mesh-standard' + pitch + '.jpg'
+        res = run([
+            binDir + '/src/pano-projector',
+            'face',
+            '--face=u',
+            '--size=1000',
+            '--pitch=' + pitch,
+            '--precision=standard',
+            sourceDir + '/tests/data/input/bass.jpg',
+            resultFile])
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+        references.append(resultFile)
+    res = subprocess.run([binDir + '/tests/image-diff', references[0], references[1]],
+        stdout=subprocess.PIPE)
+    if res.returncode:
+        print("image-diff exited with return code %d" % res.returncode)
+        return False
+    bound = float(res.stdout.split()[0])
+    return compareImages(files[0], references[0], bound)
+
+def testRotation():
+    global sourceDir, binDir, resultDir
+    # Pitching the cube up by 90° turns the front face into the top face
+    resultFile = resultDir + '/rotation-f.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--pitch=90',
+        sourceDir + '/tests/data/input/bass.jpg',
+        resultFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if not filecmp.cmp(resultFile, sourceDir + '/tests/data/expected/u.jpg'):
+        print("File comparison mismatch for the pitched front face")
+        return False
+
+    # Incremental updates must map the changes through the rotation
+    fullDir = resultDir + '/rotation-full'
+    incDir = resultDir + '/rotation-incremental'
+    inputDir = sourceDir + '/tests/data/input'
+    rotation = ['--yaw=30', '--pitch=10', '--roll=5']
+    for args in [
+        [inputDir + '/bass-edited.jpg', fullDir],
+        [inputDir + '/bass.jpg', incDir],
+        ['--changed-from=' + inputDir + '/bass.jpg', inputDir + '/bass-edited.jpg', incDir]
+    ]:
+        res = run([binDir + '/src/pano-projector', 'pyramid', '--tile-size=64']
+            + rotation + args)
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+    for dirPath, dirNames, fileNames in os.walk(fullDir):
+        for fileName in fileNames:
+            rel = os.path.relpath(dirPath + '/' + fileName, fullDir)
+            if not filecmp.cmp(fullDir + '/' + rel, incDir + '/' + rel, shallow=False):
+                print("File comparison mismatch in file " + rel)
+                return False
+    return True
+
+def testView():
+    global sourceDir, binDir, resultDir
+    # A square view with a 90° field of view is the front face
+    resultFile = resultDir + '/view-f.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'view',
+        '--width=248',
+        '--height=248',
+        sourceDir + '/tests/data/input/bass.jpg',
+        resultFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if not filecmp.cmp(resultFile, sourceDir + '/tests/data/expected/f.jpg'):
+        print("File comparison mismatch for the front view")
+        return False
+
+    # A small view decodes the input scaled down by 2, which still has twice
+    # the density of the view. It is close to the view of the full input,
+    # which aliases, and the difference is larger with a half degree yaw.
+    smallFile = resultDir + '/view-small.jpg'
+    fullFile = resultDir + '/view-small-full.jpg'
+    for args in [[smallFile], ['--no-dct-scaling', fullFile]]:
+        res = run([
+            binDir + '/src/pano-projector',
+            'view',
+            '--width=60',
+            '--height=40',
+            '--yaw=200',
+            '--pitch=-20',
+            '--roll=10',
+            sourceDir + '/tests/data/input/bass.jpg'] + args)
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+    if filecmp.cmp(smallFile, fullFile, shallow=False):
+        print("The small view was not scaled")
+        return False
+    return compareImages(smallFile, fullFile, 10.5)
+
+def testPartial():
+    global sourceDir, binDir, resultDir
+    # Explicitly covering the whole sphere is the same as the default
+    resultFile = resultDir + '/partial-f.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--hfov=360',
+        '--vfov=180',
+        sourceDir + '/tests/data/input/bass.jpg',
+        resultFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if not filecmp.cmp(resultFile, sourceDir + '/tests/data/expected/f.jpg'):
+        print("File comparison mismatch for the full coverage front face")
+        return False
+
+    # With a 180° input centred on the front face, the back face is not
+    # covered, so none of its tiles are written
+    outDir = resultDir + '/partial'
+    res = run([
+        binDir + '/src/pano-projector',
+        'pyramid',
+        '--tile-size=64',
+        '--hfov=180',
+        sourceDir + '/tests/data/input/bass.jpg',
+        outDir])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if not os.path.exists(outDir + '/1/f0_0.jpg'):
+        print("Missing front face tile")
+        return False
+    for dirPath, dirNames, fileNames in os.walk(outDir):
+        for fileName in fileNames:
+            if fileName.startswith('b'):
+                print("Unexpected back face tile " + fileName)
+                return False
+    return True
+
+def testMosaic():
+    global sourceDir, binDir, resultDir
+    # The back face crosses the seam, so the crop wraps around. Decoding only
+    # the tiles within each band must give the same result as a single pass.
+    res = True
+    for face in ['b', 'l']:
+        results = []
+        for strategy in ['single', 'bands']:
+            resultFile = '%s/mosaic-%s-%s.jpg' % (resultDir, face, strategy)
+            ret = run([
+                binDir + '/src/pano-projector',
+                'face',
+                '--face=' + face,
+                '--strategy=' + strategy,
+                sourceDir + '/tests/data/input/mosaic/bass.mosaic',
+                resultFile])
+            if ret.returncode:
+                print("pano-projector exited with return code %d" % ret.returncode)
+                return False
+            results.append(resultFile)
+        if not filecmp.cmp(results[0], results[1], shallow=False):
+            print("File comparison mismatch in face " + face)
+            res = False
+
+    # The tiles are parts of bass.jpg compressed again, so the assembled
+    # image gives nearly the same face
+    if not compareImages(resultDir + '/mosaic-b-single.jpg',
+            sourceDir + '/tests/data/expected/b.jpg', 3):
+        res = False
+
+    # Overlapping tiles are rejected
+    overlapFile = resultDir + '/overlap.mosaic'
+    with open(overlapFile, 'w') as f:
+        for x, y, name in [(0, 0, 'r0c0'), (300, 0, 'r0c1'), (0, 180, 'r1c0'),
+                (290, 170, 'r1c1')]:
+            f.write('%d %d %s/tests/data/input/mosaic/bass-%s.jpg\n' % (x, y, sourceDir, name))
+    ret = subprocess.run([binDir + '/src/pano-projector', 'face', '--face=b', overlapFile,
+        resultDir + '/overlap.jpg'], stderr=subprocess.PIPE)
+    if ret.returncode != 1 or b'overlap' not in ret.stderr:
+        print("The overlapping tiles were not reported")
+        res = False
+    return res
+
+def testTiff():
+    global sourceDir, binDir, resultDir
+    # The fixtures are bass.jpg stored as JPEG compressed YCbCr, in 128x128
+    # tiles, in strips of 16 rows, and in 256x256 tiles in a BigTIFF. Every
+    # face is close to the faces of the JPEG, which differ by the second
+    # compression, and decoding only the blocks within each band must give
+    # the same result as a single pass.
+    res = True
+    for layout in ['tiled', 'stripped', 'bigtiff']:
+        for face in ['b', 'l', 'f', 'r', 'u', 'd']:
+            results = []
+            for strategy in ['single', 'bands']:
+                resultFile = '%s/tiff-%s-%s-%s.jpg' % (resultDir, layout, face, strategy)
+                ret = run([
+                    binDir + '/src/pano-projector',
+                    'face',
+                    '--face=' + face,
+                    '--strategy=' + strategy,
+                    sourceDir + '/tests/data/input/tiff/bass-' + layout + '.tif',
+                    resultFile])
+                if ret.returncode:
+                    print("pano-projector exited with return code %d" % ret.returncode)
+                    return False
+                results.append(resultFile)
+            if not compareImages(results[0], sourceDir + '/tests/data/expected/' + face + '.jpg', 3):
+                print("Mismatch in face %s of the %s image" % (face, layout))
+                res = False
+            if not filecmp.cmp(results[0], results[1], shallow=False):
+                print("File comparison mismatch in face %s of the %s image" % (face, layout))
+                res = False
+    return res
+
+def getJpegSize(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    i = 2
+    while i < len(data):
+        marker = data[i + 1]
+        length = data[i + 2] * 256 + data[i + 3]
+        if marker in (0xc0, 0xc1, 0xc2):
+            return (data[i + 7] * 256 + data[i + 8], data[i + 5] * 256 + data[i + 6])
+        i += 2 + length
+    return None
+
+def testPreview():
+    global sourceDir, binDir, resultDir
+    previewDir = resultDir + '/preview'
+    previewFile = resultDir + '/preview.jpg'
+    statsFile = resultDir + '/stats.json'
+    ret = run([
+        binDir + '/src/pano-projector',
+        'pyramid',
+        '--tile-size=128',
+        '--preview=' + previewFile,
+        '--preview-width=200',
+        '--stats=' + statsFile,
+        sourceDir + '/tests/data/input/bass.jpg',
+        previewDir])
+    if ret.returncode:
+        print("pano-projector exited with return code %d" % ret.returncode)
+        return False
+
+    # The side outputs don't change the pyramid
+    res = compareTree(sourceDir + '/tests/data/expected', previewDir)
+
+    # The preview is the average of each 4x4 cell of bass.jpg, which decodes
+    # to the same pixels as the cells averaged separately and encoded at the
+    # default quality
+    if getJpegSize(previewFile) != (200, 100):
+        print("Unexpected preview size")
+        res = False
+    if not filecmp.cmp(previewFile, sourceDir + '/tests/data/expected/preview.jpg',
+            shallow=False):
+        print("File comparison mismatch in the preview")
+        res = False
+
+    # The means of the decoded pixels of bass.jpg, computed separately
+    with open(statsFile) as f:
+        stats = json.load(f)
+    if stats['pixels'] != 800 * 400:
+        print("Unexpected pixel count %d" % stats['pixels'])
+        res = False
+    expectMeans = {'red': 80.957, 'green': 87.109, 'blue': 93.423, 'luma': 85.987}
+    for channel, expectMean in expectMeans.items():
+        histogram = stats[channel]['histogram']
+        if sum(histogram) != 800 * 400 or abs(stats[channel]['mean'] - expectMean) > 0.001:
+            print("Unexpected statistics for " + channel)
+            res = False
+    return res
+
+def testEquirect():
+    global sourceDir, binDir, resultDir
+    # The output doesn't depend on how many bands the faces are decoded in
+    results = []
+    for bands in ['1', '7']:
+        resultFile = resultDir + '/equirect-' + bands + '.jpg'
+        res = run([
+            binDir + '/src/pano-projector',
+            'equirect',
+            '--width=800',
+            '--bands=' + bands,
+            sourceDir + '/tests/data/expected',
+            resultFile])
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+        results.append(resultFile)
+    if not filecmp.cmp(results[0], results[1], shallow=False):
+        print("File comparison mismatch between band counts")
+        return False
+
+    # Projecting the rebuilt image back gives the faces it was made from,
+    # apart from the blur of resampling twice. The back face crosses the
+    # seam and the top face covers the pole.
+    for face in ['f', 'b', 'u']:
+        faceFile = resultDir + '/equirect-' + face + '.jpg'
+        res = run([
+            binDir + '/src/pano-projector',
+            'face',
+            '--face=' + face,
+            results[0],
+            faceFile])
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+        if not compareImages(faceFile, sourceDir + '/tests/data/expected/' + face + '.jpg', 6):
+            print("Round trip mismatch in face " + face)
+            return False
+    return True
+
+def testMapping():
+    global sourceDir, binDir, resultDir
+    # An equi-angular face is the same with each decode strategy, and is
+    # flagged in the XMP metadata
+    results = []
+    for strategy in ['single', 'bands']:
+        resultFile = resultDir + '/eac-' + strategy + '.jpg'
+        res = run([
+            binDir + '/src/pano-projector',
+            'face',
+            '--face=u',
+            '--mapping=eac',
+            '--strategy=' + strategy,
+            sourceDir + '/tests/data/input/bass.jpg',
+            resultFile])
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+        results.append(resultFile)
+    if not filecmp.cmp(results[0], results[1]):
+        print("File comparison mismatch between strategies")
+        return False
+    with open(results[0], 'rb') as f:
+        if b'CubeMapping="eac"' not in f.read():
+            print("Missing mapping metadata")
+            return False
+
+    # Rebuilding the panorama from equi-angular faces gives the input back,
+    # apart from the blur of resampling twice, as for standard faces. Reading
+    # the faces with the wrong mapping differs by about four times the bound.
+    faceDir = resultDir + '/eac-faces'
+    os.makedirs(faceDir, exist_ok=True)
+    for face in ['b', 'l', 'f', 'r', 'u', 'd']:
+        res = run([
+            binDir + '/src/pano-projector',
+            'face',
+            '--face=' + face,
+            '--mapping=eac',
+            sourceDir + '/tests/data/input/bass.jpg',
+            faceDir + '/' + face + '.jpg'])
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+    resultFile = resultDir + '/eac-equirect.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'equirect',
+        '--width=800',
+        '--mapping=eac',
+        faceDir,
+        resultFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    return compareImages(resultFile, sourceDir + '/tests/data/input/bass.jpg', 6.5)
+
+def testBatch():
+    global sourceDir, binDir, resultDir
+    # Each panorama in the manifest gives the same tiles as the pyramid command
+    manifest = resultDir + '/manifest.txt'
+    input = sourceDir + '/tests/data/input/bass.jpg'
+    with open(manifest, 'w') as f:
+        f.write('# Two copies of the same job\n')
+        for i in range(2):
+            f.write('"%s" "%s/batch%d" --tile-size=128\n' % (input, resultDir, i))
+    reportFile = resultDir + '/batch.jsonl'
+    res = run([
+        binDir + '/src/pano-projector',
+        'batch',
+        '--threads=2',
+        '--report=' + reportFile,
+        manifest])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+
+    for i in range(2):
+        for face in ["b", "l", "f", "r", "u", "d"]:
+            rel = '1/%s0_0.jpg' % face
+            if not filecmp.cmp('%s/batch%d/%s' % (resultDir, i, rel),
+                    sourceDir + '/tests/data/expected/' + rel):
+                print("File comparison mismatch in file " + rel)
+                return False
+
+    with open(reportFile) as f:
+        jobs = [json.loads(line) for line in f]
+    if len(jobs) != 14 or any('error' in job for job in jobs):
+        print("Unexpected job report")
+        return False
+
+    # When a whole panorama doesn't fit in a worker's share of the memory
+    # limit, the faces are decoded separately, with the same output
+    with open(manifest, 'w') as f:
+        for i in range(2):
+            f.write('"%s" "%s/batch-limited%d" --tile-size=128\n' % (input, resultDir, i))
+    res = run([
+        binDir + '/src/pano-projector',
+        'batch',
+        '--threads=2',
+        '--mem-limit=17',
+        '--report=' + reportFile,
+        manifest])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    with open(reportFile) as f:
+        jobs = [json.loads(line) for line in f]
+    if any(job.get('strategy', 'per-face') != 'per-face' for job in jobs):
+        print("The panoramas were not decoded per face")
+        return False
+    for i in range(2):
+        for face in ["b", "l", "f", "r", "u", "d"]:
+            rel = '1/%s0_0.jpg' % face
+            if not filecmp.cmp('%s/batch-limited%d/%s' % (resultDir, i, rel),
+                    sourceDir + '/tests/data/expected/' + rel, shallow=False):
+                print("File comparison mismatch in file %s with the memory limit" % rel)
+                return False
+    return True
+
+def testStdio():
+    global sourceDir, binDir, resultDir
+    # Reading the input from memory and encoding to memory gives the same face
+    input = sourceDir + '/tests/data/input/bass.jpg'
+    print('+ pano-projector face --face=f - - < bass.jpg')
+    with open(input, 'rb') as f:
+        res = subprocess.run([binDir + '/src/pano-projector', 'face', '--face=f', '-', '-'],
+            stdin=f, stdout=subprocess.PIPE)
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    with open(sourceDir + '/tests/data/expected/f.jpg', 'rb') as f:
+        if res.stdout != f.read():
+            print("Standard output mismatch")
+            return False
+
+    # An invalid input is an error rather than exiting from libjpeg
+    res = subprocess.run([binDir + '/src/pano-projector', 'face', '--face=f', '-', '-'],
+        input=b'not a jpeg', stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    if res.returncode != 1 or b'Invalid input image' not in res.stderr:
+        print("Invalid input was not reported")
+        return False
+
+    # So is a failure to write the output, with the temporary file linked to
+    # a device which is always full
+    if os.path.exists('/dev/full'):
+        fullDir = resultDir + '/stdio-full'
+        os.makedirs(fullDir, exist_ok=True)
+        os.symlink('/dev/full', fullDir + '/f.jpg.tmp')
+        res = subprocess.run([binDir + '/src/pano-projector', 'face', '--face=f', input,
+            fullDir + '/f.jpg'], stderr=subprocess.PIPE)
+        if res.returncode != 1 or b'Unable to write output image' not in res.stderr:
+            print("The write error was not reported")
+            return False
+        if os.path.lexists(fullDir + '/f.jpg.tmp') or os.path.exists(fullDir + '/f.jpg'):
+            print("The partial output was not removed")
+            return False
+    return True
+
+def testVariants():
+    global sourceDir, binDir, resultDir
+    # One projection writes the main output, another quality, and a scaled
+    # size. The unscaled variants are the same as separate runs.
+    input = sourceDir + '/tests/data/input/bass.jpg'
+    mainFile = resultDir + '/variant-main.jpg'
+    qualityFile = resultDir + '/variant-q60.jpg'
+    halfFile = resultDir + '/variant-half.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--variant=:60:' + qualityFile,
+        '--variant=124::' + halfFile,
+        input,
+        mainFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if not filecmp.cmp(mainFile, sourceDir + '/tests/data/expected/f.jpg', shallow=False):
+        print("File comparison mismatch for the main output")
+        return False
+
+    separateFile = resultDir + '/variant-separate-q60.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--quality=60',
+        input,
+        separateFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    if not filecmp.cmp(qualityFile, separateFile, shallow=False):
+        print("File comparison mismatch for the quality variant")
+        return False
+
+    with open(halfFile, 'rb') as f:
+        data = f.read()
+    sof = data.find(b'\xff\xc0')
+    if sof < 0 or data[sof + 5:sof + 9] != b'\x00\x7c\x00\x7c':
+        print("The scaled variant is not 124x124")
+        return False
+
+    # The scaled variant is filtered down from the main output, so it is
+    # smoother than a face sampled directly at that size, but a face misplaced
+    # by a degree differs by about twice the bound
+    directFile = resultDir + '/variant-direct-124.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--size=124',
+        input,
+        directFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    return compareImages(halfFile, directFile, 10.5)
+
+def testYcbcr():
+    global sourceDir, binDir, resultDir
+    # The YCbCr pipeline writes the same face to a file and to memory
+    input = sourceDir + '/tests/data/input/bass.jpg'
+    resultFile = resultDir + '/ycbcr-f.jpg'
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--ycbcr',
+        input,
+        resultFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    with open(input, 'rb') as f:
+        res = subprocess.run([binDir + '/src/pano-projector', 'face', '--face=f', '--ycbcr',
+            '-', '-'], stdin=f, stdout=subprocess.PIPE)
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+    with open(resultFile, 'rb') as f:
+        data = f.read()
+    if res.stdout != data:
+        print("Standard output mismatch")
+        return False
+
+    # The output is a 4:2:0 baseline JPEG with the size of the RGB face
+    sof = data.find(b'\xff\xc0')
+    if sof < 0:
+        print("Missing baseline frame header")
+        return False
+    height = (data[sof + 5] << 8) | data[sof + 6]
+    width = (data[sof + 7] << 8) | data[sof + 8]
+    if (width, height) != (248, 248) or data[sof + 9] != 3 or data[sof + 11] != 0x22:
+        print("Unexpected frame header")
+        return False
+
+    # The decoded face is close to the RGB face, which libjpeg subsamples with
+    # the chroma centred between the luma samples. Sampling the chroma
+    # elsewhere gives a mean difference of about 2.
+    if not compareImages(resultFile, sourceDir + '/tests/data/expected/f.jpg', 1.8):
+        return False
+
+    # So is a face of odd size, where the last chroma column and row cover
+    # one luma sample
+    oddFile = resultDir + '/ycbcr-odd.jpg'
+    oddRgbFile = resultDir + '/ycbcr-odd-rgb.jpg'
+    for args in [['--ycbcr', input, oddFile], [input, oddRgbFile]]:
+        res = run([binDir + '/src/pano-projector', 'face', '--face=f', '--size=247'] + args)
+        if res.returncode:
+            print("pano-projector exited with return code %d" % res.returncode)
+            return False
+    if not compareImages(oddFile, oddRgbFile, 1.8):
+        return False
+
+    # Only the single decode strategy is supported
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--ycbcr',
+        '--strategy=bands',
+        input,
+        resultDir + '/ycbcr-bands.jpg'])
+    if res.returncode != 1:
+        print("The bands strategy was not rejected")
+        return False
+    return True
+
+def testIsa():
+    global sourceDir, binDir, resultDir
+    # Every ISA level must produce the same output. Levels the CPU doesn't
+    # support fail with an error and are skipped.
+    for isa in ['baseline', 'avx2', 'avx512']:
+        resultFile = resultDir + '/isa-' + isa + '.jpg'
+        res = run([
+            binDir + '/src/pano-projector',
+            'face',
+            '--face=l',
+            '--isa=' + isa,
+            sourceDir + '/tests/data/input/bass.jpg',
+            resultFile])
+        if res.returncode:
+            if isa == 'baseline':
+                print("pano-projector exited with return code %d" % res.returncode)
+                return False
+            continue
+        if not filecmp.cmp(resultFile, sourceDir + '/tests/data/expected/l.jpg'):
+            print("File comparison mismatch with ISA " + isa)
+            return False
+    return True
+
+def testBench():
+    global sourceDir, binDir, resultDir
+    reportFile = resultDir + '/bench.json'
+    res = run([
+        binDir + '/src/pano-projector',
+        'bench',
+        '--width=400',
+        '--tile-size=64',
+        '--work-dir=' + resultDir + '/bench',
+        '--output=' + reportFile])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+
+    with open(reportFile) as f:
+        report = json.load(f)
+    names = [workload['name'] for workload in report['workloads']]
+    if names != ['face', 'pyramid'] or report['config']['height'] != 200:
+        print("Unexpected bench report contents")
+        return False
+    stages = [stage['name'] for stage in report['workloads'][1]['stages']]
+    if stages not in (['decode', 'extract'],
+            ['decode', 'sample', 'downsample', 'encode', 'other']):
+        print("Unexpected bench stages: " + ', '.join(stages))
+        return False
+    return True
+
+def testTrace():
+    global sourceDir, binDir, resultDir
+    traceFile = resultDir + '/trace.json'
+    res = run([
+        binDir + '/src/pano-projector',
+        'face',
+        '--face=f',
+        '--trace=' + traceFile,
+        sourceDir + '/tests/data/input/bass.jpg',
+        resultDir + '/trace-f.jpg'])
+    if res.returncode:
+        print("pano-projector exited with return code %d" % res.returncode)
+        return False
+
+    if not filecmp.cmp(resultDir + '/trace-f.jpg', sourceDir + '/tests/data/expected/f.jpg'):
+        print("Tracing changed the output")
+        return False
+
+    with open(traceFile) as f:
+        trace = json.load(f)
+    names = set(event['name'] for event in trace['traceEvents'] if event['ph'] == 'X')
+    if not {'face', 'decode', 'sample', 'encode'} <= names:
+        print("Missing events in trace: " + ', '.join(sorted(names)))
+        return False
+    return True
+
 def main():
     global sourceDir, binDir, resultDir
 
     sourceDir = sys.argv[1]
     binDir = sys.argv[2]
+    # The optional features the build has. With only the directories, all
+    # are assumed.
+    features = sys.argv[3:] if len(sys.argv) > 3 else ['tracing', 'tiff']
     resultDir = binDir + '/test-result'
 
     if os.path.exists(resultDir):
@@ -82,6 +1143,154 @@ def main():
         print("Pyramid: FAILED")
         success = False
 
+    if (testIncremental()):
+        print("Incremental: OK")
+    else:
+        print("Incremental: FAILED")
+        success = False
+
+    if (testResume()):
+        print("Resume: OK")
+    else:
+        print("Resume: FAILED")
+        success = False
+
+    if (testStrategies()):
+        print("Strategies: OK")
+    else:
+        print("Strategies: FAILED")
+        success = False
+
+    if (testPipeline()):
+        print("Pipeline: OK")
+    else:
+        print("Pipeline: FAILED")
+        success = False
+
+    if (testPlan()):
+        print("Plan: OK")
+    else:
+        print("Plan: FAILED")
+        success = False
+
+    if (testHugePages()):
+        print("Huge pages: OK")
+    else:
+        print("Huge pages: FAILED")
+        success = False
+
+    if (testMemReport()):
+        print("Mem report: OK")
+    else:
+        print("Mem report: FAILED")
+        success = False
+
+    if (testPrecision()):
+        print("Precision: OK")
+    else:
+        print("Precision: FAILED")
+        success = False
+
+    if (testMesh()):
+        print("Mesh: OK")
+    else:
+        print("Mesh: FAILED")
+        success = False
+
+    if (testRotation()):
+        print("Rotation: OK")
+    else:
+        print("Rotation: FAILED")
+        success = False
+
+    if (testView()):
+        print("View: OK")
+    else:
+        print("View: FAILED")
+        success = False
+
+    if (testPartial()):
+        print("Partial: OK")
+    else:
+        print("Partial: FAILED")
+        success = False
+
+    if (testMosaic()):
+        print("Mosaic: OK")
+    else:
+        print("Mosaic: FAILED")
+        success = False
+
+    if 'tiff' not in features:
+        print("TIFF: skipped, TIFF input is not available in this build")
+    elif (testTiff()):
+        print("TIFF: OK")
+    else:
+        print("TIFF: FAILED")
+        success = False
+
+    if (testPreview()):
+        print("Preview: OK")
+    else:
+        print("Preview: FAILED")
+        success = False
+
+    if (testEquirect()):
+        print("Equirect: OK")
+    else:
+        print("Equirect: FAILED")
+        success = False
+
+    if (testMapping()):
+        print("Mapping: OK")
+    else:
+        print("Mapping: FAILED")
+        success = False
+
+    if (testBatch()):
+        print("Batch: OK")
+    else:
+        print("Batch: FAILED")
+        success = False
+
+    if (testStdio()):
+        print("Stdio: OK")
+    else:
+        print("Stdio: FAILED")
+        success = False
+
+    if (testVariants()):
+        print("Variants: OK")
+    else:
+        print("Variants: FAILED")
+        success = False
+
+    if (testYcbcr()):
+        print("Ycbcr: OK")
+    else:
+        print("Ycbcr: FAILED")
+        success = False
+
+    if (testIsa()):
+        print("ISA: OK")
+    else:
+        print("ISA: FAILED")
+        success = False
+
+    if (testBench()):
+        print("Bench: OK")
+    else:
+        print("Bench: FAILED")
+        success = False
+
+    if 'tracing' not in features:
+        print("Trace: skipped, tracing is not available in this build")
+    elif (testTrace()):
+        print("Trace: OK")
+    else:
+        print("Trace: FAILED")
+        success = False
+
     sys.exit(0 if success else 1)
 
 main()
\ No newline at end of file